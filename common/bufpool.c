@@ -0,0 +1,139 @@
+#include "bufpool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#define BUFPOOL_ALIGN 64
+
+obe_buf_pool_t *obe_buf_pool_alloc(const char *name)
+{
+    obe_buf_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        syslog(LOG_ERR, "Malloc failed\n");
+        return NULL;
+    }
+
+    strncpy(pool->name, name, sizeof(pool->name) - 1);
+    pthread_mutex_init(&pool->mutex, NULL);
+
+    return pool;
+}
+
+static void buf_destroy(obe_buf_t *buf)
+{
+    free(buf->data);
+    free(buf);
+}
+
+static void pool_destroy(obe_buf_pool_t *pool)
+{
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+void obe_buf_pool_free(obe_buf_pool_t *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->free_list) {
+        obe_buf_t *buf = pool->free_list;
+        pool->free_list = buf->next;
+        pool->num_free--;
+        pool->num_allocated--;
+        buf_destroy(buf);
+    }
+    pool->dead = 1;
+    int outstanding = pool->num_allocated;
+    pthread_mutex_unlock(&pool->mutex);
+
+    /* Otherwise the last obe_buf_unref() tears the pool down. */
+    if (outstanding == 0)
+        pool_destroy(pool);
+}
+
+obe_buf_t *obe_buf_pool_get(obe_buf_pool_t *pool, size_t size)
+{
+    obe_buf_t *buf = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->gets++;
+    if (pool->free_list) {
+        buf = pool->free_list;
+        pool->free_list = buf->next;
+        pool->num_free--;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (buf && buf->size < size) {
+        /* Too small (format change), grow it. */
+        free(buf->data);
+        buf->data = NULL;
+        buf->size = 0;
+    }
+
+    if (!buf) {
+        buf = calloc(1, sizeof(*buf));
+        if (!buf) {
+            syslog(LOG_ERR, "Malloc failed\n");
+            return NULL;
+        }
+        buf->pool = pool;
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->num_allocated++;
+        pool->misses++;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    if (!buf->data) {
+        if (posix_memalign((void **)&buf->data, BUFPOOL_ALIGN, size) != 0) {
+            syslog(LOG_ERR, "Malloc failed\n");
+            buf->data = NULL;
+            obe_buf_unref(buf);
+            return NULL;
+        }
+        buf->size = size;
+    }
+
+    buf->next = NULL;
+    buf->refcount = 1;
+
+    return buf;
+}
+
+obe_buf_t *obe_buf_ref(obe_buf_t *buf)
+{
+    __sync_fetch_and_add(&buf->refcount, 1);
+    return buf;
+}
+
+void obe_buf_unref(obe_buf_t *buf)
+{
+    if (!buf)
+        return;
+
+    if (__sync_sub_and_fetch(&buf->refcount, 1) > 0)
+        return;
+
+    obe_buf_pool_t *pool = buf->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->dead || !buf->data) {
+        pool->num_allocated--;
+        int destroy = pool->dead && pool->num_allocated == 0;
+        pthread_mutex_unlock(&pool->mutex);
+
+        buf_destroy(buf);
+        if (destroy)
+            pool_destroy(pool);
+        return;
+    }
+
+    buf->next = pool->free_list;
+    pool->free_list = buf;
+    pool->num_free++;
+    pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,49 @@
+#ifndef OBE_BUFPOOL_H
+#define OBE_BUFPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* Refcounted buffer pool.
+ * Buffers are handed out with a refcount of one. When the last reference
+ * is dropped the buffer goes back on the pools free list instead of being
+ * returned to the allocator, so per-frame capture paths don't malloc/free.
+ * A pool may be freed while buffers are still in flight, the memory is
+ * reclaimed when the last outstanding buffer is released.
+ */
+typedef struct obe_buf_pool_s obe_buf_pool_t;
+
+typedef struct obe_buf_s
+{
+    obe_buf_pool_t *pool;
+    struct obe_buf_s *next;
+    volatile int refcount;
+    size_t size;
+    uint8_t *data; /* 64 byte aligned */
+} obe_buf_t;
+
+struct obe_buf_pool_s
+{
+    char name[64];
+    pthread_mutex_t mutex;
+    obe_buf_t *free_list;
+    int num_free;
+    int num_allocated;
+    int dead;
+
+    /* Statistics */
+    uint64_t gets;
+    uint64_t misses;
+};
+
+obe_buf_pool_t *obe_buf_pool_alloc(const char *name);
+void obe_buf_pool_free(obe_buf_pool_t *pool);
+
+/* Return a buffer of at least size bytes. */
+obe_buf_t *obe_buf_pool_get(obe_buf_pool_t *pool, size_t size);
+
+obe_buf_t *obe_buf_ref(obe_buf_t *buf);
+void obe_buf_unref(obe_buf_t *buf);
+
+#endif /* OBE_BUFPOOL_H */
@@ -0,0 +1,176 @@
+#include "common.h"
+#include "cadence.h"
+
+#include <inttypes.h>
+
+/* Upper bucket edges in microseconds, the last bucket catches everything else */
+static const int64_t bucket_edges[OBE_CADENCE_BUCKETS - 1] =
+{
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 20000, 40000, 80000
+};
+
+static const char *hist_names[CADENCE_HIST_MAX] =
+{
+    "pts jitter", "arrival jitter", "av drift"
+};
+
+/* Gaps longer than this are a restart of the timeline, not missing frames */
+#define CADENCE_MAX_GAP ((int64_t)OBE_CLOCK * 10)
+
+void obe_cadence_init(obe_cadence_t *c)
+{
+    memset(c, 0, sizeof(*c));
+    pthread_mutex_init(&c->mutex, NULL);
+}
+
+void obe_cadence_destroy(obe_cadence_t *c)
+{
+    pthread_mutex_destroy(&c->mutex);
+}
+
+void obe_cadence_reset(obe_cadence_t *c)
+{
+    pthread_mutex_lock(&c->mutex);
+    size_t offset = offsetof(obe_cadence_t, last_pts);
+    memset((uint8_t *)c + offset, 0, sizeof(*c) - offset);
+    pthread_mutex_unlock(&c->mutex);
+}
+
+static void roll_window(obe_cadence_t *c, int64_t now)
+{
+    if (!c->window_start) {
+        c->window_start = now;
+        return;
+    }
+
+    int64_t elapsed = now - c->window_start;
+    if (elapsed < OBE_CADENCE_WINDOW_US)
+        return;
+
+    /* Idle for two windows or more, nothing in either is recent */
+    if (elapsed >= 2 * OBE_CADENCE_WINDOW_US) {
+        memset(c->hist, 0, sizeof(c->hist));
+        memset(c->max_us, 0, sizeof(c->max_us));
+    }
+
+    c->window ^= 1;
+    memset(c->hist[c->window], 0, sizeof(c->hist[c->window]));
+    memset(c->max_us[c->window], 0, sizeof(c->max_us[c->window]));
+    c->window_start = now;
+}
+
+static void sample(obe_cadence_t *c, int hist, int64_t us)
+{
+    int64_t mag = llabs(us);
+    int i;
+
+    for (i = 0; i < OBE_CADENCE_BUCKETS - 1; i++) {
+        if (mag < bucket_edges[i])
+            break;
+    }
+
+    c->hist[c->window][hist][i]++;
+    if (mag > c->max_us[c->window][hist])
+        c->max_us[c->window][hist] = mag;
+    c->last_us[hist] = us;
+}
+
+void obe_cadence_video(obe_cadence_t *c, int64_t pts, int64_t interval, struct avfm_s *avfm)
+{
+    int64_t now = obe_mdate();
+
+    pthread_mutex_lock(&c->mutex);
+
+    roll_window(c, now);
+    c->frames++;
+
+    if (c->have_last && interval > 0) {
+        int64_t delta = pts - c->last_pts;
+        int64_t frames = 0;
+
+        if (delta <= -interval || delta > CADENCE_MAX_GAP) {
+            /* Timeline jumped, start measuring again from here */
+            c->discontinuities++;
+            c->have_drift = 0;
+        } else if (delta <= interval / 2) {
+            c->duplicated++;
+        } else {
+            frames = (delta + interval / 2) / interval;
+            if (frames > 1)
+                c->missing += frames - 1;
+        }
+
+        if (frames) {
+            sample(c, CADENCE_PTS_JITTER, (delta - frames * interval) / (OBE_CLOCK / 1000000));
+            sample(c, CADENCE_ARRIVAL_JITTER, (now - c->last_arrival) - frames * interval / (OBE_CLOCK / 1000000));
+        }
+    }
+
+    if (avfm && avfm->audio_pts >= 0 && avfm->video_pts >= 0) {
+        int64_t drift = avfm_get_av_drift(avfm);
+        if (!c->have_drift) {
+            c->drift_base = drift;
+            c->have_drift = 1;
+        }
+        sample(c, CADENCE_AV_DRIFT, (drift - c->drift_base) / (OBE_CLOCK / 1000000));
+    }
+
+    c->last_pts = pts;
+    c->last_arrival = now;
+    c->have_last = 1;
+
+    pthread_mutex_unlock(&c->mutex);
+}
+
+void obe_cadence_print(obe_cadence_t *c)
+{
+    char label[16];
+
+    pthread_mutex_lock(&c->mutex);
+
+    printf("Input cadence: frames %" PRIu64 ", missing %" PRIu64 ", duplicated %" PRIu64 ", discontinuities %" PRIu64 "\n",
+        c->frames, c->missing, c->duplicated, c->discontinuities);
+
+    printf("%-16s", "(us)");
+    for (int i = 0; i < OBE_CADENCE_BUCKETS; i++) {
+        if (i < OBE_CADENCE_BUCKETS - 1)
+            snprintf(label, sizeof(label), "<%" PRIi64, bucket_edges[i]);
+        else
+            snprintf(label, sizeof(label), ">=%" PRIi64, bucket_edges[i - 1]);
+        printf(" %8s", label);
+    }
+    printf(" %8s %8s\n", "last", "max");
+
+    for (int h = 0; h < CADENCE_HIST_MAX; h++) {
+        int64_t max = c->max_us[0][h] > c->max_us[1][h] ? c->max_us[0][h] : c->max_us[1][h];
+
+        printf("%-16s", hist_names[h]);
+        for (int i = 0; i < OBE_CADENCE_BUCKETS; i++)
+            printf(" %8" PRIu64, c->hist[0][h][i] + c->hist[1][h][i]);
+        printf(" %8" PRIi64 " %8" PRIi64 "\n", c->last_us[h], max);
+    }
+
+    pthread_mutex_unlock(&c->mutex);
+}
+
+void obe_cadence_stats(obe_cadence_t *c, char *buf, size_t len)
+{
+    size_t used = strlen(buf);
+    if (used >= len)
+        return;
+
+    pthread_mutex_lock(&c->mutex);
+
+    int64_t max[CADENCE_HIST_MAX];
+    for (int h = 0; h < CADENCE_HIST_MAX; h++)
+        max[h] = c->max_us[0][h] > c->max_us[1][h] ? c->max_us[0][h] : c->max_us[1][h];
+
+    snprintf(buf + used, len - used,
+        ",in_frames=%" PRIu64 ",in_missing=%" PRIu64 ",in_dup=%" PRIu64
+        ",in_jitter_us=%" PRIi64 ",in_arrival_jitter_us=%" PRIi64 ",in_av_drift_us=%" PRIi64,
+        c->frames, c->missing, c->duplicated,
+        max[CADENCE_PTS_JITTER], max[CADENCE_ARRIVAL_JITTER],
+        c->last_us[CADENCE_AV_DRIFT]);
+
+    pthread_mutex_unlock(&c->mutex);
+}
@@ -0,0 +1,66 @@
+#ifndef OBE_CADENCE_H
+#define OBE_CADENCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* Input cadence analyser.
+ * Every input feeds it the timestamp it already computed for each video
+ * frame. We track how far each frame lands from the expected frame interval,
+ * both in the input timestamps and in the wall clock arrival time, how far
+ * the audio vs video drift wanders from where it started, and count missing
+ * and duplicated frames. All O(1) per frame.
+ *
+ * Histograms roll: two windows are kept, the oldest is cleared when the
+ * current one expires, so a report covers the last one to two windows.
+ */
+#define OBE_CADENCE_BUCKETS   12
+#define OBE_CADENCE_WINDOW_US (10 * 1000000)
+
+enum obe_cadence_hist_e
+{
+    CADENCE_PTS_JITTER = 0,   /* Timestamp interval vs expected interval */
+    CADENCE_ARRIVAL_JITTER,   /* Wall clock interval vs expected interval */
+    CADENCE_AV_DRIFT,         /* Audio vs video drift, relative to the first frame */
+    CADENCE_HIST_MAX,
+};
+
+struct avfm_s;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+
+    int64_t last_pts;         /* 27MHz */
+    int64_t last_arrival;     /* obe_mdate() */
+    int64_t drift_base;       /* 27MHz */
+    int have_last;
+    int have_drift;
+
+    uint64_t frames;
+    uint64_t missing;
+    uint64_t duplicated;
+    uint64_t discontinuities;
+
+    int64_t window_start;
+    int window;
+    uint64_t hist[2][CADENCE_HIST_MAX][OBE_CADENCE_BUCKETS];
+    int64_t max_us[2][CADENCE_HIST_MAX]; /* Largest magnitude seen in each window */
+    int64_t last_us[CADENCE_HIST_MAX];
+} obe_cadence_t;
+
+void obe_cadence_init(obe_cadence_t *c);
+void obe_cadence_destroy(obe_cadence_t *c);
+void obe_cadence_reset(obe_cadence_t *c);
+
+/* Call once per video frame. pts and interval are OBE_CLOCK, avfm may be NULL. */
+void obe_cadence_video(obe_cadence_t *c, int64_t pts, int64_t interval, struct avfm_s *avfm);
+
+/* Human readable report, for 'show input cadence'. */
+void obe_cadence_print(obe_cadence_t *c);
+
+/* Append ",key=value" pairs to a runtime statistics line. */
+void obe_cadence_stats(obe_cadence_t *c, char *buf, size_t len);
+
+#endif /* OBE_CADENCE_H */
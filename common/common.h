@@ -26,6 +26,7 @@
 
 #include <libavutil/pixfmt.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/samplefmt.h>
 #include <libavutil/common.h>
 
 #include <stdio.h>
@@ -43,6 +44,8 @@
 #include "obe.h"
 #include "stream_formats.h"
 #include <common/queue.h>
+#include <common/bufpool.h>
+#include <common/cadence.h>
 
 /* Enable some realtime debugging commands */
 #define DO_SET_VARIABLE 1
@@ -51,6 +54,10 @@
 #define MAX_STREAMS 40
 #define MAX_CHANNELS 16
 
+/* User data carried inline in each raw frame */
+#define MAX_USER_DATA        16
+#define USER_DATA_ARENA_SIZE 2048
+
 #define MIN_PROBE_TIME  5
 #define MAX_PROBE_TIME 20
 
@@ -233,6 +240,13 @@ typedef struct
     int      num_channels;
     int      num_samples;
     int      sample_fmt;
+
+    /* Interleaved views (sample_fmt == AV_SAMPLE_FMT_NONE), audio_data[0] points at the start
+     * of a capture packet which may be shared between several frames. The channels of interest
+     * start at byte 'offset' and consecutive sample frames are 'stride' bytes apart.
+     */
+    int      offset;
+    int      stride;
 } obe_audio_frame_t;
 
 enum user_data_types_e
@@ -425,6 +439,9 @@ typedef struct
     void (*release_data)( void* );
     void (*release_frame)( void* );
 
+    /* Set when the video/audio payload lives in a pooled buffer, see obe_release_bufref_data() */
+    obe_buf_t *buf_ref;
+
     /* Video */
     /* Some devices output visible and VBI/VANC data together. In order
      * to avoid memcpying raw frames, we create two image structures.
@@ -439,9 +456,12 @@ typedef struct
     int timebase_num;
     int timebase_den;
 
-    /* Ancillary / User-data */
+    /* Ancillary / User-data. The entries and their payloads live in the frame, payloads are
+     * carved from the arena by obe_user_data_add() and go away with the frame.
+     * After copying the frame struct, obe_user_data_rebase() the copy. */
     int num_user_data;
-    obe_user_data_t *user_data;
+    obe_user_data_t user_data[MAX_USER_DATA];
+    int user_data_used; /* Bytes of the arena */
 
     /* Audio */
     obe_audio_frame_t audio_frame;
@@ -452,6 +472,9 @@ typedef struct
     obe_timecode_t timecode;
 
     int reset_obe;
+
+    /* Last, new_raw_frame() leaves it uninitialised */
+    uint8_t user_data_arena[USER_DATA_ARENA_SIZE];
 } obe_raw_frame_t;
 
 typedef struct
@@ -463,6 +486,14 @@ typedef struct
     obe_queue_t queue;
     int cancel_thread;
 
+    /* Filter private context, owned by the filter thread */
+    void *priv;
+
+    /* Audio filters, silence/clipping/phase detectors on the input channels */
+    struct obe_audio_health_s *audio_health;
+
+    /* Video filters, black/freeze/illegal level analytics on the input picture */
+    struct obe_vanalytics_s *video_analytics;
 } obe_filter_t;
 #define PRINT_OBE_FILTER(f, prefix) { \
 	printf("%s: obj = %p, num_ids=%d list[0]=%d\n", \
@@ -485,6 +516,13 @@ typedef struct
 
     /* HE-AAC and E-AC3 */
     int num_samples;
+
+    /* PCM audio, fed by the audio filter when the output stream has loudness metering enabled */
+    struct obe_loudness_s *loudness;
+
+    /* Rate control of video encoders, for the burn-in OSD. Written by the encoder thread, read without locking */
+    int last_qp;
+    int last_kbps; /* Over the last second */
 } obe_encoder_t;
 
 typedef struct
@@ -612,6 +650,7 @@ struct obe_t
 
     /* Statistics and Monitoring */
     int cea708_missing_count;
+    obe_cadence_t input_cadence;
 
     /* Misc configurable system parameters */
     unsigned int probe_time_seconds;
@@ -651,8 +690,21 @@ void coded_frame_print(obe_coded_frame_t *cf);
 void destroy_coded_frame( obe_coded_frame_t *coded_frame );
 void obe_release_video_data( void *ptr );
 void obe_release_audio_data( void *ptr );
+void obe_release_bufref_data( void *ptr );
+int obe_image_alloc_pooled( obe_raw_frame_t *raw_frame, obe_buf_pool_t *pool, uint8_t *plane[4], int stride[4],
+                            int width, int height, enum AVPixelFormat csp, int align );
+int obe_audio_alloc_pooled( obe_raw_frame_t *raw_frame, obe_buf_pool_t *pool, uint8_t **audio_data, int *linesize,
+                            int num_channels, int num_samples, enum AVSampleFormat sample_fmt );
+int obe_audio_make_writable( obe_raw_frame_t *raw_frame, obe_buf_pool_t *pool );
 void obe_release_frame( void *ptr );
 
+obe_user_data_t *obe_user_data_add( obe_raw_frame_t *raw_frame, int type, int source, int len );
+uint8_t *obe_user_data_tail( obe_raw_frame_t *raw_frame, int *avail );
+void obe_user_data_commit( obe_raw_frame_t *raw_frame, obe_user_data_t *user_data, int len );
+void obe_user_data_remove( obe_raw_frame_t *raw_frame, int idx );
+void obe_user_data_rebase( obe_raw_frame_t *dst, const obe_raw_frame_t *src );
+void obe_user_data_clear( obe_raw_frame_t *raw_frame );
+
 obe_muxed_data_t *new_muxed_data( int len );
 void destroy_muxed_data( obe_muxed_data_t *muxed_data );
 
@@ -0,0 +1,231 @@
+#include "simd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <pthread.h>
+#include <libavutil/cpu.h>
+
+#define MAX_ROUTINES 16
+#define BENCH_TRIALS 3
+#define BENCH_TRIAL_US 200
+
+/* Narrowest first */
+static const struct
+{
+    const char *isa;
+    int cpu_flags;
+} isas[] =
+{
+    { "c",      0 },
+    { "mmxext", AV_CPU_FLAG_MMX2 },
+    { "sse2",   AV_CPU_FLAG_SSE2 },
+    { "ssse3",  AV_CPU_FLAG_SSSE3 },
+    { "sse4",   AV_CPU_FLAG_SSE4 },
+    { "avx",    AV_CPU_FLAG_AVX },
+    { "avx2",   AV_CPU_FLAG_AVX2 },
+#ifdef AV_CPU_FLAG_AVX512
+    { "avx512", AV_CPU_FLAG_AVX512 },
+#else
+    { "avx512", -1 }, /* libavutil can't tell */
+#endif
+};
+
+#define NUM_ISAS ((int)(sizeof(isas) / sizeof(isas[0])))
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct
+{
+    const char *routine;
+    obe_simd_fn_t fn;
+} chosen[MAX_ROUTINES];
+static int num_chosen;
+
+static int isa_level(const char *isa)
+{
+    for (int i = 0; i < NUM_ISAS; i++)
+        if (!strcmp(isa, isas[i].isa))
+            return i;
+
+    return -1;
+}
+
+/* Highest level OBE_SIMD allows, -1 when unset or "auto" */
+static int isa_cap(void)
+{
+    const char *env = getenv("OBE_SIMD");
+    if (!env || !*env || !strcmp(env, "auto"))
+        return -1;
+
+    int level = isa_level(env);
+    if (level < 0)
+        syslog(LOG_WARNING, "OBE_SIMD=%s is not an instruction set, ignored\n", env);
+
+    return level;
+}
+
+static int isa_supported(int level, int cpu_flags)
+{
+    return isas[level].cpu_flags >= 0 && (cpu_flags & isas[level].cpu_flags) == isas[level].cpu_flags;
+}
+
+/* Like obe_mdate(), here so tools/simdcheck needs nothing of the core */
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Runs per microsecond, the best of a few short trials */
+static double bench(obe_simd_fn_t fn, obe_simd_test_t test, void *ctx)
+{
+    double best = 0;
+
+    for (int t = 0; t < BENCH_TRIALS; t++) {
+        int64_t start = now_us(), elapsed;
+        int runs = 0;
+
+        do {
+            test(fn, ctx, NULL);
+            runs++;
+            elapsed = now_us() - start;
+        } while (elapsed < BENCH_TRIAL_US);
+
+        if ((double)runs / elapsed > best)
+            best = (double)runs / elapsed;
+    }
+
+    return best;
+}
+
+static obe_simd_fn_t choose(const char *routine, const obe_simd_version_t *versions, int num_versions,
+                            obe_simd_test_t test, void *ctx, int out_size)
+{
+    int cpu_flags = av_get_cpu_flags();
+    int cap = isa_cap();
+    int best = 0;
+    char line[256];
+
+    uint8_t *ref = malloc(out_size);
+    uint8_t *out = malloc(out_size);
+    if (!ref || !out) {
+        syslog(LOG_ERR, "Malloc failed\n");
+        free(ref);
+        free(out);
+        return versions[0].fn;
+    }
+
+    test(versions[0].fn, ctx, ref);
+
+    double c_rate = cap < 0 ? bench(versions[0].fn, test, ctx) : 0;
+    double best_rate = c_rate;
+    int len = snprintf(line, sizeof(line), "%s:", routine);
+
+    for (int i = 1; i < num_versions; i++) {
+        int level = isa_level(versions[i].isa);
+        if (level < 0 || !isa_supported(level, cpu_flags) || (cap >= 0 && level > cap))
+            continue;
+
+        test(versions[i].fn, ctx, out);
+        if (memcmp(ref, out, out_size)) {
+            syslog(LOG_ERR, "%s %s does not match the C version, not used\n", routine, versions[i].isa);
+            continue;
+        }
+
+        if (cap >= 0) {
+            /* Widest wins */
+            best = i;
+            continue;
+        }
+
+        double rate = bench(versions[i].fn, test, ctx);
+        if (len < (int)sizeof(line))
+            len += snprintf(line + len, sizeof(line) - len, " %s %.1fx", versions[i].isa, rate / c_rate);
+        if (rate > best_rate) {
+            best_rate = rate;
+            best = i;
+        }
+    }
+
+    if (cap < 0)
+        printf("SIMD %s, using %s\n", line, versions[best].isa);
+    else
+        printf("SIMD %s: using %s (OBE_SIMD=%s)\n", routine, versions[best].isa, isas[cap].isa);
+
+    free(ref);
+    free(out);
+
+    return versions[best].fn;
+}
+
+obe_simd_fn_t obe_simd_select(const char *routine, const obe_simd_version_t *versions, int num_versions,
+                              obe_simd_test_t test, void *ctx, int out_size)
+{
+    obe_simd_fn_t fn = NULL;
+
+    pthread_mutex_lock(&mutex);
+
+    for (int i = 0; i < num_chosen && !fn; i++)
+        if (!strcmp(chosen[i].routine, routine))
+            fn = chosen[i].fn;
+
+    if (!fn) {
+        fn = choose(routine, versions, num_versions, test, ctx, out_size);
+        if (num_chosen < MAX_ROUTINES) {
+            chosen[num_chosen].routine = routine;
+            chosen[num_chosen].fn = fn;
+            num_chosen++;
+        }
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    return fn;
+}
+
+int obe_simd_check(const char *routine, const obe_simd_version_t *versions, int num_versions,
+                   obe_simd_test_t test, void *ctx, int out_size, int timed)
+{
+    int cpu_flags = av_get_cpu_flags();
+    int failed = 0;
+
+    uint8_t *ref = malloc(out_size);
+    uint8_t *out = malloc(out_size);
+    if (!ref || !out) {
+        fprintf(stderr, "%s: malloc failed\n", routine);
+        free(ref);
+        free(out);
+        return 1;
+    }
+
+    test(versions[0].fn, ctx, ref);
+    double c_rate = timed ? bench(versions[0].fn, test, ctx) : 0;
+
+    for (int i = 1; i < num_versions; i++) {
+        int level = isa_level(versions[i].isa);
+        if (level < 0 || !isa_supported(level, cpu_flags)) {
+            if (timed)
+                printf("%-30s %-7s not run, no CPU support\n", routine, versions[i].isa);
+            continue;
+        }
+
+        test(versions[i].fn, ctx, out);
+        int at = 0;
+        while (at < out_size && ref[at] == out[at])
+            at++;
+
+        if (at < out_size) {
+            printf("%-30s %-7s DIFFERS from c, first at byte %d of %d\n", routine, versions[i].isa, at, out_size);
+            failed++;
+        } else if (timed)
+            printf("%-30s %-7s ok, %.2fx c\n", routine, versions[i].isa, bench(versions[i].fn, test, ctx) / c_rate);
+    }
+
+    free(ref);
+    free(out);
+
+    return failed;
+}
@@ -0,0 +1,41 @@
+#ifndef OBE_SIMD_H
+#define OBE_SIMD_H
+
+#include <stdint.h>
+
+/* Runtime choice between the versions of a routine.
+ * Every version the CPU runs is checked once against the C reference on the
+ * same input and dropped if its output differs by a bit. The survivors are then
+ * timed and the fastest wins, since whether the widest is the quickest depends
+ * on the CPU (AVX-512 clocks some parts down). The choice is made once per
+ * routine per process and logged.
+ *
+ * OBE_SIMD=c|mmxext|sse2|ssse3|sse4|avx|avx2|avx512 in the environment skips the
+ * timing and takes the widest checked version up to that instruction set.
+ */
+typedef void (*obe_simd_fn_t)( void );
+
+typedef struct
+{
+    const char *isa; /* One of the names above, the C reference first */
+    obe_simd_fn_t fn;
+} obe_simd_version_t;
+
+/* Run fn over the test input in ctx. With out set, first fill everything fn
+ * writes to with a pattern, so output it skips can't match what an earlier
+ * version left there, then copy what it produced to out, out_size bytes,
+ * leaving out anything it may write past the end of its rows. The inputs
+ * should include widths which aren't a whole number of vectors, to reach the
+ * tails. With out NULL, just run fn, for the timing */
+typedef void (*obe_simd_test_t)( obe_simd_fn_t fn, void *ctx, uint8_t *out );
+
+obe_simd_fn_t obe_simd_select( const char *routine, const obe_simd_version_t *versions, int num_versions,
+                               obe_simd_test_t test, void *ctx, int out_size );
+
+/* For tools/simdcheck: check every version the CPU runs against the C one,
+ * whatever OBE_SIMD says, printing any which differ and, with timed set, the
+ * speed of the others. Returns how many differ */
+int obe_simd_check( const char *routine, const obe_simd_version_t *versions, int num_versions,
+                    obe_simd_test_t test, void *ctx, int out_size, int timed );
+
+#endif /* OBE_SIMD_H */
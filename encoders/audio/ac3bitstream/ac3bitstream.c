@@ -28,7 +28,7 @@
 #include "encoders/audio/audio.h"
 #include "hexdump.h"
 
-#include "input/sdi/smpte337_detector2.h"
+#include "input/sdi/smpte337_detector.h"
 
 #define LOCAL_DEBUG 0
 #if LOCAL_DEBUG
@@ -130,7 +130,7 @@ static int validateCRC(uint8_t *buf, uint32_t buflen)
 }
 
 static void * detector_callback(void *user_context,
-        struct smpte337_detector2_s *ctx,
+        struct smpte337_detector_s *ctx,
         uint8_t datamode, uint8_t datatype, uint32_t payload_bitCount, uint8_t *payload, struct avfm_s *avfm)
 {
 	obe_aud_enc_params_t *enc_params = user_context;
@@ -161,10 +161,12 @@ static void * detector_callback(void *user_context,
                 payload);
 #endif
 
-        if (datatype != 1 /* AC3 */) {
-                fprintf(stderr, "[AC3] Detected SMPTE337 datamode %d, we don't support it.", datamode);
+	/* The detector reports every burst type, including NULL and pause bursts, only AC3 is ours. */
+	if (datatype != SMPTE337_DATA_TYPE_AC_3 || datamode != SMPTE337_DATA_MODE_16_BIT)
+		return 0;
+
+	if (!avfm)
 		return 0;
-	}
 
 	if (payload_byteCount == 0) {
 		/* No payload, an empty packet from a confused MRD4400. Discard. */
@@ -215,7 +217,7 @@ static void *start_encoder_ac3bitstream(void *ptr)
 #endif
 
 	/* We need a bitstream SMPTE337 slicer to do our bidding.... */
-        struct smpte337_detector2_s *smpte337_detector2 = smpte337_detector2_alloc((smpte337_detector2_callback)detector_callback, ptr);
+        struct smpte337_detector_s *smpte337_detector = smpte337_detector_alloc((smpte337_detector_callback)detector_callback, ptr);
 
 	obe_aud_enc_params_t *enc_params = ptr;
 	obe_encoder_t *encoder = enc_params->encoder;
@@ -272,11 +274,14 @@ static void *start_encoder_ac3bitstream(void *ptr)
 		 */
 		int depth = 32; /* 32 bit samples, data in LSB 16 bits */
 
-		size_t l = smpte337_detector2_write(smpte337_detector2, (uint8_t *)frm->audio_frame.audio_data[0],
+		/* Read our pair in place from the shared capture packet. */
+		int stride = frm->audio_frame.stride ? frm->audio_frame.stride : channels * (depth / 8);
+		size_t l = smpte337_detector_write(smpte337_detector,
+			(uint8_t *)frm->audio_frame.audio_data[0] + frm->audio_frame.offset,
 			frm->audio_frame.num_samples,
 			depth,
 			channels,
-			channels * (depth / 8),
+			stride,
 			span, &frm->avfm);
 		if (l <= 0) {
 			syslog(LOG_ERR, "[AC3] AC3Bitstream write() failed\n");
@@ -286,8 +291,8 @@ static void *start_encoder_ac3bitstream(void *ptr)
 		remove_from_queue(&encoder->queue);
 	}
 
-	if (smpte337_detector2)
-		smpte337_detector2_free(smpte337_detector2);
+	if (smpte337_detector)
+		smpte337_detector_free(smpte337_detector);
 
 	free(enc_params);
 
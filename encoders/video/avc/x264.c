@@ -119,6 +119,16 @@ static void x264_logger( void *p_unused, int i_level, const char *psz_fmt, va_li
         vsyslog( i_level == X264_LOG_INFO ? LOG_INFO : i_level == X264_LOG_WARNING ? LOG_WARNING : LOG_ERR, psz_fmt, arg );
 }
 
+/* What x264 holds on to for a picture, in one allocation passed as its opaque:
+ * the timing, then the SEI payload array, then the payloads. x264 has written the
+ * SEI by the time the picture comes back out, so the encoder loop frees the lot
+ * then and extra_sei.sei_free is left unset. */
+typedef struct
+{
+    struct avfm_s avfm;
+    x264_sei_payload_t payloads[];
+} x264_pic_data_t;
+
 /* Convert a obe_raw_frame_t into a x264_picture_t struct.
  * Incoming frame is colorspace YUV420P.
  */
@@ -131,8 +141,9 @@ PRINT_OBE_IMAGE(&raw_frame->alloc_img, "alloc X264->img");
 #endif
 #if DEV_ABR
 #else
-    int idx = 0, count = 0;
+    int idx = 0;
 #endif
+    int count = 0, size = 0;
 
     x264_picture_init( pic );
 
@@ -163,50 +174,45 @@ printf("pic->img.i_csp = %d [%s] bits = %d\n",
             raw_frame->user_data[i].type == USER_DATA_AVC_UNREGISTERED )
         {
             count++;
+            size += raw_frame->user_data[i].len;
         }
+        else
+            syslog( LOG_WARNING, "Invalid user data presented to encoder - type %i \n", raw_frame->user_data[i].type );
     }
 
     if (g_sei_timestamping) {
         /* Create space for unregister data, containing before and after timestamps. */
         count += 1;
+        size += SEI_TIMESTAMP_PAYLOAD_LENGTH;
     }
+#endif
 
-    pic->extra_sei.num_payloads = count;
+    /* x264 keeps the payloads until the picture leaves the lookahead, long after the raw
+     * frame has gone, see x264_pic_data_t */
+    x264_pic_data_t *data = malloc( sizeof(*data) + count * sizeof(*data->payloads) + size );
+    if( !data )
+        return -1;
 
-    if( pic->extra_sei.num_payloads )
-    {
-        pic->extra_sei.sei_free = free;
-        pic->extra_sei.payloads = malloc( pic->extra_sei.num_payloads * sizeof(*pic->extra_sei.payloads) );
+    memcpy( &data->avfm, &raw_frame->avfm, sizeof(data->avfm) );
+    pic->opaque = data;
+    pic->extra_sei.num_payloads = count;
+    pic->extra_sei.payloads = count ? data->payloads : NULL;
 
-        if( !pic->extra_sei.payloads )
-            return -1;
+#if DEV_ABR
+#else
+    uint8_t *payload = (uint8_t *)&data->payloads[count];
 
-        for( int i = 0; i < raw_frame->num_user_data; i++ )
-        {
-            /* Only give correctly formatted data to the encoder */
-            if( raw_frame->user_data[i].type == USER_DATA_AVC_REGISTERED_ITU_T35 ||
-                raw_frame->user_data[i].type == USER_DATA_AVC_UNREGISTERED )
-            {
-                pic->extra_sei.payloads[idx].payload_type = raw_frame->user_data[i].type;
-                pic->extra_sei.payloads[idx].payload_size = raw_frame->user_data[i].len;
-                pic->extra_sei.payloads[idx].payload = raw_frame->user_data[i].data;
-                idx++;
-            }
-            else
-            {
-                syslog( LOG_WARNING, "Invalid user data presented to encoder - type %i \n", raw_frame->user_data[i].type );
-                free( raw_frame->user_data[i].data );
-            }
-            /* Set the pointer to NULL so only x264 can free the data if necessary */
-            raw_frame->user_data[i].data = NULL;
-        }
-    }
-    else if( raw_frame->num_user_data )
+    for( int i = 0; i < raw_frame->num_user_data; i++ )
     {
-        for( int i = 0; i < raw_frame->num_user_data; i++ )
+        if( raw_frame->user_data[i].type == USER_DATA_AVC_REGISTERED_ITU_T35 ||
+            raw_frame->user_data[i].type == USER_DATA_AVC_UNREGISTERED )
         {
-            syslog( LOG_WARNING, "Invalid user data presented to encoder - type %i \n", raw_frame->user_data[i].type );
-            free( raw_frame->user_data[i].data );
+            memcpy( payload, raw_frame->user_data[i].data, raw_frame->user_data[i].len );
+            pic->extra_sei.payloads[idx].payload_type = raw_frame->user_data[i].type;
+            pic->extra_sei.payloads[idx].payload_size = raw_frame->user_data[i].len;
+            pic->extra_sei.payloads[idx].payload = payload;
+            payload += raw_frame->user_data[i].len;
+            idx++;
         }
     }
 
@@ -218,7 +224,8 @@ printf("pic->img.i_csp = %d [%s] bits = %d\n",
         p = &pic->extra_sei.payloads[count - 1];
         p->payload_type = USER_DATA_AVC_UNREGISTERED;
         p->payload_size = SEI_TIMESTAMP_PAYLOAD_LENGTH;
-        p->payload = set_timestamp_alloc();
+        p->payload = payload;
+        set_timestamp_init(p->payload, SEI_TIMESTAMP_PAYLOAD_LENGTH);
 
         struct timeval tv;
         gettimeofday(&tv, NULL);
@@ -357,6 +364,9 @@ static void *x264_start_encoder( void *ptr )
     int64_t last_raw_frame_pts = 0;
     int64_t current_raw_frame_pts = 0;
     int upstream_signal_lost = 0;
+    time_t rate_time = 0;
+    int64_t rate_bytes = 0;
+    int64_t last_dts = 0, dts_diff_accum = 0;
 #if DEV_ABR
     int encode_alternate_copy = 0;
 #endif
@@ -597,19 +607,11 @@ printf("Malloc failed\n");
 
         current_raw_frame_pts = raw_frame->pts;
 
-        avfm = malloc(sizeof(struct avfm_s));
-        if (!avfm) {
-            printf("Malloc failed\n");
-            syslog(LOG_ERR, "Malloc failed\n");
-            break;
-        }
-        memcpy(avfm, &raw_frame->avfm, sizeof(raw_frame->avfm));
 #if 0
         if (raw_frame->dup)
             printf("next frame is a dup\n");
-        avfm_dump(avfm);
+        avfm_dump(pic.opaque);
 #endif
-        pic.opaque = avfm;
         pic.param = NULL;
 
         /* If the AFD has changed, then change the SAR. x264 will write the SAR at the next keyframe
@@ -791,6 +793,17 @@ printf("Malloc failed\n");
                 _monitor_bps(enc_params, frame_size);
             }
 
+            /* For the burn-in OSD */
+            time_t now = time( NULL );
+            if( now != rate_time )
+            {
+                encoder->last_kbps = rate_bytes * 8 / 1000;
+                rate_bytes = 0;
+                rate_time = now;
+            }
+            rate_bytes += frame_size;
+            encoder->last_qp = pic_out.i_qpplus1 - 1;
+
             coded_frame = new_coded_frame( encoder->output_stream_id, frame_size );
             if( !coded_frame )
             {
@@ -880,8 +893,6 @@ if (fh)
             coded_frame->cpb_final_arrival_time   = new_dts + abs(pic_out.hrd_timing.cpb_final_arrival_time - pic_out.hrd_timing.cpb_final_arrival_time);
 #else
 
-            static int64_t last_dts = 0;
-            static int64_t dts_diff_accum = 0;
             int64_t dts_diff = 0;
             if (last_dts > 0) {
                 dts_diff = coded_frame->real_dts - last_dts - (1 * frame_duration);
@@ -919,7 +930,7 @@ if (fh)
             cpb_removal_time = coded_frame->real_pts; /* Only used for manually eyeballing the video output clock. */
             coded_frame->random_access = pic_out.b_keyframe;
             coded_frame->priority = IS_X264_TYPE_I( pic_out.i_type );
-            free( pic_out.opaque );
+            free( pic_out.opaque ); /* x264_pic_data_t, the timing and SEI of this picture */
 
             if (g_x264_nal_debug & 0x04)
                 coded_frame_print(coded_frame);
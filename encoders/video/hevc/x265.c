@@ -446,7 +446,9 @@ static int convert_obe_to_x265_pic(struct context_s *ctx, x265_picture *p, struc
 	x265_picture_init(ctx->hevc_params, p);
 
 	p->sliceType = X265_TYPE_AUTO;
-	p->bitDepth = 8;
+	/* What the video filter produced for this encoder, see video_encoder_depth(). x265 takes
+	 * 16-bit samples whenever this is above 8 and converts to its internalBitDepth itself */
+	p->bitDepth = av_pix_fmt_desc_get(img->csp)->comp[0].depth;
 	p->stride[0] = img->stride[0];
 	p->stride[1] = img->stride[1]; // >> x265_cli_csps[p->colorSpace].width[1];
 	p->stride[2] = img->stride[2]; // >> x265_cli_csps[p->colorSpace].width[2];
@@ -457,9 +459,6 @@ static int convert_obe_to_x265_pic(struct context_s *ctx, x265_picture *p, struc
 	}
 
 	p->colorSpace = img->csp == AV_PIX_FMT_YUV422P || img->csp == AV_PIX_FMT_YUV422P10 ? X265_CSP_I422 : X265_CSP_I420;
-#ifdef HIGH_BIT_DEPTH
-	p->colorSpace |= X265_CSP_HIGH_DEPTH;
-#endif
 
 	for (int i = 0; i < rf->num_user_data; i++) {
 		/* Only give correctly formatted data to the encoder */
@@ -493,14 +492,12 @@ static int convert_obe_to_x265_pic(struct context_s *ctx, x265_picture *p, struc
 			} else {
 				syslog(LOG_WARNING, MESSAGE_PREFIX " Invalid user data presented to encoder - type %i\n", rf->user_data[i].type);
 				printf(MESSAGE_PREFIX " (1) Invalid user data presented to encoder - type %i\n", rf->user_data[i].type);
-				free(rf->user_data[i].data);
 			}
 		}
 	} else if (rf->num_user_data) {
 		for (int i = 0; i < rf->num_user_data; i++) {
 			syslog(LOG_WARNING, MESSAGE_PREFIX " Invalid user data presented to encoder - type %i\n", rf->user_data[i].type);
 			printf(MESSAGE_PREFIX " (2) Invalid user data presented to encoder - type %i\n", rf->user_data[i].type);
-			free(rf->user_data[i].data);
 		}
 	}
 
@@ -21,23 +21,103 @@
  *
  *****************************************************************************/
 
-#if 0
-#define 337M_SYNCWORD_1_16_BIT 0xf872
-#define 337M_SYNCWORD_1_20_BIT 0x6f872
-#define 337M_SYNCWORD_1_24_BIT 0x96f872
-
-#define 337M_SYNCWORD_2_16_BIT 0x4e1f
-#define 337M_SYNCWORD_2_20_BIT 0x54e1f
-#define 337M_SYNCWORD_2_24_BIT 0xa54e1f
-
-#define 337M_DATA_TYPE_NULL      0
-#define 337M_DATA_TYPE_AC_3      1
-#define 337M_DATA_TYPE_TIMESTAMP 2
-#define 337M_DATA_TYPE_MP2       6
-#define 337M_DATA_TYPE_AAC       10
-#define 337M_DATA_TYPE_HE_AAC    11
-#define 337M_DATA_TYPE_E_AC_3    16
-#define 337M_DATA_TYPE_E_DIST    28
-
-// 337M startcode search function TODO
+#include <stddef.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
 #endif
+#include "337m.h"
+
+/* Preambles as they appear in MSB aligned 32 bit samples */
+#define PA_16 ((uint32_t)SMPTE337_SYNCWORD_1_16_BIT << 16)
+#define PB_16 ((uint32_t)SMPTE337_SYNCWORD_2_16_BIT << 16)
+#define PA_20 ((uint32_t)SMPTE337_SYNCWORD_1_20_BIT << 12)
+#define PB_20 ((uint32_t)SMPTE337_SYNCWORD_2_20_BIT << 12)
+#define PA_24 ((uint32_t)SMPTE337_SYNCWORD_1_24_BIT << 8)
+#define PB_24 ((uint32_t)SMPTE337_SYNCWORD_2_24_BIT << 8)
+
+#define MASK_16 0xffff0000
+#define MASK_20 0xfffff000
+#define MASK_24 0xffffff00
+
+static int check_sync( const uint32_t *w, int *data_mode )
+{
+    if( (w[0] & MASK_16) == PA_16 && (w[1] & MASK_16) == PB_16 )
+        *data_mode = SMPTE337_DATA_MODE_16_BIT;
+    else if( (w[0] & MASK_20) == PA_20 && (w[1] & MASK_20) == PB_20 )
+        *data_mode = SMPTE337_DATA_MODE_20_BIT;
+    else if( (w[0] & MASK_24) == PA_24 && (w[1] & MASK_24) == PB_24 )
+        *data_mode = SMPTE337_DATA_MODE_24_BIT;
+    else
+        return 0;
+
+    return 1;
+}
+
+int obe_337m_find_sync_c( const uint32_t *words, int count, int *data_mode )
+{
+    for( int i = 0; i < count - 1; i++ ) /* Pb must be present */
+    {
+        if( check_sync( &words[i], data_mode ) )
+            return i;
+    }
+
+    return -1;
+}
+
+int obe_337m_find_sync( const uint32_t *words, int count, int *data_mode )
+{
+    int i = 0;
+    int last = count - 1; /* Pb must be present */
+
+    if( last <= 0 )
+        return -1;
+
+#if defined(__SSE2__)
+    /* Pa is rare in PCM, so test four Pa candidates at a time for any of the three
+     * modes and only look at Pb when one of them hits. */
+    const __m128i m16 = _mm_set1_epi32( (int)MASK_16 ), p16 = _mm_set1_epi32( (int)PA_16 );
+    const __m128i m20 = _mm_set1_epi32( (int)MASK_20 ), p20 = _mm_set1_epi32( (int)PA_20 );
+    const __m128i m24 = _mm_set1_epi32( (int)MASK_24 ), p24 = _mm_set1_epi32( (int)PA_24 );
+
+    for( ; i + 4 <= last; i += 4 )
+    {
+        __m128i w = _mm_loadu_si128( (const __m128i *)&words[i] );
+        __m128i hit = _mm_cmpeq_epi32( _mm_and_si128( w, m16 ), p16 );
+        hit = _mm_or_si128( hit, _mm_cmpeq_epi32( _mm_and_si128( w, m20 ), p20 ) );
+        hit = _mm_or_si128( hit, _mm_cmpeq_epi32( _mm_and_si128( w, m24 ), p24 ) );
+
+        int mask = _mm_movemask_ps( _mm_castsi128_ps( hit ) );
+        while( mask )
+        {
+            int j = __builtin_ctz( mask );
+            if( check_sync( &words[i + j], data_mode ) )
+                return i + j;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    int idx = obe_337m_find_sync_c( words + i, count - i, data_mode );
+
+    return idx < 0 ? -1 : i + idx;
+}
+
+const char *obe_337m_data_type_name( int data_type )
+{
+    switch( data_type )
+    {
+        case SMPTE337_DATA_TYPE_NULL:       return "NULL";
+        case SMPTE337_DATA_TYPE_AC_3:       return "AC-3";
+        case SMPTE337_DATA_TYPE_TIMESTAMP:  return "Timestamp";
+        case SMPTE337_DATA_TYPE_PAUSE:      return "Pause";
+        case SMPTE337_DATA_TYPE_MPEG1_L1:   return "MPEG-1 Layer 1";
+        case SMPTE337_DATA_TYPE_MPEG1_L2L3: return "MPEG-1 Layer 2/3";
+        case SMPTE337_DATA_TYPE_MP2:        return "MPEG-2 with extension";
+        case SMPTE337_DATA_TYPE_MPEG2_AAC:  return "MPEG-2 AAC";
+        case SMPTE337_DATA_TYPE_AAC:        return "MPEG-4 AAC";
+        case SMPTE337_DATA_TYPE_HE_AAC:     return "MPEG-4 HE-AAC";
+        case SMPTE337_DATA_TYPE_E_AC_3:     return "E-AC-3";
+        case SMPTE337_DATA_TYPE_DOLBY_E:    return "Dolby E";
+        default:                            return "Unknown";
+    }
+}
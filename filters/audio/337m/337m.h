@@ -0,0 +1,75 @@
+/*****************************************************************************
+ * 337m.h : SMPTE 337M functions
+ *****************************************************************************
+ * Copyright (C) 2010 NAMETBD
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+#ifndef OBE_337M_H
+#define OBE_337M_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SMPTE337_SYNCWORD_1_16_BIT 0xf872
+#define SMPTE337_SYNCWORD_1_20_BIT 0x6f872
+#define SMPTE337_SYNCWORD_1_24_BIT 0x96f872
+
+#define SMPTE337_SYNCWORD_2_16_BIT 0x4e1f
+#define SMPTE337_SYNCWORD_2_20_BIT 0x54e1f
+#define SMPTE337_SYNCWORD_2_24_BIT 0xa54e1f
+
+/* Pc data_mode */
+#define SMPTE337_DATA_MODE_16_BIT 0
+#define SMPTE337_DATA_MODE_20_BIT 1
+#define SMPTE337_DATA_MODE_24_BIT 2
+
+/* Pc data_type, see SMPTE 338 */
+#define SMPTE337_DATA_TYPE_NULL         0
+#define SMPTE337_DATA_TYPE_AC_3         1
+#define SMPTE337_DATA_TYPE_TIMESTAMP    2
+#define SMPTE337_DATA_TYPE_PAUSE        3
+#define SMPTE337_DATA_TYPE_MPEG1_L1     4
+#define SMPTE337_DATA_TYPE_MPEG1_L2L3   5
+#define SMPTE337_DATA_TYPE_MP2          6
+#define SMPTE337_DATA_TYPE_MPEG2_AAC    7
+#define SMPTE337_DATA_TYPE_AAC          10
+#define SMPTE337_DATA_TYPE_HE_AAC       11
+#define SMPTE337_DATA_TYPE_E_AC_3       16
+#define SMPTE337_DATA_TYPE_DOLBY_E      28
+
+/* Search MSB aligned 32 bit sample words for a Pa/Pb preamble in any of
+ * the 16/20/24 bit data modes. Pa candidates are words[0] .. words[count - 2].
+ * Returns the index of Pa and sets *data_mode, or -1 if no preamble was found.
+ */
+int obe_337m_find_sync( const uint32_t *words, int count, int *data_mode );
+
+/* The same search a word at a time, which the SSE2 one finishes with */
+int obe_337m_find_sync_c( const uint32_t *words, int count, int *data_mode );
+
+const char *obe_337m_data_type_name( int data_type );
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
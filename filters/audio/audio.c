@@ -22,6 +22,9 @@
 
 #include "common/common.h"
 #include "audio.h"
+#include "loudness.h"
+#include "health.h"
+#include "ltn_ws.h"
 
 #define LOCAL_DEBUG 0
 
@@ -120,6 +123,82 @@ static void applyEffects(obe_raw_frame_t *rf)
     }
 }
 
+/* Inputs which av_samples_alloc() their PCM are moved into a pooled buffer once, so the
+ * per encoder splits below can share it rather than each taking a copy. */
+static int adopt_audio( obe_buf_pool_t *pool, obe_raw_frame_t *raw_frame )
+{
+    obe_audio_frame_t *af = &raw_frame->audio_frame;
+    obe_raw_frame_t tmp;
+
+    if( raw_frame->buf_ref && raw_frame->release_data == obe_release_bufref_data )
+        return 0;
+
+    memcpy( &tmp, raw_frame, sizeof(tmp) );
+    if( obe_audio_alloc_pooled( raw_frame, pool, af->audio_data, &af->linesize, af->num_channels,
+                                af->num_samples, af->sample_fmt ) < 0 )
+    {
+        memcpy( raw_frame, &tmp, sizeof(tmp) );
+        return -1;
+    }
+
+    av_samples_copy( af->audio_data, tmp.audio_frame.audio_data, 0, 0, af->num_samples, af->num_channels, af->sample_fmt );
+    tmp.release_data( &tmp );
+    raw_frame->release_data = obe_release_bufref_data;
+
+    return 0;
+}
+
+/* Each PCM encoder gets a view of the channels it was configured with via sdi_audio_pair
+ * and mono_channel. The view points at the parents planes and holds a reference on its
+ * buffer, nothing is copied unless something downstream has to write to the samples. */
+static obe_raw_frame_t *split_audio( obe_raw_frame_t *raw_frame, obe_output_stream_t *output_stream, uint32_t *monitored )
+{
+    obe_audio_frame_t *af;
+    int first = ((output_stream->sdi_audio_pair - 1) << 1) + output_stream->mono_channel;
+    int num_channels = av_get_channel_layout_nb_channels( output_stream->channel_layout );
+
+    if( first < 0 || first + num_channels > raw_frame->audio_frame.num_channels )
+    {
+        syslog( LOG_ERR, "Audio filter: output stream %d selects channels %d-%d of %d\n", output_stream->output_stream_id,
+                first, first + num_channels - 1, raw_frame->audio_frame.num_channels );
+        return NULL;
+    }
+
+    *monitored |= ((1u << num_channels) - 1) << first;
+
+    obe_raw_frame_t *split_raw_frame = new_raw_frame();
+    if( !split_raw_frame )
+        return NULL;
+
+    /* The header only, audio encoders take no user data */
+    memcpy( split_raw_frame, raw_frame, offsetof( obe_raw_frame_t, user_data_arena ) );
+    split_raw_frame->num_user_data = split_raw_frame->user_data_used = 0;
+    af = &split_raw_frame->audio_frame;
+    memset( af->audio_data, 0, sizeof(af->audio_data) );
+    for( int c = 0; c < num_channels; c++ )
+        af->audio_data[c] = raw_frame->audio_frame.audio_data[first + c];
+    af->num_channels = num_channels;
+    af->channel_layout = output_stream->channel_layout;
+
+    split_raw_frame->buf_ref = obe_buf_ref( raw_frame->buf_ref );
+    split_raw_frame->release_data = obe_release_bufref_data;
+
+    return split_raw_frame;
+}
+
+/* Measured on the channels the encoder gets, after any test effects */
+static void meter_loudness( obe_encoder_t *encoder, obe_raw_frame_t *raw_frame )
+{
+    if( !obe_loudness_process( encoder->loudness, raw_frame->audio_frame.audio_data, raw_frame->audio_frame.num_samples ) )
+        return;
+
+#if LTN_WS_ENABLE
+    obe_loudness_stats_t s;
+    obe_loudness_get( encoder->loudness, &s );
+    ltn_ws_set_property_loudness( g_ltn_ws_handle, encoder->output_stream_id, s.momentary, s.short_term, s.integrated, s.true_peak );
+#endif
+}
+
 static void *start_filter_audio( void *ptr )
 {
     obe_raw_frame_t *raw_frame, *split_raw_frame;
@@ -127,7 +206,15 @@ static void *start_filter_audio( void *ptr )
     obe_t *h = filter_params->h;
     obe_filter_t *filter = filter_params->filter;
     obe_output_stream_t *output_stream;
-    int num_channels;
+    obe_buf_pool_t *pool;
+
+    pool = obe_buf_pool_alloc( "audio filter" );
+    if( !pool )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        free( filter_params );
+        return NULL;
+    }
 
     while( 1 )
     {
@@ -155,9 +242,22 @@ static void *start_filter_audio( void *ptr )
             raw_frame->audio_frame.sample_fmt);
 #endif
 
-        /* ignore the video track, process all PCM encoders first */
+        if (raw_frame->audio_frame.sample_fmt != AV_SAMPLE_FMT_NONE && adopt_audio(pool, raw_frame) < 0)
+        {
+            syslog(LOG_ERR, "Malloc failed\n");
+            remove_from_queue(&filter->queue);
+            raw_frame->release_data(raw_frame);
+            raw_frame->release_frame(raw_frame);
+            continue;
+        }
+
+        /* ignore the video tracks, process all PCM encoders first */
+        uint32_t monitored = 0;
         for (int i = 1; i < h->num_encoders; i++)
         {
+            if (h->encoders[i]->is_video)
+                continue; /* Additional renditions of the video */
+
             output_stream = get_output_stream_by_id(h, h->encoders[i]->output_stream_id);
             if (output_stream->stream_format == AUDIO_AC_3_BITSTREAM)
                 continue; /* Ignore downstream AC3 bitstream encoders */
@@ -166,42 +266,34 @@ static void *start_filter_audio( void *ptr )
                 continue; /* Ignore non-pcm frames */
 
 //printf("output_stream->stream_format = %d other\n", output_stream->stream_format);
-            num_channels = av_get_channel_layout_nb_channels( output_stream->channel_layout );
-
-            split_raw_frame = new_raw_frame();
+            split_raw_frame = split_audio(raw_frame, output_stream, &monitored);
             if (!split_raw_frame)
-            {
-                syslog( LOG_ERR, "Malloc failed\n" );
-                return NULL;
-            }
-            memcpy(split_raw_frame, raw_frame, sizeof(*split_raw_frame));
-            memset(split_raw_frame->audio_frame.audio_data, 0, sizeof(split_raw_frame->audio_frame.audio_data));
-            split_raw_frame->audio_frame.linesize = split_raw_frame->audio_frame.num_channels = 0;
-            split_raw_frame->audio_frame.channel_layout = output_stream->channel_layout;
+                continue;
 
-            if (av_samples_alloc(split_raw_frame->audio_frame.audio_data, &split_raw_frame->audio_frame.linesize, num_channels,
-                              split_raw_frame->audio_frame.num_samples, split_raw_frame->audio_frame.sample_fmt, 0) < 0)
+            if (g_filter_audio_effect_pcm)
             {
-                syslog(LOG_ERR, "Malloc failed\n");
-                return NULL;
+                /* The effects write to the samples, take a private copy of this encoders channels */
+                if (obe_audio_make_writable(split_raw_frame, pool) < 0)
+                {
+                    syslog(LOG_ERR, "Malloc failed\n");
+                    split_raw_frame->release_data(split_raw_frame);
+                    split_raw_frame->release_frame(split_raw_frame);
+                    continue;
+                }
+                applyEffects(split_raw_frame);
             }
 
-            /* Copy samples for each channel into a new buffer, so each downstream encoder can
-             * compress the channels the user has selected via sdi_audio_pair.
-             */
-            av_samples_copy(split_raw_frame->audio_frame.audio_data, /* dst */
-                            &raw_frame->audio_frame.audio_data[((output_stream->sdi_audio_pair - 1) << 1) + output_stream->mono_channel], /* src */
-                            0, /* dst offset */
-                            0, /* src offset */
-                            split_raw_frame->audio_frame.num_samples,
-                            num_channels,
-                            split_raw_frame->audio_frame.sample_fmt);
-
-            applyEffects(split_raw_frame);
+            if (h->encoders[i]->loudness && split_raw_frame->audio_frame.sample_fmt == AV_SAMPLE_FMT_S32P)
+                meter_loudness(h->encoders[i], split_raw_frame);
 
             add_to_encode_queue(h, split_raw_frame, h->encoders[i]->output_stream_id);
         } /* For all PCM encoders */
 
+        /* Alarms only for the channels something is encoding */
+        if (filter->audio_health && raw_frame->audio_frame.sample_fmt == AV_SAMPLE_FMT_S32P)
+            obe_audio_health_process(filter->audio_health, raw_frame->audio_frame.audio_data,
+                                     raw_frame->audio_frame.num_channels, raw_frame->audio_frame.num_samples, monitored);
+
         /* ignore the video track, process all AC3 bitstream encoders.... */
 	/* TODO: Only one buffer can be passed to one encoder, as the input SDI
 	 * group defines a single stream of data, so this buffer can only end up at one
@@ -210,6 +302,9 @@ static void *start_filter_audio( void *ptr )
         int didForward = 0;
         for (int i = 1; i < h->num_encoders; i++)
         {
+            if (h->encoders[i]->is_video)
+                continue;
+
             output_stream = get_output_stream_by_id(h, h->encoders[i]->output_stream_id);
             if (output_stream->stream_format != AUDIO_AC_3_BITSTREAM)
                 continue; /* Ignore downstream AC3 bitstream encoders */
@@ -245,6 +340,7 @@ static void *start_filter_audio( void *ptr )
         }
     }
 
+    obe_buf_pool_free( pool );
     free( filter_params );
 
     return NULL;
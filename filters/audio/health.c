@@ -0,0 +1,349 @@
+#include <math.h>
+#include <syslog.h>
+#include "common/common.h"
+#include "health.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define SILENCE_POWER 1e-7  /* -70dBFS */
+#define ACTIVE_POWER  1e-5  /* -50dBFS, both channels of a pair need this much for a phase check */
+#define CLIP_LEVEL    0.9999f
+#define CLIP_SAMPLES  3     /* Per frame, a single full scale sample is often legitimate */
+#define PHASE_CORR    -0.5
+#define DC_LEVEL      0.01
+#define STUCK_MS      100
+
+static const struct
+{
+    const char *name;
+    int raise_ms; /* The condition has to hold this long to raise the alarm */
+    int clear_ms; /* and be gone this long to clear it */
+} alarm_defs[AUDIO_ALARM_MAX] =
+{
+    [AUDIO_ALARM_SILENCE]  = { "silence",  5000,  500 },
+    [AUDIO_ALARM_CLIPPING] = { "clipping",    0, 2000 },
+    [AUDIO_ALARM_PHASE]    = { "phase",    2000, 2000 },
+    [AUDIO_ALARM_STUCK]    = { "stuck",       0, 1000 },
+    [AUDIO_ALARM_DC]       = { "dc",       5000, 1000 },
+};
+
+/* One pass over a channel pair */
+typedef struct
+{
+    float sum2[2];
+    float sum[2];
+    float peak[2];
+    float sum_lr;
+    int clipped[2];
+} pair_measure_t;
+
+typedef struct
+{
+    int active;
+    int64_t held;  /* Samples the condition has held, or been gone for when active */
+} alarm_state_t;
+
+typedef struct
+{
+    /* Last frame */
+    double rms_db;
+    double peak_db;
+    double dc;
+    double corr;   /* With the other channel of the pair */
+
+    int32_t last;  /* Last sample, and how many times in a row it has repeated */
+    int64_t run;
+
+    alarm_state_t alarm[AUDIO_ALARM_MAX];
+} channel_state_t;
+
+struct obe_audio_health_s
+{
+    int input_stream_id;
+    int sample_rate;
+    int num_channels;
+    uint32_t monitored;
+
+    void (*measure_pair)( const int32_t *l, const int32_t *r, int n, pair_measure_t *m );
+    int (*last_change)( const int32_t *x, int n );
+
+    pthread_mutex_t mutex;
+    uint32_t alarms[AUDIO_ALARM_MAX];
+    channel_state_t ch[MAX_CHANNELS];
+};
+
+static void measure_pair_c( const int32_t *l, const int32_t *r, int n, pair_measure_t *m )
+{
+    memset( m, 0, sizeof(*m) );
+
+    for( int i = 0; i < n; i++ )
+    {
+        float x[2] = { l[i] * (1.0f / 2147483648.0f), r[i] * (1.0f / 2147483648.0f) };
+
+        for( int c = 0; c < 2; c++ )
+        {
+            float a = fabsf( x[c] );
+            m->sum2[c] += x[c] * x[c];
+            m->sum[c] += x[c];
+            m->peak[c] = FFMAX( m->peak[c], a );
+            m->clipped[c] += a >= CLIP_LEVEL;
+        }
+        m->sum_lr += x[0] * x[1];
+    }
+}
+
+/* Index of the last sample that differs from the one before it, 0 when x[1..n-1] all repeat x[0] */
+static int last_change_c( const int32_t *x, int n )
+{
+    for( int i = n - 1; i > 0; i-- )
+        if( x[i] != x[i - 1] )
+            return i;
+
+    return 0;
+}
+
+#if defined(__SSE2__)
+static float hsum_ps( __m128 v )
+{
+    v = _mm_add_ps( v, _mm_movehl_ps( v, v ) );
+    v = _mm_add_ss( v, _mm_shuffle_ps( v, v, 1 ) );
+    return _mm_cvtss_f32( v );
+}
+
+static float hmax_ps( __m128 v )
+{
+    v = _mm_max_ps( v, _mm_movehl_ps( v, v ) );
+    v = _mm_max_ss( v, _mm_shuffle_ps( v, v, 1 ) );
+    return _mm_cvtss_f32( v );
+}
+
+static int hsum_epi32( __m128i v )
+{
+    v = _mm_add_epi32( v, _mm_shuffle_epi32( v, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+    v = _mm_add_epi32( v, _mm_shuffle_epi32( v, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+    return _mm_cvtsi128_si32( v );
+}
+
+static void measure_pair_sse2( const int32_t *l, const int32_t *r, int n, pair_measure_t *m )
+{
+    const __m128 scale = _mm_set1_ps( 1.0f / 2147483648.0f );
+    const __m128 abs_mask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+    const __m128 clip = _mm_set1_ps( CLIP_LEVEL );
+    __m128 l2 = _mm_setzero_ps(), r2 = _mm_setzero_ps(), lr = _mm_setzero_ps();
+    __m128 ls = _mm_setzero_ps(), rs = _mm_setzero_ps();
+    __m128 lp = _mm_setzero_ps(), rp = _mm_setzero_ps();
+    __m128i lc = _mm_setzero_si128(), rc = _mm_setzero_si128();
+    int i;
+
+    for( i = 0; i + 4 <= n; i += 4 )
+    {
+        __m128 x = _mm_mul_ps( _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i *)&l[i] ) ), scale );
+        __m128 y = _mm_mul_ps( _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i *)&r[i] ) ), scale );
+        __m128 xa = _mm_and_ps( x, abs_mask );
+        __m128 ya = _mm_and_ps( y, abs_mask );
+
+        l2 = _mm_add_ps( l2, _mm_mul_ps( x, x ) );
+        r2 = _mm_add_ps( r2, _mm_mul_ps( y, y ) );
+        lr = _mm_add_ps( lr, _mm_mul_ps( x, y ) );
+        ls = _mm_add_ps( ls, x );
+        rs = _mm_add_ps( rs, y );
+        lp = _mm_max_ps( lp, xa );
+        rp = _mm_max_ps( rp, ya );
+        /* Compare masks are -1 */
+        lc = _mm_sub_epi32( lc, _mm_castps_si128( _mm_cmpge_ps( xa, clip ) ) );
+        rc = _mm_sub_epi32( rc, _mm_castps_si128( _mm_cmpge_ps( ya, clip ) ) );
+    }
+
+    pair_measure_t tail;
+    measure_pair_c( l + i, r + i, n - i, &tail );
+
+    m->sum2[0] = hsum_ps( l2 ) + tail.sum2[0];
+    m->sum2[1] = hsum_ps( r2 ) + tail.sum2[1];
+    m->sum[0] = hsum_ps( ls ) + tail.sum[0];
+    m->sum[1] = hsum_ps( rs ) + tail.sum[1];
+    m->sum_lr = hsum_ps( lr ) + tail.sum_lr;
+    m->peak[0] = FFMAX( hmax_ps( lp ), tail.peak[0] );
+    m->peak[1] = FFMAX( hmax_ps( rp ), tail.peak[1] );
+    m->clipped[0] = hsum_epi32( lc ) + tail.clipped[0];
+    m->clipped[1] = hsum_epi32( rc ) + tail.clipped[1];
+}
+
+/* Scans back from the end, live audio stops at the first vector */
+static int last_change_sse2( const int32_t *x, int n )
+{
+    int i = n - 4;
+
+    for( ; i > 0; i -= 4 )
+    {
+        __m128i eq = _mm_cmpeq_epi32( _mm_loadu_si128( (const __m128i *)&x[i] ), _mm_loadu_si128( (const __m128i *)&x[i - 1] ) );
+        int mask = _mm_movemask_ps( _mm_castsi128_ps( eq ) );
+        if( mask != 0xf )
+            return i + 31 - __builtin_clz( ~mask & 0xf );
+    }
+
+    return last_change_c( x, i + 4 );
+}
+#endif
+
+static void update_alarm( obe_audio_health_t *a, int c, int alarm, int condition, int n )
+{
+    alarm_state_t *s = &a->ch[c].alarm[alarm];
+    int64_t limit = (int64_t)(s->active ? alarm_defs[alarm].clear_ms : alarm_defs[alarm].raise_ms) * a->sample_rate / 1000;
+
+    if( condition == s->active )
+    {
+        s->held = 0;
+        return;
+    }
+
+    s->held += n;
+    if( s->held < limit )
+        return;
+
+    s->active = condition;
+    s->held = 0;
+
+    pthread_mutex_lock( &a->mutex );
+    if( condition )
+        a->alarms[alarm] |= 1u << c;
+    else
+        a->alarms[alarm] &= ~(1u << c);
+    pthread_mutex_unlock( &a->mutex );
+
+    if( a->monitored & (1u << c) )
+        syslog( condition ? LOG_WARNING : LOG_INFO, "Audio health: input stream %d channel %d %s alarm %s",
+                a->input_stream_id, c + 1, alarm_defs[alarm].name, condition ? "raised" : "cleared" );
+}
+
+static void update_stuck( obe_audio_health_t *a, const int32_t *x, int c, int n )
+{
+    channel_state_t *ch = &a->ch[c];
+    int i = a->last_change( x, n );
+
+    if( i == 0 && x[0] == ch->last )
+        ch->run += n;
+    else
+        ch->run = n - i;
+    ch->last = x[n - 1];
+}
+
+obe_audio_health_t *obe_audio_health_alloc( int input_stream_id, int sample_rate )
+{
+    if( sample_rate <= 0 )
+        return NULL;
+
+    obe_audio_health_t *a = calloc( 1, sizeof(*a) );
+    if( !a )
+        return NULL;
+
+    a->input_stream_id = input_stream_id;
+    a->sample_rate = sample_rate;
+    a->measure_pair = measure_pair_c;
+    a->last_change = last_change_c;
+#if defined(__SSE2__)
+    a->measure_pair = measure_pair_sse2;
+    a->last_change = last_change_sse2;
+#endif
+    pthread_mutex_init( &a->mutex, NULL );
+
+    return a;
+}
+
+void obe_audio_health_free( obe_audio_health_t *a )
+{
+    if( !a )
+        return;
+
+    pthread_mutex_destroy( &a->mutex );
+    free( a );
+}
+
+void obe_audio_health_process( obe_audio_health_t *a, uint8_t **planes, int num_channels, int num_samples, uint32_t monitored )
+{
+    if( num_samples <= 0 )
+        return;
+
+    a->num_channels = FFMIN( num_channels, MAX_CHANNELS );
+    a->monitored = monitored;
+
+    for( int c = 0; c < a->num_channels; c += 2 )
+    {
+        /* An odd last channel is measured against itself and has no phase check */
+        int c1 = FFMIN( c + 1, a->num_channels - 1 );
+        pair_measure_t m;
+
+        /* Inputs only convert the pairs an encoder takes, the other planes may hold anything */
+        if( !(monitored & (3u << c)) )
+            continue;
+        double p[2];
+
+        a->measure_pair( (const int32_t *)planes[c], (const int32_t *)planes[c1], num_samples, &m );
+
+        p[0] = (double)m.sum2[0] / num_samples;
+        p[1] = (double)m.sum2[1] / num_samples;
+        double corr = m.sum2[0] > 0.0f && m.sum2[1] > 0.0f ? m.sum_lr / sqrt( (double)m.sum2[0] * m.sum2[1] ) : 0.0;
+        int out_of_phase = c1 != c && corr < PHASE_CORR && p[0] > ACTIVE_POWER && p[1] > ACTIVE_POWER;
+
+        for( int k = 0; k < 2 && c + k < a->num_channels; k++ )
+        {
+            int cc = c + k;
+            channel_state_t *ch = &a->ch[cc];
+
+            ch->rms_db = p[k] > 0.0 ? 10.0 * log10( p[k] ) : -INFINITY;
+            ch->peak_db = m.peak[k] > 0.0f ? 20.0 * log10( m.peak[k] ) : -INFINITY;
+            ch->dc = (double)m.sum[k] / num_samples;
+            ch->corr = corr;
+
+            update_stuck( a, (const int32_t *)planes[cc], cc, num_samples );
+
+            update_alarm( a, cc, AUDIO_ALARM_SILENCE, p[k] < SILENCE_POWER, num_samples );
+            update_alarm( a, cc, AUDIO_ALARM_CLIPPING, m.clipped[k] >= CLIP_SAMPLES, num_samples );
+            update_alarm( a, cc, AUDIO_ALARM_PHASE, out_of_phase, num_samples );
+            update_alarm( a, cc, AUDIO_ALARM_STUCK, ch->last != 0 && ch->run >= (int64_t)STUCK_MS * a->sample_rate / 1000, num_samples );
+            update_alarm( a, cc, AUDIO_ALARM_DC, fabs( ch->dc ) > DC_LEVEL, num_samples );
+        }
+    }
+}
+
+uint32_t obe_audio_health_alarms( obe_audio_health_t *a, int alarm )
+{
+    pthread_mutex_lock( &a->mutex );
+    uint32_t mask = a->alarms[alarm] & a->monitored;
+    pthread_mutex_unlock( &a->mutex );
+
+    return mask;
+}
+
+void obe_audio_health_print( obe_audio_health_t *a )
+{
+    printf( "Input stream %d audio health:\n", a->input_stream_id );
+
+    for( int c = 0; c < a->num_channels; c++ )
+    {
+        channel_state_t *ch = &a->ch[c];
+
+        if( !(a->monitored & (1u << c)) )
+            continue;
+
+        printf( "    channel %2d: rms %6.1f dBFS, peak %6.1f dBFS, dc %+.4f, corr %+.2f", c + 1,
+                ch->rms_db, ch->peak_db, ch->dc, ch->corr );
+        for( int i = 0; i < AUDIO_ALARM_MAX; i++ )
+            if( obe_audio_health_alarms( a, i ) & (1u << c) )
+                printf( " [%s]", alarm_defs[i].name );
+        printf( "\n" );
+    }
+}
+
+void obe_audio_health_stats( obe_audio_health_t *a, char *buf, size_t len )
+{
+    for( int i = 0; i < AUDIO_ALARM_MAX; i++ )
+    {
+        size_t used = strlen( buf );
+        if( used >= len )
+            return;
+
+        snprintf( buf + used, len - used, ",a%d_%s=0x%04x", a->input_stream_id, alarm_defs[i].name, obe_audio_health_alarms( a, i ) );
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef OBE_FILTERS_AUDIO_HEALTH_H
+#define OBE_FILTERS_AUDIO_HEALTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Audio health detectors.
+ * The audio filter runs every PCM frame of an input through one pass per
+ * channel pair, measuring RMS, peak, clipped samples, DC offset and the L/R
+ * correlation, and how long each channel has repeated the same sample. Each
+ * condition needs to hold for a while before it raises an alarm, and to be
+ * gone for a while before it clears, so a quiet passage or a single clipped
+ * transient doesn't flap. Alarms go to syslog, only for the channels an
+ * encoder is using. C and SSE2.
+ */
+typedef struct obe_audio_health_s obe_audio_health_t;
+
+enum obe_audio_alarm_e
+{
+    AUDIO_ALARM_SILENCE = 0, /* Under -70dBFS RMS */
+    AUDIO_ALARM_CLIPPING,    /* Samples at full scale */
+    AUDIO_ALARM_PHASE,       /* Channel pair out of phase */
+    AUDIO_ALARM_STUCK,       /* The same non zero sample repeated */
+    AUDIO_ALARM_DC,          /* DC offset over 1% of full scale */
+    AUDIO_ALARM_MAX,
+};
+
+obe_audio_health_t *obe_audio_health_alloc( int input_stream_id, int sample_rate );
+void obe_audio_health_free( obe_audio_health_t *a );
+
+/* One frame of S32P samples. monitored is a bitmask of the channels alarms are raised for,
+ * pairs with neither channel in it are not read. */
+void obe_audio_health_process( obe_audio_health_t *a, uint8_t **planes, int num_channels, int num_samples, uint32_t monitored );
+
+/* Bitmask of the channels with the alarm raised */
+uint32_t obe_audio_health_alarms( obe_audio_health_t *a, int alarm );
+
+/* Levels and alarms of the monitored channels, for 'show audio health'. */
+void obe_audio_health_print( obe_audio_health_t *a );
+
+/* Append ",key=value" pairs to a runtime statistics line. */
+void obe_audio_health_stats( obe_audio_health_t *a, char *buf, size_t len );
+
+#endif
@@ -0,0 +1,445 @@
+#include <math.h>
+#include <libavutil/mem.h>
+#include <libavutil/channel_layout.h>
+#include "common/common.h"
+#include "loudness.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define BLOCKS_MOMENTARY  4  /* 100ms blocks in 400ms */
+#define BLOCKS_SHORT_TERM 30 /* 100ms blocks in 3s */
+
+/* Integrated loudness histogram, -70 to +30 LUFS in 0.1 LU bins */
+#define HIST_MIN  -70.0
+#define HIST_BINS 1000
+
+#define ABSOLUTE_GATE -70.0
+#define RELATIVE_GATE -10.0
+
+/* 4x oversampling, 12 taps per phase */
+#define TP_PHASES 4
+#define TP_TAPS   12
+
+struct obe_loudness_s
+{
+    int sample_rate;
+    int num_channels;
+    int standard;
+    double weight[MAX_CHANNELS];
+
+    /* K-weighting: high shelf pre-filter then the RLB high pass, both transposed direct form II */
+    double b[2][3];
+    double a[2][3];
+    DECLARE_ALIGNED( 16, double, z )[4][MAX_CHANNELS];
+    DECLARE_ALIGNED( 16, double, energy )[MAX_CHANNELS];
+
+    /* Last TP_TAPS samples of each channel, written twice so a window never wraps */
+    DECLARE_ALIGNED( 16, float, tp_hist )[MAX_CHANNELS][2 * TP_TAPS];
+    DECLARE_ALIGNED( 16, float, tp_coefs_t )[TP_TAPS][TP_PHASES]; /* Tap major, one vector holds a tap of all four phases */
+    int tp_pos;
+    float tp_max;
+
+    void (*kweight_pair)( obe_loudness_t *l, const int32_t *src0, const int32_t *src1, int c, int n );
+    float (*true_peak)( obe_loudness_t *l, const int32_t *src, int c, int n );
+
+    int block_len;
+    int block_fill;
+    double blocks[BLOCKS_SHORT_TERM]; /* Channel weighted mean square of each 100ms block */
+    int block_pos;
+    int num_blocks;
+
+    uint64_t hist[HIST_BINS];
+    double hist_power[HIST_BINS]; /* Sum of the blocks in each bin, the bins only decide the gating */
+
+    pthread_mutex_t mutex;
+    obe_loudness_stats_t stats;
+};
+
+/* ITU-R BS.1770-4 Annex 2 */
+static const float tp_coefs[TP_PHASES][TP_TAPS] =
+{
+    {  0.0017089843750,  0.0109863281250, -0.0196533203125,  0.0332031250000, -0.0594482421875,  0.1373291015625,
+       0.9721679687500, -0.1022949218750,  0.0476074218750, -0.0266113281250,  0.0148925781250, -0.0083007812500 },
+    { -0.0291748046875,  0.0292968750000, -0.0517578125000,  0.0891113281250, -0.1665039062500,  0.4650878906250,
+       0.7797851562500, -0.2003173828125,  0.1015625000000, -0.0582275390625,  0.0330810546875, -0.0189208984375 },
+    { -0.0189208984375,  0.0330810546875, -0.0582275390625,  0.1015625000000, -0.2003173828125,  0.7797851562500,
+       0.4650878906250, -0.1665039062500,  0.0891113281250, -0.0517578125000,  0.0292968750000, -0.0291748046875 },
+    { -0.0083007812500,  0.0148925781250, -0.0266113281250,  0.0476074218750, -0.1022949218750,  0.9721679687500,
+       0.1373291015625, -0.0594482421875,  0.0332031250000, -0.0196533203125,  0.0109863281250,  0.0017089843750 },
+};
+
+static double to_lufs( double power )
+{
+    return power > 0.0 ? -0.691 + 10.0 * log10( power ) : -INFINITY;
+}
+
+static double to_dbfs( double v )
+{
+    return v > 0.0 ? 20.0 * log10( v ) : -INFINITY;
+}
+
+/* The filters are specified at 48kHz, redesign them for the stream rate */
+static void design_filters( obe_loudness_t *l )
+{
+    double f0 = 1681.974450955533;
+    double g = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = tan( M_PI * f0 / l->sample_rate );
+    double vh = pow( 10.0, g / 20.0 );
+    double vb = pow( vh, 0.4996667741545416 );
+    double a0 = 1.0 + k / q + k * k;
+
+    l->b[0][0] = (vh + vb * k / q + k * k) / a0;
+    l->b[0][1] = 2.0 * (k * k - vh) / a0;
+    l->b[0][2] = (vh - vb * k / q + k * k) / a0;
+    l->a[0][0] = 1.0;
+    l->a[0][1] = 2.0 * (k * k - 1.0) / a0;
+    l->a[0][2] = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan( M_PI * f0 / l->sample_rate );
+    a0 = 1.0 + k / q + k * k;
+
+    l->b[1][0] = 1.0;
+    l->b[1][1] = -2.0;
+    l->b[1][2] = 1.0;
+    l->a[1][0] = 1.0;
+    l->a[1][1] = 2.0 * (k * k - 1.0) / a0;
+    l->a[1][2] = (1.0 - k / q + k * k) / a0;
+}
+
+/* BS.1770 channel weights, surrounds +1.5dB and the LFE left out */
+static double channel_weight( uint64_t channel )
+{
+    if( channel == AV_CH_LOW_FREQUENCY || channel == AV_CH_LOW_FREQUENCY_2 )
+        return 0.0;
+    if( channel == AV_CH_SIDE_LEFT || channel == AV_CH_SIDE_RIGHT ||
+        channel == AV_CH_BACK_LEFT || channel == AV_CH_BACK_RIGHT )
+        return 1.41;
+    return 1.0;
+}
+
+/* K-weight one channel and sum the square of the output */
+static void kweight_c( obe_loudness_t *l, const int32_t *src, int c, int n )
+{
+    double z0 = l->z[0][c], z1 = l->z[1][c], z2 = l->z[2][c], z3 = l->z[3][c];
+    double sum = 0.0;
+
+    for( int i = 0; i < n; i++ )
+    {
+        double x = src[i] * (1.0 / 2147483648.0);
+        double y = l->b[0][0] * x + z0;
+        z0 = l->b[0][1] * x - l->a[0][1] * y + z1;
+        z1 = l->b[0][2] * x - l->a[0][2] * y;
+
+        x = y;
+        y = l->b[1][0] * x + z2;
+        z2 = l->b[1][1] * x - l->a[1][1] * y + z3;
+        z3 = l->b[1][2] * x - l->a[1][2] * y;
+
+        sum += y * y;
+    }
+
+    l->z[0][c] = z0;
+    l->z[1][c] = z1;
+    l->z[2][c] = z2;
+    l->z[3][c] = z3;
+    l->energy[c] += sum;
+}
+
+static void kweight_pair_c( obe_loudness_t *l, const int32_t *src0, const int32_t *src1, int c, int n )
+{
+    kweight_c( l, src0, c, n );
+    kweight_c( l, src1, c + 1, n );
+}
+
+static float true_peak_c( obe_loudness_t *l, const int32_t *src, int c, int n )
+{
+    float *hist = l->tp_hist[c];
+    int pos = l->tp_pos;
+    float peak = 0.0f;
+
+    for( int i = 0; i < n; i++ )
+    {
+        hist[pos] = hist[pos + TP_TAPS] = src[i] * (1.0f / 2147483648.0f);
+        pos = pos ? pos - 1 : TP_TAPS - 1;
+
+        /* hist[pos + 1] is the newest sample */
+        for( int p = 0; p < TP_PHASES; p++ )
+        {
+            float v = 0.0f;
+            for( int k = 0; k < TP_TAPS; k++ )
+                v += tp_coefs[p][k] * hist[pos + 1 + k];
+            peak = FFMAX( peak, fabsf( v ) );
+        }
+    }
+
+    return peak;
+}
+
+#if defined(__SSE2__)
+/* Two channels at a time, the filter state of a pair sits side by side */
+static void kweight_pair_sse2( obe_loudness_t *l, const int32_t *src0, const int32_t *src1, int c, int n )
+{
+    const __m128d scale = _mm_set1_pd( 1.0 / 2147483648.0 );
+    const __m128d b00 = _mm_set1_pd( l->b[0][0] ), b01 = _mm_set1_pd( l->b[0][1] ), b02 = _mm_set1_pd( l->b[0][2] );
+    const __m128d a01 = _mm_set1_pd( l->a[0][1] ), a02 = _mm_set1_pd( l->a[0][2] );
+    const __m128d b10 = _mm_set1_pd( l->b[1][0] ), b11 = _mm_set1_pd( l->b[1][1] ), b12 = _mm_set1_pd( l->b[1][2] );
+    const __m128d a11 = _mm_set1_pd( l->a[1][1] ), a12 = _mm_set1_pd( l->a[1][2] );
+    __m128d z0 = _mm_load_pd( &l->z[0][c] ), z1 = _mm_load_pd( &l->z[1][c] );
+    __m128d z2 = _mm_load_pd( &l->z[2][c] ), z3 = _mm_load_pd( &l->z[3][c] );
+    __m128d sum = _mm_setzero_pd();
+
+    for( int i = 0; i < n; i++ )
+    {
+        __m128d x = _mm_mul_pd( _mm_cvtepi32_pd( _mm_unpacklo_epi32( _mm_cvtsi32_si128( src0[i] ), _mm_cvtsi32_si128( src1[i] ) ) ), scale );
+        __m128d y = _mm_add_pd( _mm_mul_pd( b00, x ), z0 );
+        z0 = _mm_add_pd( _mm_sub_pd( _mm_mul_pd( b01, x ), _mm_mul_pd( a01, y ) ), z1 );
+        z1 = _mm_sub_pd( _mm_mul_pd( b02, x ), _mm_mul_pd( a02, y ) );
+
+        x = y;
+        y = _mm_add_pd( _mm_mul_pd( b10, x ), z2 );
+        z2 = _mm_add_pd( _mm_sub_pd( _mm_mul_pd( b11, x ), _mm_mul_pd( a11, y ) ), z3 );
+        z3 = _mm_sub_pd( _mm_mul_pd( b12, x ), _mm_mul_pd( a12, y ) );
+
+        sum = _mm_add_pd( sum, _mm_mul_pd( y, y ) );
+    }
+
+    _mm_store_pd( &l->z[0][c], z0 );
+    _mm_store_pd( &l->z[1][c], z1 );
+    _mm_store_pd( &l->z[2][c], z2 );
+    _mm_store_pd( &l->z[3][c], z3 );
+    _mm_store_pd( &l->energy[c], _mm_add_pd( _mm_load_pd( &l->energy[c] ), sum ) );
+}
+
+/* All four phases of an input sample in one vector */
+static float true_peak_sse2( obe_loudness_t *l, const int32_t *src, int c, int n )
+{
+    const __m128 abs_mask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+    float *hist = l->tp_hist[c];
+    int pos = l->tp_pos;
+    __m128 peak = _mm_setzero_ps();
+
+    for( int i = 0; i < n; i++ )
+    {
+        hist[pos] = hist[pos + TP_TAPS] = src[i] * (1.0f / 2147483648.0f);
+        pos = pos ? pos - 1 : TP_TAPS - 1;
+
+        const float *h = &hist[pos + 1];
+        __m128 v = _mm_mul_ps( _mm_load_ps( l->tp_coefs_t[0] ), _mm_set1_ps( h[0] ) );
+        for( int k = 1; k < TP_TAPS; k++ )
+            v = _mm_add_ps( v, _mm_mul_ps( _mm_load_ps( l->tp_coefs_t[k] ), _mm_set1_ps( h[k] ) ) );
+        peak = _mm_max_ps( peak, _mm_and_ps( v, abs_mask ) );
+    }
+
+    peak = _mm_max_ps( peak, _mm_movehl_ps( peak, peak ) );
+    peak = _mm_max_ss( peak, _mm_shuffle_ps( peak, peak, 1 ) );
+    return _mm_cvtss_f32( peak );
+}
+#endif
+
+static double integrated_power( obe_loudness_t *l )
+{
+    double sum = 0.0;
+    uint64_t count = 0;
+
+    for( int i = 0; i < HIST_BINS; i++ )
+    {
+        sum += l->hist_power[i];
+        count += l->hist[i];
+    }
+    if( !count )
+        return 0.0;
+
+    /* Relative gate, 10 LU under the absolute gated mean */
+    double gate = to_lufs( sum / count ) + RELATIVE_GATE;
+    int first = FFMAX( (int)ceil( (gate - HIST_MIN) * 10.0 ), 0 );
+
+    sum = 0.0;
+    count = 0;
+    for( int i = first; i < HIST_BINS; i++ )
+    {
+        sum += l->hist_power[i];
+        count += l->hist[i];
+    }
+
+    return count ? sum / count : 0.0;
+}
+
+static double mean_blocks( obe_loudness_t *l, int n )
+{
+    double sum = 0.0;
+
+    n = FFMIN( n, l->num_blocks );
+    for( int i = 1; i <= n; i++ )
+        sum += l->blocks[(l->block_pos - i + BLOCKS_SHORT_TERM) % BLOCKS_SHORT_TERM];
+
+    return n ? sum / n : 0.0;
+}
+
+static void finish_block( obe_loudness_t *l )
+{
+    double power = 0.0;
+
+    for( int c = 0; c < l->num_channels; c++ )
+    {
+        power += l->weight[c] * l->energy[c];
+        l->energy[c] = 0.0;
+    }
+
+    l->blocks[l->block_pos] = power / l->block_len;
+    l->block_pos = (l->block_pos + 1) % BLOCKS_SHORT_TERM;
+    l->num_blocks = FFMIN( l->num_blocks + 1, BLOCKS_SHORT_TERM );
+    l->block_fill = 0;
+
+    double gating_block = mean_blocks( l, BLOCKS_MOMENTARY );
+    double momentary = l->num_blocks >= BLOCKS_MOMENTARY ? to_lufs( gating_block ) : -INFINITY;
+    if( momentary >= ABSOLUTE_GATE )
+    {
+        int bin = FFMIN( (int)((momentary - HIST_MIN) * 10.0), HIST_BINS - 1 );
+        l->hist[bin]++;
+        l->hist_power[bin] += gating_block;
+    }
+
+    double short_term = to_lufs( mean_blocks( l, BLOCKS_SHORT_TERM ) );
+    double integrated = to_lufs( integrated_power( l ) );
+
+    pthread_mutex_lock( &l->mutex );
+    l->stats.momentary = momentary;
+    l->stats.short_term = short_term;
+    l->stats.integrated = integrated;
+    l->stats.true_peak = to_dbfs( l->tp_max );
+    pthread_mutex_unlock( &l->mutex );
+}
+
+obe_loudness_t *obe_loudness_alloc( int sample_rate, uint64_t channel_layout, int standard )
+{
+    int num_channels = av_get_channel_layout_nb_channels( channel_layout );
+
+    if( sample_rate < 8000 || sample_rate % 10 || num_channels < 1 || num_channels > MAX_CHANNELS )
+        return NULL;
+
+    obe_loudness_t *l = av_mallocz( sizeof(*l) );
+    if( !l )
+        return NULL;
+
+    l->sample_rate = sample_rate;
+    l->num_channels = num_channels;
+    l->standard = standard;
+    l->block_len = sample_rate / 10;
+    for( int c = 0; c < num_channels; c++ )
+        l->weight[c] = channel_weight( av_channel_layout_extract_channel( channel_layout, c ) );
+
+    design_filters( l );
+
+    for( int k = 0; k < TP_TAPS; k++ )
+        for( int p = 0; p < TP_PHASES; p++ )
+            l->tp_coefs_t[k][p] = tp_coefs[p][k];
+
+    l->kweight_pair = kweight_pair_c;
+    l->true_peak = true_peak_c;
+#if defined(__SSE2__)
+    l->kweight_pair = kweight_pair_sse2;
+    l->true_peak = true_peak_sse2;
+#endif
+
+    pthread_mutex_init( &l->mutex, NULL );
+    l->stats.target = standard == AUDIO_LOUDNESS_ATSC_A85 ? -24.0 : -23.0;
+    l->stats.unit = standard == AUDIO_LOUDNESS_ATSC_A85 ? "LKFS" : "LUFS";
+    obe_loudness_reset( l );
+
+    return l;
+}
+
+void obe_loudness_free( obe_loudness_t *l )
+{
+    if( !l )
+        return;
+
+    pthread_mutex_destroy( &l->mutex );
+    av_free( l );
+}
+
+void obe_loudness_reset( obe_loudness_t *l )
+{
+    memset( l->z, 0, sizeof(l->z) );
+    memset( l->energy, 0, sizeof(l->energy) );
+    memset( l->tp_hist, 0, sizeof(l->tp_hist) );
+    memset( l->hist, 0, sizeof(l->hist) );
+    memset( l->hist_power, 0, sizeof(l->hist_power) );
+    l->tp_pos = 0;
+    l->tp_max = 0.0f;
+    l->block_fill = 0;
+    l->block_pos = 0;
+    l->num_blocks = 0;
+
+    pthread_mutex_lock( &l->mutex );
+    l->stats.momentary = l->stats.short_term = l->stats.integrated = l->stats.true_peak = -INFINITY;
+    pthread_mutex_unlock( &l->mutex );
+}
+
+int obe_loudness_process( obe_loudness_t *l, uint8_t **planes, int num_samples )
+{
+    int offset = 0, updated = 0;
+
+    while( offset < num_samples )
+    {
+        int n = FFMIN( num_samples - offset, l->block_len - l->block_fill );
+        int c = 0;
+
+        for( ; c + 1 < l->num_channels; c += 2 )
+            l->kweight_pair( l, (const int32_t *)planes[c] + offset, (const int32_t *)planes[c + 1] + offset, c, n );
+        if( c < l->num_channels )
+            kweight_c( l, (const int32_t *)planes[c] + offset, c, n );
+
+        for( c = 0; c < l->num_channels; c++ )
+        {
+            float peak = l->true_peak( l, (const int32_t *)planes[c] + offset, c, n );
+            l->tp_max = FFMAX( l->tp_max, peak );
+        }
+        l->tp_pos = (l->tp_pos - n % TP_TAPS + TP_TAPS) % TP_TAPS;
+
+        offset += n;
+        l->block_fill += n;
+        if( l->block_fill == l->block_len )
+        {
+            finish_block( l );
+            updated = 1;
+        }
+    }
+
+    return updated;
+}
+
+void obe_loudness_get( obe_loudness_t *l, obe_loudness_stats_t *s )
+{
+    pthread_mutex_lock( &l->mutex );
+    memcpy( s, &l->stats, sizeof(*s) );
+    pthread_mutex_unlock( &l->mutex );
+}
+
+void obe_loudness_print( obe_loudness_t *l )
+{
+    obe_loudness_stats_t s;
+    obe_loudness_get( l, &s );
+
+    printf( "Loudness: momentary %.1f short-term %.1f integrated %.1f %s (target %.0f), true peak %.1f dBTP\n",
+            s.momentary, s.short_term, s.integrated, s.unit, s.target, s.true_peak );
+}
+
+void obe_loudness_stats( obe_loudness_t *l, int output_stream_id, char *buf, size_t len )
+{
+    obe_loudness_stats_t s;
+    obe_loudness_get( l, &s );
+
+    size_t used = strlen( buf );
+    if( used >= len )
+        return;
+
+    snprintf( buf + used, len - used, ",s%d_lufs_m=%.1f,s%d_lufs_s=%.1f,s%d_lufs_i=%.1f,s%d_dbtp=%.1f",
+              output_stream_id, s.momentary, output_stream_id, s.short_term,
+              output_stream_id, s.integrated, output_stream_id, s.true_peak );
+}
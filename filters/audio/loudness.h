@@ -0,0 +1,45 @@
+#ifndef OBE_FILTERS_AUDIO_LOUDNESS_H
+#define OBE_FILTERS_AUDIO_LOUDNESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* ITU-R BS.1770-4 loudness meter, as used by EBU R128 and ATSC A/85.
+ * The audio filter runs the planar S32 samples of an encoded stream through
+ * the K-weighting filter and sums their power in 100ms blocks. Momentary
+ * loudness is the last 400ms, short-term the last 3s and integrated the
+ * gated mean of every 400ms block since the start, kept in a 0.1 LU histogram
+ * so memory and cost stay fixed however long we run. True peak is the largest
+ * sample of a 4x oversampled copy of the signal. C and SSE2.
+ */
+typedef struct obe_loudness_s obe_loudness_t;
+
+typedef struct
+{
+    double momentary;  /* LUFS, -inf until the first 400ms */
+    double short_term; /* LUFS */
+    double integrated; /* LUFS, -inf until a block passes the gates */
+    double true_peak;  /* dBTP, largest since the meter was reset */
+    double target;     /* LUFS, of the standard the stream is measured against */
+    const char *unit;  /* "LUFS" or "LKFS" */
+} obe_loudness_stats_t;
+
+/* standard is an audio_loudness_e. NULL for a layout we can't weight or an unsupported rate */
+obe_loudness_t *obe_loudness_alloc( int sample_rate, uint64_t channel_layout, int standard );
+void obe_loudness_free( obe_loudness_t *l );
+void obe_loudness_reset( obe_loudness_t *l );
+
+/* One frame of S32P samples, one plane per channel of the layout.
+ * Returns 1 when a 100ms block completed and the stats were updated. */
+int obe_loudness_process( obe_loudness_t *l, uint8_t **planes, int num_samples );
+
+/* Safe to call from any thread */
+void obe_loudness_get( obe_loudness_t *l, obe_loudness_stats_t *s );
+
+/* One line, for 'show output streams'. */
+void obe_loudness_print( obe_loudness_t *l );
+
+/* Append ",key=value" pairs to a runtime statistics line, keys prefixed with the output stream id. */
+void obe_loudness_stats( obe_loudness_t *l, int output_stream_id, char *buf, size_t len );
+
+#endif
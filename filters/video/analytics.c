@@ -0,0 +1,389 @@
+#include <syslog.h>
+#include "common/common.h"
+#include "analytics.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define GRID_ROW_STEP   4   /* Keeps to one field of an interlaced picture */
+#define BLACK_MEAN      20.0
+#define BLACK_MAX       40
+#define FREEZE_SAD      0.1 /* Live pictures rarely get under 1.0, even when static */
+#define ILLEGAL_LOW     4   /* EBU R103 gross error limits are 5-246 */
+#define ILLEGAL_HIGH    247
+#define ILLEGAL_PERCENT 1.0
+
+static const struct
+{
+    const char *name;
+    int raise_ms; /* The condition has to hold this long to raise the alarm */
+    int clear_ms; /* and be gone this long to clear it */
+} alarm_defs[VIDEO_ALARM_MAX] =
+{
+    [VIDEO_ALARM_BLACK]   = { "black",   2000,  500 },
+    [VIDEO_ALARM_FREEZE]  = { "freeze",  2000,  500 },
+    [VIDEO_ALARM_ILLEGAL] = { "illegal", 1000, 2000 },
+};
+
+typedef struct
+{
+    uint64_t sum;
+    uint64_t sad;
+    uint64_t edge;  /* Steps across block edges */
+    uint64_t inner; /* and inside the blocks */
+    uint64_t edges;
+    int min;
+    int max;
+    int illegal;
+} grid_measure_t;
+
+typedef struct
+{
+    int active;
+    int64_t held;  /* OBE_CLOCK the condition has held, or been gone for when active */
+} alarm_state_t;
+
+struct obe_vanalytics_s
+{
+    int interval;
+    int64_t nominal; /* OBE_CLOCK between analysed pictures at the nominal rate */
+    uint64_t count;
+
+    /* Grid of the current and the previous analysed picture */
+    int grid_width;
+    int grid_height;
+    uint8_t *grid[2];
+    int cur;
+    int have_prev;
+
+    int64_t last_pts;
+    int have_pts;
+
+    void (*extract_8)( const uint8_t *src, uint8_t *dst, int n );
+    void (*extract_16)( const uint16_t *src, uint8_t *dst, int n, int shift );
+    void (*measure_row)( const uint8_t *cur, const uint8_t *prev, int n, grid_measure_t *m );
+
+    alarm_state_t alarm[VIDEO_ALARM_MAX];
+
+    pthread_mutex_t mutex;
+    obe_vanalytics_stats_t stats;
+};
+
+static void extract_8_c( const uint8_t *src, uint8_t *dst, int n )
+{
+    for( int i = 0; i < n; i++ )
+        dst[i] = src[2*i];
+}
+
+static void extract_16_c( const uint16_t *src, uint8_t *dst, int n, int shift )
+{
+    for( int i = 0; i < n; i++ )
+        dst[i] = src[2*i] >> shift;
+}
+
+static void measure_row_c( const uint8_t *cur, const uint8_t *prev, int n, grid_measure_t *m )
+{
+    for( int i = 0; i < n; i++ )
+    {
+        int x = cur[i];
+
+        m->sum += x;
+        m->sad += abs( x - prev[i] );
+        m->min = FFMIN( m->min, x );
+        m->max = FFMAX( m->max, x );
+        m->illegal += x <= ILLEGAL_LOW || x >= ILLEGAL_HIGH;
+    }
+}
+
+/* Grid column x is picture column 2x, so 8 pixel block edges fall between grid
+ * columns 4k-1 and 4k. Compare that step with the one across the block middle. */
+static void measure_blocks( const uint8_t *cur, int n, grid_measure_t *m )
+{
+    for( int x = 4; x + 2 < n; x += 4 )
+    {
+        m->edge += abs( cur[x] - cur[x-1] );
+        m->inner += abs( cur[x+2] - cur[x+1] );
+        m->edges++;
+    }
+}
+
+#if defined(__SSE2__)
+static void extract_8_sse2( const uint8_t *src, uint8_t *dst, int n )
+{
+    const __m128i mask = _mm_set1_epi16( 0x00ff );
+
+    for( int i = 0; i < n; i += 16 )
+    {
+        __m128i a = _mm_and_si128( _mm_loadu_si128( (const __m128i *)&src[2*i] ), mask );
+        __m128i b = _mm_and_si128( _mm_loadu_si128( (const __m128i *)&src[2*i+16] ), mask );
+        _mm_storeu_si128( (__m128i *)&dst[i], _mm_packus_epi16( a, b ) );
+    }
+}
+
+static void extract_16_sse2( const uint16_t *src, uint8_t *dst, int n, int shift )
+{
+    const __m128i mask = _mm_set1_epi32( 0xffff );
+    const __m128i sh = _mm_cvtsi32_si128( shift );
+
+    for( int i = 0; i < n; i += 16 )
+    {
+        const __m128i *s = (const __m128i *)&src[2*i];
+        /* Even samples in the low half of each dword, shifted down to 8 bits so the packs can't saturate */
+        __m128i a0 = _mm_srl_epi32( _mm_and_si128( _mm_loadu_si128( s + 0 ), mask ), sh );
+        __m128i a1 = _mm_srl_epi32( _mm_and_si128( _mm_loadu_si128( s + 1 ), mask ), sh );
+        __m128i a2 = _mm_srl_epi32( _mm_and_si128( _mm_loadu_si128( s + 2 ), mask ), sh );
+        __m128i a3 = _mm_srl_epi32( _mm_and_si128( _mm_loadu_si128( s + 3 ), mask ), sh );
+        __m128i w0 = _mm_packs_epi32( a0, a1 );
+        __m128i w1 = _mm_packs_epi32( a2, a3 );
+        _mm_storeu_si128( (__m128i *)&dst[i], _mm_packus_epi16( w0, w1 ) );
+    }
+}
+
+static int hsum_epi64( __m128i v )
+{
+    return _mm_cvtsi128_si32( _mm_add_epi64( v, _mm_unpackhi_epi64( v, v ) ) );
+}
+
+static int hmin_epu8( __m128i v )
+{
+    v = _mm_min_epu8( v, _mm_srli_si128( v, 8 ) );
+    v = _mm_min_epu8( v, _mm_srli_si128( v, 4 ) );
+    v = _mm_min_epu8( v, _mm_srli_si128( v, 2 ) );
+    v = _mm_min_epu8( v, _mm_srli_si128( v, 1 ) );
+    return _mm_cvtsi128_si32( v ) & 0xff;
+}
+
+static int hmax_epu8( __m128i v )
+{
+    v = _mm_max_epu8( v, _mm_srli_si128( v, 8 ) );
+    v = _mm_max_epu8( v, _mm_srli_si128( v, 4 ) );
+    v = _mm_max_epu8( v, _mm_srli_si128( v, 2 ) );
+    v = _mm_max_epu8( v, _mm_srli_si128( v, 1 ) );
+    return _mm_cvtsi128_si32( v ) & 0xff;
+}
+
+/* psadbw against zero for the sum and against the previous grid for the SAD */
+static void measure_row_sse2( const uint8_t *cur, const uint8_t *prev, int n, grid_measure_t *m )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_set1_epi8( ILLEGAL_LOW );
+    const __m128i hi = _mm_set1_epi8( (char)ILLEGAL_HIGH );
+    __m128i mn = _mm_set1_epi8( (char)0xff ), mx = zero;
+    __m128i sum = zero, sad = zero;
+    int illegal = 0;
+
+    for( int i = 0; i < n; i += 16 )
+    {
+        __m128i x = _mm_loadu_si128( (const __m128i *)&cur[i] );
+        __m128i p = _mm_loadu_si128( (const __m128i *)&prev[i] );
+        __m128i bad = _mm_or_si128( _mm_cmpeq_epi8( _mm_min_epu8( x, lo ), x ),
+                                    _mm_cmpeq_epi8( _mm_max_epu8( x, hi ), x ) );
+
+        mn = _mm_min_epu8( mn, x );
+        mx = _mm_max_epu8( mx, x );
+        sum = _mm_add_epi64( sum, _mm_sad_epu8( x, zero ) );
+        sad = _mm_add_epi64( sad, _mm_sad_epu8( x, p ) );
+        illegal += __builtin_popcount( _mm_movemask_epi8( bad ) );
+    }
+
+    /* A row is at most 2^16 samples, so the row sums fit */
+    m->sum += hsum_epi64( sum );
+    m->sad += hsum_epi64( sad );
+    m->min = FFMIN( m->min, hmin_epu8( mn ) );
+    m->max = FFMAX( m->max, hmax_epu8( mx ) );
+    m->illegal += illegal;
+}
+#endif
+
+static void update_alarm( obe_vanalytics_t *a, int alarm, int condition, int64_t elapsed )
+{
+    alarm_state_t *s = &a->alarm[alarm];
+    int64_t limit = (int64_t)(s->active ? alarm_defs[alarm].clear_ms : alarm_defs[alarm].raise_ms) * OBE_CLOCK / 1000;
+
+    if( condition == s->active )
+    {
+        s->held = 0;
+        return;
+    }
+
+    s->held += elapsed;
+    if( s->held < limit )
+        return;
+
+    s->active = condition;
+    s->held = 0;
+
+    syslog( condition ? LOG_WARNING : LOG_INFO, "Video analytics: %s alarm %s", alarm_defs[alarm].name, condition ? "raised" : "cleared" );
+}
+
+static int alloc_grid( obe_vanalytics_t *a, int width, int height )
+{
+    int grid_width = (width / 2) & ~15;
+    int grid_height = (height + GRID_ROW_STEP - 1) / GRID_ROW_STEP;
+
+    if( grid_width == a->grid_width && grid_height == a->grid_height )
+        return 0;
+
+    free( a->grid[0] );
+    free( a->grid[1] );
+    a->grid[0] = malloc( grid_width * grid_height );
+    a->grid[1] = malloc( grid_width * grid_height );
+    a->grid_width = a->grid_height = 0;
+    a->have_prev = 0;
+
+    if( !a->grid[0] || !a->grid[1] )
+        return -1;
+
+    a->grid_width = grid_width;
+    a->grid_height = grid_height;
+
+    return 0;
+}
+
+obe_vanalytics_t *obe_vanalytics_alloc( int interval, int timebase_num, int timebase_den )
+{
+    if( interval <= 0 )
+        return NULL;
+
+    obe_vanalytics_t *a = calloc( 1, sizeof(*a) );
+    if( !a )
+        return NULL;
+
+    a->interval = interval;
+    if( timebase_num > 0 && timebase_den > 0 )
+        a->nominal = (int64_t)interval * OBE_CLOCK * timebase_num / timebase_den;
+    a->extract_8 = extract_8_c;
+    a->extract_16 = extract_16_c;
+    a->measure_row = measure_row_c;
+#if defined(__SSE2__)
+    a->extract_8 = extract_8_sse2;
+    a->extract_16 = extract_16_sse2;
+    a->measure_row = measure_row_sse2;
+#endif
+    pthread_mutex_init( &a->mutex, NULL );
+
+    return a;
+}
+
+void obe_vanalytics_free( obe_vanalytics_t *a )
+{
+    if( !a )
+        return;
+
+    pthread_mutex_destroy( &a->mutex );
+    free( a->grid[0] );
+    free( a->grid[1] );
+    free( a );
+}
+
+int obe_vanalytics_frame( obe_vanalytics_t *a, const uint8_t *luma, int stride, int width, int height, int depth, int64_t pts )
+{
+    if( a->count++ % a->interval )
+        return 0;
+
+    if( depth < 8 || depth > 16 || alloc_grid( a, width, height ) < 0 || !a->grid_width )
+        return 0;
+
+    uint8_t *cur = a->grid[a->cur];
+    uint8_t *prev = a->have_prev ? a->grid[!a->cur] : cur;
+    grid_measure_t m = { .min = 255 };
+
+    for( int y = 0; y < a->grid_height; y++ )
+    {
+        const uint8_t *src = luma + (size_t)y * GRID_ROW_STEP * stride;
+        uint8_t *row = cur + y * a->grid_width;
+
+        if( depth == 8 )
+            a->extract_8( src, row, a->grid_width );
+        else
+            a->extract_16( (const uint16_t *)src, row, a->grid_width, depth - 8 );
+
+        a->measure_row( row, prev + y * a->grid_width, a->grid_width, &m );
+        measure_blocks( row, a->grid_width, &m );
+    }
+
+    double samples = (double)a->grid_width * a->grid_height;
+    double mean = m.sum / samples;
+    double sad = m.sad / samples;
+    double illegal = 100.0 * m.illegal / samples;
+    int black = mean <= BLACK_MEAN && m.max <= BLACK_MAX;
+
+    /* Time since the last analysed picture, a jump in the timestamps counts as one
+     * interval at the nominal frame rate */
+    int64_t elapsed = a->have_pts ? pts - a->last_pts : 0;
+    if( elapsed < 0 || elapsed > OBE_CLOCK )
+        elapsed = a->nominal;
+    a->last_pts = pts;
+    a->have_pts = 1;
+
+    update_alarm( a, VIDEO_ALARM_BLACK, black, elapsed );
+    /* A black picture is frozen too, only report it once */
+    if( a->have_prev )
+        update_alarm( a, VIDEO_ALARM_FREEZE, !black && sad < FREEZE_SAD, elapsed );
+    update_alarm( a, VIDEO_ALARM_ILLEGAL, illegal > ILLEGAL_PERCENT, elapsed );
+
+    uint32_t alarms = 0;
+    for( int i = 0; i < VIDEO_ALARM_MAX; i++ )
+        alarms |= a->alarm[i].active << i;
+
+    pthread_mutex_lock( &a->mutex );
+    a->stats.frames++;
+    a->stats.mean = mean;
+    a->stats.min = m.min;
+    a->stats.max = m.max;
+    a->stats.illegal = illegal;
+    a->stats.sad = a->have_prev ? sad : 0.0;
+    /* One step per edge keeps a flat picture at 1.0 */
+    a->stats.blockiness = (double)(m.edge + m.edges) / (m.inner + m.edges);
+    a->stats.alarms = alarms;
+    pthread_mutex_unlock( &a->mutex );
+
+    a->cur = !a->cur;
+    a->have_prev = 1;
+
+    return 1;
+}
+
+void obe_vanalytics_get( obe_vanalytics_t *a, obe_vanalytics_stats_t *s )
+{
+    pthread_mutex_lock( &a->mutex );
+    *s = a->stats;
+    pthread_mutex_unlock( &a->mutex );
+}
+
+void obe_vanalytics_print( obe_vanalytics_t *a )
+{
+    obe_vanalytics_stats_t s;
+    obe_vanalytics_get( a, &s );
+
+    printf( "Video analytics (1 in %d pictures, %"PRIu64" analysed):\n", a->interval, s.frames );
+    printf( "    luma mean %5.1f, min %3d, max %3d, illegal %5.2f%%, sad %6.2f, blockiness %.2f",
+            s.mean, s.min, s.max, s.illegal, s.sad, s.blockiness );
+    for( int i = 0; i < VIDEO_ALARM_MAX; i++ )
+        if( s.alarms & (1u << i) )
+            printf( " [%s]", alarm_defs[i].name );
+    printf( "\n" );
+}
+
+void obe_vanalytics_stats( obe_vanalytics_t *a, char *buf, size_t len )
+{
+    obe_vanalytics_stats_t s;
+    size_t used = strlen( buf );
+
+    if( used >= len )
+        return;
+
+    obe_vanalytics_get( a, &s );
+    snprintf( buf + used, len - used, ",v_luma_mean=%.1f,v_luma_min=%d,v_luma_max=%d,v_illegal_pct=%.2f,v_sad=%.2f,v_blockiness=%.2f",
+              s.mean, s.min, s.max, s.illegal, s.sad, s.blockiness );
+
+    for( int i = 0; i < VIDEO_ALARM_MAX; i++ )
+    {
+        used = strlen( buf );
+        if( used >= len )
+            return;
+
+        snprintf( buf + used, len - used, ",v_%s=%d", alarm_defs[i].name, !!(s.alarms & (1u << i)) );
+    }
+}
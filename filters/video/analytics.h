@@ -0,0 +1,56 @@
+#ifndef OBE_FILTERS_VIDEO_ANALYTICS_H
+#define OBE_FILTERS_VIDEO_ANALYTICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Video signal analytics.
+ * Every Nth picture the luma is sampled on a grid of every 4th line and
+ * every 2nd pixel, reduced to 8 bits. From the grid we take the mean, min
+ * and max luma, the share of samples outside the EBU R103 gross error range,
+ * the mean absolute difference to the grid of the previous analysed picture
+ * and a blockiness score, the ratio of the luma steps across 8 pixel block
+ * edges to the steps inside the blocks. Black, frozen and illegal level
+ * pictures raise alarms once they have lasted a while and clear once they
+ * have been gone a while. C and SSE2.
+ */
+typedef struct obe_vanalytics_s obe_vanalytics_t;
+
+enum obe_video_alarm_e
+{
+    VIDEO_ALARM_BLACK = 0,
+    VIDEO_ALARM_FREEZE,
+    VIDEO_ALARM_ILLEGAL,
+    VIDEO_ALARM_MAX,
+};
+
+typedef struct
+{
+    uint64_t frames;   /* Analysed */
+    double mean;       /* 8-bit luma */
+    int min;
+    int max;
+    double illegal;    /* Percent of samples outside 5-246 */
+    double sad;        /* Mean absolute difference to the previous analysed picture */
+    double blockiness; /* 1.0 for a picture without block edges */
+    uint32_t alarms;   /* Bitmask of obe_video_alarm_e */
+} obe_vanalytics_stats_t;
+
+/* interval: analyse one picture in this many, of a stream with this frame duration */
+obe_vanalytics_t *obe_vanalytics_alloc( int interval, int timebase_num, int timebase_den );
+void obe_vanalytics_free( obe_vanalytics_t *a );
+
+/* Call for every picture, returns 1 when this one was analysed. depth is 8 to 16,
+ * deeper pictures have uint16_t samples. pts is OBE_CLOCK, for the alarm hysteresis. */
+int obe_vanalytics_frame( obe_vanalytics_t *a, const uint8_t *luma, int stride, int width, int height, int depth, int64_t pts );
+
+/* Safe to call from any thread */
+void obe_vanalytics_get( obe_vanalytics_t *a, obe_vanalytics_stats_t *s );
+
+/* For 'show input health'. */
+void obe_vanalytics_print( obe_vanalytics_t *a );
+
+/* Append ",key=value" pairs to a runtime statistics line. */
+void obe_vanalytics_stats( obe_vanalytics_t *a, char *buf, size_t len );
+
+#endif
@@ -0,0 +1,256 @@
+#include <syslog.h>
+#include "common/common.h"
+#include "obe/osd.h"
+#include "burnin.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define GLYPH_FIRST 0x20
+#define GLYPH_COUNT 96
+
+/* Luma and chroma, 8-bit */
+#define TEXT_Y    235
+#define BOX_Y     16
+#define NEUTRAL_C 128
+
+typedef struct
+{
+    char text[BURNIN_MAX_CHARS+1]; /* Wanted */
+    char drawn[BURNIN_MAX_CHARS];  /* In the mask, 0 for a cell that has to be drawn */
+    int len;
+} burnin_line_t;
+
+struct obe_burnin_s
+{
+    /* Sizes for the current picture height */
+    int scale;
+    int cell;         /* Glyph cell, square */
+    int pad;          /* Around the text in the box */
+    int strip_width;  /* Mask row, the widest box */
+    int strip_height; /* Box height */
+
+    uint8_t *glyphs;  /* GLYPH_COUNT cell x cell masks, 0xff on the text */
+    uint8_t *masks;   /* A strip_width x strip_height mask per line */
+    uint8_t *zero;    /* A mask row with no text, for the chroma */
+
+    burnin_line_t lines[BURNIN_MAX_LINES];
+
+    void (*blend_row_8)( uint8_t *dst, const uint8_t *mask, int n, int fg, int bg );
+    void (*blend_row_16)( uint16_t *dst, const uint8_t *mask, int n, int fg, int bg );
+};
+
+/* Text where the mask is set, elsewhere halfway to bg */
+static void blend_row_8_c( uint8_t *dst, const uint8_t *mask, int n, int fg, int bg )
+{
+    for( int i = 0; i < n; i++ )
+        dst[i] = mask[i] ? fg : ( dst[i] + bg + 1 ) >> 1;
+}
+
+static void blend_row_16_c( uint16_t *dst, const uint8_t *mask, int n, int fg, int bg )
+{
+    for( int i = 0; i < n; i++ )
+        dst[i] = mask[i] ? fg : ( dst[i] + bg + 1 ) >> 1;
+}
+
+#if defined(__SSE2__)
+static void blend_row_8_sse2( uint8_t *dst, const uint8_t *mask, int n, int fg, int bg )
+{
+    const __m128i f = _mm_set1_epi8( fg );
+    const __m128i b = _mm_set1_epi8( bg );
+    int i = 0;
+
+    for( ; i + 16 <= n; i += 16 )
+    {
+        __m128i m = _mm_loadu_si128( (const __m128i *)&mask[i] );
+        __m128i d = _mm_avg_epu8( _mm_loadu_si128( (const __m128i *)&dst[i] ), b );
+        _mm_storeu_si128( (__m128i *)&dst[i], _mm_or_si128( _mm_and_si128( m, f ), _mm_andnot_si128( m, d ) ) );
+    }
+
+    blend_row_8_c( dst + i, mask + i, n - i, fg, bg );
+}
+
+static void blend_row_16_sse2( uint16_t *dst, const uint8_t *mask, int n, int fg, int bg )
+{
+    const __m128i f = _mm_set1_epi16( fg );
+    const __m128i b = _mm_set1_epi16( bg );
+    int i = 0;
+
+    for( ; i + 8 <= n; i += 8 )
+    {
+        __m128i m = _mm_loadl_epi64( (const __m128i *)&mask[i] );
+        m = _mm_unpacklo_epi8( m, m );
+        __m128i d = _mm_avg_epu16( _mm_loadu_si128( (const __m128i *)&dst[i] ), b );
+        _mm_storeu_si128( (__m128i *)&dst[i], _mm_or_si128( _mm_and_si128( m, f ), _mm_andnot_si128( m, d ) ) );
+    }
+
+    blend_row_16_c( dst + i, mask + i, n - i, fg, bg );
+}
+#endif
+
+/* Expand the font for a new picture height. All the line masks have to be redrawn */
+static int set_scale( obe_burnin_t *b, int scale )
+{
+    free( b->glyphs );
+    free( b->masks );
+    free( b->zero );
+
+    b->scale = scale;
+    b->cell = 8 * scale;
+    b->pad = 2 * scale;
+    b->strip_width = ( BURNIN_MAX_CHARS * b->cell + 2 * b->pad + 15 ) & ~15;
+    b->strip_height = b->cell + 2 * b->pad;
+
+    b->glyphs = malloc( GLYPH_COUNT * b->cell * b->cell );
+    b->masks = calloc( BURNIN_MAX_LINES, b->strip_width * b->strip_height );
+    b->zero = calloc( 1, b->strip_width );
+    if( !b->glyphs || !b->masks || !b->zero )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        free( b->glyphs );
+        free( b->masks );
+        free( b->zero );
+        b->glyphs = b->masks = b->zero = NULL;
+        b->scale = 0;
+        return -1;
+    }
+
+    for( int g = 0; g < GLYPH_COUNT; g++ )
+    {
+        const unsigned char *bits = vc8x0_display_glyph( GLYPH_FIRST + g );
+        uint8_t *dst = b->glyphs + g * b->cell * b->cell;
+
+        for( int y = 0; y < b->cell; y++ )
+            for( int x = 0; x < b->cell; x++ )
+                *dst++ = bits && ( bits[y / scale] & ( 0x80 >> ( x / scale ) ) ) ? 0xff : 0;
+    }
+
+    for( int i = 0; i < BURNIN_MAX_LINES; i++ )
+        memset( b->lines[i].drawn, 0, sizeof(b->lines[i].drawn) );
+
+    return 0;
+}
+
+/* Copy the glyphs of the characters that changed into the line's mask */
+static void draw_line( obe_burnin_t *b, int idx )
+{
+    burnin_line_t *line = &b->lines[idx];
+    uint8_t *mask = b->masks + idx * b->strip_width * b->strip_height;
+
+    for( int c = 0; c < line->len; c++ )
+    {
+        if( line->drawn[c] == line->text[c] )
+            continue;
+
+        const uint8_t *glyph = b->glyphs + ( line->text[c] - GLYPH_FIRST ) * b->cell * b->cell;
+        uint8_t *dst = mask + b->pad * b->strip_width + b->pad + c * b->cell;
+        for( int y = 0; y < b->cell; y++ )
+            memcpy( dst + y * b->strip_width, glyph + y * b->cell, b->cell );
+
+        line->drawn[c] = line->text[c];
+    }
+
+    /* Cells past the end aren't blended, draw them again when the line grows back */
+    memset( line->drawn + line->len, 0, BURNIN_MAX_CHARS - line->len );
+}
+
+obe_burnin_t *obe_burnin_alloc( void )
+{
+    obe_burnin_t *b = calloc( 1, sizeof(*b) );
+    if( !b )
+        return NULL;
+
+    b->blend_row_8 = blend_row_8_c;
+    b->blend_row_16 = blend_row_16_c;
+#if defined(__SSE2__)
+    b->blend_row_8 = blend_row_8_sse2;
+    b->blend_row_16 = blend_row_16_sse2;
+#endif
+
+    return b;
+}
+
+void obe_burnin_free( obe_burnin_t *b )
+{
+    if( !b )
+        return;
+
+    free( b->glyphs );
+    free( b->masks );
+    free( b->zero );
+    free( b );
+}
+
+void obe_burnin_set_line( obe_burnin_t *b, int idx, const char *text )
+{
+    if( idx < 0 || idx >= BURNIN_MAX_LINES )
+        return;
+
+    burnin_line_t *line = &b->lines[idx];
+    int len = 0;
+
+    for( ; text && text[len] && len < BURNIN_MAX_CHARS; len++ )
+    {
+        unsigned char c = text[len];
+        line->text[len] = c >= GLYPH_FIRST && c < GLYPH_FIRST + GLYPH_COUNT ? c : ' ';
+    }
+    line->text[len] = 0;
+    line->len = len;
+}
+
+int obe_burnin_frame( obe_burnin_t *b, uint8_t *plane[3], const int stride[3], int width, int height,
+                      int depth, int log2_chroma_w, int log2_chroma_h )
+{
+    if( depth < 8 || depth > 16 )
+        return -1;
+
+    int scale = FFMAX( ( height + 287 ) / 288, 1 );
+    if( scale != b->scale && set_scale( b, scale ) < 0 )
+        return -1;
+
+    const int shift = depth - 8;
+    const int x_align = ( 1 << log2_chroma_w ) - 1;
+    const int y_align = ( 1 << log2_chroma_h ) - 1;
+    int x = ( width / 32 ) & ~x_align;
+    int y = ( height / 18 ) & ~y_align;
+
+    for( int i = 0; i < BURNIN_MAX_LINES; i++ )
+    {
+        burnin_line_t *line = &b->lines[i];
+        if( !line->len )
+            continue;
+
+        if( y + b->strip_height > height )
+            break;
+
+        draw_line( b, i );
+
+        /* The box around the text, whole chroma samples */
+        int w = FFMIN( line->len * b->cell + 2 * b->pad, width - x ) & ~x_align;
+        const uint8_t *mask = b->masks + i * b->strip_width * b->strip_height;
+
+        for( int p = 0; p < 3; p++ )
+        {
+            int cw = p ? log2_chroma_w : 0;
+            int ch = p ? log2_chroma_h : 0;
+            int fg = ( p ? NEUTRAL_C : TEXT_Y ) << shift;
+            int bg = ( p ? NEUTRAL_C : BOX_Y ) << shift;
+
+            for( int row = 0; row < b->strip_height >> ch; row++ )
+            {
+                uint8_t *dst = plane[p] + ( ( y >> ch ) + row ) * stride[p];
+                const uint8_t *m = p ? b->zero : mask + row * b->strip_width;
+
+                if( depth > 8 )
+                    b->blend_row_16( (uint16_t *)dst + ( x >> cw ), m, w >> cw, fg, bg );
+                else
+                    b->blend_row_8( dst + ( x >> cw ), m, w >> cw, fg, bg );
+            }
+        }
+
+        y += b->strip_height;
+    }
+
+    return 0;
+}
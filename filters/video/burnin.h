@@ -0,0 +1,38 @@
+#ifndef OBE_FILTERS_VIDEO_BURNIN_H
+#define OBE_FILTERS_VIDEO_BURNIN_H
+
+#include <stdint.h>
+
+/* On-screen display burnt into the output picture, for confidence monitoring.
+ * A few lines of text in the 8x8 font of obe/osd.c, scaled with the picture
+ * height, white on a box darkening what is behind it. The glyphs are expanded
+ * into masks once per size, a line's mask is only redrawn where its text
+ * changed, and each picture only the boxes around the text are blended.
+ * 8 to 16-bit planar YUV, C and SSE2.
+ */
+typedef struct obe_burnin_s obe_burnin_t;
+
+#define BURNIN_MAX_LINES 4
+#define BURNIN_MAX_CHARS 40
+
+/* What the video filter shows, obe_output_stream_t.osd */
+enum obe_burnin_item_e
+{
+    BURNIN_TIMECODE = 1 << 0,
+    BURNIN_PTS      = 1 << 1,
+    BURNIN_ENCODER  = 1 << 2, /* QP and bitrate of the stream's encoder */
+    BURNIN_CLOCK    = 1 << 3,
+};
+
+obe_burnin_t *obe_burnin_alloc( void );
+void obe_burnin_free( obe_burnin_t *b );
+
+/* Text of line 0 to BURNIN_MAX_LINES-1 from the next picture on, NULL or "" hides it.
+ * Longer lines are cut at BURNIN_MAX_CHARS */
+void obe_burnin_set_line( obe_burnin_t *b, int line, const char *text );
+
+/* Burn the lines into a planar picture. depth is 8 to 16, deeper pictures have uint16_t samples */
+int obe_burnin_frame( obe_burnin_t *b, uint8_t *plane[3], const int stride[3], int width, int height,
+                      int depth, int log2_chroma_w, int log2_chroma_h );
+
+#endif
@@ -58,6 +58,9 @@ obe_cc_timecode_t cc_timecode[] =
     { 0, 0, 0, 0 }
 };
 
+/* Longest caption SEI payload: ITU-T T.35 header, cc_data() with 31 triplets and the marker */
+#define CC_MAX_LEN 128
+
 static void write_bytes( bs_t *s, uint8_t *bytes, int length )
 {
     bs_flush( s );
@@ -91,8 +94,9 @@ static void write_itu_t_codes( bs_t *s )
 int write_608_cc( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
 {
     bs_t q, r;
-    uint8_t temp[1000];
+    uint8_t *temp;
     uint8_t temp2[500];
+    int avail;
     const char *user_identifier = "GA94";
     const int data_type_code    = 0x03;
     int cc_count                = 0;
@@ -113,7 +117,16 @@ int write_608_cc( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
         return -1;
     }
 
-    bs_init( &r, temp, 1000 );
+    /* Written straight into the frame, after the payload being read */
+    temp = obe_user_data_tail( raw_frame, &avail );
+    if( avail < CC_MAX_LEN )
+    {
+        /* The input filled the frame, drop these captions rather than the filter */
+        syslog( LOG_WARNING, "[cc]: No room for captions, dropped\n" );
+        return 1;
+    }
+
+    bs_init( &r, temp, CC_MAX_LEN );
 
     /* N.B MPEG-4 only */
     write_itu_t_codes( &r );
@@ -166,33 +179,31 @@ int write_608_cc( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
     bs_flush( &r );
 
     user_data->type = USER_DATA_AVC_REGISTERED_ITU_T35;
-    user_data->len = bs_pos( &r ) >> 3;
-
-    free( user_data->data );
-
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
-    {
-        syslog( LOG_ERR, "Malloc failed\n" );
-        return -1;
-    }
-
-    memcpy( user_data->data, temp, user_data->len );
+    obe_user_data_commit( raw_frame, user_data, bs_pos( &r ) >> 3 );
 
     return 0;
 }
 
-static int write_708_cc( obe_user_data_t *user_data, uint8_t *start, int cc_count )
+static int write_708_cc( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame, uint8_t *start, int cc_count )
 {
     bs_t s;
-    uint8_t temp[1000];
+    uint8_t *temp;
+    int avail;
     const char *user_identifier = "GA94";
     const int data_type_code    = 0x03;
 
     /* TODO: when MPEG-2 is added make this do the right thing */
     /* FIXME: enable echostar captions and add more types */
 
-    bs_init( &s, temp, 1000 );
+    temp = obe_user_data_tail( raw_frame, &avail );
+    if( avail < CC_MAX_LEN )
+    {
+        /* The input filled the frame, drop these captions rather than the filter */
+        syslog( LOG_WARNING, "[cc]: No room for captions, dropped\n" );
+        return 1;
+    }
+
+    bs_init( &s, temp, CC_MAX_LEN );
 
     /* N.B MPEG-4 only */
     write_itu_t_codes( &s );
@@ -216,23 +227,12 @@ static int write_708_cc( obe_user_data_t *user_data, uint8_t *start, int cc_coun
     bs_flush( &s );
 
     user_data->type = USER_DATA_AVC_REGISTERED_ITU_T35;
-    user_data->len = bs_pos( &s ) >> 3;
-
-    free( user_data->data );
-
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
-    {
-        syslog( LOG_ERR, "Malloc failed\n" );
-        return -1;
-    }
-
-    memcpy( user_data->data, temp, user_data->len );
+    obe_user_data_commit( raw_frame, user_data, bs_pos( &s ) >> 3 );
 
     return 0;
 }
 
-int read_cdp( obe_user_data_t *user_data )
+int read_cdp( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
 {
     uint8_t *start = NULL, calc_cs = 0;
     int cc_count = 0;
@@ -343,8 +343,5 @@ int read_cdp( obe_user_data_t *user_data )
     if( !cc_count )
         return 1;
 
-    if( write_708_cc( user_data, start, cc_count ) < 0 )
-        return -1;
-
-    return 0;
+    return write_708_cc( user_data, raw_frame, start, cc_count );
 }
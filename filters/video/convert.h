@@ -3,8 +3,11 @@
 
 struct filter_compress_ctx;
 
-int  filter_compress_alloc(struct filter_compress_ctx **ctx);
+/* Thumbnails width pixels wide, one every intervalMs at most, compressed on their own thread */
+int  filter_compress_alloc(struct filter_compress_ctx **ctx, int width, int intervalMs);
 void filter_compress_free(struct filter_compress_ctx *ctx);
+
+/* Never blocks. Returns 1 when the picture was taken for a thumbnail */
 int  filter_compress_jpg(struct filter_compress_ctx *ctx, obe_raw_frame_t *rf);
 
 #endif /* OBE_FILTERS_VIDEO_CONVERT_H */
@@ -1,128 +1,269 @@
+#define _GNU_SOURCE
 #include <libavutil/avutil.h>
+#include <libavutil/imgutils.h>
 #include <libavcodec/avcodec.h>
 #include <libswscale/swscale.h>
+#include <sched.h>
 #include "common/common.h"
 #include "common/bitstream.h"
+#include "convert.h"
 #include "ltn_ws.h"
 
+/* Thumbnails of the video input, for monitoring.
+ * The video filter hands over a reference to the picture at most once per interval,
+ * and only when the previous thumbnail is done, so a slow thumbnail costs a
+ * thumbnail and never a frame. A low priority thread scales it down and compresses
+ * it with an MJPEG encoder which stays open for as long as the thumbnail size does.
+ */
 struct filter_compress_ctx
 {
-	time_t lastFrameTime;
+	int width;           /* Of the thumbnail, the height follows the display aspect ratio */
+	int64_t interval;    /* OBE_CLOCK between thumbnails */
+	int64_t nextPts;
+	int havePts;
+
+	pthread_t threadId;
+	int threadRunning;
+	int terminate;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	/* The picture waiting for or being compressed by the thread, buf is NULL when it's idle */
+	obe_buf_t *buf;
+	obe_image_t img;
+	int sarWidth, sarHeight;
+
+	/* Copies of pictures which aren't refcounted */
+	obe_buf_pool_t *pool;
+
+	/* Owned by the thread */
+	AVCodecContext *c;
+	AVFrame *frame;
+	AVPacket *pkt;
+	struct SwsContext *sws;
+
+	uint64_t encoded;
 };
 
-void filter_compress_free(struct filter_compress_ctx *ctx)
+static void close_encoder(struct filter_compress_ctx *ctx)
 {
-	free(ctx);
+	avcodec_free_context(&ctx->c);
+	av_frame_free(&ctx->frame);
 }
 
-int filter_compress_alloc(struct filter_compress_ctx **p)
+static int open_encoder(struct filter_compress_ctx *ctx, int width, int height)
 {
-	struct filter_compress_ctx *ctx = calloc(1, sizeof(*ctx));
+	if (ctx->c && ctx->c->width == width && ctx->c->height == height)
+		return 0;
 
-	//av_register_all();
+	close_encoder(ctx);
+
+	const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+	if (!codec) {
+		syslog(LOG_ERR, "Thumbnails: no MJPEG encoder\n");
+		return -1;
+	}
+
+	ctx->c = avcodec_alloc_context3(codec);
+	ctx->frame = av_frame_alloc();
+	if (!ctx->c || !ctx->frame)
+		goto fail;
+
+	ctx->c->width = width;
+	ctx->c->height = height;
+	ctx->c->time_base = (AVRational) { 1, 25 };
+	ctx->c->pix_fmt = AV_PIX_FMT_YUVJ420P;
+	ctx->c->flags |= AV_CODEC_FLAG_QSCALE;
+
+	if (avcodec_open2(ctx->c, codec, NULL) < 0) {
+		syslog(LOG_ERR, "Thumbnails: could not open the MJPEG encoder\n");
+		goto fail;
+	}
+
+	ctx->frame->format = ctx->c->pix_fmt;
+	ctx->frame->width = width;
+	ctx->frame->height = height;
+	ctx->frame->quality = FF_QP2LAMBDA * 4;
+	if (av_frame_get_buffer(ctx->frame, 32) < 0)
+		goto fail;
 
-	*p = ctx;
 	return 0;
+
+fail:
+	close_encoder(ctx);
+	return -1;
 }
 
-int filter_compress_jpg(struct filter_compress_ctx *ctx, obe_raw_frame_t *rf)
+static void publish(struct filter_compress_ctx *ctx, const uint8_t *buf, int size)
 {
-	time_t now = time(0);
-	if (ctx->lastFrameTime == now) {
-		return -1;
-	}
-	printf("%s()\n", __func__);
+#if LTN_WS_ENABLE
+	ltn_ws_set_thumbnail_jpg(g_ltn_ws_handle, buf, size);
+#else
+	/* Renamed into place so a reader never sees half a picture */
+	char fn[64], tmp[80];
+	sprintf(fn, "/tmp/%d-obe-thumbnail.jpg", getpid());
+	sprintf(tmp, "%s.tmp", fn);
 
-	ctx->lastFrameTime = now;
+	FILE *fh = fopen(tmp, "wb");
+	if (!fh)
+		return;
+	size_t written = fwrite(buf, 1, size, fh);
+	fclose(fh);
+	if (written == (size_t)size)
+		rename(tmp, fn);
+#endif
+}
 
-	AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
-	if (!codec) {
-		printf("Codec not found\n");
-		exit(1);
-	}
+static void compress(struct filter_compress_ctx *ctx, obe_image_t *img, int sarWidth, int sarHeight)
+{
+	int width = ctx->width & ~1;
+	int height = av_rescale(width, (int64_t)img->height * sarHeight, (int64_t)img->width * sarWidth) & ~1;
 
-	AVCodecContext *c = avcodec_alloc_context3(codec);
-	if (!c) {
-		printf("Could not allocate video codec context\n");
-		exit(1);
-	}
+	if (height < 2 || open_encoder(ctx, width, height) < 0)
+		return;
+
+	ctx->sws = sws_getCachedContext(ctx->sws, img->width, img->height, img->csp, width, height, AV_PIX_FMT_YUVJ420P,
+		SWS_BILINEAR, NULL, NULL, NULL);
+	if (!ctx->sws || av_frame_make_writable(ctx->frame) < 0)
+		return;
+
+	sws_scale(ctx->sws, (const uint8_t * const *)img->plane, img->stride, 0, img->height, ctx->frame->data, ctx->frame->linesize);
+	ctx->frame->pts = ctx->encoded;
 
-	c->bit_rate = 400000;
-	c->width = rf->img.width;
-	c->height = rf->img.height;
-	c->time_base = (AVRational) { 1, 25 };
-	c->pix_fmt = AV_PIX_FMT_YUVJ420P;
+	if (avcodec_send_frame(ctx->c, ctx->frame) < 0)
+		return;
 
-	if (avcodec_open2(c, codec, NULL) < 0) {
-		printf("Could not open codec\n");
-		exit(1);
+	while (avcodec_receive_packet(ctx->c, ctx->pkt) == 0) {
+		publish(ctx, ctx->pkt->data, ctx->pkt->size);
+		av_packet_unref(ctx->pkt);
+		ctx->encoded++;
 	}
+}
+
+static void *thumbnail_thread(void *p)
+{
+	struct filter_compress_ctx *ctx = p;
+
+	/* Only run when nothing else wants the CPU */
+	struct sched_param param = { 0 };
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
 
-	AVFrame *frame = av_frame_alloc();
-	if (!frame) {
-		printf("Could not allocate video frame\n");
-		exit(1);
+	pthread_mutex_lock(&ctx->mutex);
+	while (1) {
+		while (!ctx->buf && !ctx->terminate)
+			pthread_cond_wait(&ctx->cond, &ctx->mutex);
+		if (ctx->terminate)
+			break;
+
+		obe_image_t img = ctx->img;
+		int sarWidth = ctx->sarWidth, sarHeight = ctx->sarHeight;
+		pthread_mutex_unlock(&ctx->mutex);
+
+		compress(ctx, &img, sarWidth, sarHeight);
+
+		pthread_mutex_lock(&ctx->mutex);
+		obe_buf_unref(ctx->buf);
+		ctx->buf = NULL;
 	}
-	frame->format = c->pix_fmt;
-	frame->width = c->width;
-	frame->height = c->height;
-
-	int ret = av_image_alloc(frame->data, frame->linesize, c->width,
-		c->height, c->pix_fmt, 32);
-	if (ret < 0) {
-		printf("Could not allocate raw picture buffer\n");
-		exit(1);
+	pthread_mutex_unlock(&ctx->mutex);
+
+	return NULL;
+}
+
+void filter_compress_free(struct filter_compress_ctx *ctx)
+{
+	if (!ctx)
+		return;
+
+	if (ctx->threadRunning) {
+		pthread_mutex_lock(&ctx->mutex);
+		ctx->terminate = 1;
+		pthread_cond_signal(&ctx->cond);
+		pthread_mutex_unlock(&ctx->mutex);
+		pthread_join(ctx->threadId, NULL);
 	}
 
-	AVPacket pkt;
-	av_init_packet(&pkt);
-	pkt.data = NULL;
-	pkt.size = 0;
-
-	memcpy(frame->data[0], rf->img.plane[0], c->height * c->width);
-	memcpy(frame->data[1], rf->img.plane[1], (c->height * c->width) / 4);
-	memcpy(frame->data[2], rf->img.plane[2], (c->height * c->width) / 4);
-
-	frame->pts = 1;
-
-	int got_output = 0;
-        ret = avcodec_send_frame(c, frame);
-        while (ret >= 0) {
-                ret = avcodec_receive_packet(c, &pkt);
-                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-                        return -1;
-                else if (ret < 0) {
-                }
-                got_output = 1;
-                break;
-        }
-
-#if 0
-	ret = avcodec_encode_video2(c, &pkt, frame, &got_output);
-	if (ret < 0) {
-		printf("Error encoding frame\n");
-		exit(1);
+	if (ctx->buf)
+		obe_buf_unref(ctx->buf);
+	close_encoder(ctx);
+	av_packet_free(&ctx->pkt);
+	sws_freeContext(ctx->sws);
+	if (ctx->pool)
+		obe_buf_pool_free(ctx->pool);
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->mutex);
+	free(ctx);
+}
+
+int filter_compress_alloc(struct filter_compress_ctx **p, int width, int intervalMs)
+{
+	struct filter_compress_ctx *ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+
+	ctx->width = width;
+	ctx->interval = (int64_t)intervalMs * OBE_CLOCK / 1000;
+	pthread_mutex_init(&ctx->mutex, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+
+	ctx->pkt = av_packet_alloc();
+	ctx->pool = obe_buf_pool_alloc("video thumbnails");
+	if (!ctx->pkt || !ctx->pool)
+		goto fail;
+
+	if (pthread_create(&ctx->threadId, NULL, thumbnail_thread, ctx) < 0)
+		goto fail;
+	pthread_setname_np(ctx->threadId, "obe-thumbnail");
+	ctx->threadRunning = 1;
+
+	*p = ctx;
+	return 0;
+
+fail:
+	filter_compress_free(ctx);
+	return -1;
+}
+
+int filter_compress_jpg(struct filter_compress_ctx *ctx, obe_raw_frame_t *rf)
+{
+	/* Start again whenever the timeline jumps */
+	if (ctx->havePts && rf->pts < ctx->nextPts && rf->pts > ctx->nextPts - 2 * ctx->interval)
+		return 0;
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (ctx->buf) {
+		/* Still busy with the last one, try again on the next frame */
+		pthread_mutex_unlock(&ctx->mutex);
+		return 0;
 	}
-#endif
+	pthread_mutex_unlock(&ctx->mutex);
 
-	if (got_output) {
-#if LTN_WS_ENABLE
-		ltn_ws_set_thumbnail_jpg(g_ltn_ws_handle, pkt.data, pkt.size);
+	obe_buf_t *buf;
+	obe_image_t img = rf->img;
 
-#endif
-#if 0
-		printf("%s() frame output\n", __func__);
-		FILE *f = fopen("/tmp/image.jpg", "wb");
-		fwrite(pkt.data, 1, pkt.size, f);
-		fclose(f);
-#endif
-		av_packet_unref(&pkt);
+	if (rf->buf_ref && rf->release_data == obe_release_bufref_data) {
+		/* The extra reference also stops later steps writing over the picture */
+		buf = obe_buf_ref(rf->buf_ref);
+	} else {
+		int size = av_image_get_buffer_size(img.csp, img.width, img.height, 32);
+		buf = size > 0 ? obe_buf_pool_get(ctx->pool, size) : NULL;
+		if (!buf)
+			return -1;
+
+		av_image_fill_arrays(img.plane, img.stride, buf->data, img.csp, img.width, img.height, 32);
+		av_image_copy(img.plane, img.stride, (const uint8_t **)rf->img.plane, rf->img.stride, img.csp, img.width, img.height);
 	}
 
-	avcodec_close(c);
-	av_free(c);
-	av_freep(&frame->data[0]);
-	av_frame_free(&frame);
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->buf = buf;
+	ctx->img = img;
+	ctx->sarWidth = rf->sar_width > 0 ? rf->sar_width : 1;
+	ctx->sarHeight = rf->sar_height > 0 ? rf->sar_height : 1;
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->mutex);
 
-	return 0;
+	ctx->nextPts = rf->pts + ctx->interval;
+	ctx->havePts = 1;
+
+	return 1;
 }
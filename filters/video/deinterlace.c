@@ -0,0 +1,298 @@
+#include "common/common.h"
+#include "deinterlace.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Samples either side of a pixel the edge directed search looks at */
+#define EDGE_BORDER 3
+
+struct obe_deint_s
+{
+    int depth;
+    const char *name;
+
+    /* One missing line. mrefs and prefs are the offsets, in samples, of the kept
+     * lines above and below, check enables the clamp against the lines two away */
+    void (*row)( void *dst, const void *prev, const void *cur, const void *next,
+                 int width, int mrefs, int prefs, int first, int check );
+};
+
+static av_always_inline int load( const void *p, int i, const int depth )
+{
+    return depth == 8 ? ((const uint8_t *)p)[i] : ((const uint16_t *)p)[i];
+}
+
+#define EDGE_SCORE( j ) ( abs( load( cur, x + mrefs - 1 + (j), depth ) - load( cur, x + prefs - 1 - (j), depth ) ) + \
+                          abs( load( cur, x + mrefs     + (j), depth ) - load( cur, x + prefs     - (j), depth ) ) + \
+                          abs( load( cur, x + mrefs + 1 + (j), depth ) - load( cur, x + prefs + 1 - (j), depth ) ) )
+#define EDGE_PRED( j ) ( ( load( cur, x + mrefs + (j), depth ) + load( cur, x + prefs - (j), depth ) ) >> 1 )
+
+static av_always_inline int deint_pixel( const void *prev, const void *cur, const void *next,
+                                         const void *prev2, const void *next2, int x, int mrefs, int prefs,
+                                         int spatial, int check, const int depth )
+{
+    int c = load( cur, x + mrefs, depth );
+    int e = load( cur, x + prefs, depth );
+    int p2 = load( prev2, x, depth );
+    int n2 = load( next2, x, depth );
+
+    /* Temporal prediction, and how far the neighbouring fields say the picture moved */
+    int d = (p2 + n2) >> 1;
+    int diff0 = abs( p2 - n2 ) >> 1;
+    int diff1 = ( abs( load( prev, x + mrefs, depth ) - c ) + abs( load( prev, x + prefs, depth ) - e ) ) >> 1;
+    int diff2 = ( abs( load( next, x + mrefs, depth ) - c ) + abs( load( next, x + prefs, depth ) - e ) ) >> 1;
+    int diff = FFMAX3( diff0, diff1, diff2 );
+
+    /* Spatial prediction, following the edge through the pixel if there is a better one than vertical */
+    int pred = (c + e) >> 1;
+    if( spatial )
+    {
+        int score = abs( load( cur, x + mrefs - 1, depth ) - load( cur, x + prefs - 1, depth ) ) + abs( c - e ) +
+                    abs( load( cur, x + mrefs + 1, depth ) - load( cur, x + prefs + 1, depth ) ) - 1;
+        int s = EDGE_SCORE( -1 );
+        if( s < score )
+        {
+            score = s;
+            pred = EDGE_PRED( -1 );
+            s = EDGE_SCORE( -2 );
+            if( s < score )
+            {
+                score = s;
+                pred = EDGE_PRED( -2 );
+            }
+        }
+
+        s = EDGE_SCORE( 1 );
+        if( s < score )
+        {
+            score = s;
+            pred = EDGE_PRED( 1 );
+            s = EDGE_SCORE( 2 );
+            if( s < score )
+            {
+                score = s;
+                pred = EDGE_PRED( 2 );
+            }
+        }
+    }
+
+    /* Allow more motion where the spatial prediction disagrees with the lines two away */
+    if( check )
+    {
+        int b = ( load( prev2, x + 2 * mrefs, depth ) + load( next2, x + 2 * mrefs, depth ) ) >> 1;
+        int f = ( load( prev2, x + 2 * prefs, depth ) + load( next2, x + 2 * prefs, depth ) ) >> 1;
+        int max = FFMAX3( d - e, d - c, FFMIN( b - c, f - e ) );
+        int min = FFMIN3( d - e, d - c, FFMAX( b - c, f - e ) );
+
+        diff = FFMAX3( diff, min, -max );
+    }
+
+    return av_clip( pred, d - diff, d + diff );
+}
+
+static av_always_inline void deint_span_c( void *dst, const void *prev, const void *cur, const void *next,
+                                           int start, int end, int width, int mrefs, int prefs,
+                                           int first, int check, const int depth )
+{
+    const void *prev2 = first ? prev : cur;
+    const void *next2 = first ? cur : next;
+
+    for( int x = start; x < end; x++ )
+    {
+        int spatial = x >= EDGE_BORDER && x < width - EDGE_BORDER;
+        int v = deint_pixel( prev, cur, next, prev2, next2, x, mrefs, prefs, spatial, check, depth );
+
+        if( depth == 8 )
+            ((uint8_t *)dst)[x] = v;
+        else
+            ((uint16_t *)dst)[x] = v;
+    }
+}
+
+static void deint_row_8_c( void *dst, const void *prev, const void *cur, const void *next,
+                           int width, int mrefs, int prefs, int first, int check )
+{
+    deint_span_c( dst, prev, cur, next, 0, width, width, mrefs, prefs, first, check, 8 );
+}
+
+static void deint_row_10_c( void *dst, const void *prev, const void *cur, const void *next,
+                            int width, int mrefs, int prefs, int first, int check )
+{
+    deint_span_c( dst, prev, cur, next, 0, width, width, mrefs, prefs, first, check, 10 );
+}
+
+#if defined(__SSE2__)
+/* Eight pixels at a time, widened to 16 bits. Bit exact with the C */
+static av_always_inline __m128i load8( const void *p, int i, const int depth )
+{
+    if( depth == 8 )
+        return _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)((const uint8_t *)p + i) ), _mm_setzero_si128() );
+
+    return _mm_loadu_si128( (const __m128i *)((const uint16_t *)p + i) );
+}
+
+static av_always_inline __m128i absdiff8( __m128i a, __m128i b )
+{
+    return _mm_sub_epi16( _mm_max_epi16( a, b ), _mm_min_epi16( a, b ) );
+}
+
+static av_always_inline __m128i avg8( __m128i a, __m128i b )
+{
+    return _mm_srai_epi16( _mm_add_epi16( a, b ), 1 );
+}
+
+static av_always_inline __m128i select8( __m128i mask, __m128i a, __m128i b )
+{
+    return _mm_or_si128( _mm_and_si128( mask, a ), _mm_andnot_si128( mask, b ) );
+}
+
+#define EDGE_SCORE8( j ) _mm_add_epi16( _mm_add_epi16( \
+    absdiff8( load8( cur, x + mrefs - 1 + (j), depth ), load8( cur, x + prefs - 1 - (j), depth ) ), \
+    absdiff8( load8( cur, x + mrefs     + (j), depth ), load8( cur, x + prefs     - (j), depth ) ) ), \
+    absdiff8( load8( cur, x + mrefs + 1 + (j), depth ), load8( cur, x + prefs + 1 - (j), depth ) ) )
+#define EDGE_PRED8( j ) avg8( load8( cur, x + mrefs + (j), depth ), load8( cur, x + prefs - (j), depth ) )
+
+#define EDGE_CHECK8( j, cond ) \
+    s = EDGE_SCORE8( j ); \
+    mask = cond( _mm_cmplt_epi16( s, score ) ); \
+    score = select8( mask, s, score ); \
+    pred = select8( mask, EDGE_PRED8( j ), pred );
+#define EDGE_FIRST( m ) (m)
+#define EDGE_NESTED( m ) _mm_and_si128( mask, m )
+
+static av_always_inline void deint_row_sse2( void *dst, const void *prev, const void *cur, const void *next,
+                                             int width, int mrefs, int prefs, int first, int check, const int depth )
+{
+    const void *prev2 = first ? prev : cur;
+    const void *next2 = first ? cur : next;
+    int x;
+
+    /* Rows next to the top and bottom are rare, leave them to the C */
+    if( !check || width < 2 * EDGE_BORDER + 8 )
+    {
+        deint_span_c( dst, prev, cur, next, 0, width, width, mrefs, prefs, first, check, depth );
+        return;
+    }
+
+    deint_span_c( dst, prev, cur, next, 0, EDGE_BORDER, width, mrefs, prefs, first, check, depth );
+
+    for( x = EDGE_BORDER; x + 8 <= width - EDGE_BORDER; x += 8 )
+    {
+        __m128i c = load8( cur, x + mrefs, depth );
+        __m128i e = load8( cur, x + prefs, depth );
+        __m128i p2 = load8( prev2, x, depth );
+        __m128i n2 = load8( next2, x, depth );
+        __m128i s, mask;
+
+        __m128i d = avg8( p2, n2 );
+        __m128i diff0 = _mm_srai_epi16( absdiff8( p2, n2 ), 1 );
+        __m128i diff1 = _mm_srai_epi16( _mm_add_epi16( absdiff8( load8( prev, x + mrefs, depth ), c ),
+                                                       absdiff8( load8( prev, x + prefs, depth ), e ) ), 1 );
+        __m128i diff2 = _mm_srai_epi16( _mm_add_epi16( absdiff8( load8( next, x + mrefs, depth ), c ),
+                                                       absdiff8( load8( next, x + prefs, depth ), e ) ), 1 );
+        __m128i diff = _mm_max_epi16( _mm_max_epi16( diff0, diff1 ), diff2 );
+
+        __m128i pred = avg8( c, e );
+        __m128i score = _mm_add_epi16( _mm_add_epi16(
+            absdiff8( load8( cur, x + mrefs - 1, depth ), load8( cur, x + prefs - 1, depth ) ), absdiff8( c, e ) ),
+            absdiff8( load8( cur, x + mrefs + 1, depth ), load8( cur, x + prefs + 1, depth ) ) );
+        score = _mm_sub_epi16( score, _mm_set1_epi16( 1 ) );
+
+        EDGE_CHECK8( -1, EDGE_FIRST )
+        EDGE_CHECK8( -2, EDGE_NESTED )
+        EDGE_CHECK8( 1, EDGE_FIRST )
+        EDGE_CHECK8( 2, EDGE_NESTED )
+
+        __m128i b = avg8( load8( prev2, x + 2 * mrefs, depth ), load8( next2, x + 2 * mrefs, depth ) );
+        __m128i f = avg8( load8( prev2, x + 2 * prefs, depth ), load8( next2, x + 2 * prefs, depth ) );
+        __m128i de = _mm_sub_epi16( d, e );
+        __m128i dc = _mm_sub_epi16( d, c );
+        __m128i bc = _mm_sub_epi16( b, c );
+        __m128i fe = _mm_sub_epi16( f, e );
+        __m128i max = _mm_max_epi16( _mm_max_epi16( de, dc ), _mm_min_epi16( bc, fe ) );
+        __m128i min = _mm_min_epi16( _mm_min_epi16( de, dc ), _mm_max_epi16( bc, fe ) );
+        diff = _mm_max_epi16( _mm_max_epi16( diff, min ), _mm_sub_epi16( _mm_setzero_si128(), max ) );
+
+        pred = _mm_min_epi16( _mm_max_epi16( pred, _mm_sub_epi16( d, diff ) ), _mm_add_epi16( d, diff ) );
+
+        if( depth == 8 )
+            _mm_storel_epi64( (__m128i *)((uint8_t *)dst + x), _mm_packus_epi16( pred, pred ) );
+        else
+            _mm_storeu_si128( (__m128i *)((uint16_t *)dst + x), pred );
+    }
+
+    deint_span_c( dst, prev, cur, next, x, width, width, mrefs, prefs, first, check, depth );
+}
+
+static void deint_row_8_sse2( void *dst, const void *prev, const void *cur, const void *next,
+                              int width, int mrefs, int prefs, int first, int check )
+{
+    deint_row_sse2( dst, prev, cur, next, width, mrefs, prefs, first, check, 8 );
+}
+
+static void deint_row_10_sse2( void *dst, const void *prev, const void *cur, const void *next,
+                               int width, int mrefs, int prefs, int first, int check )
+{
+    deint_row_sse2( dst, prev, cur, next, width, mrefs, prefs, first, check, 10 );
+}
+#endif
+
+obe_deint_t *obe_deint_alloc( int depth )
+{
+    if( depth != 8 && depth != 10 )
+        return NULL;
+
+    obe_deint_t *d = calloc( 1, sizeof(*d) );
+    if( !d )
+        return NULL;
+
+    d->depth = depth;
+    d->row = depth == 8 ? deint_row_8_c : deint_row_10_c;
+    d->name = "motion adaptive c";
+#if defined(__SSE2__)
+    d->row = depth == 8 ? deint_row_8_sse2 : deint_row_10_sse2;
+    d->name = "motion adaptive sse2";
+#endif
+
+    return d;
+}
+
+void obe_deint_free( obe_deint_t *d )
+{
+    free( d );
+}
+
+const char *obe_deint_name( obe_deint_t *d )
+{
+    return d->name;
+}
+
+void obe_deint_plane( obe_deint_t *d, uint8_t *dst, int dst_stride,
+                      const uint8_t *prev, const uint8_t *cur, const uint8_t *next, int stride,
+                      int width, int height, int field, int first )
+{
+    int bytes = d->depth > 8 ? 2 : 1;
+    int refs = stride / bytes;
+
+    for( int y = 0; y < height; y++ )
+    {
+        if( ( y & 1 ) == field )
+            memcpy( dst, cur, width * bytes );
+        else
+        {
+            /* Mirror the kept lines at the edges, where there is no line two away to check against */
+            int mrefs = y ? -refs : refs;
+            int prefs = y + 1 < height ? refs : -refs;
+            int check = y != 1 && y + 2 != height;
+
+            d->row( dst, prev, cur, next, width, mrefs, prefs, first, check );
+        }
+
+        dst += dst_stride;
+        prev += stride;
+        cur += stride;
+        next += stride;
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef OBE_FILTERS_VIDEO_DEINTERLACE_H
+#define OBE_FILTERS_VIDEO_DEINTERLACE_H
+
+#include <stdint.h>
+
+/* Motion adaptive deinterlacer, yadif class.
+ * The lines of one field are kept, the missing lines in between are rebuilt
+ * from the same lines in the neighbouring fields where the picture is still
+ * and from an edge directed interpolation of the kept field where it moves.
+ * The motion search needs the frame before and the frame after the one being
+ * deinterlaced. 8 and 10-bit planar rows, C and SSE2.
+ */
+typedef struct obe_deint_s obe_deint_t;
+
+/* NULL for an unsupported bit depth */
+obe_deint_t *obe_deint_alloc( int depth );
+void obe_deint_free( obe_deint_t *d );
+const char *obe_deint_name( obe_deint_t *d );
+
+/* Rebuild one plane. field is the parity of the kept lines, 0 for the top
+ * field. first is set when the kept field is the earlier of the two in cur.
+ * prev, cur and next share stride, width is in samples. */
+void obe_deint_plane( obe_deint_t *d, uint8_t *dst, int dst_stride,
+                      const uint8_t *prev, const uint8_t *cur, const uint8_t *next, int stride,
+                      int width, int height, int field, int first );
+
+#endif
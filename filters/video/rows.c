@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include "common/simd.h"
+#include "rows.h"
+#include "x86/vfilter.h"
+
+void obe_dither_row_10_to_8_c( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride )
+{
+    const int scale = 511;
+    const uint16_t shift = 11;
+
+    int k;
+    for (k = 0; k < width-7; k+=8)
+    {
+        dst[k+0] = (src[k+0] + dither[0])*scale>>shift;
+        dst[k+1] = (src[k+1] + dither[1])*scale>>shift;
+        dst[k+2] = (src[k+2] + dither[2])*scale>>shift;
+        dst[k+3] = (src[k+3] + dither[3])*scale>>shift;
+        dst[k+4] = (src[k+4] + dither[4])*scale>>shift;
+        dst[k+5] = (src[k+5] + dither[5])*scale>>shift;
+        dst[k+6] = (src[k+6] + dither[6])*scale>>shift;
+        dst[k+7] = (src[k+7] + dither[7])*scale>>shift;
+    }
+    for (; k < width; k++)
+        dst[k] = (src[k] + dither[k&7])*scale>>shift;
+
+}
+
+/* Note: srcf is the next field (two pixels down) */
+void obe_downsample_chroma_row_top_c( uint16_t *src, uint16_t *dst, int width, int stride )
+{
+    uint16_t *srcf = src + stride;
+
+    for( int i = 0; i < width/2; i++ )
+        dst[i] = (3*src[i] + srcf[i] + 2) >> 2;
+}
+
+void obe_downsample_chroma_row_bottom_c( uint16_t *src, uint16_t *dst, int width, int stride )
+{
+    uint16_t *srcf = src + stride;
+
+    for( int i = 0; i < width/2; i++ )
+        dst[i] = (src[i] + 3*srcf[i] + 2) >> 2;
+}
+
+static const obe_simd_version_t downsample_top_versions[] =
+{
+    { "c",      (obe_simd_fn_t)obe_downsample_chroma_row_top_c },
+    { "sse2",   (obe_simd_fn_t)obe_downsample_chroma_row_top_sse2 },
+    { "avx",    (obe_simd_fn_t)obe_downsample_chroma_row_top_avx },
+    { "avx2",   (obe_simd_fn_t)obe_downsample_chroma_row_top_avx2 },
+    { "avx512", (obe_simd_fn_t)obe_downsample_chroma_row_top_avx512 },
+};
+
+static const obe_simd_version_t downsample_bottom_versions[] =
+{
+    { "c",      (obe_simd_fn_t)obe_downsample_chroma_row_bottom_c },
+    { "sse2",   (obe_simd_fn_t)obe_downsample_chroma_row_bottom_sse2 },
+    { "avx",    (obe_simd_fn_t)obe_downsample_chroma_row_bottom_avx },
+    { "avx2",   (obe_simd_fn_t)obe_downsample_chroma_row_bottom_avx2 },
+    { "avx512", (obe_simd_fn_t)obe_downsample_chroma_row_bottom_avx512 },
+};
+
+static const obe_simd_version_t dither_versions[] =
+{
+    { "c",      (obe_simd_fn_t)obe_dither_row_10_to_8_c },
+    { "sse4",   (obe_simd_fn_t)obe_dither_row_10_to_8_sse4 },
+    { "avx",    (obe_simd_fn_t)obe_dither_row_10_to_8_avx },
+    { "avx2",   (obe_simd_fn_t)obe_dither_row_10_to_8_avx2 },
+    { "avx512", (obe_simd_fn_t)obe_dither_row_10_to_8_avx512 },
+};
+
+/* Rows of up to 1080p 10-bit 4:2:2 chroma. The asm needs them aligned and writes
+ * whole registers past the end, so rows keep this pitch whatever the width and
+ * only the samples within the width are compared */
+#define ROW_TEST_WIDTH  960
+#define ROW_TEST_ROWS   4
+#define ROW_TEST_POISON 0xa5
+
+/* 1080p chroma, then 720p chroma which isn't a whole number of AVX2 or AVX-512
+ * vectors, then a width which isn't a whole number of SSE ones either */
+static const int row_test_widths[] = { ROW_TEST_WIDTH, 360, 357 };
+
+DECLARE_ALIGNED(16, static const uint16_t, row_test_dithers)[2][8] =
+{
+    { 1,  2,  1,  2,  1,  2,  1,  2 },
+    { 3,  0,  3,  0,  3,  0,  3,  0 },
+};
+
+typedef struct
+{
+    uint16_t src[ROW_TEST_ROWS][ROW_TEST_WIDTH];
+    uint16_t dst[ROW_TEST_ROWS][ROW_TEST_WIDTH];
+    const int *widths;
+    int num_widths;
+    int samples; /* Sum of the widths */
+} row_test_t;
+
+/* One field's worth of output rows at each width, each from a row and the one two below */
+static void test_downsample( obe_simd_fn_t fn, void *ctx, uint8_t *out )
+{
+    row_test_t *t = ctx;
+    const int stride = sizeof(t->src[0]);
+
+    for( int w = 0; w < t->num_widths; w++ )
+    {
+        int width = t->widths[w];
+
+        if( out )
+            memset( t->dst, ROW_TEST_POISON, sizeof(t->dst) );
+
+        for( int j = 0; j < ROW_TEST_ROWS / 2; j++ )
+            ((obe_downsample_row_t)fn)( t->src[j], t->dst[j], width * 2, stride );
+
+        for( int j = 0; out && j < ROW_TEST_ROWS / 2; j++ )
+        {
+            memcpy( out, t->dst[j], width * sizeof(t->dst[j][0]) );
+            out += width * sizeof(t->dst[j][0]);
+        }
+    }
+}
+
+static void test_dither( obe_simd_fn_t fn, void *ctx, uint8_t *out )
+{
+    row_test_t *t = ctx;
+    uint8_t *dst = (uint8_t *)t->dst;
+
+    for( int w = 0; w < t->num_widths; w++ )
+    {
+        int width = t->widths[w];
+
+        if( out )
+            memset( t->dst, ROW_TEST_POISON, sizeof(t->dst) );
+
+        for( int j = 0; j < ROW_TEST_ROWS; j++ )
+            ((obe_dither_row_t)fn)( t->src[j], dst + j * ROW_TEST_WIDTH, row_test_dithers[j&1], width, sizeof(t->src[0]) );
+
+        for( int j = 0; out && j < ROW_TEST_ROWS; j++ )
+        {
+            memcpy( out, dst + j * ROW_TEST_WIDTH, width );
+            out += width;
+        }
+    }
+}
+
+/* Pseudo random 10-bit samples */
+static row_test_t *row_test_alloc( const int *widths, int num_widths )
+{
+    if( !widths )
+    {
+        widths = row_test_widths;
+        num_widths = FF_ARRAY_ELEMS(row_test_widths);
+    }
+
+    row_test_t *t = av_malloc( sizeof(*t) );
+    if( !t )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        return NULL;
+    }
+
+    t->widths = widths;
+    t->num_widths = num_widths;
+    t->samples = 0;
+    for( int w = 0; w < num_widths; w++ )
+    {
+        if( widths[w] < 1 || widths[w] > ROW_TEST_WIDTH )
+        {
+            fprintf( stderr, "Row width %d is not 1 to %d\n", widths[w], ROW_TEST_WIDTH );
+            av_free( t );
+            return NULL;
+        }
+        t->samples += widths[w];
+    }
+
+    uint32_t seed = 1;
+    for( int j = 0; j < ROW_TEST_ROWS; j++ )
+        for( int i = 0; i < ROW_TEST_WIDTH; i++ )
+        {
+            seed = seed * 1664525 + 1013904223;
+            t->src[j][i] = seed >> 22;
+        }
+
+    return t;
+}
+
+void obe_vfilter_rows_select( obe_downsample_row_t *top, obe_downsample_row_t *bottom, obe_dither_row_t *dither )
+{
+    *top = obe_downsample_chroma_row_top_c;
+    *bottom = obe_downsample_chroma_row_bottom_c;
+    *dither = obe_dither_row_10_to_8_c;
+
+    row_test_t *t = row_test_alloc( NULL, 0 );
+    if( !t )
+        return;
+
+    *top = (obe_downsample_row_t)obe_simd_select( "downsample_chroma_row_top", downsample_top_versions,
+        FF_ARRAY_ELEMS(downsample_top_versions), test_downsample, t, t->samples * ROW_TEST_ROWS );
+    *bottom = (obe_downsample_row_t)obe_simd_select( "downsample_chroma_row_bottom", downsample_bottom_versions,
+        FF_ARRAY_ELEMS(downsample_bottom_versions), test_downsample, t, t->samples * ROW_TEST_ROWS );
+    *dither = (obe_dither_row_t)obe_simd_select( "dither_row_10_to_8", dither_versions,
+        FF_ARRAY_ELEMS(dither_versions), test_dither, t, t->samples * ROW_TEST_ROWS );
+
+    av_free( t );
+}
+
+int obe_vfilter_rows_check( const int *widths, int num_widths, int timed )
+{
+    row_test_t *t = row_test_alloc( widths, num_widths );
+    if( !t )
+        return -1;
+
+    /* Downsampling writes half the rows, at two bytes a sample */
+    int failed = obe_simd_check( "downsample_chroma_row_top", downsample_top_versions,
+                                 FF_ARRAY_ELEMS(downsample_top_versions), test_downsample, t, t->samples * ROW_TEST_ROWS, timed );
+    failed += obe_simd_check( "downsample_chroma_row_bottom", downsample_bottom_versions,
+                              FF_ARRAY_ELEMS(downsample_bottom_versions), test_downsample, t, t->samples * ROW_TEST_ROWS, timed );
+    failed += obe_simd_check( "dither_row_10_to_8", dither_versions,
+                              FF_ARRAY_ELEMS(dither_versions), test_dither, t, t->samples * ROW_TEST_ROWS, timed );
+
+    av_free( t );
+
+    return failed;
+}
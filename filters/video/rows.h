@@ -0,0 +1,25 @@
+#ifndef OBE_FILTERS_VIDEO_ROWS_H
+#define OBE_FILTERS_VIDEO_ROWS_H
+
+#include <stdint.h>
+
+/* The per row kernels of the video filter, 4:2:2 to 4:2:0 chroma downsampling
+ * of one field and 10 to 8-bit dithering, with their C, asm and intrinsics
+ * versions. Free of the rest of the filter, so tools/simdcheck links them too.
+ */
+typedef void (*obe_downsample_row_t)( uint16_t *src, uint16_t *dst, int width, int stride );
+typedef void (*obe_dither_row_t)( uint16_t *src, uint8_t *dst, const uint16_t *dithers, int width, int stride );
+
+void obe_downsample_chroma_row_top_c( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_bottom_c( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_dither_row_10_to_8_c( uint16_t *src, uint8_t *dst, const uint16_t *dithers, int width, int stride );
+
+/* The fastest versions which match the C ones here, see obe_simd_select() */
+void obe_vfilter_rows_select( obe_downsample_row_t *top, obe_downsample_row_t *bottom, obe_dither_row_t *dither );
+
+/* Check every version the CPU runs against C at each of the widths, in chroma
+ * samples up to 960, and time them when timed is set. widths NULL for the ones
+ * obe_vfilter_rows_select() checks. Returns how many versions differ. */
+int obe_vfilter_rows_check( const int *widths, int num_widths, int timed );
+
+#endif
@@ -0,0 +1,414 @@
+#include <math.h>
+#include <libavutil/mem.h>
+#include <libswscale/swscale.h>
+#include "common/common.h"
+#include "scale.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define COEF_BITS 14
+#define MAX_TAPS  8
+
+/* Edge replication either side of the widened source row */
+#define LINE_PAD  16
+
+struct obe_hscale_s
+{
+    int src_width;
+    int dst_width;
+    int depth;
+    int taps;
+    const char *name;
+
+    int32_t *offsets; /* First tap of each output pixel, into line */
+    int16_t *coefs;   /* taps per output pixel, summing to 1 << COEF_BITS */
+    int16_t *line;    /* Source row widened to 16 bits, LINE_PAD either side */
+
+    void (*filter)( const obe_hscale_t *s, void *dst );
+};
+
+static const struct
+{
+    int num;
+    int den;
+} scale_ratios[] =
+{
+    { 4, 3 }, /* 1920 -> 1440, 1280 -> 960 */
+    { 3, 2 }, /* 1920 -> 1280 */
+    { 2, 1 }, /* 1920 -> 960, 3840 -> 1920, 1280 -> 640 */
+};
+
+static double lanczos2( double x )
+{
+    if( x == 0.0 )
+        return 1.0;
+    if( fabs( x ) >= 2.0 )
+        return 0.0;
+
+    double px = M_PI * x;
+    return 2.0 * sin( px ) * sin( px / 2.0 ) / (px * px);
+}
+
+static double triangle( double x )
+{
+    x = fabs( x );
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+static int build_taps( obe_hscale_t *s, double (*kernel)( double ), int cosited )
+{
+    double f = (double)s->src_width / s->dst_width;
+
+    for( int x = 0; x < s->dst_width; x++ )
+    {
+        double centre = cosited ? x * f : (x + 0.5) * f - 0.5;
+        int start = (int)floor( centre ) - s->taps / 2 + 1;
+        int16_t *c = &s->coefs[x * s->taps];
+        double w[MAX_TAPS], sum = 0.0;
+        int total = 0, peak = 0;
+
+        for( int k = 0; k < s->taps; k++ )
+        {
+            w[k] = kernel( (start + k - centre) / f );
+            sum += w[k];
+        }
+
+        for( int k = 0; k < s->taps; k++ )
+        {
+            c[k] = lrint( w[k] / sum * (1 << COEF_BITS) );
+            total += c[k];
+            if( c[k] > c[peak] )
+                peak = k;
+        }
+
+        /* Unity gain after rounding */
+        c[peak] += (1 << COEF_BITS) - total;
+
+        s->offsets[x] = start + LINE_PAD;
+        if( s->offsets[x] < 0 || s->offsets[x] + MAX_TAPS > s->src_width + 2 * LINE_PAD )
+            return -1;
+    }
+
+    return 0;
+}
+
+static inline int clip_pixel( int v, int max )
+{
+    return v < 0 ? 0 : v > max ? max : v;
+}
+
+static void filter_tail_c( const obe_hscale_t *s, void *dst, int x )
+{
+    const int max = (1 << s->depth) - 1;
+
+    for( ; x < s->dst_width; x++ )
+    {
+        const int16_t *src = s->line + s->offsets[x];
+        const int16_t *c = &s->coefs[x * s->taps];
+        int sum = 1 << (COEF_BITS - 1);
+
+        for( int k = 0; k < s->taps; k++ )
+            sum += src[k] * c[k];
+
+        sum = clip_pixel( sum >> COEF_BITS, max );
+        if( s->depth == 8 )
+            ((uint8_t *)dst)[x] = sum;
+        else
+            ((uint16_t *)dst)[x] = sum;
+    }
+}
+
+static void filter_c( const obe_hscale_t *s, void *dst )
+{
+    filter_tail_c( s, dst, 0 );
+}
+
+#if defined(__SSE2__)
+/* Four outputs of pmaddwd partial sums, one register each, to one register of totals */
+static inline __m128i hsum4_epi32( __m128i a, __m128i b, __m128i c, __m128i d )
+{
+    __m128i ab = _mm_add_epi32( _mm_unpacklo_epi32( a, b ), _mm_unpackhi_epi32( a, b ) );
+    __m128i cd = _mm_add_epi32( _mm_unpacklo_epi32( c, d ), _mm_unpackhi_epi32( c, d ) );
+
+    return _mm_add_epi32( _mm_unpacklo_epi64( ab, cd ), _mm_unpackhi_epi64( ab, cd ) );
+}
+
+static inline __m128i taps8_x4( const obe_hscale_t *s, int x )
+{
+    const int16_t *c = &s->coefs[x * 8];
+    __m128i r[4];
+
+    for( int i = 0; i < 4; i++ )
+        r[i] = _mm_madd_epi16( _mm_loadu_si128( (const __m128i *)(s->line + s->offsets[x+i]) ),
+                               _mm_load_si128( (const __m128i *)(c + 8 * i) ) );
+
+    return hsum4_epi32( r[0], r[1], r[2], r[3] );
+}
+
+/* Two outputs share a register, 4 taps each */
+static inline __m128i taps4_x4( const obe_hscale_t *s, int x )
+{
+    const int16_t *c = &s->coefs[x * 4];
+    __m128i r[2];
+
+    for( int i = 0; i < 2; i++ )
+    {
+        __m128i px = _mm_unpacklo_epi64( _mm_loadl_epi64( (const __m128i *)(s->line + s->offsets[x+2*i]) ),
+                                         _mm_loadl_epi64( (const __m128i *)(s->line + s->offsets[x+2*i+1]) ) );
+        r[i] = _mm_madd_epi16( px, _mm_load_si128( (const __m128i *)(c + 8 * i) ) );
+    }
+
+    __m128 a = _mm_castsi128_ps( r[0] ), b = _mm_castsi128_ps( r[1] );
+    return _mm_add_epi32( _mm_castps_si128( _mm_shuffle_ps( a, b, _MM_SHUFFLE( 2, 0, 2, 0 ) ) ),
+                          _mm_castps_si128( _mm_shuffle_ps( a, b, _MM_SHUFFLE( 3, 1, 3, 1 ) ) ) );
+}
+
+static av_always_inline void filter_sse2( const obe_hscale_t *s, void *dst, const int taps, const int depth )
+{
+    const __m128i round = _mm_set1_epi32( 1 << (COEF_BITS - 1) );
+    const __m128i max = _mm_set1_epi16( (1 << depth) - 1 );
+    const __m128i zero = _mm_setzero_si128();
+    int x;
+
+    for( x = 0; x + 8 <= s->dst_width; x += 8 )
+    {
+        __m128i lo = taps == 8 ? taps8_x4( s, x ) : taps4_x4( s, x );
+        __m128i hi = taps == 8 ? taps8_x4( s, x + 4 ) : taps4_x4( s, x + 4 );
+
+        lo = _mm_srai_epi32( _mm_add_epi32( lo, round ), COEF_BITS );
+        hi = _mm_srai_epi32( _mm_add_epi32( hi, round ), COEF_BITS );
+        __m128i px = _mm_packs_epi32( lo, hi );
+
+        if( depth == 8 )
+            _mm_storel_epi64( (__m128i *)((uint8_t *)dst + x), _mm_packus_epi16( px, px ) );
+        else
+            _mm_storeu_si128( (__m128i *)((uint16_t *)dst + x), _mm_min_epi16( _mm_max_epi16( px, zero ), max ) );
+    }
+
+    filter_tail_c( s, dst, x );
+}
+
+static void filter8_8_sse2( const obe_hscale_t *s, void *dst )  { filter_sse2( s, dst, 8, 8 ); }
+static void filter8_10_sse2( const obe_hscale_t *s, void *dst ) { filter_sse2( s, dst, 8, 10 ); }
+static void filter4_8_sse2( const obe_hscale_t *s, void *dst )  { filter_sse2( s, dst, 4, 8 ); }
+static void filter4_10_sse2( const obe_hscale_t *s, void *dst ) { filter_sse2( s, dst, 4, 10 ); }
+#endif
+
+obe_hscale_t *obe_hscale_alloc( int src_width, int dst_width, int depth, int quality, int cosited )
+{
+    int i;
+
+    if( depth != 8 && depth != 10 )
+        return NULL;
+
+    if( quality != VIDEO_SCALER_NORMAL && quality != VIDEO_SCALER_FAST )
+        return NULL;
+
+    for( i = 0; i < FF_ARRAY_ELEMS(scale_ratios); i++ )
+    {
+        if( src_width * scale_ratios[i].den == dst_width * scale_ratios[i].num )
+            break;
+    }
+    if( i == FF_ARRAY_ELEMS(scale_ratios) )
+        return NULL;
+
+    obe_hscale_t *s = calloc( 1, sizeof(*s) );
+    if( !s )
+        return NULL;
+
+    s->src_width = src_width;
+    s->dst_width = dst_width;
+    s->depth = depth;
+    s->taps = quality == VIDEO_SCALER_FAST ? 4 : 8;
+
+    s->offsets = av_malloc( dst_width * sizeof(*s->offsets) );
+    s->coefs = av_malloc( dst_width * s->taps * sizeof(*s->coefs) );
+    s->line = av_mallocz( (src_width + 2 * LINE_PAD) * sizeof(*s->line) );
+    if( !s->offsets || !s->coefs || !s->line )
+        goto fail;
+
+    if( build_taps( s, quality == VIDEO_SCALER_FAST ? triangle : lanczos2, cosited ) < 0 )
+        goto fail;
+
+    s->filter = filter_c;
+    s->name = quality == VIDEO_SCALER_FAST ? "triangle 4-tap c" : "lanczos2 8-tap c";
+#if defined(__SSE2__)
+    if( s->taps == 8 )
+        s->filter = depth == 8 ? filter8_8_sse2 : filter8_10_sse2;
+    else
+        s->filter = depth == 8 ? filter4_8_sse2 : filter4_10_sse2;
+    s->name = quality == VIDEO_SCALER_FAST ? "triangle 4-tap sse2" : "lanczos2 8-tap sse2";
+#endif
+
+    return s;
+
+fail:
+    obe_hscale_free( s );
+    return NULL;
+}
+
+void obe_hscale_free( obe_hscale_t *s )
+{
+    if( !s )
+        return;
+
+    av_free( s->offsets );
+    av_free( s->coefs );
+    av_free( s->line );
+    free( s );
+}
+
+const char *obe_hscale_name( obe_hscale_t *s )
+{
+    return s->name;
+}
+
+static void fill_line( obe_hscale_t *s, const uint8_t *src )
+{
+    int16_t *line = s->line + LINE_PAD;
+    const int w = s->src_width;
+
+    if( s->depth == 8 )
+    {
+        for( int x = 0; x < w; x++ )
+            line[x] = src[x];
+    }
+    else
+        memcpy( line, src, w * sizeof(*line) );
+
+    for( int i = 1; i <= LINE_PAD; i++ )
+    {
+        line[-i] = line[0];
+        line[w-1+i] = line[w-1];
+    }
+}
+
+void obe_hscale_plane( obe_hscale_t *s, const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int height )
+{
+    for( int y = 0; y < height; y++ )
+    {
+        fill_line( s, src );
+        s->filter( s, dst );
+
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+/** Benchmark **/
+#define BENCH_HEIGHT 1080
+#define BENCH_RUNS   10
+
+/* Zone plate over a ramp, plenty of energy near Nyquist to show up aliasing */
+static void bench_picture( uint8_t *buf, int stride, int width, int height, int depth )
+{
+    const int max = (1 << depth) - 1;
+
+    for( int y = 0; y < height; y++ )
+    {
+        for( int x = 0; x < width; x++ )
+        {
+            double dx = x - width / 2, dy = y - height / 2;
+            double v = 0.35 * (1.0 + cos( (dx * dx + dy * dy) * M_PI / (2.0 * width) )) + 0.3 * x / width;
+            int p = clip_pixel( lrint( v * max ), max );
+
+            if( depth == 8 )
+                buf[y * stride + x] = p;
+            else
+                ((uint16_t *)(buf + y * stride))[x] = p;
+        }
+    }
+}
+
+static double bench_psnr( const uint8_t *a, const uint8_t *b, int stride, int width, int height, int depth )
+{
+    const double max = (1 << depth) - 1;
+    double sse = 0.0;
+
+    for( int y = 0; y < height; y++ )
+    {
+        for( int x = 0; x < width; x++ )
+        {
+            int d = depth == 8 ? a[y * stride + x] - b[y * stride + x] :
+                    ((const uint16_t *)(a + y * stride))[x] - ((const uint16_t *)(b + y * stride))[x];
+            sse += d * d;
+        }
+    }
+
+    if( sse == 0.0 )
+        return 99.99;
+
+    return 10.0 * log10( max * max * width * height / sse );
+}
+
+void obe_hscale_bench( void )
+{
+    static const struct
+    {
+        int src;
+        int dst;
+    } sizes[] = { { 1920, 1440 }, { 1920, 1280 }, { 1920, 960 }, { 3840, 1920 } };
+    static const int qualities[] = { VIDEO_SCALER_NORMAL, VIDEO_SCALER_FAST };
+
+    printf( "Horizontal downscalers, %d lines, PSNR against swscale lanczos:\n", BENCH_HEIGHT );
+
+    for( int i = 0; i < FF_ARRAY_ELEMS(sizes); i++ )
+    {
+        for( int depth = 8; depth <= 10; depth += 2 )
+        {
+            enum AVPixelFormat fmt = depth == 8 ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_GRAY10;
+            int bpp = depth == 8 ? 1 : 2;
+            int src_stride = FFALIGN( sizes[i].src * bpp, 32 );
+            int dst_stride = FFALIGN( sizes[i].dst * bpp, 32 );
+            uint8_t *src = av_malloc( src_stride * BENCH_HEIGHT );
+            uint8_t *ref = av_malloc( dst_stride * BENCH_HEIGHT );
+            uint8_t *dst = av_malloc( dst_stride * BENCH_HEIGHT );
+            struct SwsContext *sws = sws_getContext( sizes[i].src, BENCH_HEIGHT, fmt, sizes[i].dst, BENCH_HEIGHT, fmt,
+                                                     SWS_FULL_CHR_H_INP | SWS_ACCURATE_RND | SWS_LANCZOS, NULL, NULL, NULL );
+            if( !src || !ref || !dst || !sws )
+            {
+                fprintf( stderr, "Malloc failed\n" );
+                goto next;
+            }
+
+            bench_picture( src, src_stride, sizes[i].src, BENCH_HEIGHT, depth );
+
+            const uint8_t *src_planes[4] = { src };
+            int src_strides[4] = { src_stride };
+            uint8_t *ref_planes[4] = { ref };
+            int ref_strides[4] = { dst_stride };
+
+            int64_t start = obe_mdate();
+            for( int r = 0; r < BENCH_RUNS; r++ )
+                sws_scale( sws, src_planes, src_strides, 0, BENCH_HEIGHT, ref_planes, ref_strides );
+            double sws_ms = (obe_mdate() - start) / (1000.0 * BENCH_RUNS);
+
+            printf( "  %4d -> %4d %2d-bit  swscale %7.2f ms", sizes[i].src, sizes[i].dst, depth, sws_ms );
+
+            for( int q = 0; q < FF_ARRAY_ELEMS(qualities); q++ )
+            {
+                obe_hscale_t *s = obe_hscale_alloc( sizes[i].src, sizes[i].dst, depth, qualities[q], 0 );
+                if( !s )
+                    continue;
+
+                start = obe_mdate();
+                for( int r = 0; r < BENCH_RUNS; r++ )
+                    obe_hscale_plane( s, src, src_stride, dst, dst_stride, BENCH_HEIGHT );
+                double ms = (obe_mdate() - start) / (1000.0 * BENCH_RUNS);
+
+                printf( "  %s %7.2f ms %5.2f dB", obe_hscale_name( s ), ms,
+                        bench_psnr( ref, dst, dst_stride, sizes[i].dst, BENCH_HEIGHT, depth ) );
+                obe_hscale_free( s );
+            }
+            printf( "\n" );
+
+next:
+            sws_freeContext( sws );
+            av_free( src );
+            av_free( ref );
+            av_free( dst );
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef OBE_FILTERS_VIDEO_SCALE_H
+#define OBE_FILTERS_VIDEO_SCALE_H
+
+#include <stdint.h>
+
+/* Dedicated horizontal downscalers.
+ * The output ladders we build from 1920 and 3840 wide sources only ever scale
+ * the width, by 4:3, 3:2 or 2:1. For those ratios a fixed polyphase filter,
+ * with the taps of every output pixel computed once, is far cheaper than a
+ * general swscale Lanczos context. Anything else is left to swscale.
+ *
+ * VIDEO_SCALER_NORMAL is an 8 tap Lanczos2, VIDEO_SCALER_FAST a 4 tap
+ * triangle (area) filter. 8 and 10-bit planar rows, C and SSE2.
+ */
+typedef struct obe_hscale_s obe_hscale_t;
+
+/* NULL when the ratio or quality has no dedicated scaler.
+ * cosited selects MPEG-2 chroma siting, the output sample aligned with the left source sample. */
+obe_hscale_t *obe_hscale_alloc( int src_width, int dst_width, int depth, int quality, int cosited );
+void obe_hscale_free( obe_hscale_t *s );
+const char *obe_hscale_name( obe_hscale_t *s );
+
+void obe_hscale_plane( obe_hscale_t *s, const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int height );
+
+/* Time the dedicated scalers against swscale Lanczos on a synthetic picture
+ * and print their PSNR against the swscale output, for 'show scalers'. */
+void obe_hscale_bench( void );
+
+#endif
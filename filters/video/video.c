@@ -27,15 +27,18 @@
 #include "common/common.h"
 #include "common/bitstream.h"
 #include "video.h"
+#include "scale.h"
+#include "deinterlace.h"
+#include "analytics.h"
+#include "burnin.h"
 #include "cc.h"
 #include "dither.h"
+#include "rows.h"
 #include "x86/vfilter.h"
 #include "input/sdi/sdi.h"
+#include "ltn_ws.h"
 
-#define DO_JPG 0
-#if DO_JPG
 #include "convert.h"
-#endif
 
 #define DO_CRYSTAL_FP 0
 #if DO_CRYSTAL_FP
@@ -43,13 +46,137 @@
 #include "analyze_fp.h"
 #endif
 
-#if X264_BIT_DEPTH > 8
-typedef uint16_t pixel;
-#else
-typedef uint8_t pixel;
-#endif
+#define MAX_PLAN_STEPS 12
+#define MAX_RENDITIONS 8
+#define MAX_CARRIED_USER_DATA 16
+
+typedef struct obe_vid_filter_ctx_s obe_vid_filter_ctx_t;
+typedef struct obe_vid_filter_step_s obe_vid_filter_step_t;
+
+/* The per row work of the steps which touch samples themselves, specialised for a
+ * sample size, chroma layout and scan. A step picks its set from filter_kernels[]
+ * when the plan is compiled, so no format is looked at in the per row loops. */
+enum
+{
+    KERNEL_DEPTH_8,
+    KERNEL_DEPTH_16,  /* 9 to 16-bit, in uint16_t */
+};
+
+enum
+{
+    KERNEL_PLANAR,
+    KERNEL_SEMIPLANAR, /* NV12 style, u and v interleaved in one plane */
+};
+
+enum
+{
+    KERNEL_PROGRESSIVE,
+    KERNEL_INTERLACED,
+};
+
+typedef struct
+{
+    const char *name;
+
+    /* Black over the first width luma samples of the top line and the chroma beside them */
+    void (*blank_line)( uint8_t *plane[4], int width, int depth );
+
+    /* Halve the chroma rows of one plane, 4:2:2 to 4:2:0. width is in samples, height in
+     * output rows. May run in place, each output row lands at or above the rows it is made from */
+    void (*downsample_chroma)( obe_vid_filter_ctx_t *vfilt, uint8_t *src, int src_stride,
+                               uint8_t *dst, int dst_stride, int width, int height );
+} obe_vid_filter_kernels_t;
+
+/* One stage of the plan. Stages producing a new image write into one of the
+ * filter's ping-pong buffers, with a layout fixed when the plan was compiled,
+ * or straight over their input when the geometry allows it. */
+struct obe_vid_filter_step_s
+{
+    const char *name;
+    int (*run)( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame );
+
+    /* Input geometry, for show filter */
+    enum AVPixelFormat in_csp;
+    int in_width;
+    int in_height;
+
+    /* Output image, plane pointers are offsets from the start of the buffer */
+    obe_image_t out;
+    int pool_idx; /* -1 when the step passes its input through */
+
+    /* Output fits over the input, strides shifted down by in_place_shift */
+    int in_place;
+    int in_place_shift;
+
+    /* Per plane work sizes */
+    int width[4];
+    int height[4];
+
+    /* resize */
+    struct SwsContext *sws_ctx;
+    obe_hscale_t *hscale[2]; /* luma, chroma */
+
+    /* deinterlace */
+    obe_deint_t *deint;
+
+    /* blank-lines and downconvert */
+    const obe_vid_filter_kernels_t *kernels;
+};
+
+/* One size of the scaling pyramid, built from the main picture or from a larger level.
+ * The step describes the scaler, its output lives in a rendition pool buffer. */
+typedef struct
+{
+    obe_vid_filter_step_t step;
+    int src;    /* Level scaled from, -1 for the main picture */
+    int fields; /* Interlaced, sws_ctx scales one field */
+} obe_vid_filter_level_t;
 
+/* An additional video encoder fed from this input */
 typedef struct
+{
+    int output_stream_id;
+    int width;
+    int height;
+    int level;  /* -1 when encoded at the size of the main picture */
+} obe_vid_filter_rendition_t;
+
+/* The work for one input format, compiled on the first frame and again whenever
+ * the input format changes. The per frame loop only walks the steps. */
+typedef struct
+{
+    int compiled;
+    enum AVPixelFormat csp;
+    int width;
+    int height;
+    int format;
+
+    int num_steps;
+    obe_vid_filter_step_t steps[MAX_PLAN_STEPS];
+
+    /* Decimation, by timestamp */
+    int decimate;
+    int64_t frame_duration; /* OBE_CLOCK, of the input */
+    int64_t next_keep;
+    int kept;
+
+    /* Deinterlacing, the rest of the plan treats the picture as progressive */
+    int deinterlace;
+    int tff;
+    int64_t field_duration; /* OBE_CLOCK */
+
+    /* Renditions, largest level first */
+    int num_levels;
+    obe_vid_filter_level_t levels[MAX_RENDITIONS];
+    int num_renditions;
+    obe_vid_filter_rendition_t renditions[MAX_RENDITIONS];
+
+    /* Layout of the main picture when it has to be copied somewhere refcounted to be shared */
+    int share_main;
+    obe_image_t main;
+} obe_vid_filter_plan_t;
+
+struct obe_vid_filter_ctx_s
 {
     /* cpu flags */
     uint32_t avutil_cpu;
@@ -57,19 +184,65 @@ typedef struct
     /* upscaling */
     void (*scale_plane)( uint16_t *src, int stride, int width, int height, int lshift, int rshift );
 
-    /* resize */
-    struct SwsContext *sws_ctx;
-    int sws_ctx_flags;
-    enum AVPixelFormat dst_pix_fmt;
-
     /* downsample */
     void (*downsample_chroma_row_top)( uint16_t *src, uint16_t *dst, int width, int stride );
     void (*downsample_chroma_row_bottom)( uint16_t *src, uint16_t *dst, int width, int stride );
 
     /* dither */
     void (*dither_row_10_to_8)( uint16_t *src, uint8_t *dst, const uint16_t *dithers, int width, int stride );
-    int16_t *error_buf;
-} obe_vid_filter_ctx_t;
+
+    /* Stream */
+    obe_t *h;
+    obe_int_input_stream_t *input_stream;
+    obe_output_stream_t *output_stream;
+    int target_csp;
+    int target_depth;
+
+    obe_vid_filter_plan_t plan;
+
+    /* Ping-pong output buffers. Consecutive steps draw from alternate pools, and
+     * a pool hands back its most recently released buffer, so steady state
+     * filtering does no allocation and works on the same few cache-warm buffers.
+     * Every buffer is buf_size bytes, enough for any step of the plan. */
+    obe_buf_pool_t *pool[2];
+    size_t buf_size;
+
+    /* Pyramid levels, and the main picture when a rendition shares it. These are
+     * held by the encoders, so they come from a pool of their own */
+    obe_buf_pool_t *rendition_pool;
+    size_t rendition_buf_size;
+
+    /* The deinterlacer looks at the frames either side, so it holds on to the
+     * previous picture and to the current frame until the next one arrives.
+     * At field rate the second field is filtered after the first. */
+    obe_raw_frame_t deint_prev;
+    obe_raw_frame_t deint_cur;
+    int have_prev;
+    int have_cur;
+    obe_raw_frame_t *second_field;
+    int second_field_step;
+
+    /* Owned by the filter, NULL when analytics are off */
+    obe_vanalytics_t *analytics;
+
+    /* Captions from decimated frames, waiting for the next frame kept */
+    obe_user_data_t carried[MAX_CARRIED_USER_DATA];
+    int num_carried;
+    uint8_t carried_arena[USER_DATA_ARENA_SIZE];
+    int carried_used;
+
+    /* Thumbnails, NULL when off */
+    struct filter_compress_ctx *fc_ctx;
+
+    /* Burn-in OSD, NULL when off */
+    obe_burnin_t *burnin;
+#if DO_CRYSTAL_FP
+    struct filter_analyze_fp_ctx *fp_ctx;
+#endif
+};
+
+/* Guards the plans against show filter while they are recompiled */
+static pthread_mutex_t plan_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 typedef struct
 {
@@ -98,6 +271,7 @@ typedef struct
 const static obe_cli_csp_t obe_cli_csps[] =
 {
     [AV_PIX_FMT_YUV420P] = { 3, { 1, .5, .5 }, { 1, .5, .5 }, 2, 2, 8 },
+    [AV_PIX_FMT_YUV422P] = { 3, { 1, .5, .5 }, { 1, 1, 1 }, 2, 2, 8 },
     [AV_PIX_FMT_NV12] =    { 2, { 1,  1 },     { 1, .5 },     2, 2, 8 },
     [AV_PIX_FMT_YUV420P10] = { 3, { 1, .5, .5 }, { 1, .5, .5 }, 2, 2, 10 },
     [AV_PIX_FMT_YUV422P10] = { 3, { 1, .5, .5 }, { 1, 1, 1 }, 2, 2, 10 },
@@ -176,45 +350,6 @@ static int set_sar( obe_raw_frame_t *raw_frame, int is_wide )
     return -1;
 }
 
-static void dither_row_10_to_8_c( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride )
-{
-    const int scale = 511;
-    const uint16_t shift = 11;
-
-    int k;
-    for (k = 0; k < width-7; k+=8)
-    {
-        dst[k+0] = (src[k+0] + dither[0])*scale>>shift;
-        dst[k+1] = (src[k+1] + dither[1])*scale>>shift;
-        dst[k+2] = (src[k+2] + dither[2])*scale>>shift;
-        dst[k+3] = (src[k+3] + dither[3])*scale>>shift;
-        dst[k+4] = (src[k+4] + dither[4])*scale>>shift;
-        dst[k+5] = (src[k+5] + dither[5])*scale>>shift;
-        dst[k+6] = (src[k+6] + dither[6])*scale>>shift;
-        dst[k+7] = (src[k+7] + dither[7])*scale>>shift;
-    }
-    for (; k < width; k++)
-        dst[k] = (src[k] + dither[k&7])*scale>>shift;
-
-}
-
-/* Note: srcf is the next field (two pixels down) */
-static void downsample_chroma_row_top_c( uint16_t *src, uint16_t *dst, int width, int stride )
-{
-    uint16_t *srcf = src + stride;
-
-    for( int i = 0; i < width/2; i++ )
-        dst[i] = (3*src[i] + srcf[i] + 2) >> 2;
-}
-
-static void downsample_chroma_row_bottom_c( uint16_t *src, uint16_t *dst, int width, int stride )
-{
-    uint16_t *srcf = src + stride;
-
-    for( int i = 0; i < width/2; i++ )
-        dst[i] = (src[i] + 3*srcf[i] + 2) >> 2;
-}
-
 static void init_filter( obe_vid_filter_ctx_t *vfilt )
 {
     vfilt->avutil_cpu = av_get_cpu_flags();
@@ -232,281 +367,549 @@ static void init_filter( obe_vid_filter_ctx_t *vfilt )
         vfilt->scale_plane = obe_scale_plane_avx;
 #endif
 
-    /* downsampling */
-    vfilt->downsample_chroma_row_top = downsample_chroma_row_top_c;
-    vfilt->downsample_chroma_row_bottom = downsample_chroma_row_bottom_c;
+    /* Row functions, whichever checked version runs fastest here */
+    obe_vfilter_rows_select( &vfilt->downsample_chroma_row_top, &vfilt->downsample_chroma_row_bottom,
+                             &vfilt->dither_row_10_to_8 );
+}
+
+/* The half line at the top of a PAL frame */
+#define BLANK_LINE( name, type, chroma_planes, chroma_width ) \
+static void blank_line_##name( uint8_t *plane[4], int width, int depth ) \
+{ \
+    type *y = (type *)plane[0]; \
+    for( int i = 0; i < width; i++ ) \
+        y[i] = 16 << (depth-8); \
+\
+    for( int p = 1; p <= chroma_planes; p++ ) \
+    { \
+        type *c = (type *)plane[p]; \
+        for( int i = 0; i < chroma_width; i++ ) \
+            c[i] = 128 << (depth-8); \
+    } \
+}
 
-    /* dither */
-    vfilt->dither_row_10_to_8 = dither_row_10_to_8_c;
+BLANK_LINE( 8_planar, uint8_t, 2, width/2 )
+BLANK_LINE( 8_semiplanar, uint8_t, 1, width )
+BLANK_LINE( 16_planar, uint16_t, 2, width/2 )
+BLANK_LINE( 16_semiplanar, uint16_t, 1, width )
 
-    if( vfilt->avutil_cpu & AV_CPU_FLAG_SSE2 )
+/* Progressive, each output row is the average of the two it replaces */
+#define DOWNSAMPLE_PROGRESSIVE( name, type ) \
+static void downsample_chroma_##name##_progressive( obe_vid_filter_ctx_t *vfilt, uint8_t *src, int src_stride, \
+                                                    uint8_t *dst, int dst_stride, int width, int height ) \
+{ \
+    for( int j = 0; j < height; j++, src += 2*src_stride, dst += dst_stride ) \
+    { \
+        type *s0 = (type *)src; \
+        type *s1 = (type *)(src + src_stride); \
+        type *d = (type *)dst; \
+        for( int i = 0; i < width; i++ ) \
+            d[i] = (s0[i] + s1[i] + 1) >> 1; \
+    } \
+}
+
+DOWNSAMPLE_PROGRESSIVE( 8, uint8_t )
+DOWNSAMPLE_PROGRESSIVE( 16, uint16_t )
+
+/* Interlaced, within each field, weighted towards where the field's 4:2:0 chroma sits */
+static void downsample_chroma_8_interlaced( obe_vid_filter_ctx_t *vfilt, uint8_t *src, int src_stride,
+                                            uint8_t *dst, int dst_stride, int width, int height )
+{
+    for( int j = 0; j < height; j += 2, src += 4*src_stride, dst += 2*dst_stride )
     {
-        vfilt->downsample_chroma_row_top = obe_downsample_chroma_row_top_sse2;
-        vfilt->downsample_chroma_row_bottom = obe_downsample_chroma_row_bottom_sse2;
-    }
+        uint8_t *t0 = src, *b0 = src + src_stride, *t1 = src + 2*src_stride, *b1 = src + 3*src_stride;
+        uint8_t *dt = dst, *db = dst + dst_stride;
 
-    if( vfilt->avutil_cpu & AV_CPU_FLAG_SSE4 )
-        vfilt->dither_row_10_to_8 = obe_dither_row_10_to_8_sse4;
+        for( int i = 0; i < width; i++ )
+            dt[i] = (3*t0[i] + t1[i] + 2) >> 2;
+        for( int i = 0; i < width; i++ )
+            db[i] = (b0[i] + 3*b1[i] + 2) >> 2;
+    }
+}
 
-    if( vfilt->avutil_cpu & AV_CPU_FLAG_AVX )
+/* The row functions take the width in bytes */
+static void downsample_chroma_16_interlaced( obe_vid_filter_ctx_t *vfilt, uint8_t *src, int src_stride,
+                                             uint8_t *dst, int dst_stride, int width, int height )
+{
+    for( int j = 0; j < height; j += 2, src += 4*src_stride, dst += 2*dst_stride )
     {
-        vfilt->downsample_chroma_row_top = obe_downsample_chroma_row_top_avx;
-        vfilt->downsample_chroma_row_bottom = obe_downsample_chroma_row_bottom_avx;
-        vfilt->dither_row_10_to_8 = obe_dither_row_10_to_8_avx;
+        vfilt->downsample_chroma_row_top( (uint16_t *)src, (uint16_t *)dst, width*2, src_stride );
+        vfilt->downsample_chroma_row_bottom( (uint16_t *)(src + src_stride), (uint16_t *)(dst + dst_stride),
+                                             width*2, src_stride );
     }
 }
 
-static void blank_line( uint16_t *y, uint16_t *u, uint16_t *v, int width )
+/* Downsampling only looks down a column, so it is the same for both chroma layouts */
+#define KERNELS( depth, layout, scan ) \
+    { #depth "-bit " #layout " " #scan, blank_line_##depth##_##layout, downsample_chroma_##depth##_##scan }
+
+static const obe_vid_filter_kernels_t filter_kernels[2][2][2] =
+{
+    [KERNEL_DEPTH_8] =
+    {
+        [KERNEL_PLANAR] = { KERNELS( 8, planar, progressive ), KERNELS( 8, planar, interlaced ) },
+        [KERNEL_SEMIPLANAR] = { KERNELS( 8, semiplanar, progressive ), KERNELS( 8, semiplanar, interlaced ) },
+    },
+    [KERNEL_DEPTH_16] =
+    {
+        [KERNEL_PLANAR] = { KERNELS( 16, planar, progressive ), KERNELS( 16, planar, interlaced ) },
+        [KERNEL_SEMIPLANAR] = { KERNELS( 16, semiplanar, progressive ), KERNELS( 16, semiplanar, interlaced ) },
+    },
+};
+
+/* NULL for anything which isn't planar or semiplanar YUV */
+static const obe_vid_filter_kernels_t *get_kernels( enum AVPixelFormat csp, int interlaced )
 {
-    for( int i = 0; i < width; i++ )
-        y[i] = 0x40;
+    const AVPixFmtDescriptor *d = av_pix_fmt_desc_get( csp );
+
+    if( !d || d->nb_components < 3 || (d->flags & AV_PIX_FMT_FLAG_RGB) || d->comp[0].plane == d->comp[1].plane )
+        return NULL;
 
-    for( int i = 0; i < width/2; i++ )
-        u[i] = 0x200;
+    int depth = d->comp[0].depth > 8 ? KERNEL_DEPTH_16 : KERNEL_DEPTH_8;
+    int layout = d->comp[1].plane == d->comp[2].plane ? KERNEL_SEMIPLANAR : KERNEL_PLANAR;
+
+    return &filter_kernels[depth][layout][interlaced ? KERNEL_INTERLACED : KERNEL_PROGRESSIVE];
+}
+
+/* The 4:2:0 format a 4:2:2 one is downconverted to, AV_PIX_FMT_NONE when there is no kernel for it */
+static enum AVPixelFormat downconvert_csp( enum AVPixelFormat csp )
+{
+    switch( csp )
+    {
+        case AV_PIX_FMT_YUV422P:   return AV_PIX_FMT_YUV420P;
+        case AV_PIX_FMT_YUV422P10: return AV_PIX_FMT_YUV420P10;
+        default:                   return AV_PIX_FMT_NONE;
+    }
+}
 
-    for( int i = 0; i < width/2; i++ )
-        v[i] = 0x200;
+/* The encoders only take planar pictures, semiplanar input is split into planes first */
+static enum AVPixelFormat planar_csp( enum AVPixelFormat csp )
+{
+    switch( csp )
+    {
+        case AV_PIX_FMT_NV12: return AV_PIX_FMT_YUV420P;
+        case AV_PIX_FMT_NV16: return AV_PIX_FMT_YUV422P;
+        default:              return csp;
+    }
 }
 
-static void blank_lines( obe_raw_frame_t *raw_frame )
+static int csp_is_planar( enum AVPixelFormat csp )
 {
-    /* All SDI input is 10-bit 4:2:2 */
-    /* FIXME: assumes planar, non-interleaved format */
-    uint16_t *y, *u, *v;
+    const AVPixFmtDescriptor *d = av_pix_fmt_desc_get( csp );
+
+    return d && d->nb_components >= 3 && d->comp[1].plane != d->comp[2].plane;
+}
 
-    y = (uint16_t*)raw_frame->img.plane[0];
-    u = (uint16_t*)raw_frame->img.plane[1];
-    v = (uint16_t*)raw_frame->img.plane[2];
+/* The picture may be overwritten if it lives in a pooled buffer nobody else holds */
+static int frame_is_writable( obe_raw_frame_t *raw_frame )
+{
+    obe_buf_t *buf = raw_frame->buf_ref;
 
-    blank_line( y, u, v, raw_frame->img.width / 2 );
+    return buf && raw_frame->release_data == obe_release_bufref_data && buf->refcount == 1 &&
+           raw_frame->img.plane[0] >= buf->data && raw_frame->img.plane[0] < buf->data + buf->size;
 }
 
-static int resize_frame( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame, int width )
+/* Set up the output of a step. Either the input picture is reused, *buf is NULL,
+ * or a ping-pong buffer laid out as compiled into step->out is returned in *buf */
+static int step_begin( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame,
+                       obe_image_t *out, obe_buf_t **buf )
 {
-    obe_image_t tmp_image = {0};
+    *buf = NULL;
 
-    if( !vfilt->sws_ctx || raw_frame->reset_obe )
+    if( step->in_place && frame_is_writable( raw_frame ) )
     {
-        if( IS_INTERLACED( raw_frame->img.format ) )
-            vfilt->dst_pix_fmt = raw_frame->img.csp;
-        else
-            vfilt->dst_pix_fmt = raw_frame->img.csp == AV_PIX_FMT_YUV422P10 ? AV_PIX_FMT_YUV420P10 : AV_PIX_FMT_YUV420P;
+        int aligned = 1;
 
-        vfilt->sws_ctx_flags |= SWS_FULL_CHR_H_INP | SWS_ACCURATE_RND | SWS_LANCZOS;
-
-        vfilt->sws_ctx = sws_getContext( raw_frame->img.width, raw_frame->img.height, raw_frame->img.csp,
-                                         width, raw_frame->img.height, vfilt->dst_pix_fmt,
-                                         vfilt->sws_ctx_flags, NULL, NULL, NULL );
-        if( !vfilt->sws_ctx )
+        memcpy( out, &raw_frame->img, sizeof(obe_image_t) );
+        out->csp = step->out.csp;
+        out->planes = step->out.planes;
+        for( int i = 0; i < out->planes; i++ )
         {
-            fprintf( stderr, "Video scaling failed\n" );
-            return -1;
+            out->stride[i] >>= step->in_place_shift;
+            aligned &= !(out->stride[i] & 15);
         }
-    }
 
-    tmp_image.width = width;
-    tmp_image.height = raw_frame->img.height;
-    const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(raw_frame->alloc_img.csp);
-    tmp_image.planes = d->nb_components;
-    tmp_image.csp = vfilt->dst_pix_fmt;
-//printf("filter new csp is %d\n", vfilt->dst_pix_fmt);
-    tmp_image.format = raw_frame->img.format;
+        /* The SIMD row functions store aligned */
+        if( aligned )
+            return 0;
+    }
 
-    if( av_image_alloc( tmp_image.plane, tmp_image.stride, tmp_image.width, tmp_image.height+1,
-                        tmp_image.csp, 16 ) < 0 )
+    *buf = obe_buf_pool_get( vfilt->pool[step->pool_idx], vfilt->buf_size );
+    if( !*buf )
     {
         syslog( LOG_ERR, "Malloc failed\n" );
         return -1;
     }
 
-    sws_scale( vfilt->sws_ctx, (const uint8_t* const*)raw_frame->img.plane, raw_frame->img.stride,
-               0, tmp_image.height, tmp_image.plane, tmp_image.stride );
+    memcpy( out, &step->out, sizeof(obe_image_t) );
+    for( int i = 0; i < out->planes; i++ )
+        out->plane[i] = (*buf)->data + (uintptr_t)step->out.plane[i];
+
+    return 0;
+}
+
+/* The frame now carries the step output. A new buffer replaces the input picture */
+static void step_end( obe_raw_frame_t *raw_frame, obe_buf_t *buf, obe_image_t *out )
+{
+    if( buf )
+    {
+        raw_frame->release_data( raw_frame );
+        raw_frame->buf_ref = buf;
+        raw_frame->release_data = obe_release_bufref_data;
+    }
 
-    raw_frame->release_data( raw_frame );
-    memcpy( &raw_frame->alloc_img, &tmp_image, sizeof(obe_image_t) );
+    memcpy( &raw_frame->alloc_img, out, sizeof(obe_image_t) );
     memcpy( &raw_frame->img, &raw_frame->alloc_img, sizeof(obe_image_t) );
+}
+
+/* Caption data of a dropped frame goes out with the next frame kept, the
+ * rest of the user data describes a picture that is no longer there */
+static void carry_user_data( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame )
+{
+    for( int i = 0; i < raw_frame->num_user_data; i++ )
+    {
+        obe_user_data_t *user_data = &raw_frame->user_data[i];
+
+        if( ( user_data->type == USER_DATA_CEA_608 || user_data->type == USER_DATA_CEA_708_CDP ) &&
+            vfilt->num_carried < MAX_CARRIED_USER_DATA &&
+            user_data->len <= USER_DATA_ARENA_SIZE - vfilt->carried_used )
+        {
+            obe_user_data_t *carried = &vfilt->carried[vfilt->num_carried++];
+            memcpy( carried, user_data, sizeof(*user_data) );
+            carried->data = &vfilt->carried_arena[vfilt->carried_used];
+            memcpy( carried->data, user_data->data, user_data->len );
+            vfilt->carried_used += user_data->len;
+        }
+    }
+}
+
+static int restore_user_data( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame )
+{
+    obe_user_data_t own[MAX_USER_DATA];
+    int num_own = raw_frame->num_user_data;
+
+    /* Oldest first. The frame's own payloads stay where they are in its arena */
+    memcpy( own, raw_frame->user_data, num_own * sizeof(*own) );
+    raw_frame->num_user_data = 0;
+
+    for( int i = 0; i < vfilt->num_carried; i++ )
+    {
+        obe_user_data_t *carried = &vfilt->carried[i];
+        obe_user_data_t *user_data = obe_user_data_add( raw_frame, carried->type, carried->source, carried->len );
+        if( !user_data )
+            break;
+        user_data->field = carried->field;
+        memcpy( user_data->data, carried->data, carried->len );
+    }
+
+    for( int i = 0; i < num_own; i++ )
+    {
+        if( raw_frame->num_user_data == MAX_USER_DATA )
+        {
+            syslog( LOG_WARNING, "User data of type %d dropped, frame is full\n", own[i].type );
+            continue;
+        }
+        raw_frame->user_data[raw_frame->num_user_data++] = own[i];
+    }
+
+    vfilt->num_carried = 0;
+    vfilt->carried_used = 0;
 
     return 0;
 }
 
-static int csp_num_interleaved( int csp, int plane )
+static void flush_carried_user_data( obe_vid_filter_ctx_t *vfilt )
 {
-    return ( csp == AV_PIX_FMT_NV12 && plane == 1 ) ? 2 : 1;
+    vfilt->num_carried = 0;
+    vfilt->carried_used = 0;
 }
 
-#if 0
+/* Keep one frame in plan->decimate. Frames are picked by timestamp, so a frame
+ * lost on input doesn't shift which ones are kept. Dropped frames cost nothing
+ * more: returns 1 with the picture released, the caller frees the header */
+static int run_decimate( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
+{
+    obe_vid_filter_plan_t *plan = &vfilt->plan;
+    int64_t interval = plan->frame_duration;
+    int64_t span = plan->decimate * interval;
 
-/* The dithering algorithm is based on Sierra-2-4A error diffusion. It has been
- * written in such a way so that if the source has been upconverted using the
- * same algorithm as used in scale_image, dithering down to the source bit
- * depth again is lossless. */
-#define DITHER_PLANE( pitch ) \
-static void dither_plane_##pitch( pixel *dst, int dst_stride, uint16_t *src, int src_stride, \
-                                        int width, int height, int16_t *errors ) \
-{ \
-    const int lshift = 16-X264_BIT_DEPTH; \
-    const int rshift = 2*X264_BIT_DEPTH-16; \
-    const int pixel_max = (1 << X264_BIT_DEPTH)-1; \
-    const int half = 1 << (16-X264_BIT_DEPTH); \
-    memset( errors, 0, (width+1) * sizeof(int16_t) ); \
-    for( int y = 0; y < height; y++, src += src_stride, dst += dst_stride ) \
-    { \
-        int err = 0; \
-        for( int x = 0; x < width; x++ ) \
-        { \
-            err = err*2 + errors[x] + errors[x+1]; \
-            dst[x*pitch] = obe_clip3( (((src[x*pitch]+half)<<2)+err)*pixel_max >> 18, 0, pixel_max ); \
-            errors[x] = err = src[x*pitch] - (dst[x*pitch] << lshift) - (dst[x*pitch] >> rshift); \
-        } \
-    } \
+    /* Start again on the first frame, and whenever the timeline jumps */
+    if( !plan->kept || raw_frame->pts < plan->next_keep - span || raw_frame->pts > plan->next_keep + span )
+        plan->next_keep = raw_frame->pts;
+
+    if( raw_frame->pts < plan->next_keep - interval / 2 )
+    {
+        carry_user_data( vfilt, raw_frame );
+        raw_frame->release_data( raw_frame );
+        return 1;
+    }
+
+    plan->kept = 1;
+    plan->next_keep = raw_frame->pts + span;
+    avfm_set_video_interval_clk( &raw_frame->avfm, avfm_get_video_interval_clk( &raw_frame->avfm ) * plan->decimate );
+
+    if( vfilt->num_carried && restore_user_data( vfilt, raw_frame ) < 0 )
+        return -1;
+
+    return 0;
 }
 
-DITHER_PLANE( 1 )
-DITHER_PLANE( 2 )
+static int run_blank_lines( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
+{
+    obe_image_t out;
+    obe_buf_t *buf;
+
+    if( step_begin( vfilt, step, raw_frame, &out, &buf ) < 0 )
+        return -1;
+
+    if( buf )
+        av_image_copy( out.plane, out.stride, (const uint8_t **)raw_frame->img.plane, raw_frame->img.stride,
+                       out.csp, out.width, out.height );
+
+    step->kernels->blank_line( out.plane, out.width / 2, av_pix_fmt_desc_get( out.csp )->comp[0].depth );
+
+    step_end( raw_frame, buf, &out );
+
+    return 0;
+}
 
-static int dither_image( obe_raw_frame_t *raw_frame, int16_t *error_buf )
+/* Black, freeze and illegal level detection on the input luma. Only one picture
+ * in output_stream->analytics is looked at, the others pass straight through */
+static int run_analytics( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
 {
     obe_image_t *img = &raw_frame->img;
-    obe_image_t tmp_image = {0};
-    obe_image_t *out = &tmp_image;
 
-    tmp_image.csp = X264_BIT_DEPTH == 10 ? PIX_FMT_YUV420P10 : PIX_FMT_YUV420P;
-    tmp_image.width = raw_frame->img.width;
-    tmp_image.height = raw_frame->img.height;
+    if( !obe_vanalytics_frame( vfilt->analytics, img->plane[0], img->stride[0], img->width, img->height,
+                               av_pix_fmt_desc_get( step->in_csp )->comp[0].depth, raw_frame->pts ) )
+        return 0;
 
-    if( av_image_alloc( tmp_image.plane, tmp_image.stride, tmp_image.width, tmp_image.height,
-                        tmp_image.csp, 16 ) < 0 )
-    {
-        syslog( LOG_ERR, "Malloc failed\n" );
+#if LTN_WS_ENABLE
+    obe_vanalytics_stats_t s;
+    obe_vanalytics_get( vfilt->analytics, &s );
+    ltn_ws_set_property_video_analytics( g_ltn_ws_handle, s.mean, s.min, s.max, s.illegal, s.sad, s.blockiness,
+                                         !!(s.alarms & (1 << VIDEO_ALARM_BLACK)), !!(s.alarms & (1 << VIDEO_ALARM_FREEZE)),
+                                         !!(s.alarms & (1 << VIDEO_ALARM_ILLEGAL)) );
+#endif
+
+    return 0;
+}
+
+static int run_resize( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
+{
+    obe_image_t out;
+    obe_buf_t *buf;
+
+    if( step_begin( vfilt, step, raw_frame, &out, &buf ) < 0 )
         return -1;
-    }
 
-    for( int i = 0; i < img->planes; i++ )
+    sws_scale( step->sws_ctx, (const uint8_t* const*)raw_frame->img.plane, raw_frame->img.stride,
+               0, out.height, out.plane, out.stride );
+
+    step_end( raw_frame, buf, &out );
+
+    return 0;
+}
+
+/* Dedicated fixed ratio horizontal scaler, same pixel format in and out */
+static int run_hscale( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
+{
+    obe_image_t out;
+    obe_buf_t *buf;
+
+    if( step_begin( vfilt, step, raw_frame, &out, &buf ) < 0 )
+        return -1;
+
+    for( int i = 0; i < out.planes; i++ )
+        obe_hscale_plane( step->hscale[!!i], raw_frame->img.plane[i], raw_frame->img.stride[i],
+                          out.plane[i], out.stride[i], step->height[i] );
+
+    step_end( raw_frame, buf, &out );
+
+    return 0;
+}
+
+/* Release the pictures held by the deinterlacer, on a format change or at exit */
+static void flush_deinterlace( obe_vid_filter_ctx_t *vfilt )
+{
+    if( vfilt->have_prev )
+        vfilt->deint_prev.release_data( &vfilt->deint_prev );
+
+    if( vfilt->have_cur )
+        vfilt->deint_cur.release_data( &vfilt->deint_cur );
+
+    vfilt->have_prev = vfilt->have_cur = 0;
+}
+
+static void deinterlace_picture( obe_vid_filter_step_t *step, obe_image_t *out, obe_image_t *prev,
+                                 obe_image_t *cur, obe_image_t *next, int field, int first )
+{
+    for( int i = 0; i < out->planes; i++ )
+        obe_deint_plane( step->deint, out->plane[i], out->stride[i], prev->plane[i], cur->plane[i], next->plane[i],
+                         cur->stride[i], step->width[i], step->height[i], field, first );
+}
+
+static void shift_field_timing( obe_raw_frame_t *raw_frame, int64_t offset, int64_t field_duration )
+{
+    struct avfm_s *avfm = &raw_frame->avfm;
+
+    raw_frame->pts += offset;
+    if( avfm->audio_pts >= 0 )
+        avfm_set_pts_audio( avfm, avfm->audio_pts + offset );
+    if( avfm->audio_pts_corrected >= 0 )
+        avfm_set_pts_audio_corrected( avfm, avfm->audio_pts_corrected + offset );
+    if( avfm->video_pts >= 0 )
+        avfm_set_pts_video( avfm, avfm->video_pts + offset );
+    avfm_set_video_interval_clk( avfm, field_duration );
+}
+
+/* The output for a frame is made once the frame after it arrives. The frame is passed on
+ * one step late, with its own timing and user data, and the first frame of all is held back:
+ * returns 1, the header is empty and the caller releases it.
+ * All inputs release their headers with obe_release_frame(), so contents can move between them. */
+static int run_deinterlace( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
+{
+    obe_vid_filter_plan_t *plan = &vfilt->plan;
+    obe_raw_frame_t *prev = &vfilt->deint_prev;
+    obe_raw_frame_t *cur = &vfilt->deint_cur;
+    obe_raw_frame_t next;
+    obe_image_t out;
+    obe_buf_t *buf;
+    int field = !plan->tff;
+
+    if( !vfilt->have_cur )
     {
-        int num_interleaved = csp_num_interleaved( img->csp, i );
-        int height = obe_cli_csps[img->csp].height[i] * img->height;
-        int width = obe_cli_csps[img->csp].width[i] * img->width / num_interleaved;
+        memcpy( cur, raw_frame, sizeof(*cur) );
+        obe_user_data_rebase( cur, raw_frame );
+        vfilt->have_cur = 1;
+        obe_user_data_clear( raw_frame );
+        return 1;
+    }
 
-#define CALL_DITHER_PLANE( pitch, off ) \
-        dither_plane_##pitch( ((pixel*)out->plane[i])+off, out->stride[i]/sizeof(pixel), \
-                ((uint16_t*)img->plane[i])+off, img->stride[i]/2, width, height, error_buf )
+    memcpy( &next, raw_frame, sizeof(next) );
+    obe_user_data_rebase( &next, raw_frame );
 
-        if( num_interleaved == 1 )
-        {
-            CALL_DITHER_PLANE( 1, 0 );
-        }
-        else
+    /* Neighbours in another layout can't be used, nor is there one before the first frame.
+     * The current picture stands in for them */
+    obe_image_t *p = vfilt->have_prev ? &prev->img : &cur->img;
+    obe_image_t *n = &next.img;
+    if( memcmp( p->stride, cur->img.stride, sizeof(p->stride) ) )
+        p = &cur->img;
+    if( memcmp( n->stride, cur->img.stride, sizeof(n->stride) ) )
+        n = &cur->img;
+
+    if( step_begin( vfilt, step, raw_frame, &out, &buf ) < 0 )
+        return -1;
+    deinterlace_picture( step, &out, p, &cur->img, n, field, 1 );
+
+    if( plan->deinterlace == VIDEO_DEINTERLACE_FIELD )
+    {
+        obe_raw_frame_t *second = new_raw_frame();
+        obe_image_t out2;
+        obe_buf_t *buf2;
+
+        if( !second || step_begin( vfilt, step, raw_frame, &out2, &buf2 ) < 0 )
         {
-            CALL_DITHER_PLANE( 2, 0 );
-            CALL_DITHER_PLANE( 2, 1 );
+            free( second );
+            obe_buf_unref( buf );
+            return -1;
         }
+        deinterlace_picture( step, &out2, p, &cur->img, n, !field, 0 );
+
+        /* The second field has no user data of its own */
+        memcpy( second, cur, sizeof(*second) );
+        second->opaque = NULL;
+        obe_user_data_clear( second );
+        second->buf_ref = buf2;
+        second->release_data = obe_release_bufref_data;
+        second->release_frame = obe_release_frame;
+        memcpy( &second->alloc_img, &out2, sizeof(obe_image_t) );
+        memcpy( &second->img, &out2, sizeof(obe_image_t) );
+        shift_field_timing( second, plan->field_duration, plan->field_duration );
+
+        vfilt->second_field = second;
+        vfilt->second_field_step = step - plan->steps + 1;
     }
 
-    raw_frame->release_data( raw_frame );
-    memcpy( &raw_frame->alloc_img, out, sizeof(obe_image_t) );
-    memcpy( &raw_frame->img, &raw_frame->alloc_img, sizeof(obe_image_t) );
+    /* The current picture is the previous one from now on */
+    if( vfilt->have_prev )
+        prev->release_data( prev );
+    memcpy( prev, cur, sizeof(*prev) );
+    obe_user_data_clear( prev );
+    vfilt->have_prev = 1;
+
+    /* Pass on the current frame, with the deinterlaced picture */
+    memcpy( raw_frame, cur, sizeof(*raw_frame) );
+    obe_user_data_rebase( raw_frame, cur );
+    raw_frame->opaque = NULL;
+    raw_frame->buf_ref = buf;
+    raw_frame->release_data = obe_release_bufref_data;
+    memcpy( &raw_frame->alloc_img, &out, sizeof(obe_image_t) );
+    memcpy( &raw_frame->img, &out, sizeof(obe_image_t) );
+    if( plan->deinterlace == VIDEO_DEINTERLACE_FIELD )
+        shift_field_timing( raw_frame, 0, plan->field_duration );
+
+    memcpy( cur, &next, sizeof(*cur) );
+    obe_user_data_rebase( cur, &next );
 
     return 0;
 }
 
-#endif
+static int csp_num_interleaved( int csp, int plane )
+{
+    return ( csp == AV_PIX_FMT_NV12 && plane == 1 ) ? 2 : 1;
+}
 
-/* For a traditional interlaced frame, downsample the chroma
- * converting a frame of PIX_FMT_YUV422P10 to PIX_FMT_YUV420P10
- * Limited to 10bit pixels only.
- */
-static int downconvert_image_interlaced( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame )
+/* 4:2:2 to 4:2:0, the chroma rows halved by the step's kernels, within each field
+ * for a traditional interlaced frame. */
+static int run_downconvert( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
 {
     obe_image_t *img = &raw_frame->img;
-    obe_image_t tmp_image = {0};
+    obe_image_t tmp_image;
     obe_image_t *out = &tmp_image;
+    const int sample_size = av_pix_fmt_desc_get( img->csp )->comp[0].depth > 8 ? 2 : 1;
 
-    /* FIXME: support 8-bit. Note hardcoded width*2 below. */
-    tmp_image.csp = AV_PIX_FMT_YUV420P10;
-    tmp_image.width = raw_frame->img.width;
-    tmp_image.height = raw_frame->img.height;
-    const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(raw_frame->alloc_img.csp);
-    tmp_image.planes = d->nb_components;
-    tmp_image.format = raw_frame->img.format;
+    obe_buf_t *buf;
 
-    if( av_image_alloc( tmp_image.plane, tmp_image.stride, tmp_image.width, tmp_image.height+1,
-                        tmp_image.csp, 16 ) < 0 )
-    {
-        syslog( LOG_ERR, "Malloc failed\n" );
+    if( step_begin( vfilt, step, raw_frame, out, &buf ) < 0 )
         return -1;
-    }
 
-    av_image_copy_plane( (uint8_t*)tmp_image.plane[0], tmp_image.stride[0],
-                         (const uint8_t *)raw_frame->img.plane[0], raw_frame->img.stride[0],
-                          raw_frame->img.width * 2, raw_frame->img.height );
+    /* In place, output chroma rows are written behind the input rows still to be read
+     * and luma is left where it is. */
+    if( buf )
+        av_image_copy_plane( (uint8_t*)out->plane[0], out->stride[0],
+                             (const uint8_t *)img->plane[0], img->stride[0],
+                             av_image_get_linesize( out->csp, out->width, 0 ), step->height[0] );
 
-    for( int i = 1; i < tmp_image.planes; i++ )
+    for( int i = 1; i < av_pix_fmt_count_planes( out->csp ); i++ )
     {
-        int num_interleaved = csp_num_interleaved( img->csp, i );
-        int height = obe_cli_csps[out->csp].height[i] * img->height;
-        int width = obe_cli_csps[out->csp].width[i] * img->width / num_interleaved;
-        uint16_t *src = (uint16_t*)img->plane[i];
-        uint16_t *dst = (uint16_t*)out->plane[i];
-
-        for( int j = 0; j < height; j += 2 )
-        {
-            uint16_t *srcp = (uint16_t*)src + img->stride[i] / 2;
-            uint16_t *dstp = (uint16_t*)dst + out->stride[i] / 2;
-            vfilt->downsample_chroma_row_top( src, dst, width*2, img->stride[i] );
-            vfilt->downsample_chroma_row_bottom( srcp, dstp, width*2, img->stride[i] );
-
-            src += img->stride[i] * 2;
-            dst += out->stride[i];
-        }
+        step->kernels->downsample_chroma( vfilt, img->plane[i], img->stride[i], out->plane[i], out->stride[i],
+                                          av_image_get_linesize( out->csp, out->width, i ) / sample_size,
+                                          step->height[i] );
     }
 
-    raw_frame->release_data( raw_frame );
-    memcpy( &raw_frame->alloc_img, out, sizeof(obe_image_t) );
-    memcpy( &raw_frame->img, &raw_frame->alloc_img, sizeof(obe_image_t) );
+    step_end( raw_frame, buf, out );
 
     return 0;
 }
 
 /* Convert from 10bit to 8bit and apply a video dither. */
-static int dither_image( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame )
+static int run_dither( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
 {
     obe_image_t *img = &raw_frame->img;
-    obe_image_t tmp_image = {0};
+    obe_image_t tmp_image;
     obe_image_t *out = &tmp_image;
 
-    tmp_image.csp = img->csp == AV_PIX_FMT_YUV422P10 ? AV_PIX_FMT_YUV422P : AV_PIX_FMT_YUV420P;
-#if 0
-printf("%s() inputcsp = %d csp = %d   PIX_FMT_YUV422P = %d PIX_FMT_YUV420P = %d\n", __func__, img->csp, tmp_image.csp, PIX_FMT_YUV422P, PIX_FMT_YUV420P);
-if (tmp_image.csp == PIX_FMT_YUV420P)
-  printf("CSP now PIX_FMT_YUV420P\n");
-#endif
-    tmp_image.width = raw_frame->img.width;
-    tmp_image.height = raw_frame->img.height;
-    const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(raw_frame->alloc_img.csp);
-    tmp_image.planes = d->nb_components;
-    tmp_image.format = raw_frame->img.format;
-#if 0
-printf("%s(2) inputcsp = %d csp = %d   PIX_FMT_YUV422P = %d PIX_FMT_YUV420P = %d\n", __func__, img->csp, tmp_image.csp, PIX_FMT_YUV422P, PIX_FMT_YUV420P);
-#endif
+    obe_buf_t *buf;
 
-    if( av_image_alloc( tmp_image.plane, tmp_image.stride, tmp_image.width, tmp_image.height+1,
-                        tmp_image.csp, 16 ) < 0 )
-    {
-        syslog( LOG_ERR, "Malloc failed\n" );
+    /* In place, each 8-bit row lands in the first half of where its 10-bit row started,
+     * never ahead of the input still to be read */
+    if( step_begin( vfilt, step, raw_frame, out, &buf ) < 0 )
         return -1;
-    }
 
     for( int i = 0; i < img->planes; i++ )
     {
-        //const int src_depth = av_pix_fmt_descriptors[img->csp].comp[i].depth_minus1+1;
-        //const int dst_depth = av_pix_fmt_descriptors[out->csp].comp[i].depth_minus1+1;
-
-        //uint16_t scale = obe_dither_scale[dst_depth-1][src_depth-1];
-        //int shift = src_depth-dst_depth + obe_dither_scale[src_depth-2][dst_depth-1];
-
-        int num_interleaved = csp_num_interleaved( img->csp, i );
-        int height = obe_cli_csps[img->csp].height[i] * img->height;
-        int width = obe_cli_csps[img->csp].width[i] * img->width / num_interleaved;
+        int height = step->height[i];
+        int width = step->width[i];
         uint16_t *src = (uint16_t*)img->plane[i];
         uint8_t *dst = out->plane[i];
 
@@ -521,9 +924,7 @@ printf("%s(2) inputcsp = %d csp = %d   PIX_FMT_YUV422P = %d PIX_FMT_YUV420P = %d
         }
     }
 
-    raw_frame->release_data( raw_frame );
-    memcpy( &raw_frame->alloc_img, &tmp_image, sizeof(obe_image_t) );
-    memcpy( &raw_frame->img, &raw_frame->alloc_img, sizeof(obe_image_t) );
+    step_end( raw_frame, buf, out );
 
     return 0;
 }
@@ -532,7 +933,8 @@ printf("%s(2) inputcsp = %d csp = %d   PIX_FMT_YUV422P = %d PIX_FMT_YUV420P = %d
 static int write_afd( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
 {
     bs_t r;
-    uint8_t temp[100];
+    uint8_t *temp;
+    int avail;
     const int country_code      = 0xb5;
     const int provider_code     = 0x31;
     const char *user_identifier = "DTG1";
@@ -541,6 +943,15 @@ static int write_afd( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
 
     /* TODO: when MPEG-2 is added make this do the right thing */
 
+    /* Built at the free end of the arena, clear of the payload being read */
+    temp = obe_user_data_tail( raw_frame, &avail );
+    if( avail < 100 )
+    {
+        /* The input filled the frame, drop this entry rather than the filter */
+        syslog( LOG_WARNING, "No room for user data, dropped\n" );
+        return 1;
+    }
+
     bs_init( &r, temp, 100 );
 
     bs_write( &r,  8, country_code );  // itu_t_t35_country_code
@@ -568,26 +979,16 @@ static int write_afd( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
         set_sar( raw_frame, is_wide ); // TODO check return
 
     user_data->type = USER_DATA_AVC_REGISTERED_ITU_T35;
-    user_data->len = bs_pos( &r ) >> 3;
-
-    free( user_data->data );
-
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
-    {
-        syslog( LOG_ERR, "Malloc failed\n" );
-        return -1;
-    }
-
-    memcpy( user_data->data, temp, user_data->len );
+    obe_user_data_commit( raw_frame, user_data, bs_pos( &r ) >> 3 );
 
     return 0;
 }
 
-static int write_bar_data( obe_user_data_t *user_data )
+static int write_bar_data( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
 {
     bs_t r;
-    uint8_t temp[100];
+    uint8_t *temp;
+    int avail;
     const int country_code      = 0xb5;
     const int provider_code     = 0x31;
     const char *user_identifier = "GA94";
@@ -597,6 +998,14 @@ static int write_bar_data( obe_user_data_t *user_data )
 
     /* TODO: when MPEG-2 is added make this do the right thing */
 
+    temp = obe_user_data_tail( raw_frame, &avail );
+    if( avail < 100 )
+    {
+        /* The input filled the frame, drop this entry rather than the filter */
+        syslog( LOG_WARNING, "No room for user data, dropped\n" );
+        return 1;
+    }
+
     bs_init( &r, temp, 100 );
 
     bs_write( &r,  8, country_code );  // itu_t_t35_country_code
@@ -636,18 +1045,7 @@ static int write_bar_data( obe_user_data_t *user_data )
     bs_flush( &r );
 
     user_data->type = USER_DATA_AVC_REGISTERED_ITU_T35;
-    user_data->len = bs_pos( &r ) >> 3;
-
-    free( user_data->data );
-
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
-    {
-        syslog( LOG_ERR, "Malloc failed\n" );
-        return -1;
-    }
-
-    memcpy( user_data->data, temp, user_data->len );
+    obe_user_data_commit( raw_frame, user_data, bs_pos( &r ) >> 3 );
 
     return 0;
 }
@@ -668,11 +1066,11 @@ static int encapsulate_user_data( obe_raw_frame_t *raw_frame, obe_int_input_stre
         if( raw_frame->user_data[i].type == USER_DATA_CEA_608 )
             ret = write_608_cc( &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_CEA_708_CDP )
-            ret = read_cdp( &raw_frame->user_data[i] );
+            ret = read_cdp( &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_AFD )
             ret = write_afd( &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_BAR_DATA )
-            ret = write_bar_data( &raw_frame->user_data[i] );
+            ret = write_bar_data( &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_WSS )
             ret = convert_wss_to_afd( &raw_frame->user_data[i], raw_frame );
 
@@ -682,44 +1080,798 @@ static int encapsulate_user_data( obe_raw_frame_t *raw_frame, obe_int_input_stre
 
         if( ret == 1 )
         {
-            free( raw_frame->user_data[i].data );
-            memmove( &raw_frame->user_data[i], &raw_frame->user_data[i+1],
-                     sizeof(*raw_frame->user_data) * (raw_frame->num_user_data-i-1) );
-            raw_frame->num_user_data--;
+            obe_user_data_remove( raw_frame, i );
             i--;
         }
     }
 
-    if( !raw_frame->num_user_data )
+    return ret;
+}
+
+static int run_user_data( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
+{
+    return encapsulate_user_data( raw_frame, vfilt->input_stream ) < 0 ? -1 : 0;
+}
+
+/* If SAR, on an SD stream, has not been updated by AFD or WSS, set to default 4:3
+ * TODO: make this user-choosable. OBE will prioritise any SAR information from AFD or WSS over any user settings */
+static int run_default_sar( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
+{
+    if( raw_frame->sar_width == 1 && raw_frame->sar_height == 1 )
+    {
+        set_sar( raw_frame, IS_SD( raw_frame->img.format ) ? vfilt->output_stream->is_wide : 1 );
+        raw_frame->sar_guess = 1;
+    }
+
+    return 0;
+}
+
+/* Burn the monitoring text into the output picture. Drawn over the picture when nobody
+ * else holds it, otherwise over a copy */
+static int run_burnin( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
+{
+    int items = vfilt->output_stream->osd;
+    obe_image_t out;
+    obe_buf_t *buf;
+    char text[BURNIN_MAX_CHARS+1];
+    int line = 0;
+
+    if( items & BURNIN_TIMECODE )
+    {
+        obe_timecode_t *tc = &raw_frame->timecode;
+        snprintf( text, sizeof(text), "TC  %02d:%02d:%02d%c%02d", tc->hours, tc->mins, tc->seconds,
+                  tc->drop_frame ? ';' : ':', tc->frames );
+        obe_burnin_set_line( vfilt->burnin, line++, text );
+    }
+
+    if( items & BURNIN_PTS )
+    {
+        snprintf( text, sizeof(text), "PTS %.3f", (double)raw_frame->pts / OBE_CLOCK );
+        obe_burnin_set_line( vfilt->burnin, line++, text );
+    }
+
+    if( items & BURNIN_ENCODER )
+    {
+        obe_encoder_t *encoder = get_encoder( vfilt->h, vfilt->output_stream->output_stream_id );
+        if( encoder )
+            snprintf( text, sizeof(text), "QP  %d  %d kb/s", encoder->last_qp, encoder->last_kbps );
+        else
+            snprintf( text, sizeof(text), "QP  -" );
+        obe_burnin_set_line( vfilt->burnin, line++, text );
+    }
+
+    if( items & BURNIN_CLOCK )
+    {
+        struct timeval tv;
+        struct tm tm;
+        gettimeofday( &tv, NULL );
+        localtime_r( &tv.tv_sec, &tm );
+        snprintf( text, sizeof(text), "%04d-%02d-%02d %02d:%02d:%02d.%03d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                  tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(tv.tv_usec / 1000) );
+        obe_burnin_set_line( vfilt->burnin, line++, text );
+    }
+
+    if( step_begin( vfilt, step, raw_frame, &out, &buf ) < 0 )
+        return -1;
+
+    if( buf )
+        av_image_copy( out.plane, out.stride, (const uint8_t **)raw_frame->img.plane, raw_frame->img.stride,
+                       out.csp, out.width, out.height );
+
+    const AVPixFmtDescriptor *d = av_pix_fmt_desc_get( out.csp );
+    obe_burnin_frame( vfilt->burnin, out.plane, out.stride, out.width, out.height,
+                      d->comp[0].depth, d->log2_chroma_w, d->log2_chroma_h );
+
+    step_end( raw_frame, buf, &out );
+
+    return 0;
+}
+
+/* Hands a picture to the thumbnail thread now and then, never waits for it */
+static int run_jpg( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
+{
+    filter_compress_jpg( vfilt->fc_ctx, raw_frame );
+
+    return 0;
+}
+
+#if DO_CRYSTAL_FP
+static int run_crystal_fp( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_raw_frame_t *raw_frame )
+{
+    filter_analyze_fp_process( vfilt->fp_ctx, raw_frame );
+
+    return 0;
+}
+#endif
+
+static void scale_level( obe_vid_filter_level_t *level, obe_image_t *in, obe_image_t *out )
+{
+    obe_vid_filter_step_t *step = &level->step;
+
+    if( !step->sws_ctx )
+    {
+        for( int i = 0; i < out->planes; i++ )
+            obe_hscale_plane( step->hscale[!!i], in->plane[i], in->stride[i], out->plane[i], out->stride[i], step->height[i] );
+    }
+    else if( level->fields )
+    {
+        for( int field = 0; field < 2; field++ )
+        {
+            const uint8_t *src[4] = { NULL };
+            uint8_t *dst[4] = { NULL };
+            int src_stride[4] = { 0 }, dst_stride[4] = { 0 };
+
+            for( int i = 0; i < out->planes; i++ )
+            {
+                src[i] = in->plane[i] + field * in->stride[i];
+                src_stride[i] = in->stride[i] * 2;
+                dst[i] = out->plane[i] + field * out->stride[i];
+                dst_stride[i] = out->stride[i] * 2;
+            }
+
+            sws_scale( step->sws_ctx, src, src_stride, 0, in->height / 2, dst, dst_stride );
+        }
+    }
+    else
+        sws_scale( step->sws_ctx, (const uint8_t* const*)in->plane, in->stride, 0, in->height, out->plane, out->stride );
+}
+
+/* A new frame header around a shared picture. The picture buffer is refcounted, the
+ * user data is small and each encoder gets its own copy in the header */
+static obe_raw_frame_t *clone_rendition( obe_raw_frame_t *raw_frame, obe_buf_t *buf, obe_image_t *img )
+{
+    obe_raw_frame_t *clone = new_raw_frame();
+    if( !clone )
+        return NULL;
+
+    memcpy( clone, raw_frame, sizeof(*clone) );
+    clone->opaque = NULL;
+    clone->buf_ref = obe_buf_ref( buf );
+    clone->release_data = obe_release_bufref_data;
+    clone->release_frame = obe_release_frame;
+    memcpy( &clone->alloc_img, img, sizeof(obe_image_t) );
+    memcpy( &clone->img, img, sizeof(obe_image_t) );
+
+    /* Keep the display aspect ratio of the main picture */
+    av_reduce( &clone->sar_width, &clone->sar_height,
+               (int64_t)raw_frame->sar_width * raw_frame->img.width * img->height,
+               (int64_t)raw_frame->sar_height * raw_frame->img.height * img->width, 65535 );
+
+    obe_user_data_rebase( clone, raw_frame );
+
+    return clone;
+}
+
+/* Build the pyramid for this frame and hand every rendition encoder its level */
+static int run_renditions( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame )
+{
+    obe_vid_filter_plan_t *plan = &vfilt->plan;
+    obe_buf_t *bufs[MAX_RENDITIONS] = { NULL };
+    obe_image_t imgs[MAX_RENDITIONS];
+    obe_buf_t *buf;
+    int ret = -1;
+
+    /* Encoders sharing the main picture need it refcounted */
+    if( plan->share_main && !( raw_frame->buf_ref && raw_frame->release_data == obe_release_bufref_data ) )
+    {
+        obe_image_t out;
+
+        buf = obe_buf_pool_get( vfilt->rendition_pool, vfilt->rendition_buf_size );
+        if( !buf )
+            goto fail;
+
+        memcpy( &out, &plan->main, sizeof(obe_image_t) );
+        for( int i = 0; i < out.planes; i++ )
+            out.plane[i] = buf->data + (uintptr_t)plan->main.plane[i];
+
+        av_image_copy( out.plane, out.stride, (const uint8_t **)raw_frame->img.plane, raw_frame->img.stride,
+                       out.csp, out.width, out.height );
+        step_end( raw_frame, buf, &out );
+    }
+
+    for( int i = 0; i < plan->num_levels; i++ )
+    {
+        obe_vid_filter_level_t *level = &plan->levels[i];
+
+        bufs[i] = obe_buf_pool_get( vfilt->rendition_pool, vfilt->rendition_buf_size );
+        if( !bufs[i] )
+            goto fail;
+
+        memcpy( &imgs[i], &level->step.out, sizeof(obe_image_t) );
+        for( int j = 0; j < imgs[i].planes; j++ )
+            imgs[i].plane[j] = bufs[i]->data + (uintptr_t)level->step.out.plane[j];
+
+        scale_level( level, level->src < 0 ? &raw_frame->img : &imgs[level->src], &imgs[i] );
+    }
+
+    for( int i = 0; i < plan->num_renditions; i++ )
+    {
+        obe_vid_filter_rendition_t *rendition = &plan->renditions[i];
+        int level = rendition->level;
+        obe_raw_frame_t *clone;
+
+        clone = clone_rendition( raw_frame, level < 0 ? raw_frame->buf_ref : bufs[level],
+                                 level < 0 ? &raw_frame->img : &imgs[level] );
+        if( !clone )
+            goto end;
+
+        add_to_encode_queue( vfilt->h, clone, rendition->output_stream_id );
+    }
+
+    ret = 0;
+    goto end;
+
+fail:
+    syslog( LOG_ERR, "Malloc failed\n" );
+end:
+    /* The encoders hold the levels now */
+    for( int i = 0; i < plan->num_levels; i++ )
     {
-        free( raw_frame->user_data );
-        raw_frame->user_data = NULL;
+        if( bufs[i] )
+            obe_buf_unref( bufs[i] );
     }
 
     return ret;
 }
 
-static void *start_filter_video( void *ptr )
+static void free_step( obe_vid_filter_step_t *step )
 {
-    obe_vid_filter_params_t *filter_params = ptr;
-    obe_t *h = filter_params->h;
-    obe_filter_t *filter = filter_params->filter;
-    obe_int_input_stream_t *input_stream = filter_params->input_stream;
-    obe_raw_frame_t *raw_frame;
-    obe_output_stream_t *output_stream = get_output_stream_by_id(h, 0); /* FIXME when output_stream_id for video is not zero */
+    if( step->sws_ctx )
+        sws_freeContext( step->sws_ctx );
+
+    obe_hscale_free( step->hscale[0] );
+    obe_hscale_free( step->hscale[1] );
+    obe_deint_free( step->deint );
+}
+
+static void free_plan( obe_vid_filter_plan_t *plan )
+{
+    for( int i = 0; i < plan->num_steps; i++ )
+        free_step( &plan->steps[i] );
+
+    for( int i = 0; i < plan->num_levels; i++ )
+        free_step( &plan->levels[i].step );
+
+    memset( plan, 0, sizeof(*plan) );
+}
+
+static obe_vid_filter_step_t *add_step( obe_vid_filter_plan_t *plan, const char *name, obe_image_t *img,
+                                        int (*run)( obe_vid_filter_ctx_t *, obe_vid_filter_step_t *, obe_raw_frame_t * ) )
+{
+    obe_vid_filter_step_t *step = &plan->steps[plan->num_steps++];
+
+    step->name = name;
+    step->run = run;
+    step->in_csp = img->csp;
+    step->in_width = img->width;
+    step->in_height = img->height;
+    step->pool_idx = -1;
+
+    /* Steps which don't produce a new image pass the input through */
+    memcpy( &step->out, img, sizeof(obe_image_t) );
+
+    return step;
+}
+
+/* Lay out a picture in a single buffer, plane pointers as offsets from its start.
+ * Returns the buffer size needed */
+static int image_layout( obe_image_t *out, enum AVPixelFormat csp, int width, int height, int format )
+{
+    memset( out, 0, sizeof(*out) );
+    out->csp = csp;
+    out->width = width;
+    out->height = height;
+    out->planes = av_pix_fmt_count_planes( csp );
+    out->format = format;
+
+    if( av_image_fill_linesizes( out->stride, csp, FFALIGN( width, 32 ) ) < 0 )
+        return -1;
+
+    for( int i = 0; i < 4; i++ )
+        out->stride[i] = FFALIGN( out->stride[i], 32 );
+
+    /* One spare line, as av_image_alloc() was given before */
+    int size = av_image_fill_pointers( out->plane, csp, out->height+1, NULL, out->stride );
+
+    return size < 0 ? -1 : size + 32;
+}
+
+/* Fix the output layout of a step and pick its ping-pong pool, the other one from
+ * the step before. img is updated to describe the output, for the steps that follow. */
+static int step_output( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_image_t *img,
+                        enum AVPixelFormat csp, int width, int *next_pool )
+{
+    obe_image_t *out = &step->out;
+
+    int size = image_layout( out, csp, width, img->height, img->format );
+    if( size < 0 )
+        return -1;
+    vfilt->buf_size = FFMAX( vfilt->buf_size, size );
+
+    step->pool_idx = *next_pool;
+    *next_pool ^= 1;
+
+    memcpy( img, out, sizeof(obe_image_t) );
+
+    return 0;
+}
+
+static void step_plane_sizes( obe_vid_filter_step_t *step, enum AVPixelFormat csp, obe_image_t *img )
+{
+    for( int i = 0; i < img->planes; i++ )
+    {
+        int num_interleaved = csp_num_interleaved( img->csp, i );
+        step->height[i] = obe_cli_csps[csp].height[i] * img->height;
+        step->width[i] = obe_cli_csps[csp].width[i] * img->width / num_interleaved;
+    }
+}
+
+/* Use a dedicated scaler when only the width changes, by a ratio one exists for */
+static int compile_hscale( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_step_t *step, obe_image_t *img, int width )
+{
+    int quality = vfilt->output_stream->scaler;
     int h_shift, v_shift;
-    const AVPixFmtDescriptor *pfd;
 
-#if DO_JPG
-    struct filter_compress_ctx *fc_ctx = NULL;
-    filter_compress_alloc(&fc_ctx);
-#endif
+    if( img->csp != AV_PIX_FMT_YUV420P && img->csp != AV_PIX_FMT_YUV422P &&
+        img->csp != AV_PIX_FMT_YUV420P10 && img->csp != AV_PIX_FMT_YUV422P10 )
+        return -1;
+
+    if( av_pix_fmt_get_chroma_sub_sample( img->csp, &h_shift, &v_shift ) < 0 )
+        return -1;
+
+    int depth = av_pix_fmt_desc_get( img->csp )->comp[0].depth;
+    step->hscale[0] = obe_hscale_alloc( img->width, width, depth, quality, 0 );
+    step->hscale[1] = obe_hscale_alloc( img->width >> h_shift, width >> h_shift, depth, quality, 1 );
+    if( !step->hscale[0] || !step->hscale[1] )
+    {
+        obe_hscale_free( step->hscale[0] );
+        obe_hscale_free( step->hscale[1] );
+        step->hscale[0] = step->hscale[1] = NULL;
+        return -1;
+    }
+
+    step->height[0] = img->height;
+    step->height[1] = step->height[2] = (img->height + (1 << v_shift) - 1) >> v_shift;
+
+    return 0;
+}
+
+static int compile_deinterlace( obe_vid_filter_ctx_t *vfilt, obe_image_t *img, int *next_pool )
+{
+    obe_vid_filter_plan_t *plan = &vfilt->plan;
+    obe_vid_filter_step_t *step;
+    int h_shift, v_shift;
+
+    if( img->csp != AV_PIX_FMT_YUV420P && img->csp != AV_PIX_FMT_YUV422P &&
+        img->csp != AV_PIX_FMT_YUV420P10 && img->csp != AV_PIX_FMT_YUV422P10 )
+    {
+        fprintf( stderr, "Deinterlacing %s is not supported\n", av_get_pix_fmt_name( img->csp ) );
+        return -1;
+    }
+
+    if( av_pix_fmt_get_chroma_sub_sample( img->csp, &h_shift, &v_shift ) < 0 )
+        return -1;
+
+    step = add_step( plan, plan->deinterlace == VIDEO_DEINTERLACE_FIELD ? "deinterlace-field" : "deinterlace-frame",
+                     img, run_deinterlace );
+    step->deint = obe_deint_alloc( av_pix_fmt_desc_get( img->csp )->comp[0].depth );
+    if( !step->deint )
+        return -1;
+
+    step->width[0] = img->width;
+    step->height[0] = img->height;
+    step->width[1] = step->width[2] = AV_CEIL_RSHIFT( img->width, h_shift );
+    step->height[1] = step->height[2] = AV_CEIL_RSHIFT( img->height, v_shift );
+
+    plan->tff = vfilt->input_stream->tff;
+    plan->field_duration = av_rescale_q( 1, (AVRational){ vfilt->input_stream->timebase_num, vfilt->input_stream->timebase_den },
+                                         (AVRational){ 1, OBE_CLOCK } ) / 2;
+
+    return step_output( vfilt, step, img, img->csp, img->width, next_pool );
+}
+
+/* Scaler for one pyramid level, same pixel format in and out */
+static int compile_level( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_level_t *level, obe_image_t *in )
+{
+    obe_vid_filter_step_t *step = &level->step;
+    int width = step->out.width;
+    int height = step->out.height;
+
+    step->in_csp = in->csp;
+    step->in_width = in->width;
+    step->in_height = in->height;
+
+    if( height == in->height && compile_hscale( vfilt, step, in, width ) == 0 )
+    {
+        step->name = "pyramid-fixed";
+        return 0;
+    }
+
+    /* Scale the fields separately so they don't blend into each other */
+    level->fields = IS_INTERLACED( in->format ) && !vfilt->plan.deinterlace;
+    step->name = level->fields ? "pyramid-fields" : "pyramid";
+    step->sws_ctx = sws_getContext( in->width, in->height >> level->fields, in->csp,
+                                    width, height >> level->fields, in->csp,
+                                    SWS_FULL_CHR_H_INP | SWS_ACCURATE_RND | SWS_LANCZOS, NULL, NULL, NULL );
+    if( !step->sws_ctx )
+    {
+        fprintf( stderr, "Video scaling failed\n" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Every other video stream encoded from this input is a rendition of the main picture.
+ * Each distinct size is a level of a pyramid, scaled once per frame from the smallest
+ * level already built which covers it, and shared by every encoder of that size. */
+static int compile_renditions( obe_vid_filter_ctx_t *vfilt, obe_image_t *img )
+{
+    obe_vid_filter_plan_t *plan = &vfilt->plan;
+    obe_t *h = vfilt->h;
+    int size;
 
+    vfilt->rendition_buf_size = 0;
+
+    for( int i = 0; i < h->num_output_streams; i++ )
+    {
+        obe_output_stream_t *os = obe_core_get_output_stream_by_index( h, i );
+        obe_encoder_t *encoder = get_encoder( h, os->output_stream_id );
+
+        if( os == vfilt->output_stream || os->stream_action != STREAM_ENCODE || !encoder || !encoder->is_video ||
+            os->input_stream_id != vfilt->input_stream->input_stream_id )
+            continue;
+
+        if( plan->num_renditions == MAX_RENDITIONS )
+        {
+            fprintf( stderr, "Too many video renditions, at most %d\n", MAX_RENDITIONS );
+            return -1;
+        }
+
+        obe_vid_filter_rendition_t *rendition = &plan->renditions[plan->num_renditions++];
+        rendition->output_stream_id = os->output_stream_id;
+        rendition->width = os->avc_param.i_width;
+        rendition->height = os->avc_param.i_height;
+        rendition->level = -1;
+
+        if( rendition->width > img->width || rendition->height > img->height )
+        {
+            fprintf( stderr, "Video rendition %dx%d is larger than the main picture\n", rendition->width, rendition->height );
+            return -1;
+        }
+
+        if( rendition->width == img->width && rendition->height == img->height )
+        {
+            plan->share_main = 1;
+            continue;
+        }
+
+        /* Insert the size, keeping the levels largest first */
+        int j, area = rendition->width * rendition->height;
+        for( j = 0; j < plan->num_levels; j++ )
+        {
+            obe_image_t *out = &plan->levels[j].step.out;
+            if( out->width == rendition->width && out->height == rendition->height )
+                break;
+            if( out->width * out->height < area )
+            {
+                memmove( &plan->levels[j+1], &plan->levels[j], (plan->num_levels - j) * sizeof(plan->levels[0]) );
+                memset( &plan->levels[j], 0, sizeof(plan->levels[0]) );
+                plan->num_levels++;
+                break;
+            }
+        }
+        if( j == plan->num_levels )
+            plan->num_levels++;
+
+        size = image_layout( &plan->levels[j].step.out, img->csp, rendition->width, rendition->height, img->format );
+        if( size < 0 )
+            return -1;
+        vfilt->rendition_buf_size = FFMAX( vfilt->rendition_buf_size, size );
+    }
+
+    for( int i = 0; i < plan->num_levels; i++ )
+    {
+        obe_vid_filter_level_t *level = &plan->levels[i];
+
+        level->src = -1;
+        for( int j = 0; j < i; j++ )
+        {
+            if( plan->levels[j].step.out.width >= level->step.out.width &&
+                plan->levels[j].step.out.height >= level->step.out.height )
+                level->src = j;
+        }
+
+        if( compile_level( vfilt, level, level->src < 0 ? img : &plan->levels[level->src].step.out ) < 0 )
+            return -1;
+    }
+
+    for( int i = 0; i < plan->num_renditions; i++ )
+    {
+        obe_vid_filter_rendition_t *rendition = &plan->renditions[i];
+        for( int j = 0; j < plan->num_levels; j++ )
+        {
+            if( plan->levels[j].step.out.width == rendition->width && plan->levels[j].step.out.height == rendition->height )
+                rendition->level = j;
+        }
+    }
+
+    if( plan->share_main )
+    {
+        size = image_layout( &plan->main, img->csp, img->width, img->height, img->format );
+        if( size < 0 )
+            return -1;
+        vfilt->rendition_buf_size = FFMAX( vfilt->rendition_buf_size, size );
+    }
+
+    return 0;
+}
+
+/* Work out, once, everything the per frame loop used to decide on every frame */
+static int compile_plan( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame )
+{
+    obe_vid_filter_plan_t *plan = &vfilt->plan;
+    obe_vid_filter_step_t *step;
+    obe_image_t img = raw_frame->img;
+    int width = vfilt->output_stream->avc_param.i_width;
+    int h_shift, v_shift;
+    int next_pool = 0;
+
+    /* Pictures of the old format are no use to the new plan */
+    flush_deinterlace( vfilt );
+    flush_carried_user_data( vfilt );
+
+    pthread_mutex_lock( &plan_mutex );
+
+    free_plan( plan );
+    vfilt->buf_size = 0;
+    plan->csp = img.csp;
+    plan->width = img.width;
+    plan->height = img.height;
+    plan->format = img.format;
+
+    /* TODO: scale 8-bit to 10-bit
+     * TODO: convert from 4:2:0 to 4:2:2 */
+
+    /* Drop frames before doing any work on them */
+    if( vfilt->output_stream->decimate > 1 && !IS_INTERLACED( img.format ) )
+    {
+        plan->decimate = vfilt->output_stream->decimate;
+        plan->frame_duration = av_rescale_q( 1, (AVRational){ vfilt->input_stream->timebase_num, vfilt->input_stream->timebase_den },
+                                             (AVRational){ 1, OBE_CLOCK } );
+        add_step( plan, "decimate", &img, run_decimate );
+    }
+
+    if( img.format == INPUT_VIDEO_FORMAT_PAL && get_kernels( img.csp, IS_INTERLACED( img.format ) ) )
+    {
+        step = add_step( plan, "blank-lines", &img, run_blank_lines );
+        step->kernels = get_kernels( img.csp, IS_INTERLACED( img.format ) );
+        step->in_place = 1;
+        if( step_output( vfilt, step, &img, img.csp, img.width, &next_pool ) < 0 )
+            goto fail;
+    }
+
+    /* Analyse the picture as it arrived, before it is deinterlaced or scaled */
+    if( vfilt->analytics )
+        add_step( plan, "analytics", &img, run_analytics );
+
+    /* Deinterlace before anything scales the picture */
+    if( IS_INTERLACED( img.format ) && vfilt->output_stream->deinterlace )
+    {
+        plan->deinterlace = vfilt->output_stream->deinterlace;
+        if( compile_deinterlace( vfilt, &img, &next_pool ) < 0 )
+            goto fail;
+    }
+    int interlaced = IS_INTERLACED( img.format ) && !plan->deinterlace;
+    enum AVPixelFormat down_csp = vfilt->target_csp == X264_CSP_I420 ? downconvert_csp( img.csp ) : AV_PIX_FMT_NONE;
+
+    /* Resize if necessary. Together with colourspace conversion if progressive and
+     * there are no kernels to downconvert the format, or the picture is semiplanar.
+     * Splitting the chroma plane leaves the lines alone so is safe on fields */
+    if( img.width != width || planar_csp( img.csp ) != img.csp ||
+        (!interlaced && vfilt->target_csp == X264_CSP_I420 && down_csp == AV_PIX_FMT_NONE) )
+    {
+        enum AVPixelFormat dst_pix_fmt;
+
+        if( interlaced || down_csp != AV_PIX_FMT_NONE || vfilt->target_csp != X264_CSP_I420 )
+            dst_pix_fmt = planar_csp( img.csp );
+        else
+            dst_pix_fmt = img.csp == AV_PIX_FMT_YUV422P10 ? AV_PIX_FMT_YUV420P10 : AV_PIX_FMT_YUV420P;
+
+        step = add_step( plan, "resize", &img, run_resize );
+        if( dst_pix_fmt == img.csp && compile_hscale( vfilt, step, &img, width ) == 0 )
+        {
+            step->name = "resize-fixed";
+            step->run = run_hscale;
+        }
+        else
+        {
+            step->sws_ctx = sws_getContext( img.width, img.height, img.csp, width, img.height, dst_pix_fmt,
+                                            SWS_FULL_CHR_H_INP | SWS_ACCURATE_RND | SWS_LANCZOS, NULL, NULL, NULL );
+            if( !step->sws_ctx )
+            {
+                fprintf( stderr, "Video scaling failed\n" );
+                goto fail;
+            }
+        }
+
+        if( step_output( vfilt, step, &img, dst_pix_fmt, width, &next_pool ) < 0 )
+            goto fail;
+    }
+
+    if( av_pix_fmt_get_chroma_sub_sample( img.csp, &h_shift, &v_shift ) < 0 )
+        goto fail;
+
+    /* Downconvert if input is 4:2:2 and target is 4:2:0, within each field when interlaced */
+    if( h_shift == 1 && v_shift == 0 && vfilt->target_csp == X264_CSP_I420 )
+    {
+        down_csp = downconvert_csp( img.csp );
+        if( down_csp == AV_PIX_FMT_NONE )
+        {
+            fprintf( stderr, "Video filter: cannot downconvert %s\n", av_get_pix_fmt_name( img.csp ) );
+            goto fail;
+        }
+
+        step = add_step( plan, interlaced ? "downconvert-interlaced" : "downconvert-progressive", &img, run_downconvert );
+        step->kernels = get_kernels( img.csp, interlaced );
+        step_plane_sizes( step, down_csp, &img );
+        step->in_place = 1;
+        if( step_output( vfilt, step, &img, down_csp, img.width, &next_pool ) < 0 )
+            goto fail;
+    }
+
+    const AVPixFmtDescriptor *pfd = av_pix_fmt_desc_get( img.csp );
+    if( pfd->comp[0].depth == 10 && vfilt->target_depth == 8 )
+    {
+        step = add_step( plan, "dither-10-to-8", &img, run_dither );
+        step_plane_sizes( step, img.csp, &img );
+        step->in_place = 1;
+        step->in_place_shift = 1;
+        if( step_output( vfilt, step, &img, img.csp == AV_PIX_FMT_YUV422P10 ? AV_PIX_FMT_YUV422P : AV_PIX_FMT_YUV420P,
+                         img.width, &next_pool ) < 0 )
+            goto fail;
+    }
+
+    /* Burnt into the picture as encoded, renditions and thumbnails show it too.
+     * The blend works on three planes */
+    if( vfilt->burnin && !csp_is_planar( img.csp ) )
+        fprintf( stderr, "Video filter: no burn-in on %s pictures\n", av_get_pix_fmt_name( img.csp ) );
+    else if( vfilt->burnin )
+    {
+        step = add_step( plan, "burn-in", &img, run_burnin );
+        step->in_place = 1;
+        if( step_output( vfilt, step, &img, img.csp, img.width, &next_pool ) < 0 )
+            goto fail;
+    }
+
+    if( !csp_is_planar( img.csp ) )
+    {
+        fprintf( stderr, "Video filter: encoders cannot take %s\n", av_get_pix_fmt_name( img.csp ) );
+        goto fail;
+    }
+
+    add_step( plan, "user-data", &img, run_user_data );
+    add_step( plan, "default-sar", &img, run_default_sar );
+
+    if( vfilt->fc_ctx )
+        add_step( plan, "jpeg-thumbnail", &img, run_jpg );
 #if DO_CRYSTAL_FP
-    struct filter_analyze_fp_ctx *fp_ctx = NULL;
-    filter_analyze_fp_alloc(&fp_ctx);
+    add_step( plan, "crystal-fp", &img, run_crystal_fp );
 #endif
 
+    if( compile_renditions( vfilt, &img ) < 0 )
+        goto fail;
+
+    plan->compiled = 1;
+    pthread_mutex_unlock( &plan_mutex );
+
+    return 0;
+
+fail:
+    free_plan( plan );
+    pthread_mutex_unlock( &plan_mutex );
+
+    return -1;
+}
+
+static int plan_is_stale( obe_vid_filter_plan_t *plan, obe_raw_frame_t *raw_frame )
+{
+    return !plan->compiled || raw_frame->reset_obe ||
+           plan->csp != raw_frame->img.csp || plan->width != raw_frame->img.width ||
+           plan->height != raw_frame->img.height || plan->format != raw_frame->img.format;
+}
+
+void video_filter_show( obe_filter_t *filter )
+{
+    pthread_mutex_lock( &plan_mutex );
+
+    obe_vid_filter_ctx_t *vfilt = filter->priv;
+    if( !vfilt || !vfilt->plan.compiled )
+    {
+        printf( "Video filter: no plan compiled yet\n" );
+        pthread_mutex_unlock( &plan_mutex );
+        return;
+    }
+
+    obe_vid_filter_plan_t *plan = &vfilt->plan;
+    printf( "Video filter: input %s %dx%d, %d steps, %zu byte buffers\n", av_get_pix_fmt_name( plan->csp ),
+            plan->width, plan->height, plan->num_steps, vfilt->buf_size );
+
+    for( int i = 0; i < plan->num_steps; i++ )
+    {
+        obe_vid_filter_step_t *step = &plan->steps[i];
+        printf( "  %d: %-24s %s %dx%d -> %s %dx%d%s%s\n", i, step->name,
+                av_get_pix_fmt_name( step->in_csp ), step->in_width, step->in_height,
+                av_get_pix_fmt_name( step->out.csp ), step->out.width, step->out.height,
+                step->pool_idx < 0 ? "" : step->pool_idx ? " (pong)" : " (ping)",
+                step->in_place ? " in place when writable" : "" );
+        if( step->hscale[0] )
+            printf( "     %s\n", obe_hscale_name( step->hscale[0] ) );
+        if( step->deint )
+            printf( "     %s, %s field first\n", obe_deint_name( step->deint ), plan->tff ? "top" : "bottom" );
+        if( step->kernels )
+            printf( "     %s kernels\n", step->kernels->name );
+    }
+
+    if( plan->num_renditions )
+        printf( "Renditions: %d levels, %zu byte buffers%s\n", plan->num_levels, vfilt->rendition_buf_size,
+                plan->share_main ? ", main picture shared" : "" );
+
+    for( int i = 0; i < plan->num_levels; i++ )
+    {
+        obe_vid_filter_step_t *step = &plan->levels[i].step;
+        printf( "  L%d: %-23s %dx%d -> %dx%d from %s", i, step->name, step->in_width, step->in_height,
+                step->out.width, step->out.height, plan->levels[i].src < 0 ? "main" : "level" );
+        if( plan->levels[i].src >= 0 )
+            printf( " L%d", plan->levels[i].src );
+        printf( "%s%s\n", step->hscale[0] ? ", " : "", step->hscale[0] ? obe_hscale_name( step->hscale[0] ) : "" );
+    }
+
+    for( int i = 0; i < plan->num_renditions; i++ )
+    {
+        obe_vid_filter_rendition_t *rendition = &plan->renditions[i];
+        printf( "  output stream %d: %dx%d", rendition->output_stream_id, rendition->width, rendition->height );
+        if( rendition->level < 0 )
+            printf( " shares the main picture\n" );
+        else
+            printf( " from L%d\n", rendition->level );
+    }
+
+    pthread_mutex_unlock( &plan_mutex );
+}
+
+/* Returns 1 when a step took the picture and dropped or held the frame back */
+static int run_steps( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame, int first_step )
+{
+    for( int i = first_step; i < vfilt->plan.num_steps; i++ )
+    {
+        obe_vid_filter_step_t *step = &vfilt->plan.steps[i];
+        int ret = step->run( vfilt, step, raw_frame );
+        if( ret )
+            return ret;
+    }
+
+    return 0;
+}
+
+static int output_frame( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame )
+{
+    /* Before the main picture is queued, its encoder releases it */
+    if( vfilt->plan.num_renditions && run_renditions( vfilt, raw_frame ) < 0 )
+        return -1;
+
+    add_to_encode_queue( vfilt->h, raw_frame, 0 );
+
+    return 0;
+}
+
+static void *start_filter_video( void *ptr )
+{
+    obe_vid_filter_params_t *filter_params = ptr;
+    obe_t *h = filter_params->h;
+    obe_filter_t *filter = filter_params->filter;
+    obe_raw_frame_t *raw_frame;
+
     obe_vid_filter_ctx_t *vfilt = calloc( 1, sizeof(*vfilt) );
     if( !vfilt )
     {
@@ -728,12 +1880,39 @@ static void *start_filter_video( void *ptr )
     }
 
     init_filter( vfilt );
+    vfilt->h = h;
+    vfilt->input_stream = filter_params->input_stream;
+    vfilt->output_stream = get_output_stream_by_id(h, 0); /* FIXME when output_stream_id for video is not zero */
+    vfilt->target_csp = filter_params->target_csp;
+    vfilt->target_depth = filter_params->target_depth;
+    vfilt->analytics = filter->video_analytics;
+
+    vfilt->pool[0] = obe_buf_pool_alloc( "video filter ping" );
+    vfilt->pool[1] = obe_buf_pool_alloc( "video filter pong" );
+    vfilt->rendition_pool = obe_buf_pool_alloc( "video filter renditions" );
+    if( !vfilt->pool[0] || !vfilt->pool[1] || !vfilt->rendition_pool )
+    {
+        fprintf( stderr, "Malloc failed\n" );
+        goto end;
+    }
+
+    if( vfilt->output_stream->thumbnail_interval > 0 &&
+        filter_compress_alloc( &vfilt->fc_ctx, vfilt->output_stream->thumbnail_width, vfilt->output_stream->thumbnail_interval ) < 0 )
+        syslog( LOG_ERR, "Couldn't start the thumbnail thread, no thumbnails\n" );
+
+    if( vfilt->output_stream->osd && !(vfilt->burnin = obe_burnin_alloc()) )
+        syslog( LOG_ERR, "Malloc failed, no OSD\n" );
+
+#if DO_CRYSTAL_FP
+    filter_analyze_fp_alloc(&vfilt->fp_ctx);
+#endif
+
+    pthread_mutex_lock( &plan_mutex );
+    filter->priv = vfilt;
+    pthread_mutex_unlock( &plan_mutex );
 
     while( 1 )
     {
-        /* TODO: support resolution changes */
-        /* TODO: support changes in pixel format */
-
         pthread_mutex_lock( &filter->queue.mutex );
 
         while( !filter->queue.size && !filter->cancel_thread )
@@ -749,82 +1928,66 @@ static void *start_filter_video( void *ptr )
 //PRINT_OBE_IMAGE(&raw_frame->img, "VIDEO FILTER  PRE");
         pthread_mutex_unlock( &filter->queue.mutex );
 
-        /* TODO: scale 8-bit to 10-bit
-         * TODO: convert from 4:2:0 to 4:2:2 */
+        if( plan_is_stale( &vfilt->plan, raw_frame ) && compile_plan( vfilt, raw_frame ) < 0 )
+            goto end;
 
-        if( raw_frame->img.format == INPUT_VIDEO_FORMAT_PAL )
-            blank_lines( raw_frame );
+        int ret = run_steps( vfilt, raw_frame, 0 );
+        if( ret < 0 )
+            goto end;
 
-        /* Resize if necessary. Together with colourspace conversion if progressive */
-        if( raw_frame->img.width != output_stream->avc_param.i_width || (!IS_INTERLACED( raw_frame->img.format ) &&
-                                                                          filter_params->target_csp == X264_CSP_I420 ) )
-        {
-            if( resize_frame( vfilt, raw_frame, output_stream->avc_param.i_width ) < 0 )
-                goto end;
-        }
-//PRINT_OBE_IMAGE(&raw_frame->img, "RESIZE POST      ");
+        remove_from_queue( &filter->queue );
+//PRINT_OBE_IMAGE(&raw_frame->img, "VIDEO FILTER POST");
 
-        if( av_pix_fmt_get_chroma_sub_sample( raw_frame->img.csp, &h_shift, &v_shift ) < 0 )
+        if( ret )
+            raw_frame->release_frame( raw_frame );
+        else if( output_frame( vfilt, raw_frame ) < 0 )
             goto end;
 
-        /* Downconvert using interlaced scaling if input is 4:2:2 and target is 4:2:0 */
-        if( h_shift == 1 && v_shift == 0 && filter_params->target_csp == X264_CSP_I420 )
+        /* Field rate deinterlacing made a second frame, it goes through the rest of the plan */
+        if( vfilt->second_field )
         {
-            /* Convert from YUV422P10 to YUV420P10, chroma subsample, specific to interlaced. */
-            if( downconvert_image_interlaced( vfilt, raw_frame ) < 0 )
+            raw_frame = vfilt->second_field;
+            vfilt->second_field = NULL;
+            if( run_steps( vfilt, raw_frame, vfilt->second_field_step ) < 0 || output_frame( vfilt, raw_frame ) < 0 )
                 goto end;
-//PRINT_OBE_IMAGE(&raw_frame->img, "DownCo POST      ");
         }
+    }
 
-        pfd = av_pix_fmt_desc_get( raw_frame->img.csp );
-        if( pfd->comp[0].depth == 10 && X264_BIT_DEPTH == 8 )
+end:
+    if( vfilt )
+    {
+        pthread_mutex_lock( &plan_mutex );
+        filter->priv = NULL;
+        free_plan( &vfilt->plan );
+        pthread_mutex_unlock( &plan_mutex );
+
+        flush_deinterlace( vfilt );
+        flush_carried_user_data( vfilt );
+        if( vfilt->second_field )
         {
-            /* Convert from 10bit to 8bit and apply a video dither. */
-            if( dither_image( vfilt, raw_frame ) < 0 )
-                goto end;
+            vfilt->second_field->release_data( vfilt->second_field );
+            vfilt->second_field->release_frame( vfilt->second_field );
         }
-//PRINT_OBE_IMAGE(&raw_frame->img, "DITHER POST      ");
 
-        if( encapsulate_user_data( raw_frame, input_stream ) < 0 )
-            goto end;
-
-        /* If SAR, on an SD stream, has not been updated by AFD or WSS, set to default 4:3
-         * TODO: make this user-choosable. OBE will prioritise any SAR information from AFD or WSS over any user settings */
-        if( raw_frame->sar_width == 1 && raw_frame->sar_height == 1 )
+        /* Deferred until the last frame from these pools has been encoded */
+        for( int i = 0; i < 2; i++ )
         {
-            set_sar( raw_frame, IS_SD( raw_frame->img.format ) ? output_stream->is_wide : 1 );
-            raw_frame->sar_guess = 1;
+            if( vfilt->pool[i] )
+                obe_buf_pool_free( vfilt->pool[i] );
         }
+        if( vfilt->rendition_pool )
+            obe_buf_pool_free( vfilt->rendition_pool );
 
-        remove_from_queue( &filter->queue );
-//PRINT_OBE_IMAGE(&raw_frame->img, "VIDEO FILTER POST");
-
-#if DO_JPG
-	filter_compress_jpg(fc_ctx, raw_frame);
-#endif
+        /* Drops its reference to a picture still being compressed */
+        filter_compress_free( vfilt->fc_ctx );
+        obe_burnin_free( vfilt->burnin );
 #if DO_CRYSTAL_FP
-	filter_analyze_fp_process(fp_ctx, raw_frame);
+        filter_analyze_fp_free(vfilt->fp_ctx);
 #endif
-
-        add_to_encode_queue( h, raw_frame, 0 );
-    }
-
-end:
-    if( vfilt )
-    {
-        if( vfilt->sws_ctx )
-            sws_freeContext( vfilt->sws_ctx );
-
         free( vfilt );
     }
 
     free( filter_params );
-#if DO_JPG
-    filter_compress_free(fc_ctx);
-#endif
-#if DO_CRYSTAL_FP
-    filter_analyze_fp_free(fp_ctx);
-#endif
 
     return NULL;
 }
@@ -35,8 +35,12 @@ typedef struct
     obe_filter_t *filter;
     obe_int_input_stream_t *input_stream;
     int target_csp;
+    int target_depth; /* Bits per sample the encoder takes */
 } obe_vid_filter_params_t;
 
 extern const obe_vid_filter_func_t video_filter;
 
+/* Print the compiled plan of a running video filter, for 'show filter' */
+void video_filter_show( obe_filter_t *filter );
+
 #endif
@@ -32,8 +32,14 @@ void obe_downsample_chroma_row_top_sse2( uint16_t *src, uint16_t *dst, int width
 void obe_downsample_chroma_row_bottom_sse2( uint16_t *src, uint16_t *dst, int width, int stride );
 void obe_downsample_chroma_row_top_avx( uint16_t *src, uint16_t *dst, int width, int stride );
 void obe_downsample_chroma_row_bottom_avx( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_top_avx2( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_bottom_avx2( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_top_avx512( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_bottom_avx512( uint16_t *src, uint16_t *dst, int width, int stride );
 
 void obe_dither_row_10_to_8_sse4( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride );
 void obe_dither_row_10_to_8_avx( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride );
+void obe_dither_row_10_to_8_avx2( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride );
+void obe_dither_row_10_to_8_avx512( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride );
 
 #endif
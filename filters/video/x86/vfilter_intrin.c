@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include <immintrin.h>
+#include "vfilter.h"
+
+/* AVX2 and AVX-512 versions of the vfilter.asm rows. yasm and this x86inc
+ * can't emit AVX-512, so these are intrinsics built for their instruction set
+ * whatever the compiler flags, and only called once obe_simd_select() has seen
+ * the CPU run them. Unlike the asm they stop at the end of the row. */
+
+#define AVX2   __attribute__((target("avx2")))
+#define AVX512 __attribute__((target("avx512f,avx512bw,avx512vl")))
+
+/* Chroma of one field, dst = (w0*src + w1*srcf + 2) >> 2, srcf two rows down */
+#define DOWNSAMPLE_ROW( name, w0, w1 ) \
+AVX2 void obe_downsample_chroma_row_##name##_avx2( uint16_t *src, uint16_t *dst, int width, int stride ) \
+{ \
+    const uint16_t *srcf = src + stride; \
+    const __m256i two = _mm256_set1_epi16( 2 ); \
+    const __m256i three = _mm256_set1_epi16( 3 ); \
+    int n = width / 2, i = 0; \
+\
+    for( ; i + 16 <= n; i += 16 ) \
+    { \
+        __m256i a = _mm256_loadu_si256( (const __m256i *)&src[i] ); \
+        __m256i b = _mm256_loadu_si256( (const __m256i *)&srcf[i] ); \
+        __m256i r = _mm256_add_epi16( _mm256_mullo_epi16( w0 == 3 ? a : b, three ), \
+                                      _mm256_add_epi16( w0 == 3 ? b : a, two ) ); \
+        _mm256_storeu_si256( (__m256i *)&dst[i], _mm256_srli_epi16( r, 2 ) ); \
+    } \
+\
+    for( ; i < n; i++ ) \
+        dst[i] = (w0*src[i] + w1*srcf[i] + 2) >> 2; \
+} \
+\
+AVX512 void obe_downsample_chroma_row_##name##_avx512( uint16_t *src, uint16_t *dst, int width, int stride ) \
+{ \
+    const uint16_t *srcf = src + stride; \
+    const __m512i two = _mm512_set1_epi16( 2 ); \
+    const __m512i three = _mm512_set1_epi16( 3 ); \
+    int n = width / 2; \
+\
+    for( int i = 0; i < n; i += 32 ) \
+    { \
+        __mmask32 k = n - i >= 32 ? ~0u : ( 1u << ( n - i ) ) - 1; \
+        __m512i a = _mm512_maskz_loadu_epi16( k, &src[i] ); \
+        __m512i b = _mm512_maskz_loadu_epi16( k, &srcf[i] ); \
+        __m512i r = _mm512_add_epi16( _mm512_mullo_epi16( w0 == 3 ? a : b, three ), \
+                                      _mm512_add_epi16( w0 == 3 ? b : a, two ) ); \
+        _mm512_mask_storeu_epi16( &dst[i], k, _mm512_srli_epi16( r, 2 ) ); \
+    } \
+}
+
+DOWNSAMPLE_ROW( top, 3, 1 )
+DOWNSAMPLE_ROW( bottom, 1, 3 )
+
+/* (src + dither) * 511 >> 11, as the high half of (src + dither) << 5 times 511.
+ * Saturated to 8 bits like the asm */
+AVX2 void obe_dither_row_10_to_8_avx2( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride )
+{
+    const __m256i d = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i *)dither ) );
+    const __m256i scale = _mm256_set1_epi16( 511 );
+    int k = 0;
+
+    for( ; k + 32 <= width; k += 32 )
+    {
+        __m256i a = _mm256_add_epi16( _mm256_loadu_si256( (const __m256i *)&src[k] ), d );
+        __m256i b = _mm256_add_epi16( _mm256_loadu_si256( (const __m256i *)&src[k+16] ), d );
+        a = _mm256_mulhi_epu16( _mm256_slli_epi16( a, 5 ), scale );
+        b = _mm256_mulhi_epu16( _mm256_slli_epi16( b, 5 ), scale );
+        _mm256_storeu_si256( (__m256i *)&dst[k], _mm256_permute4x64_epi64( _mm256_packus_epi16( a, b ), 0xd8 ) );
+    }
+
+    for( ; k < width; k++ )
+    {
+        int v = (src[k] + dither[k&7])*511 >> 11;
+        dst[k] = v > 255 ? 255 : v;
+    }
+}
+
+AVX512 void obe_dither_row_10_to_8_avx512( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride )
+{
+    const __m512i d = _mm512_broadcast_i32x4( _mm_loadu_si128( (const __m128i *)dither ) );
+    const __m512i scale = _mm512_set1_epi16( 511 );
+
+    for( int k = 0; k < width; k += 32 )
+    {
+        __mmask32 m = width - k >= 32 ? ~0u : ( 1u << ( width - k ) ) - 1;
+        __m512i a = _mm512_add_epi16( _mm512_maskz_loadu_epi16( m, &src[k] ), d );
+        a = _mm512_mulhi_epu16( _mm512_slli_epi16( a, 5 ), scale );
+        _mm256_mask_storeu_epi8( &dst[k], m, _mm512_cvtusepi16_epi8( a ) );
+    }
+}
@@ -366,6 +366,8 @@ lastTimestamp = frame->timestamp;
 	//raw_frame->avfm.hw_audio_correction_clk = clock_offset;
 	//avfm_dump(&raw_frame->avfm);
 
+	obe_cadence_video(&ctx->h->input_cadence, pts, av_rescale_q(1, ctx->v_timebase, (AVRational){1, OBE_CLOCK}), &rf->avfm);
+
 	if (add_to_filter_queue(ctx->h, rf) < 0 ) {
 	}
 }
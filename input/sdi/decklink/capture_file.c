@@ -0,0 +1,419 @@
+#include "capture_file.h"
+#include "common/bufpool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define MODULE_PREFIX "[capture-file]: "
+
+/* Records in flight between the capture callback and the disk. At 1080i
+ * that's roughly a second of video.
+ */
+#define WRITER_QUEUE_DEPTH 32
+
+struct capture_file_writer_s
+{
+	int fd;
+	char fn[256];
+	int write_error;
+
+	obe_buf_pool_t *pool;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int terminate;
+
+	obe_buf_t *queue[WRITER_QUEUE_DEPTH];
+	int queue_head;
+	int queue_depth;
+
+	uint32_t audio_frame_bytes; /* num_channels * 4 */
+	uint64_t frame_nr;
+	uint64_t dropped;
+
+	/* Owned by the writer thread */
+	uint64_t offset;
+	uint64_t *index;
+	uint64_t count;
+	uint64_t index_alloc;
+};
+
+struct capture_file_reader_s
+{
+	uint8_t *addr;
+	size_t size;
+	size_t data_end;
+
+	const struct capture_file_header_s *hdr;
+	const uint64_t *index;
+	uint64_t *index_alloc; /* When we had to build the index ourselves */
+	uint64_t count;
+};
+
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void writer_append(struct capture_file_writer_s *w, const uint8_t *buf, size_t len, int is_record)
+{
+	if (w->write_error)
+		return;
+
+	if (write_all(w->fd, buf, len) < 0) {
+		syslog(LOG_ERR, MODULE_PREFIX "Write to '%s' failed, %s. Recording stopped.", w->fn, strerror(errno));
+		fprintf(stderr, MODULE_PREFIX "Write to '%s' failed, %s. Recording stopped.\n", w->fn, strerror(errno));
+		w->write_error = 1;
+		return;
+	}
+
+	if (is_record) {
+		if (w->count == w->index_alloc) {
+			uint64_t n = w->index_alloc ? w->index_alloc * 2 : 4096;
+			uint64_t *p = (uint64_t *)realloc(w->index, n * sizeof(uint64_t));
+			if (!p) {
+				syslog(LOG_ERR, MODULE_PREFIX "Malloc failed, index will be rebuilt on replay\n");
+				w->write_error = 1;
+				return;
+			}
+			w->index = p;
+			w->index_alloc = n;
+		}
+		w->index[w->count++] = w->offset;
+	}
+
+	w->offset += len;
+}
+
+static void *writer_thread(void *p)
+{
+	struct capture_file_writer_s *w = (struct capture_file_writer_s *)p;
+
+	while (1) {
+		pthread_mutex_lock(&w->mutex);
+		while (w->queue_depth == 0 && !w->terminate)
+			pthread_cond_wait(&w->cond, &w->mutex);
+
+		if (w->queue_depth == 0) {
+			pthread_mutex_unlock(&w->mutex);
+			break;
+		}
+
+		obe_buf_t *buf = w->queue[w->queue_head];
+		w->queue_head = (w->queue_head + 1) % WRITER_QUEUE_DEPTH;
+		w->queue_depth--;
+		pthread_mutex_unlock(&w->mutex);
+
+		const struct capture_file_record_s *rec = (const struct capture_file_record_s *)buf->data;
+		writer_append(w, buf->data, sizeof(*rec) + rec->payload_size, 1);
+
+		obe_buf_unref(buf);
+	}
+
+	return NULL;
+}
+
+int capture_file_writer_alloc(struct capture_file_writer_s **writer, const char *fn, const struct capture_file_header_s *hdr)
+{
+	struct capture_file_writer_s *w = (struct capture_file_writer_s *)calloc(1, sizeof(*w));
+	if (!w)
+		return -1;
+
+	snprintf(w->fn, sizeof(w->fn), "%s", fn);
+	w->audio_frame_bytes = hdr->num_channels * sizeof(int32_t);
+	w->fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0644);
+	if (w->fd < 0) {
+		fprintf(stderr, MODULE_PREFIX "Unable to create '%s', %s\n", fn, strerror(errno));
+		free(w);
+		return -1;
+	}
+
+	struct capture_file_header_s h = *hdr;
+	memcpy(h.magic, CAPTURE_FILE_MAGIC, sizeof(h.magic));
+	h.version = CAPTURE_FILE_VERSION;
+	h.header_size = sizeof(h);
+	writer_append(w, (const uint8_t *)&h, sizeof(h), 0);
+	if (w->write_error) {
+		close(w->fd);
+		free(w);
+		return -1;
+	}
+
+	w->pool = obe_buf_pool_alloc("capture file");
+	if (!w->pool) {
+		close(w->fd);
+		free(w);
+		return -1;
+	}
+
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	if (pthread_create(&w->thread, NULL, writer_thread, w) < 0) {
+		obe_buf_pool_free(w->pool);
+		close(w->fd);
+		free(w);
+		return -1;
+	}
+	pthread_setname_np(w->thread, "obe-capfile");
+
+	*writer = w;
+	return 0;
+}
+
+void capture_file_writer_free(struct capture_file_writer_s *w)
+{
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->mutex);
+	w->terminate = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	pthread_join(w->thread, NULL);
+
+	if (w->index) {
+		struct capture_file_trailer_s t;
+		memset(&t, 0, sizeof(t));
+		t.magic = CAPTURE_FILE_TRAILER_MAGIC;
+		t.count = w->count;
+		t.index_offset = w->offset;
+		writer_append(w, (const uint8_t *)w->index, w->count * sizeof(uint64_t), 0);
+		writer_append(w, (const uint8_t *)&t, sizeof(t), 0);
+	}
+
+	printf(MODULE_PREFIX "Closed '%s', %" PRIu64 " frames, %" PRIu64 " dropped\n", w->fn, w->count, w->dropped);
+
+	close(w->fd);
+	obe_buf_pool_free(w->pool);
+	pthread_mutex_destroy(&w->mutex);
+	pthread_cond_destroy(&w->cond);
+	free(w->index);
+	free(w);
+}
+
+int capture_file_writer_write(struct capture_file_writer_s *w, struct capture_file_record_s *rec,
+	const uint32_t *vanc_line_nr, void * const *vanc_lines, const void *video, const void *audio)
+{
+	size_t vanc_nr_len = rec->num_vanc_lines * sizeof(uint32_t);
+	size_t vanc_len = (size_t)rec->num_vanc_lines * rec->row_bytes;
+	size_t video_len = video ? (size_t)rec->height * rec->row_bytes : 0;
+	size_t audio_len = audio ? (size_t)rec->sample_frame_count * w->audio_frame_bytes : 0;
+
+	size_t payload = CAPTURE_FILE_ALIGN(vanc_nr_len) + CAPTURE_FILE_ALIGN(vanc_len) +
+		CAPTURE_FILE_ALIGN(video_len) + CAPTURE_FILE_ALIGN(audio_len);
+
+	rec->magic = CAPTURE_FILE_RECORD_MAGIC;
+	rec->flags = (video ? CAPTURE_FILE_HAS_VIDEO : 0) | (audio ? CAPTURE_FILE_HAS_AUDIO : 0);
+	rec->frame_nr = w->frame_nr++;
+	rec->payload_size = payload;
+
+	pthread_mutex_lock(&w->mutex);
+	int full = w->queue_depth == WRITER_QUEUE_DEPTH || w->write_error;
+	if (full)
+		w->dropped++;
+	pthread_mutex_unlock(&w->mutex);
+	if (full)
+		return -1;
+
+	obe_buf_t *buf = obe_buf_pool_get(w->pool, sizeof(*rec) + payload);
+	if (!buf)
+		return -1;
+
+	uint8_t *p = buf->data;
+	memcpy(p, rec, sizeof(*rec));
+	p += sizeof(*rec);
+
+	memcpy(p, vanc_line_nr, vanc_nr_len);
+	p += CAPTURE_FILE_ALIGN(vanc_nr_len);
+
+	for (uint32_t i = 0; i < rec->num_vanc_lines; i++)
+		memcpy(p + ((size_t)i * rec->row_bytes), vanc_lines[i], rec->row_bytes);
+	p += CAPTURE_FILE_ALIGN(vanc_len);
+
+	if (video_len)
+		memcpy(p, video, video_len);
+	p += CAPTURE_FILE_ALIGN(video_len);
+
+	if (audio_len)
+		memcpy(p, audio, audio_len);
+
+	pthread_mutex_lock(&w->mutex);
+	w->queue[(w->queue_head + w->queue_depth) % WRITER_QUEUE_DEPTH] = buf;
+	w->queue_depth++;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+
+	return 0;
+}
+
+static int record_valid(struct capture_file_reader_s *r, uint64_t offset)
+{
+	if (offset + sizeof(struct capture_file_record_s) > r->data_end)
+		return 0;
+
+	const struct capture_file_record_s *rec = (const struct capture_file_record_s *)(r->addr + offset);
+	if (rec->magic != CAPTURE_FILE_RECORD_MAGIC)
+		return 0;
+
+	return offset + sizeof(*rec) + rec->payload_size <= r->data_end;
+}
+
+static int build_index(struct capture_file_reader_s *r)
+{
+	uint64_t alloc = 0;
+	uint64_t offset = r->hdr->header_size;
+
+	r->count = 0;
+	while (record_valid(r, offset)) {
+		if (r->count == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			uint64_t *p = (uint64_t *)realloc(r->index_alloc, alloc * sizeof(uint64_t));
+			if (!p)
+				return -1;
+			r->index_alloc = p;
+		}
+		r->index_alloc[r->count++] = offset;
+
+		const struct capture_file_record_s *rec = (const struct capture_file_record_s *)(r->addr + offset);
+		offset += sizeof(*rec) + rec->payload_size;
+	}
+
+	r->index = r->index_alloc;
+	return 0;
+}
+
+int capture_file_reader_open(struct capture_file_reader_s **reader, const char *fn)
+{
+	int fd = open(fn, O_RDONLY | O_LARGEFILE);
+	if (fd < 0) {
+		fprintf(stderr, MODULE_PREFIX "Unable to open '%s', %s\n", fn, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct capture_file_header_s)) {
+		fprintf(stderr, MODULE_PREFIX "'%s' is not a capture file\n", fn);
+		close(fd);
+		return -1;
+	}
+
+	/* Private and writable, so the consumer can modify frames in place without touching the file. */
+	void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, MODULE_PREFIX "Unable to map '%s', %s\n", fn, strerror(errno));
+		return -1;
+	}
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+	struct capture_file_reader_s *r = (struct capture_file_reader_s *)calloc(1, sizeof(*r));
+	if (!r) {
+		munmap(addr, st.st_size);
+		return -1;
+	}
+	r->addr = (uint8_t *)addr;
+	r->size = r->data_end = st.st_size;
+	r->hdr = (const struct capture_file_header_s *)addr;
+
+	if (memcmp(r->hdr->magic, CAPTURE_FILE_MAGIC, sizeof(r->hdr->magic)) ||
+		r->hdr->version != CAPTURE_FILE_VERSION || r->hdr->header_size > r->size) {
+		fprintf(stderr, MODULE_PREFIX "'%s' is not a version %d capture file\n", fn, CAPTURE_FILE_VERSION);
+		capture_file_reader_close(r);
+		return -1;
+	}
+
+	/* Prefer the index the writer left behind */
+	if (r->size >= r->hdr->header_size + sizeof(struct capture_file_trailer_s)) {
+		const struct capture_file_trailer_s *t =
+			(const struct capture_file_trailer_s *)(r->addr + r->size - sizeof(*t));
+		if (t->magic == CAPTURE_FILE_TRAILER_MAGIC &&
+			t->index_offset + (t->count * sizeof(uint64_t)) + sizeof(*t) == r->size) {
+			r->index = (const uint64_t *)(r->addr + t->index_offset);
+			r->count = t->count;
+			r->data_end = t->index_offset;
+		}
+	}
+
+	if (!r->index) {
+		fprintf(stderr, MODULE_PREFIX "'%s' has no index, rebuilding\n", fn);
+		if (build_index(r) < 0) {
+			capture_file_reader_close(r);
+			return -1;
+		}
+	}
+
+	printf(MODULE_PREFIX "Opened '%s', %" PRIu64 " frames\n", fn, r->count);
+
+	*reader = r;
+	return 0;
+}
+
+void capture_file_reader_close(struct capture_file_reader_s *r)
+{
+	if (!r)
+		return;
+
+	munmap(r->addr, r->size);
+	free(r->index_alloc);
+	free(r);
+}
+
+const struct capture_file_header_s *capture_file_reader_header(struct capture_file_reader_s *r)
+{
+	return r->hdr;
+}
+
+uint64_t capture_file_reader_count(struct capture_file_reader_s *r)
+{
+	return r->count;
+}
+
+int capture_file_reader_get(struct capture_file_reader_s *r, uint64_t nr, struct capture_file_frame_s *frame)
+{
+	if (nr >= r->count || !record_valid(r, r->index[nr]))
+		return -1;
+
+	const struct capture_file_record_s *rec = (const struct capture_file_record_s *)(r->addr + r->index[nr]);
+	size_t vanc_nr_len = rec->num_vanc_lines * sizeof(uint32_t);
+	size_t vanc_len = (size_t)rec->num_vanc_lines * rec->row_bytes;
+	size_t video_len = rec->flags & CAPTURE_FILE_HAS_VIDEO ? (size_t)rec->height * rec->row_bytes : 0;
+	size_t audio_len = rec->flags & CAPTURE_FILE_HAS_AUDIO ?
+		(size_t)rec->sample_frame_count * r->hdr->num_channels * sizeof(int32_t) : 0;
+
+	if (CAPTURE_FILE_ALIGN(vanc_nr_len) + CAPTURE_FILE_ALIGN(vanc_len) +
+		CAPTURE_FILE_ALIGN(video_len) + audio_len > rec->payload_size)
+		return -1;
+
+	uint8_t *p = (uint8_t *)(rec + 1);
+
+	frame->rec = rec;
+	frame->vanc_line_nr = (const uint32_t *)p;
+	p += CAPTURE_FILE_ALIGN(vanc_nr_len);
+	frame->vanc = p;
+	p += CAPTURE_FILE_ALIGN(vanc_len);
+	frame->video = video_len ? p : NULL;
+	p += CAPTURE_FILE_ALIGN(video_len);
+	frame->audio = rec->flags & CAPTURE_FILE_HAS_AUDIO ? p : NULL;
+
+	return 0;
+}
@@ -0,0 +1,123 @@
+#ifndef OBE_DECKLINK_CAPTURE_FILE_H
+#define OBE_DECKLINK_CAPTURE_FILE_H
+
+/* Capture file, a recording of the DeckLink input callback.
+ *
+ * Everything timedVideoInputFrameArrived() reads from the hardware is kept,
+ * raw v210 frames, the VANC lines the card handed us, 32bit interleaved audio
+ * packets, stream_time / packet_time and the frame flags, plus the wall clock
+ * arrival time so a replay can reproduce the callback cadence.
+ *
+ * Layout, all little endian:
+ *   capture_file_header_s
+ *   capture_file_record_s + payload, repeated
+ *   uint64_t record offsets[count]
+ *   capture_file_trailer_s
+ *
+ * Record payload, each section starting on a CAPTURE_FILE_ALIGN boundary:
+ *   uint32_t vanc_line_nr[num_vanc_lines]
+ *   num_vanc_lines * row_bytes of v210 VANC
+ *   height * row_bytes of v210 video       (CAPTURE_FILE_HAS_VIDEO)
+ *   sample_frame_count * num_channels * 4 of S32 audio (CAPTURE_FILE_HAS_AUDIO)
+ *
+ * The index is written on close. A file without one (the recorder was killed)
+ * is still readable, the reader walks the records instead.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPTURE_FILE_MAGIC          "OBEDLREC"
+#define CAPTURE_FILE_VERSION        1
+#define CAPTURE_FILE_RECORD_MAGIC   0x454d5246 /* 'FRME' */
+#define CAPTURE_FILE_TRAILER_MAGIC  0x58444e49 /* 'INDX' */
+
+#define CAPTURE_FILE_ALIGN(x)       (((x) + 63) & ~(uint64_t)63)
+
+#define CAPTURE_FILE_HAS_VIDEO      (1 << 0)
+#define CAPTURE_FILE_HAS_AUDIO      (1 << 1)
+
+struct capture_file_header_s
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	int32_t  video_format;    /* input_video_format_e */
+	uint32_t width;
+	uint32_t coded_height;
+	uint32_t height;
+	int32_t  interlaced;
+	int32_t  tff;
+	int32_t  timebase_num;
+	int32_t  timebase_den;
+	uint32_t num_channels;
+	uint32_t sample_rate;
+	int32_t  half_duplex;
+	uint32_t reserved[17];    /* Pad to 128 bytes */
+} __attribute__((packed));
+
+struct capture_file_record_s
+{
+	uint32_t magic;
+	uint32_t flags;           /* CAPTURE_FILE_HAS_... */
+	uint64_t frame_nr;
+	int64_t  arrival_time;    /* obe_mdate() when the callback fired */
+	int64_t  stream_time;     /* GetStreamTime(), OBE_CLOCK */
+	int64_t  frame_duration;  /* GetStreamTime(), OBE_CLOCK */
+	int64_t  packet_time;     /* GetPacketTime(), OBE_CLOCK */
+	uint32_t video_flags;     /* BMDFrameFlags */
+	uint32_t width;
+	uint32_t height;
+	uint32_t row_bytes;
+	uint32_t num_vanc_lines;
+	uint32_t sample_frame_count;
+	uint32_t payload_size;    /* Bytes following this record, including padding */
+	uint32_t reserved[13];    /* Pad to 128 bytes */
+} __attribute__((packed));
+
+struct capture_file_trailer_s
+{
+	uint32_t magic;
+	uint32_t reserved;
+	uint64_t count;
+	uint64_t index_offset;
+} __attribute__((packed));
+
+/* A record, pointing into the mapped file. The mapping is private and
+ * writable, the callback is free to scribble on the buffers (burnwriter).
+ */
+struct capture_file_frame_s
+{
+	const struct capture_file_record_s *rec;
+	const uint32_t *vanc_line_nr;
+	uint8_t *vanc;
+	uint8_t *video;
+	uint8_t *audio;
+};
+
+struct capture_file_writer_s;
+struct capture_file_reader_s;
+
+/* The writer copies each record into a pooled buffer and hands it to its own
+ * thread, so the capture callback never waits on the disk. If the disk can't
+ * keep up records are dropped and counted, rather than stalling capture.
+ */
+int  capture_file_writer_alloc(struct capture_file_writer_s **w, const char *fn, const struct capture_file_header_s *hdr);
+void capture_file_writer_free(struct capture_file_writer_s *w);
+int  capture_file_writer_write(struct capture_file_writer_s *w, struct capture_file_record_s *rec,
+	const uint32_t *vanc_line_nr, void * const *vanc_lines, const void *video, const void *audio);
+
+int  capture_file_reader_open(struct capture_file_reader_s **r, const char *fn);
+void capture_file_reader_close(struct capture_file_reader_s *r);
+const struct capture_file_header_s *capture_file_reader_header(struct capture_file_reader_s *r);
+uint64_t capture_file_reader_count(struct capture_file_reader_s *r);
+int  capture_file_reader_get(struct capture_file_reader_s *r, uint64_t nr, struct capture_file_frame_s *frame);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_DECKLINK_CAPTURE_FILE_H */
@@ -47,10 +47,13 @@ extern "C"
 #include "input/sdi/vbi.h"
 #include "input/sdi/x86/sdi.h"
 #include "input/sdi/smpte337_detector.h"
+#include "input/sdi/decklink/capture_file.h"
+#include "input/sdi/slate.h"
 #include <libavcodec/avcodec.h>
 #include <libswresample/swresample.h>
 #include <libavutil/opt.h>
 #include <libavutil/pixdesc.h>
+#include <libavutil/mathematics.h>
 #include <libklvanc/vanc.h>
 #include <libklscte35/scte35.h>
 }
@@ -150,15 +153,6 @@ static const char *getModeName(BMDDisplayMode m)
 
 class DeckLinkCaptureDelegate;
 
-struct audio_pair_s {
-    int    nr; /* 0 - 7 */
-    struct smpte337_detector_s *smpte337_detector;
-    int    smpte337_detected_ac3;
-    int    smpte337_frames_written;
-    void  *decklink_ctx;
-    int    input_stream_id; /* We need this during capture, so we can forward the payload to the right output encoder. */
-};
-
 typedef struct
 {
     IDeckLink *p_card;
@@ -169,12 +163,21 @@ typedef struct
        see section 2.4.15 of the blackmagic decklink sdk documentation. */
     IDeckLinkConfiguration *p_config;
 
-    /* Video */
-    AVCodec         *dec;
-    AVCodecContext  *codec;
+    /* Video - v210 is unpacked straight into pooled planar 4:2:2 10bit */
+    void (*v210_unpack_aligned) ( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+    void (*v210_unpack_unaligned) ( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+    obe_buf_pool_t *video_pool;
 
-    /* Audio - Sample Rate Conversion. We convert S32 interleaved into S32P planer. */
-    struct SwrContext *avr;
+    /* Loss of signal, frames injected while the input is gone */
+    struct obe_slate_s *slate;
+
+    /* Audio - We convert S32 interleaved into S32P planer, but only for the channels
+     * referenced by PCM output streams. Planes of unreferenced channels are left untouched.
+     */
+    obe_s32_deinterleave_pair_t deinterleave_pair;
+    int deinterleave_align;
+    uint32_t audio_pair_mask; /* bit 0 = SDI audio pair 1 */
+    obe_buf_pool_t *audio_pool;
 
     int64_t last_frame_time;
 
@@ -205,7 +208,6 @@ typedef struct
 #if KL_PRBS_INPUT
     struct prbs_context_s prbs;
 #endif
-#define MAX_AUDIO_PAIRS 8
     struct audio_pair_s audio_pairs[MAX_AUDIO_PAIRS];
 
     int isHalfDuplex;
@@ -217,6 +219,13 @@ typedef struct
     struct ltn_histogram_s *callback_2_hdl;
     struct ltn_histogram_s *callback_3_hdl;
     struct ltn_histogram_s *callback_4_hdl;
+
+    /* Capture file recording, or replay in place of the card */
+    struct capture_file_writer_s *recorder;
+    int recorder_failed;
+    struct capture_file_reader_s *replay;
+    pthread_t replay_thread;
+    volatile int replay_running;
 } decklink_ctx_t;
 
 typedef struct
@@ -241,6 +250,11 @@ typedef struct
     int enable_los_exit_ms;
     int enable_frame_injection;
     int enable_allow_1080p60;
+    int enable_los_osd;
+    int los_slate;
+    int free_run;
+    char *record_location;
+    char *replay_location;
 
     /* Output */
     int probe_success;
@@ -554,6 +568,10 @@ public:
             BMDDisplayMode mode_id = p_display_mode->GetDisplayMode();
             syslog( LOG_WARNING, "Video input format changed" );
 
+            /* The frame interval changed, measure the new format from scratch */
+            if( decklink_ctx->h )
+                obe_cadence_reset( &decklink_ctx->h->input_cadence );
+
             if( decklink_ctx->last_frame_time == -1 )
             {
                 for( i = 0; video_format_tab[i].obe_name != -1; i++ )
@@ -664,12 +682,69 @@ static void dumpAudio(uint16_t *ptr, int fc, int num_channels)
 static int prbs_inited = 0;
 #endif
 
+/* Work out which SDI audio pairs are actually consumed by PCM output streams,
+ * so the capture path only deinterleaves those channels.
+ */
+static uint32_t get_audio_pair_mask(obe_t *h)
+{
+    uint32_t mask = 0;
+
+    for (int i = 0; i < h->num_output_streams; i++) {
+        obe_output_stream_t *os = obe_core_get_output_stream_by_index(h, i);
+        if (os->stream_action != STREAM_ENCODE)
+            continue;
+
+        switch (os->stream_format) {
+        case AUDIO_MP2:
+        case AUDIO_AC_3:
+        case AUDIO_E_AC_3:
+        case AUDIO_AAC:
+            break;
+        default:
+            continue;
+        }
+
+        int num_channels = av_get_channel_layout_nb_channels(os->channel_layout);
+        if (num_channels <= 0)
+            num_channels = 2;
+
+        int first = ((os->sdi_audio_pair - 1) << 1) + os->mono_channel;
+        int last = first + num_channels - 1;
+        if (first < 0)
+            continue;
+
+        for (int ch = first; ch <= last && ch < MAX_CHANNELS; ch++)
+            mask |= 1 << (ch >> 1);
+    }
+
+    return mask;
+}
+
+static void setup_audio_funcs(decklink_opts_t *decklink_opts)
+{
+    decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
+
+    obe_s32_deinterleave_pair_select(&decklink_ctx->deinterleave_pair, &decklink_ctx->deinterleave_align);
+
+    decklink_ctx->audio_pair_mask = get_audio_pair_mask(decklink_ctx->h);
+
+    printf(PREFIX "Audio deinterleave for pairs mask 0x%02x\n", decklink_ctx->audio_pair_mask);
+}
+
+static void setup_video_funcs(decklink_opts_t *decklink_opts)
+{
+    decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
+
+    obe_v210_planar_unpack_select(&decklink_ctx->v210_unpack_aligned, &decklink_ctx->v210_unpack_unaligned);
+}
+
 static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_opts_, IDeckLinkAudioInputPacket *audioframe, int64_t videoPTS)
 {
     obe_raw_frame_t *raw_frame = NULL;
     void *frame_bytes;
     audioframe->GetBytes(&frame_bytes);
     int hasSentAudioBuffer = 0;
+    obe_buf_t *packet_buf = NULL; /* Shared by all bitstream pairs */
 
         for (int i = 0; i < MAX_AUDIO_PAIRS; i++) {
             struct audio_pair_s *pair = &decklink_ctx->audio_pairs[i];
@@ -726,20 +801,9 @@ static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_
             }
 #endif
 
-                /* Allocate a samples buffer for num_samples samples, and fill data pointers and linesize accordingly. */
-                if( av_samples_alloc( raw_frame->audio_frame.audio_data, &raw_frame->audio_frame.linesize, decklink_opts_->num_channels,
-                              raw_frame->audio_frame.num_samples, (AVSampleFormat)raw_frame->audio_frame.sample_fmt, 0 ) < 0 )
-                {
-                    syslog( LOG_ERR, "Malloc failed\n" );
-                    return -1;
-                }
-
-                /* Convert input samples from S32 interleaved into S32P planer. */
-                if (swr_convert(decklink_ctx->avr,
-                        raw_frame->audio_frame.audio_data,
-                        raw_frame->audio_frame.num_samples,
-                        (const uint8_t**)&frame_bytes,
-                        raw_frame->audio_frame.num_samples) < 0)
+                /* Only the pairs in audio_pair_mask are converted, the remaining planes are stale */
+                if (sdi_deinterleave_audio(raw_frame, (const int32_t *)frame_bytes, decklink_ctx->audio_pool,
+                    decklink_ctx->deinterleave_pair, decklink_ctx->deinterleave_align, decklink_ctx->audio_pair_mask) < 0)
                 {
                     syslog(LOG_ERR, PREFIX "Sample format conversion failed\n");
                     return -1;
@@ -759,7 +823,7 @@ static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_
                 avfm_set_video_interval_clk(&raw_frame->avfm, decklink_ctx->vframe_duration);
                 //raw_frame->avfm.hw_audio_correction_clk = clock_offset;
 
-                raw_frame->release_data = obe_release_audio_data;
+                raw_frame->release_data = obe_release_bufref_data;
                 raw_frame->release_frame = obe_release_frame;
                 raw_frame->input_stream_id = pair->input_stream_id;
                 if (add_to_filter_queue(decklink_ctx->h, raw_frame) < 0)
@@ -770,22 +834,36 @@ static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_
 
             if (pair->smpte337_detected_ac3) {
 
-                /* Ship the buffer + offset into it, down to the encoders. The encoders will look at offset 0. */
+                /* Ship a view of the shared packet down to the encoders. The packet is copied once
+                 * regardless of the number of bitstream pairs, each frame holds a reference and an
+                 * offset to the pair it carries.
+                 */
                 int depth = 32;
                 int span = 2;
-                int offset = i * ((depth / 8) * span);
+                int stride = decklink_opts_->num_channels * (depth / 8);
+                if (!packet_buf) {
+                    int l = audioframe->GetSampleFrameCount() * stride;
+                    packet_buf = obe_buf_pool_get(decklink_ctx->audio_pool, l);
+                    if (!packet_buf) {
+                        syslog(LOG_ERR, "Malloc failed\n");
+                        goto end;
+                    }
+                    memcpy(packet_buf->data, frame_bytes, l);
+                }
+
                 raw_frame = new_raw_frame();
+                if (!raw_frame) {
+                    syslog(LOG_ERR, "Malloc failed\n");
+                    goto end;
+                }
                 raw_frame->audio_frame.num_samples = audioframe->GetSampleFrameCount();
                 raw_frame->audio_frame.num_channels = decklink_opts_->num_channels;
-                raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_S32P; /* No specific format. The audio filter will play passthrough. */
-
-                int l = audioframe->GetSampleFrameCount() * decklink_opts_->num_channels * (depth / 8);
-                raw_frame->audio_frame.audio_data[0] = (uint8_t *)malloc(l);
-                raw_frame->audio_frame.linesize = raw_frame->audio_frame.num_channels * (depth / 8);
-
-                memcpy(raw_frame->audio_frame.audio_data[0], (uint8_t *)frame_bytes + offset, l - offset);
-
-                raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_NONE;
+                raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_NONE; /* No specific format. The audio filter will play passthrough. */
+                raw_frame->audio_frame.linesize = stride;
+                raw_frame->audio_frame.stride = stride;
+                raw_frame->audio_frame.offset = i * ((depth / 8) * span);
+                raw_frame->buf_ref = obe_buf_ref(packet_buf);
+                raw_frame->audio_frame.audio_data[0] = packet_buf->data;
 
                 BMDTimeValue packet_time;
                 audioframe->GetPacketTime(&packet_time, OBE_CLOCK);
@@ -802,7 +880,7 @@ static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_
                 //raw_frame->avfm.hw_audio_correction_clk = clock_offset;
                 //avfm_dump(&raw_frame->avfm);
 
-                raw_frame->release_data = obe_release_audio_data;
+                raw_frame->release_data = obe_release_bufref_data;
                 raw_frame->release_frame = obe_release_frame;
                 raw_frame->input_stream_id = pair->input_stream_id;
 //printf("frame for pair %d input %d at offset %d\n", pair->nr, raw_frame->input_stream_id, offset);
@@ -811,10 +889,12 @@ static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_
             }
         } /* For all audio pairs... */
 end:
+    obe_buf_unref(packet_buf);
 
     return S_OK;
 
 fail:
+    obe_buf_unref(packet_buf);
 
     if( raw_frame )
     {
@@ -934,20 +1014,13 @@ time_t        g_decklink_missing_video_last_time = 0;
 
 int           g_decklink_record_audio_buffers = 0;
 
-static obe_raw_frame_t *cached = NULL;
-static void cache_video_frame(obe_raw_frame_t *frame)
-{
-    if (cached != NULL) {
-        cached->release_data(cached);
-        cached->release_frame(cached);
-    }
-
-    cached = obe_raw_frame_copy(frame);
-}
-
 HRESULT DeckLinkCaptureDelegate::noVideoInputFrameArrived(IDeckLinkVideoInputFrame *videoframe, IDeckLinkAudioInputPacket *audioframe)
 {
-	if (!cached)
+	decklink_ctx_t *decklink_ctx = &decklink_opts_->decklink_ctx;
+
+	/* A header referencing the slate, nothing is copied per frame */
+	obe_raw_frame_t *raw_frame = decklink_ctx->slate ? obe_slate_get_frame(decklink_ctx->slate) : NULL;
+	if (!raw_frame)
 		return S_OK;
 
 	g_decklink_injected_frame_count++;
@@ -961,15 +1034,13 @@ HRESULT DeckLinkCaptureDelegate::noVideoInputFrameArrived(IDeckLinkVideoInputFra
             exit(1);
         }
 
-	decklink_ctx_t *decklink_ctx = &decklink_opts_->decklink_ctx;
- 	BMDTimeValue frame_duration;
+	BMDTimeValue frame_duration;
 	obe_t *h = decklink_ctx->h;
 
 	/* use SDI ticks as clock source */
 	videoframe->GetStreamTime(&decklink_ctx->stream_time, &frame_duration, OBE_CLOCK);
 	obe_clock_tick(h, (int64_t)decklink_ctx->stream_time);
 
-	obe_raw_frame_t *raw_frame = obe_raw_frame_copy(cached);
 	raw_frame->pts = decklink_ctx->stream_time;
 
 	BMDTimeValue packet_time;
@@ -998,17 +1069,111 @@ HRESULT DeckLinkCaptureDelegate::noVideoInputFrameArrived(IDeckLinkVideoInputFra
 	avfm_set_hw_received_time(&raw_frame->avfm);
 #if 0
 	//avfm_dump(&raw_frame->avfm);
-	printf("Injecting cached frame %d for time %" PRIi64 "\n", g_decklink_injected_frame_count, raw_frame->pts);
+	printf("Injecting slate frame %d for time %" PRIi64 "\n", g_decklink_injected_frame_count, raw_frame->pts);
 #endif
 	add_to_filter_queue(h, raw_frame);
 
 	return S_OK;
 }
 
+/* Write everything timedVideoInputFrameArrived() pulls from the card to the capture file.
+ * Called before any processing, so the burnwriter and friends don't leak into the recording.
+ */
+static void record_frame(decklink_opts_t *decklink_opts, IDeckLinkVideoInputFrame *videoframe, IDeckLinkAudioInputPacket *audioframe)
+{
+	decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
+	struct capture_file_record_s rec;
+	uint32_t vanc_line_nr[DECKLINK_VANC_LINES];
+	void *vanc_lines[DECKLINK_VANC_LINES];
+	IDeckLinkVideoFrameAncillary *ancillary = NULL;
+	void *video = NULL, *audio = NULL;
+	BMDTimeValue stream_time = 0, frame_duration = 0, packet_time = 0;
+
+	if (!decklink_ctx->recorder) {
+		if (decklink_ctx->recorder_failed)
+			return;
+
+		/* Created on the first frame, after any format detection has settled. */
+		struct capture_file_header_s hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.video_format = decklink_opts->video_format;
+		hdr.width = decklink_opts->width;
+		hdr.coded_height = decklink_opts->coded_height;
+		hdr.height = decklink_opts->height;
+		hdr.interlaced = decklink_opts->interlaced;
+		hdr.tff = decklink_opts->tff;
+		hdr.timebase_num = decklink_opts->timebase_num;
+		hdr.timebase_den = decklink_opts->timebase_den;
+		hdr.num_channels = decklink_opts->num_channels;
+		hdr.sample_rate = 48000;
+		hdr.half_duplex = decklink_ctx->isHalfDuplex;
+
+		if (capture_file_writer_alloc(&decklink_ctx->recorder, decklink_opts->record_location, &hdr) < 0) {
+			klsyslog_and_stdout(LOG_ERR, "Decklink card index %i: Unable to record to '%s'",
+				decklink_opts->card_idx, decklink_opts->record_location);
+			decklink_ctx->recorder_failed = 1;
+			return;
+		}
+		klsyslog_and_stdout(LOG_INFO, "Decklink card index %i: Recording to '%s'",
+			decklink_opts->card_idx, decklink_opts->record_location);
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.arrival_time = obe_mdate();
+
+	if (videoframe) {
+		videoframe->GetStreamTime(&stream_time, &frame_duration, OBE_CLOCK);
+		videoframe->GetBytes(&video);
+		rec.video_flags = videoframe->GetFlags();
+		rec.width = videoframe->GetWidth();
+		rec.height = videoframe->GetHeight();
+		rec.row_bytes = videoframe->GetRowBytes();
+
+		if (videoframe->GetAncillaryData(&ancillary) == S_OK) {
+			int j;
+			for (j = 0; first_active_line[j].format != -1; j++) {
+				if (decklink_opts->video_format == first_active_line[j].format)
+					break;
+			}
+
+			/* The same lines the callback asks for, skipping those the card refuses. */
+			int line = decklink_opts->video_format == INPUT_VIDEO_FORMAT_NTSC ? 4 : 1;
+			while (rec.num_vanc_lines < DECKLINK_VANC_LINES) {
+				void *buf;
+				if (ancillary->GetBufferForVerticalBlankingLine(line, &buf) == S_OK) {
+					vanc_line_nr[rec.num_vanc_lines] = line;
+					vanc_lines[rec.num_vanc_lines++] = buf;
+				}
+				line = sdi_next_line(decklink_opts->video_format, line);
+				if (line == first_active_line[j].line)
+					break;
+			}
+		}
+	}
+
+	if (audioframe) {
+		audioframe->GetPacketTime(&packet_time, OBE_CLOCK);
+		audioframe->GetBytes(&audio);
+		rec.sample_frame_count = audioframe->GetSampleFrameCount();
+	}
+
+	rec.stream_time = stream_time;
+	rec.frame_duration = frame_duration;
+	rec.packet_time = packet_time;
+
+	capture_file_writer_write(decklink_ctx->recorder, &rec, vanc_line_nr, vanc_lines, video, audio);
+
+	if (ancillary)
+		ancillary->Release();
+}
+
 HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFrame *videoframe, IDeckLinkAudioInputPacket *audioframe )
 {
 	decklink_ctx_t *decklink_ctx = &decklink_opts_->decklink_ctx;
 
+	if (decklink_opts_->record_location && !decklink_opts_->probe)
+		record_frame(decklink_opts_, videoframe, audioframe);
+
 	if (g_decklink_histogram_reset) {
 		g_decklink_histogram_reset = 0;
 		ltn_histogram_reset(decklink_ctx->callback_hdl);
@@ -1022,9 +1187,11 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFram
 	ltn_histogram_sample_end(decklink_ctx->callback_duration_hdl);
 
 
-	uint32_t val[2];
-	decklink_ctx->p_input->GetAvailableVideoFrameCount(&val[0]);
-	decklink_ctx->p_input->GetAvailableAudioSampleFrameCount(&val[1]);
+	uint32_t val[2] = { 0, 0 };
+	if (decklink_ctx->p_input) {
+		decklink_ctx->p_input->GetAvailableVideoFrameCount(&val[0]);
+		decklink_ctx->p_input->GetAvailableAudioSampleFrameCount(&val[1]);
+	}
 
 	if (g_decklink_histogram_print_secs > 0) {
 		ltn_histogram_interval_print(STDOUT_FILENO, decklink_ctx->callback_hdl, g_decklink_histogram_print_secs);
@@ -1045,11 +1212,9 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
 {
     decklink_ctx_t *decklink_ctx = &decklink_opts_->decklink_ctx;
     obe_raw_frame_t *raw_frame = NULL;
-    AVPacket pkt;
-    AVFrame *frame = NULL;
     void *frame_bytes, *anc_line;
     obe_t *h = decklink_ctx->h;
-    int ret, num_anc_lines = 0, anc_line_stride,
+    int num_anc_lines = 0, anc_line_stride,
     lines_read = 0, first_line = 0, last_line = 0, line, num_vbi_lines, vii_line;
     uint32_t *frame_ptr;
     uint16_t *anc_buf, *anc_buf_pos;
@@ -1354,8 +1519,6 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
         }
     }
 
-    av_init_packet( &pkt );
-
     if( videoframe )
     {
         ltn_histogram_sample_begin(decklink_ctx->callback_2_hdl);
@@ -1589,43 +1752,36 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
         if( !decklink_opts_->probe )
         {
             ltn_histogram_sample_begin(decklink_ctx->callback_4_hdl);
-            frame = av_frame_alloc();
-            if( !frame )
+
+            raw_frame->release_data = obe_release_bufref_data;
+            raw_frame->release_frame = obe_release_frame;
+
+            obe_image_t *img = &raw_frame->alloc_img;
+            if( obe_image_alloc_pooled( raw_frame, decklink_ctx->video_pool, img->plane, img->stride, width, height + 1,
+                                        AV_PIX_FMT_YUV422P10, 32 ) < 0 )
             {
                 syslog( LOG_ERR, "[decklink]: Could not allocate video frame\n" );
-                goto end;
+                goto fail;
             }
-            decklink_ctx->codec->width = width;
-            decklink_ctx->codec->height = height;
-
-            pkt.data = (uint8_t*)frame_bytes;
-            pkt.size = stride * height;
-
-//frame->width = width;
-//frame->height = height;
-//frame->format = decklink_ctx->codec->pix_fmt;
-//
 
-            ret = avcodec_send_packet(decklink_ctx->codec, &pkt);
-            while (ret >= 0) {
-                ret = avcodec_receive_frame(decklink_ctx->codec, frame);
-                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-                    return -1;
-                else if (ret < 0) {
-                }
-                break;
+            /* v210 to planar 4:2:2 10bit. Rows are 128 byte multiples, so only the base address matters. */
+            void (*unpack)( const uint32_t *, uint16_t *, uint16_t *, uint16_t *, int ) =
+                ((uintptr_t)frame_bytes & 31) ? decklink_ctx->v210_unpack_unaligned : decklink_ctx->v210_unpack_aligned;
+            const uint8_t *src = (const uint8_t *)frame_bytes;
+            uint16_t *y = (uint16_t *)img->plane[0];
+            uint16_t *u = (uint16_t *)img->plane[1];
+            uint16_t *v = (uint16_t *)img->plane[2];
+            for( int i = 0; i < height; i++ )
+            {
+                unpack( (const uint32_t *)src, y, u, v, width );
+                src += stride;
+                y += img->stride[0] / 2;
+                u += img->stride[1] / 2;
+                v += img->stride[2] / 2;
             }
 
-            raw_frame->release_data = obe_release_video_data;
-            raw_frame->release_frame = obe_release_frame;
-
-            memcpy( raw_frame->alloc_img.stride, frame->linesize, sizeof(raw_frame->alloc_img.stride) );
-            memcpy( raw_frame->alloc_img.plane, frame->data, sizeof(raw_frame->alloc_img.plane) );
-            av_frame_free( &frame );
-            raw_frame->alloc_img.csp = decklink_ctx->codec->pix_fmt;
-
-            const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(raw_frame->alloc_img.csp);
-            raw_frame->alloc_img.planes = d->nb_components;
+            raw_frame->alloc_img.csp = AV_PIX_FMT_YUV422P10;
+            raw_frame->alloc_img.planes = av_pix_fmt_count_planes( raw_frame->alloc_img.csp );
             raw_frame->alloc_img.width = width;
             raw_frame->alloc_img.height = height;
             raw_frame->alloc_img.format = decklink_opts_->video_format;
@@ -1689,8 +1845,10 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
             //raw_frame->avfm.hw_audio_correction_clk = clock_offset;
             //avfm_dump(&raw_frame->avfm);
 
-            if (g_decklink_inject_frame_enable)
-                cache_video_frame(raw_frame);
+            obe_cadence_video(&h->input_cadence, decklink_ctx->stream_time, decklink_ctx->vframe_duration, &raw_frame->avfm);
+
+            if (g_decklink_inject_frame_enable && decklink_ctx->slate)
+                obe_slate_set_frame(decklink_ctx->slate, raw_frame);
 
             if( add_to_filter_queue( h, raw_frame ) < 0 )
                 goto fail;
@@ -1727,7 +1885,7 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
                         depth,
                         decklink_opts_->num_channels,
                         decklink_opts_->num_channels * (depth / 8),
-                        span);
+                        span, NULL);
 
                 }
             }
@@ -1741,11 +1899,6 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
     }
 
 end:
-    if( frame )
-        av_frame_free( &frame );
-
-    av_packet_unref( &pkt );
-
     ltn_histogram_sample_end(decklink_ctx->callback_3_hdl);
     return S_OK;
 
@@ -1762,10 +1915,257 @@ fail:
     return S_OK;
 }
 
+/* Capture file replay. The recorded payloads are dressed up as SDK frames and pushed
+ * through the same delegate the card calls, so everything downstream of the callback
+ * behaves exactly as it did live.
+ */
+static BMDTimeValue replay_rescale(BMDTimeValue v, BMDTimeScale timeScale)
+{
+    if (timeScale == OBE_CLOCK)
+        return v;
+
+    return av_rescale(v, timeScale, OBE_CLOCK);
+}
+
+class ReplayVideoFrameAncillary : public IDeckLinkVideoFrameAncillary
+{
+public:
+    ReplayVideoFrameAncillary(const struct capture_file_frame_s *frame) : frame_(frame) {}
+
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { return E_NOINTERFACE; }
+    /* Lives on the replay thread stack, references are meaningless. */
+    virtual ULONG STDMETHODCALLTYPE AddRef(void) { return 1; }
+    virtual ULONG STDMETHODCALLTYPE Release(void) { return 1; }
+
+    virtual HRESULT STDMETHODCALLTYPE GetBufferForVerticalBlankingLine(uint32_t lineNumber, void **buffer)
+    {
+        for (uint32_t i = 0; i < frame_->rec->num_vanc_lines; i++) {
+            if (frame_->vanc_line_nr[i] == lineNumber) {
+                *buffer = frame_->vanc + ((size_t)i * frame_->rec->row_bytes);
+                return S_OK;
+            }
+        }
+
+        /* The card refused this line during the recording */
+        return E_FAIL;
+    }
+    virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat(void) { return bmdFormat10BitYUV; }
+    virtual BMDDisplayMode STDMETHODCALLTYPE GetDisplayMode(void) { return 0; }
+
+private:
+    const struct capture_file_frame_s *frame_;
+};
+
+class ReplayVideoInputFrame : public IDeckLinkVideoInputFrame
+{
+public:
+    ReplayVideoInputFrame(const struct capture_file_frame_s *frame, BMDTimeValue time_offset)
+        : frame_(frame), time_offset_(time_offset), ancillary_(frame) {}
+
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { return E_NOINTERFACE; }
+    virtual ULONG STDMETHODCALLTYPE AddRef(void) { return 1; }
+    virtual ULONG STDMETHODCALLTYPE Release(void) { return 1; }
+
+    virtual long STDMETHODCALLTYPE GetWidth(void) { return frame_->rec->width; }
+    virtual long STDMETHODCALLTYPE GetHeight(void) { return frame_->rec->height; }
+    virtual long STDMETHODCALLTYPE GetRowBytes(void) { return frame_->rec->row_bytes; }
+    virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat(void) { return bmdFormat10BitYUV; }
+    virtual BMDFrameFlags STDMETHODCALLTYPE GetFlags(void) { return frame_->rec->video_flags; }
+    virtual HRESULT STDMETHODCALLTYPE GetBytes(void **buffer)
+    {
+        *buffer = frame_->video;
+        return S_OK;
+    }
+    virtual HRESULT STDMETHODCALLTYPE GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode **timecode)
+    {
+        *timecode = NULL;
+        return S_FALSE;
+    }
+    virtual HRESULT STDMETHODCALLTYPE GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary)
+    {
+        *ancillary = &ancillary_;
+        return S_OK;
+    }
+    virtual HRESULT STDMETHODCALLTYPE GetStreamTime(BMDTimeValue *frameTime, BMDTimeValue *frameDuration, BMDTimeScale timeScale)
+    {
+        *frameTime = replay_rescale(frame_->rec->stream_time + time_offset_, timeScale);
+        *frameDuration = replay_rescale(frame_->rec->frame_duration, timeScale);
+        return S_OK;
+    }
+    virtual HRESULT STDMETHODCALLTYPE GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue *frameTime, BMDTimeValue *frameDuration)
+    {
+        return GetStreamTime(frameTime, frameDuration, timeScale);
+    }
+
+private:
+    const struct capture_file_frame_s *frame_;
+    BMDTimeValue time_offset_;
+    ReplayVideoFrameAncillary ancillary_;
+};
+
+class ReplayAudioInputPacket : public IDeckLinkAudioInputPacket
+{
+public:
+    ReplayAudioInputPacket(const struct capture_file_frame_s *frame, BMDTimeValue time_offset)
+        : frame_(frame), time_offset_(time_offset) {}
+
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { return E_NOINTERFACE; }
+    virtual ULONG STDMETHODCALLTYPE AddRef(void) { return 1; }
+    virtual ULONG STDMETHODCALLTYPE Release(void) { return 1; }
+
+    virtual long STDMETHODCALLTYPE GetSampleFrameCount(void) { return frame_->rec->sample_frame_count; }
+    virtual HRESULT STDMETHODCALLTYPE GetBytes(void **buffer)
+    {
+        *buffer = frame_->audio;
+        return S_OK;
+    }
+    virtual HRESULT STDMETHODCALLTYPE GetPacketTime(BMDTimeValue *packetTime, BMDTimeScale timeScale)
+    {
+        *packetTime = replay_rescale(frame_->rec->packet_time + time_offset_, timeScale);
+        return S_OK;
+    }
+
+private:
+    const struct capture_file_frame_s *frame_;
+    BMDTimeValue time_offset_;
+};
+
+static int open_replay(decklink_opts_t *decklink_opts)
+{
+    decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
+
+    if (capture_file_reader_open(&decklink_ctx->replay, decklink_opts->replay_location) < 0)
+        return -1;
+
+    const struct capture_file_header_s *hdr = capture_file_reader_header(decklink_ctx->replay);
+    const struct obe_to_decklink_video *fmt = getVideoFormatByOBEName(hdr->video_format);
+
+    if (!fmt) {
+        fprintf(stderr, PREFIX "Capture file has an unsupported video format %d\n", hdr->video_format);
+        return -1;
+    }
+
+    if (hdr->num_channels != (uint32_t)decklink_opts->num_channels || capture_file_reader_count(decklink_ctx->replay) == 0) {
+        fprintf(stderr, PREFIX "Capture file has %d audio channels and %" PRIu64 " frames, can't replay\n",
+            hdr->num_channels, capture_file_reader_count(decklink_ctx->replay));
+        return -1;
+    }
+
+    /* What open_card() would have learned from the card and the display mode */
+    decklink_opts->video_format = hdr->video_format;
+    decklink_opts->timebase_num = fmt->timebase_num;
+    decklink_opts->timebase_den = fmt->timebase_den;
+    decklink_opts->width = hdr->width;
+    decklink_opts->coded_height = hdr->coded_height;
+    decklink_opts->height = hdr->height;
+    decklink_opts->interlaced = hdr->interlaced;
+    decklink_opts->tff = hdr->tff;
+    calculate_audio_sfc_window(decklink_opts);
+    setup_pixel_funcs(decklink_opts);
+
+    decklink_ctx->isHalfDuplex = hdr->half_duplex;
+    decklink_ctx->enabled_mode_id = fmt->bmd_name;
+    decklink_ctx->enabled_mode_fmt = fmt;
+
+    syslog(LOG_INFO, "Replaying DeckLink capture file '%s' (%s)", decklink_opts->replay_location, fmt->ascii_name);
+
+    return 0;
+}
+
+/* Feed the recording to the delegate. Paced by the recorded arrival times unless free
+ * running or probing. At the end of the file we loop, offsetting the hardware clocks so
+ * they keep running forwards.
+ */
+static void *replay_thread(void *p)
+{
+    decklink_opts_t *decklink_opts = (decklink_opts_t *)p;
+    decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
+    struct capture_file_reader_s *r = decklink_ctx->replay;
+    uint64_t count = capture_file_reader_count(r);
+    struct capture_file_frame_s first, last, frame;
+    BMDTimeValue video_offset = 0, audio_offset = 0;
+    int64_t arrival_offset = 0;
+    struct timespec start;
+
+    if (capture_file_reader_get(r, 0, &first) < 0 || capture_file_reader_get(r, count - 1, &last) < 0) {
+        fprintf(stderr, PREFIX "Capture file is damaged, replay stopped\n");
+        return NULL;
+    }
+
+    /* The span of one pass of the file, on each clock */
+    const BMDTimeValue video_span = last.rec->stream_time + last.rec->frame_duration - first.rec->stream_time;
+    const BMDTimeValue audio_span = last.rec->packet_time - first.rec->packet_time +
+        av_rescale(last.rec->sample_frame_count, OBE_CLOCK, 48000);
+    const int64_t arrival_span = last.rec->arrival_time - first.rec->arrival_time +
+        av_rescale(last.rec->frame_duration, 1000000, OBE_CLOCK);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint64_t nr = 0; decklink_ctx->replay_running; nr++) {
+        if (nr == count) {
+            nr = 0;
+            video_offset += video_span;
+            audio_offset += audio_span;
+            arrival_offset += arrival_span;
+        }
+
+        if (capture_file_reader_get(r, nr, &frame) < 0) {
+            fprintf(stderr, PREFIX "Capture file record %" PRIu64 " is damaged, skipping\n", nr);
+            continue;
+        }
+
+        if (!decklink_opts->probe && !decklink_opts->free_run) {
+            int64_t due = frame.rec->arrival_time - first.rec->arrival_time + arrival_offset;
+            struct timespec ts = start;
+            ts.tv_sec += due / 1000000;
+            ts.tv_nsec += (due % 1000000) * 1000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        }
+
+        ReplayVideoInputFrame videoframe(&frame, video_offset);
+        ReplayAudioInputPacket audioframe(&frame, audio_offset);
+
+        decklink_ctx->p_delegate->VideoInputFrameArrived(
+            frame.video ? &videoframe : NULL,
+            frame.audio ? &audioframe : NULL);
+    }
+
+    return NULL;
+}
+
+static int start_replay(decklink_opts_t *decklink_opts)
+{
+    decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
+
+    decklink_ctx->replay_running = 1;
+    if (pthread_create(&decklink_ctx->replay_thread, NULL, replay_thread, decklink_opts) != 0) {
+        fprintf(stderr, PREFIX "Could not start the replay thread\n");
+        decklink_ctx->replay_running = 0;
+        return -1;
+    }
+    pthread_setname_np(decklink_ctx->replay_thread, "obe-dl-replay");
+
+    return 0;
+}
+
 static void close_card( decklink_opts_t *decklink_opts )
 {
     decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
 
+    if (decklink_ctx->replay_running) {
+        decklink_ctx->replay_running = 0;
+        pthread_join(decklink_ctx->replay_thread, NULL);
+    }
+
+    if (decklink_ctx->replay) {
+        capture_file_reader_close(decklink_ctx->replay);
+        decklink_ctx->replay = NULL;
+    }
+
     if( decklink_ctx->p_config )
         decklink_ctx->p_config->Release();
 
@@ -1781,12 +2181,6 @@ static void close_card( decklink_opts_t *decklink_opts )
     if( decklink_ctx->p_delegate )
         decklink_ctx->p_delegate->Release();
 
-    if( decklink_ctx->codec )
-    {
-        avcodec_close( decklink_ctx->codec );
-        av_free( decklink_ctx->codec );
-    }
-
     if (decklink_ctx->vanchdl) {
         klvanc_context_destroy(decklink_ctx->vanchdl);
         decklink_ctx->vanchdl = 0;
@@ -1808,8 +2202,26 @@ static void close_card( decklink_opts_t *decklink_opts )
     if( IS_SD( decklink_opts->video_format ) )
         vbi_raw_decoder_destroy( &decklink_ctx->non_display_parser.vbi_decoder );
 
-    if (decklink_ctx->avr)
-        swr_free(&decklink_ctx->avr);
+    if (decklink_ctx->audio_pool) {
+        obe_buf_pool_free(decklink_ctx->audio_pool);
+        decklink_ctx->audio_pool = NULL;
+    }
+
+    if (decklink_ctx->slate) {
+        obe_slate_free(decklink_ctx->slate);
+        decklink_ctx->slate = NULL;
+    }
+
+    if (decklink_ctx->video_pool) {
+        obe_buf_pool_free(decklink_ctx->video_pool);
+        decklink_ctx->video_pool = NULL;
+    }
+
+    /* After the input has stopped, so no callback can race us */
+    if (decklink_ctx->recorder) {
+        capture_file_writer_free(decklink_ctx->recorder);
+        decklink_ctx->recorder = NULL;
+    }
 
 }
 
@@ -1836,43 +2248,9 @@ static int cb_EIA_608(void *callback_context, struct klvanc_context_s *ctx, stru
 	return 0;
 }
 
-static int findOutputStreamIdByFormat(decklink_ctx_t *decklink_ctx, enum stream_type_e stype, enum stream_formats_e fmt)
-{
-	if (decklink_ctx && decklink_ctx->device == NULL)
-		return -1;
-
-	for(int i = 0; i < decklink_ctx->device->num_input_streams; i++) {
-		if ((decklink_ctx->device->input_streams[i]->stream_type == stype) &&
-			(decklink_ctx->device->input_streams[i]->stream_format == fmt))
-			return i;
-        }
-
-	return -1;
-}
- 
-static int transmit_scte35_section_to_muxer(decklink_ctx_t *decklink_ctx, uint8_t *section, uint32_t section_length)
-{
-	int streamId = findOutputStreamIdByFormat(decklink_ctx, STREAM_TYPE_MISC, DVB_TABLE_SECTION);
-	if (streamId < 0)
-		return 0;
-
-	/* Now send the constructed frame to the mux */
-	obe_coded_frame_t *coded_frame = new_coded_frame(streamId, section_length);
-	if (!coded_frame) {
-		syslog(LOG_ERR, "Malloc failed during %s, needed %d bytes\n", __func__, section_length);
-		return -1;
-	}
-	coded_frame->pts = decklink_ctx->stream_time;
-	coded_frame->random_access = 1; /* ? */
-	memcpy(coded_frame->data, section, section_length);
-	add_to_queue(&decklink_ctx->h->mux_queue, coded_frame);
-
-	return 0;
-}
-
 static int transmit_pes_to_muxer(decklink_ctx_t *decklink_ctx, uint8_t *buf, uint32_t byteCount)
 {
-	int streamId = findOutputStreamIdByFormat(decklink_ctx, STREAM_TYPE_MISC, SMPTE2038);
+	int streamId = sdi_find_output_stream_id(decklink_ctx->device, STREAM_TYPE_MISC, SMPTE2038);
 	if (streamId < 0)
 		return 0;
 
@@ -1905,25 +2283,7 @@ static int cb_SCTE_104(void *callback_context, struct klvanc_context_s *ctx, str
 		return 0;
 	}
 
-	struct klvanc_single_operation_message *m = &pkt->so_msg;
-
-	if (m->opID == 0xFFFF /* Multiple Operation Message */) {
-		struct splice_entries results;
-		/* Note, we add 10 second to the PTS to compensate for TS_START added by libmpegts */
-		int r = scte35_generate_from_scte104(pkt, &results,
-						     decklink_ctx->stream_time / 300 + (10 * 90000));
-		if (r != 0) {
-			fprintf(stderr, "Generation of SCTE-35 sections failed\n");
-		}
-
-		for (size_t i = 0; i < results.num_splices; i++) {
-			transmit_scte35_section_to_muxer(decklink_ctx, results.splice_entry[i],
-							 results.splice_size[i]);
-			free(results.splice_entry[i]);
-		}
-	} else {
-		/* Unsupported single_operation_message type */
-	}
+	sdi_scte104_to_scte35(decklink_ctx->h, decklink_ctx->device, pkt, decklink_ctx->stream_time);
 
 	if (decklink_ctx->h->verbose_bitmask & INPUTSOURCE__SDI_VANC_DISCOVERY_SCTE104) {
 		static time_t lastErrTime = 0;
@@ -2014,36 +2374,6 @@ static struct klvanc_callbacks_s callbacks =
 };
 /* End: VANC Callbacks */
 
-static void * detector_callback(void *user_context,
-        struct smpte337_detector_s *ctx,
-        uint8_t datamode, uint8_t datatype, uint32_t payload_bitCount, uint8_t *payload)
-{
-	struct audio_pair_s *pair = (struct audio_pair_s *)user_context;
-#if 0
-	decklink_ctx_t *decklink_ctx = pair->decklink_ctx;
-        printf("%s() datamode = %d [%sbit], datatype = %d [payload: %s]"
-                ", payload_bitcount = %d, payload = %p\n",
-                __func__,
-                datamode,
-                datamode == 0 ? "16" :
-                datamode == 1 ? "20" :
-                datamode == 2 ? "24" : "Reserved",
-                datatype,
-                datatype == 1 ? "SMPTE338 / AC-3 (audio) data" : "TBD",
-                payload_bitCount,
-		payload);
-#endif
-
-	if (datatype == 1 /* AC3 */) {
-		pair->smpte337_detected_ac3 = 1;
-	} else
-		fprintf(stderr, "[decklink] Detected datamode %d on pair %d, we don't support it.",
-			datamode,
-			pair->nr);
-
-        return 0;
-}
-
 static int open_card( decklink_opts_t *decklink_opts, int allowFormatDetection)
 {
     decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
@@ -2122,11 +2452,10 @@ static int open_card( decklink_opts_t *decklink_opts, int allowFormatDetection)
 
         pair->nr = i;
         pair->smpte337_detected_ac3 = 0;
-        pair->decklink_ctx = decklink_ctx;
         pair->input_stream_id = i + 1; /* Video is zero, audio onwards. */
 
         if (OPTION_ENABLED(bitstream_audio)) {
-            pair->smpte337_detector = smpte337_detector_alloc((smpte337_detector_callback)detector_callback, pair);
+            pair->smpte337_detector = smpte337_detector_alloc(sdi_smpte337_detector_callback, pair);
         } else {
             pair->smpte337_frames_written = 256;
         }
@@ -2134,32 +2463,15 @@ static int open_card( decklink_opts_t *decklink_opts, int allowFormatDetection)
 
     decklink_ctx->h->verbose_bitmask = INPUTSOURCE__SDI_VANC_DISCOVERY_SCTE104;
 
-    decklink_ctx->dec = avcodec_find_decoder( AV_CODEC_ID_V210 );
-    if( !decklink_ctx->dec )
-    {
-        fprintf( stderr, "[decklink] Could not find v210 decoder\n" );
-        goto finish;
-    }
-
-    decklink_ctx->codec = avcodec_alloc_context3( decklink_ctx->dec );
-    if( !decklink_ctx->codec )
+    /* Replay a capture file instead of talking to a card */
+    if( decklink_opts->replay_location )
     {
-        fprintf( stderr, "[decklink] Could not allocate AVCodecContext\n" );
-        goto finish;
-    }
-
-    decklink_ctx->codec->get_buffer2 = obe_get_buffer2;
-#if 0
-    decklink_ctx->codec->release_buffer = obe_release_buffer;
-    decklink_ctx->codec->reget_buffer = obe_reget_buffer;
-    decklink_ctx->codec->flags |= CODEC_FLAG_EMU_EDGE;
-#endif
-
-    /* TODO: setup custom strides */
-    if( avcodec_open2( decklink_ctx->codec, decklink_ctx->dec, NULL ) < 0 )
-    {
-        fprintf( stderr, "[decklink] Could not open libavcodec\n" );
-        goto finish;
+        if( open_replay( decklink_opts ) < 0 )
+        {
+            ret = -1;
+            goto finish;
+        }
+        goto setup_callback;
     }
 
     decklink_iterator = CreateDeckLinkIteratorInstance();
@@ -2408,32 +2720,47 @@ static int open_card( decklink_opts_t *decklink_opts, int allowFormatDetection)
         goto finish;
     }
 
+setup_callback:
     if( !decklink_opts->probe )
     {
-        decklink_ctx->avr = swr_alloc();
-        if (!decklink_ctx->avr)
+        decklink_ctx->audio_pool = obe_buf_pool_alloc("decklink audio");
+        if (!decklink_ctx->audio_pool)
+        {
+            fprintf(stderr, PREFIX "Could not alloc audio buffer pool\n");
+            ret = -1;
+            goto finish;
+        }
+
+        setup_audio_funcs(decklink_opts);
+
+        decklink_ctx->video_pool = obe_buf_pool_alloc("decklink video");
+        if (!decklink_ctx->video_pool)
         {
-            fprintf(stderr, PREFIX "Could not alloc libswresample context\n");
+            fprintf(stderr, PREFIX "Could not alloc video buffer pool\n");
             ret = -1;
             goto finish;
         }
 
-        /* Give libswresample a made up channel map */
-        av_opt_set_int( decklink_ctx->avr, "in_channel_layout",   (1 << decklink_opts->num_channels) - 1, 0 );
-        av_opt_set_int( decklink_ctx->avr, "in_sample_fmt",       AV_SAMPLE_FMT_S32, 0 );
-        av_opt_set_int( decklink_ctx->avr, "in_sample_rate",      48000, 0 );
-        av_opt_set_int( decklink_ctx->avr, "out_channel_layout",  (1 << decklink_opts->num_channels) - 1, 0 );
-        av_opt_set_int( decklink_ctx->avr, "out_sample_fmt",      AV_SAMPLE_FMT_S32P, 0 );
-        av_opt_set_int( decklink_ctx->avr, "out_sample_rate",     48000, 0 );
+        setup_video_funcs(decklink_opts);
 
-        if (swr_init(decklink_ctx->avr) < 0)
+        /* Always, injection can be switched on at runtime */
+        if (obe_slate_alloc(&decklink_ctx->slate, (enum input_los_slate_e)decklink_opts->los_slate,
+                            OPTION_ENABLED(los_osd)) < 0)
         {
-            fprintf(stderr, PREFIX "couldn't setup sample rate conversion\n");
+            fprintf(stderr, PREFIX "Could not alloc loss of signal slate\n");
+            ret = -1;
             goto finish;
         }
     }
 
     decklink_ctx->p_delegate = new DeckLinkCaptureDelegate( decklink_opts );
+
+    if( decklink_ctx->replay )
+    {
+        ret = start_replay( decklink_opts );
+        goto finish;
+    }
+
     decklink_ctx->p_input->SetCallback( decklink_ctx->p_delegate );
 
     result = decklink_ctx->p_input->StartStreams();
@@ -2509,7 +2836,11 @@ static void *probe_stream( void *ptr )
     decklink_opts->enable_patch1 = user_opts->enable_patch1;
     decklink_opts->enable_los_exit_ms = user_opts->enable_los_exit_ms;
     decklink_opts->enable_frame_injection = user_opts->enable_frame_injection;
+    decklink_opts->enable_los_osd = user_opts->enable_los_osd;
+    decklink_opts->los_slate = user_opts->los_slate;
     decklink_opts->enable_allow_1080p60 = user_opts->enable_allow_1080p60;
+    if (user_opts->input_type == INPUT_DEVICE_DECKLINK_REPLAY)
+        decklink_opts->replay_location = user_opts->location;
 
     decklink_opts->probe = non_display_parser->probe = 1;
 
@@ -2690,7 +3021,7 @@ static void *probe_stream( void *ptr )
 
     device->num_input_streams = cur_stream;
     memcpy(device->input_streams, streams, device->num_input_streams * sizeof(obe_int_input_stream_t**) );
-    device->device_type = INPUT_DEVICE_DECKLINK;
+    device->device_type = user_opts->input_type;
     memcpy( &device->user_opts, user_opts, sizeof(*user_opts) );
 
     /* Upstream is responsible for freeing streams[x] allocations */
@@ -2741,6 +3072,10 @@ static void *open_input( void *ptr )
     decklink_opts->enable_patch1 = user_opts->enable_patch1;
     decklink_opts->enable_los_exit_ms = user_opts->enable_los_exit_ms;
     decklink_opts->enable_allow_1080p60 = user_opts->enable_allow_1080p60;
+    decklink_opts->free_run = user_opts->enable_free_run;
+    decklink_opts->record_location = user_opts->record_location;
+    if (user_opts->input_type == INPUT_DEVICE_DECKLINK_REPLAY)
+        decklink_opts->replay_location = user_opts->location;
 
     decklink_ctx = &decklink_opts->decklink_ctx;
 
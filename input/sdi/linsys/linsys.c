@@ -46,7 +46,6 @@
 
 #include <libavutil/mathematics.h>
 #include <libavutil/bswap.h>
-#include <libswresample/swresample.h>
 #include <libavutil/opt.h>
 
 #define SDIVIDEO_DEVICE         "/dev/sdivideorx%u"
@@ -140,6 +139,12 @@ typedef struct
     obe_raw_frame_t *raw_frame;
     void (*unpack_line) ( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
 
+    /* Frames are decoded straight out of the mmap'd DMA buffer into pooled planes, the
+     * DMA buffer is handed back to the driver as soon as the decode is done. */
+    obe_buf_pool_t *vpool;
+    uint16_t     *anc_buf; /* LINSYS_VANC_LINES lines */
+    uint8_t      *vbi_buf;
+
     /* audio device reader */
     int          afd;
     int          max_channel;
@@ -149,7 +154,9 @@ typedef struct
     unsigned int abuffer_size;
     int64_t      a_counter;
     AVRational   a_timebase;
-    struct SwrContext *avr;
+    obe_buf_pool_t *apool;
+    obe_s32_deinterleave_pair_t deinterleave_pair;
+    int deinterleave_align;
 
     int64_t      last_frame_time;
 
@@ -283,8 +290,13 @@ static void close_card( linsys_opts_t *linsys_opts )
     }
     close( linsys_ctx->afd );
 
-    if( linsys_ctx->avr )
-        swr_free(&linsys_ctx->avr);
+    av_freep( &linsys_ctx->anc_buf );
+    av_freep( &linsys_ctx->vbi_buf );
+
+    obe_buf_pool_free( linsys_ctx->vpool );
+    linsys_ctx->vpool = NULL;
+    obe_buf_pool_free( linsys_ctx->apool );
+    linsys_ctx->apool = NULL;
 }
 
 static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
@@ -340,7 +352,7 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
     }
     output = &raw_frame->alloc_img;
 
-    raw_frame->release_data = obe_release_video_data;
+    raw_frame->release_data = obe_release_bufref_data;
     raw_frame->release_frame = obe_release_frame;
     raw_frame->arrival_time = linsys_ctx->last_frame_time;
 
@@ -353,7 +365,8 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
     if( av_image_fill_linesizes( output->stride, output->csp, output->width ) < 0 )
         goto fail;
 
-    if( av_image_alloc( output->plane, output->stride, linsys_ctx->width, linsys_ctx->coded_height + 1, AV_PIX_FMT_YUV422P10, 16 ) < 0 )
+    if( obe_image_alloc_pooled( raw_frame, linsys_ctx->vpool, output->plane, output->stride, linsys_ctx->width,
+                                linsys_ctx->coded_height + 1, AV_PIX_FMT_YUV422P10, 16 ) < 0 )
         goto fail;
 
     uint16_t *y_dst = (uint16_t*)output->plane[0];
@@ -416,6 +429,18 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
 
     anc_line_stride = FFALIGN( (linsys_ctx->width * 2 * sizeof(uint16_t)), 16 );
 
+    /* Scratch for the ancillary lines, allocated once */
+    if( !linsys_ctx->anc_buf )
+    {
+        linsys_ctx->anc_buf = av_malloc( LINSYS_VANC_LINES * anc_line_stride );
+        linsys_ctx->vbi_buf = av_malloc( linsys_ctx->width * 2 * LINSYS_VANC_LINES );
+        if( !linsys_ctx->anc_buf || !linsys_ctx->vbi_buf )
+        {
+            syslog( LOG_ERR, "Malloc failed\n" );
+            goto fail;
+        }
+    }
+
     y_src = (uint16_t*)output->plane[0];
     u_src = (uint16_t*)output->plane[1];
     v_src = (uint16_t*)output->plane[2];
@@ -433,14 +458,9 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
 
         first_line = cur_line = linsys_opts->video_format == INPUT_VIDEO_FORMAT_NTSC ? 4 : 1;
 
-        /* Overallocate slightly for VANC buffer
+        /* The VANC buffer is overallocated slightly
          * Some VBI services stray into the active picture so allocate some extra space */
-        anc_buf = anc_buf_pos = av_malloc( LINSYS_VANC_LINES * anc_line_stride );
-        if( !anc_buf )
-        {
-            syslog( LOG_ERR, "Malloc failed\n" );
-            goto fail;
-        }
+        anc_buf = anc_buf_pos = linsys_ctx->anc_buf;
 
         while( cur_line != first_active_line[j].line )
         {
@@ -477,12 +497,7 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
             }
 
             /* Only the first two lines can be probed for VBI data */
-            anc_buf = anc_buf_pos = av_malloc( NUM_ACTIVE_VBI_LINES * anc_line_stride );
-            if( !anc_buf )
-            {
-                syslog( LOG_ERR, "Malloc failed\n" );
-                goto fail;
-            }
+            anc_buf = anc_buf_pos = linsys_ctx->anc_buf;
         }
         else
             num_vbi_lines += linsys_opts->video_format == INPUT_VIDEO_FORMAT_NTSC;
@@ -502,12 +517,7 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
             last_line = sdi_next_line( linsys_opts->video_format, last_line );
         }
 
-        vbi_buf = av_malloc( linsys_ctx->width * 2 * num_anc_lines );
-        if( !vbi_buf )
-        {
-            syslog( LOG_ERR, "Malloc failed\n" );
-            goto fail;
-        }
+        vbi_buf = linsys_ctx->vbi_buf;
 
         /* Scale the lines from 10-bit to 8-bit */
         linsys_ctx->downscale_line( anc_buf, vbi_buf, num_anc_lines );
@@ -546,12 +556,8 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
 
         if( decode_vbi( h, &linsys_ctx->non_display_parser, vbi_buf, raw_frame ) < 0 )
             goto fail;
-
-        av_free( vbi_buf );
     }
 
-    av_free( anc_buf );
-
     if( linsys_opts->probe )
     {
         raw_frame->release_data( raw_frame );
@@ -617,6 +623,8 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
         raw_frame->sar_width = raw_frame->sar_height = 1;
         raw_frame->pts = pts = av_rescale_q( linsys_ctx->v_counter++, linsys_ctx->v_timebase, (AVRational){1, OBE_CLOCK} );
 
+        obe_cadence_video( &h->input_cadence, pts, av_rescale_q( 1, linsys_ctx->v_timebase, (AVRational){1, OBE_CLOCK} ), NULL );
+
         if( add_to_filter_queue( h, raw_frame ) < 0 )
             goto fail;
 
@@ -654,24 +662,19 @@ static int handle_audio_frame( linsys_opts_t *linsys_opts, uint8_t *data )
     raw_frame->audio_frame.num_channels = linsys_opts->num_channels;
     raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_S32P;
 
-    if( av_samples_alloc( raw_frame->audio_frame.audio_data, &raw_frame->audio_frame.linesize, linsys_opts->num_channels,
-                          raw_frame->audio_frame.num_samples, raw_frame->audio_frame.sample_fmt, 0 ) < 0 )
+    /* S32 interleaved to S32P planar, straight from the DMA buffer into a pooled buffer */
+    if( sdi_deinterleave_audio( raw_frame, (const int32_t *)data, linsys_ctx->apool, linsys_ctx->deinterleave_pair,
+                                linsys_ctx->deinterleave_align, UINT32_MAX ) < 0 )
     {
         syslog( LOG_ERR, "Malloc failed\n" );
-        return -1;
-    }
-
-    if (swr_convert(linsys_ctx->avr, raw_frame->audio_frame.audio_data, raw_frame->audio_frame.num_samples,
-                            (const uint8_t **)&data, raw_frame->audio_frame.num_samples) < 0)
-    {
-        syslog( LOG_ERR, "[linsys-sdiaudio] Sample format conversion failed\n" );
+        free( raw_frame );
         return -1;
     }
 
     raw_frame->pts = av_rescale_q( linsys_ctx->a_counter, linsys_ctx->a_timebase, (AVRational){1, OBE_CLOCK} );
     linsys_ctx->a_counter += raw_frame->audio_frame.num_samples;
 
-    raw_frame->release_data = obe_release_audio_data;
+    raw_frame->release_data = obe_release_bufref_data;
     raw_frame->release_frame = obe_release_frame;
     for( int i = 0; i < linsys_ctx->device->num_input_streams; i++ )
     {
@@ -898,13 +901,7 @@ static int open_card( linsys_opts_t *linsys_opts )
     cpu_flags = av_get_cpu_flags();
 
     /* Setup unpack functions */
-    linsys_ctx->unpack_line = obe_v210_planar_unpack_c;
-
-    if( cpu_flags & AV_CPU_FLAG_SSSE3 )
-        linsys_ctx->unpack_line = obe_v210_planar_unpack_aligned_ssse3;
-
-    if( cpu_flags & AV_CPU_FLAG_AVX )
-        linsys_ctx->unpack_line = obe_v210_planar_unpack_aligned_avx;
+    obe_v210_planar_unpack_select( &linsys_ctx->unpack_line, NULL );
 
     /* Setup VBI and VANC pack functions */
     if( IS_SD( linsys_opts->video_format ) )
@@ -992,31 +989,16 @@ static int open_card( linsys_opts_t *linsys_opts )
         goto finish;
     }
 
-    if( !linsys_opts->probe )
+    linsys_ctx->apool = obe_buf_pool_alloc( "linsys audio" );
+    if( !linsys_ctx->apool )
     {
-        linsys_ctx->avr = swr_alloc();
-        if( !linsys_ctx->avr )
-        {
-            fprintf( stderr, "[linsys-sdiaudio] couldn't setup sample rate conversion \n" );
-            ret = -1;
-            goto finish;
-        }
-
-        /* Give libavresample a made up channel map */
-        av_opt_set_int( linsys_ctx->avr, "in_channel_layout",   (1 << linsys_opts->num_channels) - 1, 0 );
-        av_opt_set_int( linsys_ctx->avr, "in_sample_fmt",       AV_SAMPLE_FMT_S32, 0 );
-        av_opt_set_int( linsys_ctx->avr, "in_sample_rate",      48000, 0 );
-        av_opt_set_int( linsys_ctx->avr, "out_channel_layout",  (1 << linsys_opts->num_channels) - 1, 0 );
-        av_opt_set_int( linsys_ctx->avr, "out_sample_fmt",      AV_SAMPLE_FMT_S32P, 0 );
-        av_opt_set_int( linsys_ctx->avr, "out_sample_rate",     48000, 0 );
-
-        if (swr_init(linsys_ctx->avr) < 0)
-        {
-            fprintf( stderr, "Could not open AVResample\n" );
-            goto finish;
-        }
+        fprintf( stderr, "[linsys-sdiaudio] couldn't allocate audio buffer pool \n" );
+        ret = -1;
+        goto finish;
     }
 
+    obe_s32_deinterleave_pair_select( &linsys_ctx->deinterleave_pair, &linsys_ctx->deinterleave_align );
+
     if( (linsys_ctx->afd = open( adev, O_RDONLY )) < 0 )
     {
         fprintf( stderr, "[linsys-sdiaudio] couldn't open device %s \n", adev );
@@ -1070,6 +1052,14 @@ static int open_card( linsys_opts_t *linsys_opts )
 
     linsys_ctx->num_vbuffers = NB_VBUFFERS;
 
+    linsys_ctx->vpool = obe_buf_pool_alloc( "linsys video" );
+    if( !linsys_ctx->vpool )
+    {
+        fprintf( stderr, "[linsys-sdi] couldn't allocate video buffer pool \n" );
+        ret = -1;
+        goto finish;
+    }
+
     if( write_ul_sysfs( SDIVIDEO_BUFFERS_FILE, linsys_opts->card_idx, linsys_ctx->num_vbuffers ) < 0 )
     {
         fprintf( stderr, "[linsys-sdi] could not write NB_VBUFFERS \n");
@@ -23,31 +23,16 @@
  *****************************************************************************/
 
 #include "sdi.h"
+#include "smpte337_detector.h"
+#include "x86/sdi.h"
+#include "common/simd.h"
 #include <libavutil/bswap.h>
-
-#define READ_PIXELS(a, b, c)         \
-    do {                             \
-        val  = av_le2ne32( *src++ ); \
-        *a++ =  val & 0x3ff;         \
-        *b++ = (val >> 10) & 0x3ff;  \
-        *c++ = (val >> 20) & 0x3ff;  \
-    } while (0)
+#include <libavutil/mem.h>
+#include <libklvanc/vanc.h>
+#include <libklscte35/scte35.h>
 
 unsigned int g_sdi_max_delay = (100 * 1000); /* acceptible level of signal delay, after which we assume the cable was pulled. */
 
-void obe_v210_planar_unpack_c( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width )
-{
-    uint32_t val;
-
-    for( int i = 0; i < width - 5; i += 6 )
-    {
-        READ_PIXELS( u, y, v );
-        READ_PIXELS( y, u, y );
-        READ_PIXELS( v, y, u );
-        READ_PIXELS( y, v, y );
-    }
-}
-
 /* Convert v210 to the native HD-SDI pixel format. */
 void obe_v210_line_to_nv20_c( uint32_t *src, uint16_t *dst, int width )
 {
@@ -148,6 +133,116 @@ void obe_blank_line_uyvy_c( uint16_t *dst, int width )
     }
 }
 
+/* Extract one stereo pair from S32 interleaved audio. stride is the size of a sample frame in bytes. */
+void obe_s32_deinterleave_pair_c( const int32_t *src, int32_t *l, int32_t *r, intptr_t stride, int len )
+{
+    for( int i = 0; i < len; i++ )
+    {
+        l[i] = src[0];
+        r[i] = src[1];
+        src = (const int32_t *)((const uint8_t *)src + stride);
+    }
+}
+
+static const obe_simd_version_t deinterleave_pair_versions[] =
+{
+    { "c",    (obe_simd_fn_t)obe_s32_deinterleave_pair_c },
+    { "sse2", (obe_simd_fn_t)obe_s32_deinterleave_pair_sse2 },
+    { "avx2", (obe_simd_fn_t)obe_s32_deinterleave_pair_avx2 },
+};
+
+/* Every pair of 16 channels, for an NTSC frame of audio less the sample the
+ * caller's C tail would take */
+#define DEINTERLEAVE_TEST_CHANNELS 16
+#define DEINTERLEAVE_TEST_LEN      1600
+#define DEINTERLEAVE_TEST_POISON   0xa5
+
+typedef struct
+{
+    int32_t src[DEINTERLEAVE_TEST_LEN * DEINTERLEAVE_TEST_CHANNELS];
+    int32_t dst[DEINTERLEAVE_TEST_CHANNELS][DEINTERLEAVE_TEST_LEN];
+} deinterleave_test_t;
+
+static void test_deinterleave_pair( obe_simd_fn_t fn, void *ctx, uint8_t *out )
+{
+    deinterleave_test_t *t = ctx;
+
+    if( out )
+        memset( t->dst, DEINTERLEAVE_TEST_POISON, sizeof(t->dst) );
+
+    for( int i = 0; i < DEINTERLEAVE_TEST_CHANNELS; i += 2 )
+        ((obe_s32_deinterleave_pair_t)fn)( t->src + i, t->dst[i], t->dst[i+1],
+                                           DEINTERLEAVE_TEST_CHANNELS * sizeof(int32_t), DEINTERLEAVE_TEST_LEN );
+
+    if( out )
+        memcpy( out, t->dst, sizeof(t->dst) );
+}
+
+void obe_s32_deinterleave_pair_select( obe_s32_deinterleave_pair_t *deinterleave_pair, int *align )
+{
+    *deinterleave_pair = obe_s32_deinterleave_pair_c;
+    *align = 1;
+
+    deinterleave_test_t *t = av_malloc( sizeof(*t) );
+    if( !t )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        return;
+    }
+
+    uint32_t seed = 1;
+    for( int i = 0; i < FF_ARRAY_ELEMS(t->src); i++ )
+    {
+        seed = seed * 1664525 + 1013904223;
+        t->src[i] = seed;
+    }
+
+    *deinterleave_pair = (obe_s32_deinterleave_pair_t)obe_simd_select( "s32_deinterleave_pair", deinterleave_pair_versions,
+        FF_ARRAY_ELEMS(deinterleave_pair_versions), test_deinterleave_pair, t, sizeof(t->dst) );
+
+    /* The asm takes whole registers of samples */
+    if( *deinterleave_pair == obe_s32_deinterleave_pair_avx2 )
+        *align = 8;
+    else if( *deinterleave_pair == obe_s32_deinterleave_pair_sse2 )
+        *align = 4;
+
+    av_free( t );
+}
+
+int sdi_deinterleave_audio( obe_raw_frame_t *raw_frame, const int32_t *src, obe_buf_pool_t *pool,
+                            obe_s32_deinterleave_pair_t deinterleave_pair, int align, uint32_t pair_mask )
+{
+    obe_audio_frame_t *af = &raw_frame->audio_frame;
+    intptr_t stride = af->num_channels * sizeof(int32_t);
+    int simd_len = af->num_samples & ~(align - 1);
+
+    af->linesize = FFALIGN( af->num_samples * (int)sizeof(int32_t), 64 );
+    raw_frame->buf_ref = obe_buf_pool_get( pool, af->linesize * af->num_channels );
+    if( !raw_frame->buf_ref )
+        return -1;
+
+    for( int i = 0; i < af->num_channels; i++ )
+        af->audio_data[i] = raw_frame->buf_ref->data + (i * af->linesize);
+
+    for( int i = 0; i < af->num_channels / 2; i++ )
+    {
+        if( !(pair_mask & (1 << i)) )
+            continue;
+
+        const int32_t *s = src + (i * 2);
+        int32_t *l = (int32_t *)af->audio_data[(i * 2) + 0];
+        int32_t *r = (int32_t *)af->audio_data[(i * 2) + 1];
+
+        if( simd_len )
+            deinterleave_pair( s, l, r, stride, simd_len );
+        if( simd_len < af->num_samples )
+            obe_s32_deinterleave_pair_c( s + (simd_len * af->num_channels), l + simd_len, r + simd_len,
+                                         stride, af->num_samples - simd_len );
+    }
+
+    return 0;
+}
+
 int add_non_display_services( obe_sdi_non_display_data_t *non_display_data, obe_int_input_stream_t *stream, int location )
 {
     int idx = 0, count = 0;
@@ -347,3 +442,78 @@ int obe_convert_analogue_to_smpte( int format, int line_analogue, int field, int
 
     return 0;
 }
+
+void sdi_smpte337_detector_callback( void *user_context, struct smpte337_detector_s *det, uint8_t datamode, uint8_t datatype,
+                                     uint32_t payload_bitCount, uint8_t *payload, struct avfm_s *avfm )
+{
+    struct audio_pair_s *pair = user_context;
+
+    if( datatype == SMPTE337_DATA_TYPE_AC_3 )
+        pair->smpte337_detected_ac3 = 1;
+    else if( datatype != SMPTE337_DATA_TYPE_NULL && datatype != SMPTE337_DATA_TYPE_PAUSE &&
+             datatype != pair->smpte337_reported_datatype )
+    {
+        /* Report once per change, the detector calls us for every burst. */
+        fprintf( stderr, "[sdi] Detected SMPTE337 %s (datatype %d, datamode %d) on pair %d, we don't support it.\n",
+                 obe_337m_data_type_name( datatype ), datatype, datamode, pair->nr );
+        pair->smpte337_reported_datatype = datatype;
+    }
+}
+
+int sdi_find_output_stream_id( obe_device_t *device, enum stream_type_e stype, enum stream_formats_e fmt )
+{
+    if( !device )
+        return -1;
+
+    for( int i = 0; i < device->num_input_streams; i++ )
+    {
+        if( device->input_streams[i]->stream_type == stype && device->input_streams[i]->stream_format == fmt )
+            return i;
+    }
+
+    return -1;
+}
+
+int sdi_transmit_scte35_section( obe_t *h, obe_device_t *device, uint8_t *section, uint32_t section_length, int64_t pts )
+{
+    int stream_id = sdi_find_output_stream_id( device, STREAM_TYPE_MISC, DVB_TABLE_SECTION );
+    if( stream_id < 0 )
+        return 0;
+
+    obe_coded_frame_t *coded_frame = new_coded_frame( stream_id, section_length );
+    if( !coded_frame )
+    {
+        syslog( LOG_ERR, "Malloc failed during %s, needed %d bytes\n", __func__, section_length );
+        return -1;
+    }
+    coded_frame->pts = pts;
+    coded_frame->random_access = 1;
+    memcpy( coded_frame->data, section, section_length );
+    add_to_queue( &h->mux_queue, coded_frame );
+
+    return 0;
+}
+
+int sdi_scte104_to_scte35( obe_t *h, obe_device_t *device, struct klvanc_packet_scte_104_s *pkt, int64_t pts )
+{
+    /* Silently discard type 1 SCTE104 packets, as per SMPTE 291 section 6.3 */
+    if( klvanc_packetType1( &pkt->hdr ) )
+        return 0;
+
+    /* Other single_operation_message types are unsupported */
+    if( pkt->so_msg.opID != 0xFFFF /* Multiple Operation Message */ )
+        return 0;
+
+    struct splice_entries results;
+    /* Note, we add 10 second to the PTS to compensate for TS_START added by libmpegts */
+    if( scte35_generate_from_scte104( pkt, &results, pts / 300 + (10 * 90000) ) != 0 )
+        fprintf( stderr, "Generation of SCTE-35 sections failed\n" );
+
+    for( size_t i = 0; i < results.num_splices; i++ )
+    {
+        sdi_transmit_scte35_section( h, device, results.splice_entry[i], results.splice_size[i], pts );
+        free( results.splice_entry[i] );
+    }
+
+    return 0;
+}
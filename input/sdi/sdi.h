@@ -28,6 +28,7 @@
 #undef ZVBI_DEBUG
 #include <libzvbi.h>
 #include <libavutil/crc.h>
+#include "v210_unpack.h"
 
 /* In microseconds */
 extern unsigned int g_sdi_max_delay;
@@ -120,6 +121,52 @@ void obe_yuv422p10_line_to_uyvy_c( uint16_t *y, uint16_t *u, uint16_t *v, uint16
 void obe_downscale_line_c( uint16_t *src, uint8_t *dst, int lines );
 void obe_blank_line_nv20_c( uint16_t *dst, int width );
 void obe_blank_line_uyvy_c( uint16_t *dst, int width );
+void obe_s32_deinterleave_pair_c( const int32_t *src, int32_t *l, int32_t *r, intptr_t stride, int len );
+
+/* Extract a stereo pair from interleaved S32, len a multiple of the align the
+ * select gave, stride the bytes of an interleaved sample frame */
+typedef void (*obe_s32_deinterleave_pair_t)( const int32_t *src, int32_t *l, int32_t *r, intptr_t stride, int len );
+
+/* The fastest version which matches obe_s32_deinterleave_pair_c, see obe_simd_select() */
+void obe_s32_deinterleave_pair_select( obe_s32_deinterleave_pair_t *deinterleave_pair, int *align );
+
+/* S32 interleaved audio to S32P planes in a buffer from pool. Only the pairs
+ * in pair_mask (bit 0 = SDI audio pair 1) are written, the others are stale */
+int sdi_deinterleave_audio( obe_raw_frame_t *raw_frame, const int32_t *src, obe_buf_pool_t *pool,
+                            obe_s32_deinterleave_pair_t deinterleave_pair, int align, uint32_t pair_mask );
+
+#define MAX_AUDIO_PAIRS 8
+
+struct smpte337_detector_s;
+
+/* An SDI audio pair, and what the SMPTE 337 detector has found on it */
+struct audio_pair_s
+{
+    int    nr; /* 0 - 7 */
+    struct smpte337_detector_s *smpte337_detector;
+    int    smpte337_detected_ac3;
+    int    smpte337_frames_written;
+    int    smpte337_reported_datatype;
+    int    input_stream_id; /* We need this during capture, so we can forward the payload to the right output encoder. */
+};
+
+/* smpte337_detector_callback for a detector on a pair, the pair is the user context.
+ * Flags AC-3 and reports other data types once per change */
+void sdi_smpte337_detector_callback( void *user_context, struct smpte337_detector_s *det, uint8_t datamode, uint8_t datatype,
+                                     uint32_t payload_bitCount, uint8_t *payload, struct avfm_s *avfm );
+
+struct klvanc_packet_scte_104_s;
+
+/* Index of the first of the device's input streams of type and format, else -1 */
+int sdi_find_output_stream_id( obe_device_t *device, enum stream_type_e stype, enum stream_formats_e fmt );
+
+/* Queue a SCTE-35 section to the mux, if a stream carries them */
+int sdi_transmit_scte35_section( obe_t *h, obe_device_t *device, uint8_t *section, uint32_t section_length, int64_t pts );
+
+/* Translate a SCTE-104 Multiple Operation Message seen at pts (27MHz) to SCTE-35 and
+ * queue it to the mux. Type 1 packets and other messages are dropped */
+int sdi_scte104_to_scte35( obe_t *h, obe_device_t *device, struct klvanc_packet_scte_104_s *pkt, int64_t pts );
+
 int add_non_display_services( obe_sdi_non_display_data_t *non_display_data, obe_int_input_stream_t *stream, int location );
 int check_probed_non_display_data( obe_sdi_non_display_data_t *non_display_data, int type );
 int check_active_non_display_data( obe_raw_frame_t *raw_frame, int type );
@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+
+#include "common/common.h"
+#include "obe/osd.h"
+#include "slate.h"
+
+#define SLATE_PICTURES 4
+#define SLATE_TEXT_MAX 48
+
+struct slate_rect_s
+{
+	int x, y, w, h;
+};
+
+/* A copy of the base picture with the banner burnt in */
+struct slate_picture_s
+{
+	obe_buf_t *buf;
+	uint32_t generation;      /* Of the base it was copied from */
+	char text[SLATE_TEXT_MAX];
+	struct slate_rect_s dirty;
+};
+
+struct obe_slate_s
+{
+	enum input_los_slate_e type;
+	int osd;
+	obe_buf_pool_t *pool;
+
+	/* Header of the last live frame. Its plane pointers are only meaningful
+	 * relative to tmpl.alloc_img.plane[0], we rebase them onto our buffers.
+	 */
+	obe_raw_frame_t tmpl;
+	int have_tmpl;
+	int supported;            /* Planar YUV, we can draw into it */
+	int depth;
+	int log2_chroma_w, log2_chroma_h;
+	size_t image_size;
+
+	/* What we show, a reference to the last good frame or a picture we rendered */
+	obe_buf_t *base;
+	uint32_t generation;
+
+	struct slate_picture_s pic[SLATE_PICTURES];
+	int current;
+};
+
+/* 75% bars, 8bit Y Cb Cr */
+static const uint8_t bars[7][3] =
+{
+	{ 180, 128, 128 }, /* White */
+	{ 162,  44, 142 }, /* Yellow */
+	{ 131, 156,  44 }, /* Cyan */
+	{ 112,  72,  58 }, /* Green */
+	{  84, 184, 198 }, /* Magenta */
+	{  65, 100, 212 }, /* Red */
+	{  35, 212, 114 }, /* Blue */
+};
+
+static const uint8_t black[3] = { 16, 128, 128 };
+
+static void image_rebase(obe_image_t *dst, const obe_image_t *src, const uint8_t *from, uint8_t *to)
+{
+	*dst = *src;
+	for (int i = 0; i < 4; i++) {
+		if (src->plane[i])
+			dst->plane[i] = to + (src->plane[i] - from);
+	}
+}
+
+static void fill_rect(struct obe_slate_s *s, obe_image_t *img, const struct slate_rect_s *r, const uint8_t yuv[3])
+{
+	for (int p = 0; p < 3; p++) {
+		int cw = p ? s->log2_chroma_w : 0;
+		int ch = p ? s->log2_chroma_h : 0;
+		int x = r->x >> cw, w = r->w >> cw;
+		int y = r->y >> ch, h = r->h >> ch;
+
+		for (int j = y; j < y + h; j++) {
+			uint8_t *row = img->plane[p] + j * img->stride[p];
+			if (s->depth > 8) {
+				uint16_t v = yuv[p] << (s->depth - 8);
+				uint16_t *d = (uint16_t *)row + x;
+				for (int i = 0; i < w; i++)
+					d[i] = v;
+			} else {
+				memset(row + x, yuv[p], w);
+			}
+		}
+	}
+}
+
+static void copy_rect(struct obe_slate_s *s, obe_image_t *dst, const obe_image_t *src, const struct slate_rect_s *r)
+{
+	int bps = s->depth > 8 ? 2 : 1;
+
+	for (int p = 0; p < 3; p++) {
+		int cw = p ? s->log2_chroma_w : 0;
+		int ch = p ? s->log2_chroma_h : 0;
+		int x = r->x >> cw, w = r->w >> cw;
+		int y = r->y >> ch, h = r->h >> ch;
+
+		for (int j = y; j < y + h; j++)
+			memcpy(dst->plane[p] + j * dst->stride[p] + x * bps,
+			       src->plane[p] + j * src->stride[p] + x * bps, w * bps);
+	}
+}
+
+/* Black box, white 8x8 font scaled up, luma only. r is set to the rectangle touched. */
+static void draw_banner(struct obe_slate_s *s, obe_image_t *img, const char *text, struct slate_rect_s *r)
+{
+	int scale = img->height >= 720 ? 4 : 2;
+	int pad = 2 * scale;
+	int cell = 8 * scale;
+	int len = strlen(text);
+
+	r->x = (img->width / 16) & ~((1 << s->log2_chroma_w) - 1);
+	r->y = (img->height / 8) & ~((1 << s->log2_chroma_h) - 1);
+
+	int max = (img->width - r->x - 2 * pad) / cell;
+	if (len > max)
+		len = max;
+	if (len <= 0 || r->y + cell + 2 * pad > img->height) {
+		r->w = r->h = 0;
+		return;
+	}
+
+	r->w = len * cell + 2 * pad;
+	r->h = cell + 2 * pad;
+	fill_rect(s, img, r, black);
+
+	uint16_t fg = 235 << (s->depth - 8);
+	for (int c = 0; c < len; c++) {
+		const unsigned char *glyph = vc8x0_display_glyph(text[c]);
+		if (!glyph)
+			continue;
+
+		int x0 = r->x + pad + c * cell;
+		for (int row = 0; row < 8 * scale; row++) {
+			uint8_t bits = glyph[row / scale];
+			uint8_t *line = img->plane[0] + (r->y + pad + row) * img->stride[0];
+			for (int col = 0; col < cell; col++) {
+				if (!(bits & (0x80 >> (col / scale))))
+					continue;
+				if (s->depth > 8)
+					((uint16_t *)line)[x0 + col] = fg;
+				else
+					line[x0 + col] = fg;
+			}
+		}
+	}
+}
+
+static int same_geometry(const obe_raw_frame_t *a, const obe_raw_frame_t *b)
+{
+	if (a->alloc_img.csp != b->alloc_img.csp || a->alloc_img.planes != b->alloc_img.planes ||
+	    a->alloc_img.width != b->alloc_img.width || a->alloc_img.height != b->alloc_img.height ||
+	    a->img.width != b->img.width || a->img.height != b->img.height ||
+	    memcmp(a->alloc_img.stride, b->alloc_img.stride, sizeof(a->alloc_img.stride)))
+		return 0;
+
+	uintptr_t a0 = (uintptr_t)a->alloc_img.plane[0], b0 = (uintptr_t)b->alloc_img.plane[0];
+	for (int i = 0; i < a->alloc_img.planes; i++) {
+		if ((uintptr_t)a->img.plane[i] - a0 != (uintptr_t)b->img.plane[i] - b0 ||
+		    (uintptr_t)a->alloc_img.plane[i] - a0 != (uintptr_t)b->alloc_img.plane[i] - b0)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void set_geometry(struct obe_slate_s *s, const obe_raw_frame_t *frame)
+{
+	const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(frame->alloc_img.csp);
+	uint8_t *planes[4];
+	int size;
+
+	s->supported = d && d->nb_components >= 3 && (d->flags & AV_PIX_FMT_FLAG_PLANAR) &&
+		!(d->flags & AV_PIX_FMT_FLAG_RGB) && d->comp[0].depth <= 16;
+	if (s->supported) {
+		s->depth = d->comp[0].depth;
+		s->log2_chroma_w = d->log2_chroma_w;
+		s->log2_chroma_h = d->log2_chroma_h;
+	}
+
+	size = av_image_fill_pointers(planes, frame->alloc_img.csp, frame->alloc_img.height, NULL,
+		frame->alloc_img.stride);
+	if (size < 0)
+		s->supported = 0;
+	s->image_size = size < 0 ? 0 : size;
+
+	/* Anything built on the old layout is useless now */
+	obe_buf_unref(s->base);
+	s->base = NULL;
+	s->current = -1;
+	s->generation++;
+}
+
+void obe_slate_set_frame(struct obe_slate_s *s, const obe_raw_frame_t *frame)
+{
+	int changed = !s->have_tmpl || !same_geometry(frame, &s->tmpl);
+
+	if (changed)
+		set_geometry(s, frame);
+
+	if (s->type == INPUT_LOS_SLATE_LAST_FRAME) {
+		obe_buf_unref(s->base);
+		s->base = NULL;
+		if (frame->buf_ref && frame->buf_ref->data == frame->alloc_img.plane[0]) {
+			s->base = obe_buf_ref(frame->buf_ref);
+			s->generation++;
+		}
+	} else if (!changed) {
+		return;
+	}
+
+	memcpy(&s->tmpl, frame, sizeof(s->tmpl));
+	s->tmpl.opaque = NULL;
+	s->tmpl.buf_ref = NULL;
+	obe_user_data_clear(&s->tmpl);
+	s->have_tmpl = 1;
+}
+
+/* Black or bars, rendered once into a buffer of our own. Also the fallback
+ * for INPUT_LOS_SLATE_LAST_FRAME when the input doesn't hand us pooled frames.
+ */
+static int render_base(struct obe_slate_s *s)
+{
+	const uint8_t *from = s->tmpl.alloc_img.plane[0];
+
+	if (!s->supported)
+		return -1;
+
+	obe_buf_t *buf = obe_buf_pool_get(s->pool, s->image_size + s->tmpl.alloc_img.stride[0]);
+	if (!buf)
+		return -1;
+
+	obe_image_t img;
+	image_rebase(&img, &s->tmpl.alloc_img, from, buf->data);
+	struct slate_rect_s r = { 0, 0, img.width, img.height };
+	fill_rect(s, &img, &r, black);
+
+	if (s->type == INPUT_LOS_SLATE_BARS) {
+		image_rebase(&img, &s->tmpl.img, from, buf->data);
+		int align = ~((1 << s->log2_chroma_w) - 1);
+		for (int i = 0; i < 7; i++) {
+			r.x = (img.width * i / 7) & align;
+			r.w = ((img.width * (i + 1) / 7) & align) - r.x;
+			if (i == 6)
+				r.w = img.width - r.x;
+			r.y = 0;
+			r.h = img.height & ~((1 << s->log2_chroma_h) - 1);
+			fill_rect(s, &img, &r, bars[i]);
+		}
+	}
+
+	s->base = buf;
+	s->current = -1;
+	s->generation++;
+
+	return 0;
+}
+
+/* Return a picture showing text, or NULL to show the base as is. */
+static obe_buf_t *compose(struct obe_slate_s *s, const char *text)
+{
+	const uint8_t *from = s->tmpl.alloc_img.plane[0];
+	struct slate_picture_s *p;
+	obe_image_t img, base_img;
+	int idx = -1, best = -1;
+
+	if (s->current >= 0) {
+		p = &s->pic[s->current];
+		if (p->generation == s->generation && !strcmp(p->text, text))
+			return p->buf;
+	}
+
+	/* A picture only we hold, ideally one built on the current base so that
+	 * just the banner needs rewriting.
+	 */
+	for (int i = 0; i < SLATE_PICTURES; i++) {
+		p = &s->pic[i];
+		if (p->buf && p->buf->refcount != 1)
+			continue;
+
+		int score = !p->buf ? 1 : p->generation == s->generation ? 2 : 0;
+		if (score > best) {
+			best = score;
+			idx = i;
+		}
+	}
+
+	/* Everything is still in flight downstream, repeat the last picture.
+	 * A steady cadence matters more than a clock that's a second behind.
+	 */
+	if (idx < 0)
+		return s->current >= 0 ? s->pic[s->current].buf : NULL;
+
+	p = &s->pic[idx];
+	image_rebase(&base_img, &s->tmpl.img, from, s->base->data);
+
+	if (best == 2) {
+		image_rebase(&img, &s->tmpl.img, from, p->buf->data);
+		copy_rect(s, &img, &base_img, &p->dirty);
+	} else {
+		if (p->buf && p->buf->size < s->image_size) {
+			obe_buf_unref(p->buf);
+			p->buf = NULL;
+		}
+		if (!p->buf)
+			p->buf = obe_buf_pool_get(s->pool, s->image_size);
+		if (!p->buf)
+			return NULL;
+
+		memcpy(p->buf->data, s->base->data, s->image_size < s->base->size ? s->image_size : s->base->size);
+		image_rebase(&img, &s->tmpl.img, from, p->buf->data);
+	}
+
+	draw_banner(s, &img, text, &p->dirty);
+	p->generation = s->generation;
+	snprintf(p->text, sizeof(p->text), "%s", text);
+	s->current = idx;
+
+	return p->buf;
+}
+
+obe_raw_frame_t *obe_slate_get_frame(struct obe_slate_s *s)
+{
+	const uint8_t *from = s->tmpl.alloc_img.plane[0];
+
+	if (!s->have_tmpl)
+		return NULL;
+
+	if (!s->base && render_base(s) < 0)
+		return NULL;
+
+	obe_buf_t *buf = s->base;
+	if (s->osd && s->supported) {
+		char text[SLATE_TEXT_MAX];
+		struct tm tm;
+		time_t now = time(NULL);
+
+		localtime_r(&now, &tm);
+		strftime(text, sizeof(text), "NO SIGNAL %Y-%m-%d %H:%M:%S", &tm);
+
+		obe_buf_t *pic = compose(s, text);
+		if (pic)
+			buf = pic;
+	}
+
+	obe_raw_frame_t *frame = new_raw_frame();
+	if (!frame)
+		return NULL;
+
+	/* The template carries no user data, leave the arena alone */
+	memcpy(frame, &s->tmpl, offsetof(obe_raw_frame_t, user_data_arena));
+	image_rebase(&frame->alloc_img, &s->tmpl.alloc_img, from, buf->data);
+	image_rebase(&frame->img, &s->tmpl.img, from, buf->data);
+	frame->buf_ref = obe_buf_ref(buf);
+	frame->release_data = obe_release_bufref_data;
+	frame->release_frame = obe_release_frame;
+
+	return frame;
+}
+
+int obe_slate_alloc(struct obe_slate_s **p, enum input_los_slate_e type, int osd)
+{
+	struct obe_slate_s *s = calloc(1, sizeof(*s));
+	if (!s)
+		return -1;
+
+	s->pool = obe_buf_pool_alloc("slate");
+	if (!s->pool) {
+		free(s);
+		return -1;
+	}
+
+	s->type = type;
+	s->osd = osd;
+	s->current = -1;
+
+	*p = s;
+	return 0;
+}
+
+void obe_slate_free(struct obe_slate_s *s)
+{
+	if (!s)
+		return;
+
+	for (int i = 0; i < SLATE_PICTURES; i++)
+		obe_buf_unref(s->pic[i].buf);
+	obe_buf_unref(s->base);
+	obe_buf_pool_free(s->pool);
+	free(s);
+}
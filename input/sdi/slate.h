@@ -0,0 +1,42 @@
+#ifndef OBE_SDI_SLATE_H
+#define OBE_SDI_SLATE_H
+
+/* Loss of signal slate.
+ *
+ * While an input has no signal we keep the encoders fed with a picture of our
+ * choosing, black, colour bars or the last good frame. The picture is held
+ * once, as a refcounted pooled buffer, and every injected frame is a new
+ * obe_raw_frame_t header referencing it, no planes are copied per frame.
+ *
+ * With the OSD enabled a "NO SIGNAL" banner and the wall clock are burnt in.
+ * The text changes once a second, only the banner rectangle of a small ring
+ * of composed pictures is rewritten, and only once nobody downstream holds
+ * that picture anymore.
+ */
+
+#include "common/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct obe_slate_s;
+
+int  obe_slate_alloc(struct obe_slate_s **s, enum input_los_slate_e type, int osd);
+void obe_slate_free(struct obe_slate_s *s);
+
+/* Feed every live video frame through here. Geometry is learnt from it, and
+ * for INPUT_LOS_SLATE_LAST_FRAME a reference to its pooled buffer is kept.
+ */
+void obe_slate_set_frame(struct obe_slate_s *s, const obe_raw_frame_t *frame);
+
+/* A new video frame showing the slate. The caller sets the pts and the avfm
+ * timing. NULL until a live frame has been seen.
+ */
+obe_raw_frame_t *obe_slate_get_frame(struct obe_slate_s *s);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_SDI_SLATE_H */
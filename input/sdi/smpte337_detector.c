@@ -23,8 +23,19 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <libavutil/mathematics.h>
+
+#include "common/common.h"
 #include "smpte337_detector.h"
 
+#define MESSAGE_PREFIX "[smpte337_detector]: "
+
+/* A single streaming SMPTE337 detector. Samples for the channel span are copied, MSB aligned,
+ * into a fixed word buffer. Preambles are searched for across words (16, 20 and 24 bit modes)
+ * with obe_337m_find_sync(), bursts are unpacked into a fixed payload buffer and handed to
+ * the caller. Nothing is allocated after smpte337_detector_alloc().
+ */
+
 struct smpte337_detector_s *smpte337_detector_alloc(smpte337_detector_callback cb, void *cbContext)
 {
 	struct smpte337_detector_s *ctx = calloc(1, sizeof(*ctx));
@@ -33,9 +44,13 @@ struct smpte337_detector_s *smpte337_detector_alloc(smpte337_detector_callback c
 
 	ctx->cb = cb;
 	ctx->cbContext = cbContext;
-	ctx->rb = rb_new_threadsafe(32 * 1024, 256 * 1024);
-	if (!ctx->rb) {
-		free(ctx);
+	ctx->cbPos = UINT64_MAX;
+	ctx->words = malloc(SMPTE337_DETECTOR_MAX_WORDS * sizeof(uint32_t));
+	ctx->payload = malloc(SMPTE337_DETECTOR_MAX_WORDS * sizeof(uint32_t));
+	ctx->markAvfm = calloc(SMPTE337_DETECTOR_MAX_MARKS, sizeof(struct avfm_s));
+	ctx->cbAvfm = calloc(1, sizeof(struct avfm_s));
+	if (!ctx->words || !ctx->payload || !ctx->markAvfm || !ctx->cbAvfm) {
+		smpte337_detector_free(ctx);
 		return NULL;
 	}
 
@@ -44,148 +59,142 @@ struct smpte337_detector_s *smpte337_detector_alloc(smpte337_detector_callback c
 
 void smpte337_detector_free(struct smpte337_detector_s *ctx)
 {
-	rb_free(ctx->rb);
+	free(ctx->words);
+	free(ctx->payload);
+	free(ctx->markAvfm);
+	free(ctx->cbAvfm);
 	free(ctx);
 }
 
-static void handleCallback(struct smpte337_detector_s *ctx, uint8_t datamode, uint8_t datatype,
-	uint32_t payload_bitCount, uint8_t *payload)
+/* Drop consumed words, keeping the buffer contiguous for the sync search. */
+static void compact(struct smpte337_detector_s *ctx)
 {
-	ctx->cb(ctx->cbContext, ctx, datamode, datatype, payload_bitCount, payload);
+	if (ctx->readPos == 0)
+		return;
+
+	int rem = ctx->wordsUsed - ctx->readPos;
+	if (rem > 0)
+		memmove(ctx->words, ctx->words + ctx->readPos, rem * sizeof(uint32_t));
+
+	ctx->basePos += ctx->readPos;
+	ctx->wordsUsed = rem;
+	ctx->readPos = 0;
 }
 
-/* 16b mode is largely untested, fair wanring. */
-static size_t smpte337_detector_write_16b(struct smpte337_detector_s *ctx, uint8_t *buf,
-	uint32_t audioFrames, uint32_t sampleDepth, uint32_t channelsPerFrame,
-	uint32_t frameStrideBytes,
-	uint32_t spanCount)
+static void reset(struct smpte337_detector_s *ctx)
 {
-	size_t consumed = 0;
-
-	uint16_t *p = (uint16_t *)buf;
-	for (int i = 0; i < audioFrames; i++) {
-
-		uint16_t *q = p;
-		for (int k = 0; k < spanCount; k++) {
-			/* Sample in N words into a byte orientied buffer */
-			uint8_t *x = (uint8_t *)q;
-
-			/* Flush the word into the fifo MSB first */
-			int didOverflow = 0;
-			rb_write_with_state(ctx->rb, ((const char *)x) + 1, 1, &didOverflow);
-			if (didOverflow) {
-				fprintf(stderr, "overflow occured.\n");
-			}
-			rb_write_with_state(ctx->rb, ((const char *)x) + 0, 1, &didOverflow);
-			if (didOverflow) {
-				fprintf(stderr, "overflow occured.\n");
-			}
-			q++;
-			consumed += 2;
-		}
+	ctx->basePos += ctx->wordsUsed;
+	ctx->wordsUsed = 0;
+	ctx->readPos = 0;
+	ctx->syncLossCount++;
+}
+
+/* Find the timing for the write() containing absolute word pos, and adjust it to the Pa sample. */
+static struct avfm_s *burst_timing(struct smpte337_detector_s *ctx, uint64_t pos)
+{
+	int n = ctx->markCount < SMPTE337_DETECTOR_MAX_MARKS ? ctx->markCount : SMPTE337_DETECTOR_MAX_MARKS;
+
+	for (int i = 0; i < n; i++) {
+		int idx = (ctx->markCount - 1 - i) % SMPTE337_DETECTOR_MAX_MARKS;
+		if (ctx->markPos[idx] > pos)
+			continue;
+
+		memcpy(ctx->cbAvfm, &ctx->markAvfm[idx], sizeof(struct avfm_s));
 
-		p += (frameStrideBytes / sizeof(uint16_t));
+		/* Calculate frame PTS plus sample offset, for a given rate, for accurate PTS timing generation. */
+		int64_t samples = (pos - ctx->markPos[idx]) / ctx->spanCount;
+		int64_t pts = av_rescale_q(samples, (AVRational){1, 48000}, (AVRational){1, OBE_CLOCK});
+		avfm_set_pts_audio_corrected(ctx->cbAvfm, ctx->cbAvfm->audio_pts + pts);
+
+		return ctx->cbAvfm;
 	}
-	return consumed;
+
+	return NULL;
 }
 
-static size_t smpte337_detector_write_32b(struct smpte337_detector_s *ctx, uint8_t *buf,
-	uint32_t audioFrames, uint32_t sampleDepth, uint32_t channelsPerFrame,
-	uint32_t frameStrideBytes,
-	uint32_t spanCount)
+/* Unpack nwords words of bits each, MSB first, into a byte stream. */
+static void unpack_payload(uint8_t *dst, const uint32_t *w, int nwords, int bits)
 {
-	size_t consumed = 0;
-
-	uint32_t *p = (uint32_t *)buf;
-	for (int i = 0; i < audioFrames; i++) {
-
-		uint32_t *q = p;
-		for (int k = 0; k < spanCount; k++) {
-			/* Sample in N words into a byte orientied buffer */
-			uint8_t *x = (uint8_t *)q;
-
-			/* Flush the word into the fifo MSB first */
-			int didOverflow = 0;
-			rb_write_with_state(ctx->rb, ((const char *)x) + 3, 1, &didOverflow);
-			if (didOverflow) {
-				fprintf(stderr, "overflow occured.\n");
-			}
-			rb_write_with_state(ctx->rb, ((const char *)x) + 2, 1, &didOverflow);
-			if (didOverflow) {
-				fprintf(stderr, "overflow occured.\n");
-			}
-			q++;
-			consumed += 2;
+	if (bits == 16) {
+		for (int i = 0; i < nwords; i++) {
+			*dst++ = w[i] >> 24;
+			*dst++ = w[i] >> 16;
 		}
+		return;
+	}
 
-		p += (frameStrideBytes / sizeof(uint32_t));
+	uint64_t acc = 0;
+	int accbits = 0;
+	for (int i = 0; i < nwords; i++) {
+		acc = (acc << bits) | (w[i] >> (32 - bits));
+		accbits += bits;
+		while (accbits >= 8) {
+			accbits -= 8;
+			*dst++ = acc >> accbits;
+		}
 	}
-	return consumed;
+	if (accbits)
+		*dst = acc << (8 - accbits);
 }
 
 static void run_detector(struct smpte337_detector_s *ctx)
 {
-	int skipped = 0;
-
-#define PEEK_LEN 16
-	uint8_t dat[PEEK_LEN];
-	while(1) {
-		if (rb_used(ctx->rb) < PEEK_LEN)
+	static const int mode_bits[] = { 16, 20, 24 };
+
+	while (ctx->wordsUsed - ctx->readPos >= 4) {
+		int mode;
+		int idx = obe_337m_find_sync(ctx->words + ctx->readPos, ctx->wordsUsed - ctx->readPos, &mode);
+		if (idx < 0) {
+			/* The final word could still be a Pa, keep it. */
+			ctx->readPos = ctx->wordsUsed - 1;
 			break;
+		}
+		ctx->readPos += idx;
+
+		/* Stamp the burst while the write holding its Pa is amongst the marks,
+		 * short writes can push it out before the payload is complete. */
+		uint64_t pos = ctx->basePos + ctx->readPos;
+		if (pos != ctx->cbPos) {
+			ctx->cbPos = pos;
+			ctx->cbTimed = burst_timing(ctx, pos) != NULL;
+		}
 
-		if (rb_peek(ctx->rb, (char *)&dat[0], PEEK_LEN) < PEEK_LEN)
-			break;
+		if (ctx->wordsUsed - ctx->readPos < 4)
+			break; /* Come back for Pc/Pd */
+
+		const uint32_t *burst = ctx->words + ctx->readPos;
+		int bits = mode_bits[mode];
+		uint32_t pc = burst[2] >> (32 - bits);
+		uint32_t pd = burst[3] >> (32 - bits);
 
-		/* Find the supported patterns - In this case, AC3 only in 16bit mode */
-		/* See SMPTE 337M 2015 spec table 6.
-		 * Pa = dat0/1
-		 * Pb = dat2/3 ... etc
-		 */
-		if (dat[0] == 0xF8 && dat[1] == 0x72 && dat[2] == 0x4e && dat[3] == 0x1f) {
-			/* Confirmed.... pa = 16bit, pb = 16bit */
-
-			/* Check the burst_info.... */
-			if ((dat[5] & 0x1f) == 0x01) {
-				/* Bits 0-4 datatype, 1 = AC3 */
-				/* Bits 5-6 datamode, 0 = 16bit */
-				/* Bits   7 errorflg, 0 = no error */
-				uint32_t payload_bitCount = (dat[6] << 8) | dat[7];
-				uint32_t payload_byteCount = payload_bitCount / 8;
-				
-				if (rb_used(ctx->rb) >= (8 + payload_byteCount)) {
-					char *payload = NULL;
-					size_t l = rb_read_alloc(ctx->rb, &payload, 8 + payload_byteCount);
-					if (l != (8 + payload_byteCount)) {
-						fprintf(stderr, "[smpte337_detector] Warning, rb read failure.\n");
-
-						/* Intensionally flush the ring and start acquisition again. */
-						rb_empty(ctx->rb);
-					} else {
-						handleCallback(ctx, (dat[5] >> 5) & 0x03, dat[5] & 0x1f,
-							payload_bitCount, (uint8_t *)payload + 8);
-					}
-					if (payload)
-						free(payload);
-				} else {
-					/* Not enough data in the ring buffer, come back next time. */
-					break;
-				}
-
-			} else {
-				rb_discard(ctx->rb, 1); /* Pop a byte, and continue the search */
-				skipped++;
-			}
-		} else {
-			rb_discard(ctx->rb, 1); /* Pop a byte, and continue the search */
-			skipped++;
+		/* Pc bits 0-4 datatype, bits 5-6 datamode, bit 7 errorflg. Pd is the burst length in bits. */
+		uint8_t datatype = pc & 0x1f;
+		uint8_t datamode = (pc >> 5) & 0x03;
+		int nwords = (pd + bits - 1) / bits;
+
+		if (4 + nwords > SMPTE337_DETECTOR_MAX_WORDS / 2) {
+			/* Bogus length, a false sync. Resume the search after this Pa. */
+			ctx->readPos++;
+			continue;
 		}
 
-	} /* while */
+		if (ctx->wordsUsed - ctx->readPos < 4 + nwords)
+			break; /* Not enough data yet, come back next time. */
+
+		unpack_payload(ctx->payload, burst + 4, nwords, bits);
+
+		struct avfm_s *avfm = ctx->cbTimed ? ctx->cbAvfm : NULL;
+
+		ctx->burstCount++;
+		ctx->cb(ctx->cbContext, ctx, datamode, datatype, pd, ctx->payload, avfm);
+
+		ctx->readPos += 4 + nwords;
+	}
 }
 
 size_t smpte337_detector_write(struct smpte337_detector_s *ctx, uint8_t *buf,
 	uint32_t audioFrames, uint32_t sampleDepth, uint32_t channelsPerFrame,
-	uint32_t frameStrideBytes, uint32_t spanCount)
+	uint32_t frameStrideBytes, uint32_t spanCount, struct avfm_s *avfm)
 {
 	if ((!buf) || (!audioFrames) || (!channelsPerFrame) || (!frameStrideBytes) ||
 		((sampleDepth != 16) && (sampleDepth != 32)) ||
@@ -193,18 +202,47 @@ size_t smpte337_detector_write(struct smpte337_detector_s *ctx, uint8_t *buf,
 		return 0;
 	}
 
-	size_t ret = 0;
-	if (sampleDepth == 16) {
-		ret = smpte337_detector_write_16b(ctx, buf, audioFrames, sampleDepth,
-			channelsPerFrame, frameStrideBytes, spanCount);
-	} else
+	uint32_t count = audioFrames * spanCount;
+	if (count > SMPTE337_DETECTOR_MAX_WORDS)
+		return 0;
+
+	if (spanCount != ctx->spanCount) {
+		ctx->spanCount = spanCount;
+		ctx->markCount = 0;
+		reset(ctx);
+	}
+
+	compact(ctx);
+	if (ctx->wordsUsed + count > SMPTE337_DETECTOR_MAX_WORDS) {
+		fprintf(stderr, MESSAGE_PREFIX "overflow occured.\n");
+		reset(ctx);
+	}
+
+	if (avfm) {
+		int idx = ctx->markCount++ % SMPTE337_DETECTOR_MAX_MARKS;
+		ctx->markPos[idx] = ctx->basePos + ctx->wordsUsed;
+		memcpy(&ctx->markAvfm[idx], avfm, sizeof(*avfm));
+	}
+
+	uint32_t *dst = ctx->words + ctx->wordsUsed;
 	if (sampleDepth == 32) {
-		ret = smpte337_detector_write_32b(ctx, buf, audioFrames, sampleDepth,
-			channelsPerFrame, frameStrideBytes, spanCount);
+		for (uint32_t i = 0; i < audioFrames; i++) {
+			const uint32_t *p = (const uint32_t *)(buf + (i * frameStrideBytes));
+			for (uint32_t k = 0; k < spanCount; k++)
+				*dst++ = p[k];
+		}
+	} else {
+		for (uint32_t i = 0; i < audioFrames; i++) {
+			const uint16_t *p = (const uint16_t *)(buf + (i * frameStrideBytes));
+			for (uint32_t k = 0; k < spanCount; k++)
+				*dst++ = (uint32_t)p[k] << 16;
+		}
 	}
+	ctx->wordsUsed += count;
 
-	/* Now all the fifo contains byte stream re-ordered data, run the detector. */
+	/* Now the buffer contains the words for the span, run the detector. */
 	run_detector(ctx);
 
-	return ret;
+	/* Historically callers are told the number of payload bytes examined, 2 per word. */
+	return count * 2;
 }
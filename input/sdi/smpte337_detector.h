@@ -32,22 +32,51 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
-#include "encoders/audio/ac3bitstream/klringbuffer.h"
+#include "filters/audio/337m/337m.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 struct smpte337_detector_s;
+struct avfm_s;
 
+/* payload is valid for the duration of the callback only.
+ * avfm is NULL when the caller didn't supply timing to smpte337_detector_write(),
+ * else audio_pts_corrected holds the PTS of the sample containing Pa.
+ */
 typedef void (*smpte337_detector_callback)(void *user_context,
 	struct smpte337_detector_s *ctx, 
 	uint8_t datamode, uint8_t datatype, uint32_t payload_bitCount,
-	uint8_t *payload);
+	uint8_t *payload, struct avfm_s *avfm);
+
+/* Sample words are held in a fixed buffer, large enough for the longest
+ * (E-AC-3, 6144 sample frames) burst on a pair, plus some slack.
+ */
+#define SMPTE337_DETECTOR_MAX_WORDS (32 * 1024)
+#define SMPTE337_DETECTOR_MAX_MARKS 8
 
 struct smpte337_detector_s
 {
-	KLRingBuffer *rb;
+	uint32_t *words;   /* MSB aligned samples, spanCount words per audio frame */
+	int       wordsUsed;
+	int       readPos;
+	uint64_t  basePos; /* Absolute position of words[0] */
+	uint32_t  spanCount;
+
+	uint8_t  *payload; /* Scratch, payload bytes handed to the callback */
+
+	/* Timing of recent writes, so bursts can be stamped with the PTS of their Pa sample. */
+	uint64_t  markPos[SMPTE337_DETECTOR_MAX_MARKS];
+	struct avfm_s *markAvfm; /* SMPTE337_DETECTOR_MAX_MARKS entries */
+	int       markCount;
+	struct avfm_s *cbAvfm;
+	uint64_t  cbPos;   /* Absolute position of the Pa cbAvfm is for */
+	int       cbTimed;
+
+	/* Statistics */
+	uint64_t  burstCount;
+	uint64_t  syncLossCount;
 
 	smpte337_detector_callback cb;
 	void *cbContext;
@@ -57,9 +86,12 @@ struct smpte337_detector_s *smpte337_detector_alloc(smpte337_detector_callback c
 
 void smpte337_detector_free(struct smpte337_detector_s *ctx);
 
+/* Push audioFrames frames, starting at buf, spanCount channels of each frame are
+ * examined. sampleDepth is 16 or 32, avfm may be NULL.
+ */
 size_t smpte337_detector_write(struct smpte337_detector_s *ctx, uint8_t *buf,
 	uint32_t audioFrames, uint32_t sampleDepth, uint32_t channelsPerFrame, uint32_t frameStrideBytes,
-	uint32_t spanCount);
+	uint32_t spanCount, struct avfm_s *avfm);
 
 #ifdef __cplusplus
 };
@@ -35,6 +35,7 @@ using namespace std;
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <time.h>
 
 #define MODULE_PREFIX "[v210]: "
 
@@ -47,42 +48,80 @@ extern "C"
 #include "input/sdi/ancillary.h"
 #include "input/sdi/vbi.h"
 #include "input/sdi/x86/sdi.h"
+#include "input/sdi/smpte337_detector.h"
 #include <libswresample/swresample.h>
 #include <libavutil/opt.h>
 #include <libavutil/mathematics.h>
 #include <libavutil/bswap.h>
+#include <libavutil/cpu.h>
 #include <libavutil/opt.h>
+#include <libklvanc/vanc.h>
+#include <libklscte35/scte35.h>
 }
 
 struct obe_to_v210_video
 {
     int obe_name;
     int width, height;
-    uint32_t reserved;
+    int progressive;
     int timebase_num;
     int timebase_den;
+    const char *name;
 };
 
+/* Frames are stored back to back as decklink style v210, full coded height
+ * (486 lines for NTSC), line stride padded to 48 pixels / 128 bytes.
+ */
 const static struct obe_to_v210_video video_format_tab[] =
 {
-    { INPUT_VIDEO_FORMAT_720P_5994, 1280, 720, 0 /* bmdModeHD720p60 */, 1001, 60000 },
-    { INPUT_VIDEO_FORMAT_720P_60,   1280, 720, 0 /* bmdModeHD720p60 */, 1000, 60000 },
+    { INPUT_VIDEO_FORMAT_PAL,        720,  576,  0, 1,    25,    "720x576i", },
+    { INPUT_VIDEO_FORMAT_NTSC,       720,  486,  0, 1001, 30000, "720x480i", },
+    { INPUT_VIDEO_FORMAT_720P_50,    1280, 720,  1, 1,    50,    "1280x720p50", },
+    { INPUT_VIDEO_FORMAT_720P_5994,  1280, 720,  1, 1001, 60000, "1280x720p59.94", },
+    { INPUT_VIDEO_FORMAT_720P_60,    1280, 720,  1, 1,    60,    "1280x720p60", },
+    { INPUT_VIDEO_FORMAT_1080I_50,   1920, 1080, 0, 1,    25,    "1920x1080i25", },
+    { INPUT_VIDEO_FORMAT_1080I_5994, 1920, 1080, 0, 1001, 30000, "1920x1080i29.97", },
+    { INPUT_VIDEO_FORMAT_1080I_60,   1920, 1080, 0, 1,    30,    "1920x1080i30", },
+    { INPUT_VIDEO_FORMAT_1080P_2398, 1920, 1080, 1, 1001, 24000, "1920x1080p23.98", },
+    { INPUT_VIDEO_FORMAT_1080P_24,   1920, 1080, 1, 1,    24,    "1920x1080p24", },
+    { INPUT_VIDEO_FORMAT_1080P_25,   1920, 1080, 1, 1,    25,    "1920x1080p25", },
+    { INPUT_VIDEO_FORMAT_1080P_2997, 1920, 1080, 1, 1001, 30000, "1920x1080p29.97", },
+    { INPUT_VIDEO_FORMAT_1080P_30,   1920, 1080, 1, 1,    30,    "1920x1080p30", },
+    { INPUT_VIDEO_FORMAT_1080P_50,   1920, 1080, 1, 1,    50,    "1920x1080p50", },
+    { INPUT_VIDEO_FORMAT_1080P_5994, 1920, 1080, 1, 1001, 60000, "1920x1080p59.94", },
+    { INPUT_VIDEO_FORMAT_1080P_60,   1920, 1080, 1, 1,    60,    "1920x1080p60", },
+    { INPUT_VIDEO_FORMAT_2160P_50,   3840, 2160, 1, 1,    50,    "3840x2160p50", },
+    { -1, 0, 0, 0, 0, 0, NULL },
 };
 
-static int lookupOBEName(int w, int h, int den, int num)
+static const struct obe_to_v210_video *lookupFormat(int obe_name)
 {
-	for (unsigned int i = 0; i < (sizeof(video_format_tab) / sizeof(struct obe_to_v210_video)); i++) {
-		const struct obe_to_v210_video *fmt = &video_format_tab[i];
-		if ((fmt->width == w) && (fmt->height == h) &&
-			(fmt->timebase_den == den) && (fmt->timebase_num == num))
-		{
-			return fmt->obe_name;
-		}
+	for (int i = 0; video_format_tab[i].obe_name != -1; i++) {
+		if (video_format_tab[i].obe_name == obe_name)
+			return &video_format_tab[i];
 	}
 
-	return video_format_tab[0].obe_name;
+	return NULL;
 }
 
+/* Optional sidecars, found next to the video file by swapping its .v210 extension.
+ * Both are indexed by video frame number and loop with the video.
+ *  .s32  Raw 16 channel interleaved S32LE, the decklink capture layout.
+ *  .wav  PCM 48KHz, 16/24/32 bit, up to 16 channels. Used when there's no .s32.
+ *  .vanc VANC lines as captured, each a v210_vanc_record_s followed by length
+ *        bytes of v210, in frame order.
+ * Without an audio sidecar the input plays silence.
+ */
+#define V210_VANC_RECORD_MAGIC 0x434e4156 /* 'VANC' */
+
+struct v210_vanc_record_s
+{
+	uint32_t magic;
+	uint32_t frame_nr;
+	uint32_t line_nr;
+	uint32_t length;
+} __attribute__((packed));
+
 typedef struct
 {
 	/* V210 input related */
@@ -90,14 +129,40 @@ typedef struct
 	uint8_t *v210_addr;
 	size_t v210_file_size;
 	unsigned int frameSizeBytesVideo;
+	unsigned int strideBytesVideo;
 	unsigned int totalInputFrames;
 	unsigned int currentFrame;
 	uint64_t v_counter;
-
-	/* AVCodec for V210 conversion. */
-	AVCodec         *dec;
-	AVCodecContext  *codec;
-	/* End: AVCodec for V210 conversion. */
+	char video_fn[256];
+
+	void (*unpack_line) (const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width);
+	obe_buf_pool_t *vpool;
+
+	/* Pacing, absolute CLOCK_MONOTONIC deadlines from the first frame. */
+	struct timespec start_time;
+
+	/* Audio sidecar, num_channels interleaved S32 */
+	const int32_t *audio_s32;
+	uint64_t audioFrames;
+	uint8_t *audio_map;
+	size_t audio_map_size;
+	int32_t *audio_converted;
+	uint64_t a_counter;
+	obe_buf_pool_t *apool;
+	obe_s32_deinterleave_pair_t deinterleave_pair;
+	int deinterleave_align;
+	struct audio_pair_s audio_pairs[MAX_AUDIO_PAIRS];
+
+	/* VANC sidecar */
+	uint8_t *vanc_addr;
+	size_t vanc_file_size;
+	size_t *vanc_index; /* Per video frame, offset of its first record or SIZE_MAX */
+	uint16_t *anc_line;
+	void (*pack_anc_line) (uint32_t *src, uint16_t *dst, int width);
+	obe_sdi_non_display_data_t non_display_parser;
+	struct klvanc_context_s *vanchdl;
+	struct klvanc_callbacks_s callbacks;
+	int64_t vanc_pts;
 
 	pthread_t vthreadId;
 	int vthreadTerminate, vthreadRunning, vthreadComplete;
@@ -131,6 +196,11 @@ typedef struct
 
     int interlaced;
     int tff;
+
+    int free_run;
+    int enable_bitstream_audio;
+    int enable_scte35;
+    char *location;
 } v210_opts_t;
 
 static uint8_t *getNextFrameAddress(v210_opts_t *opts)
@@ -145,19 +215,463 @@ static uint8_t *getNextFrameAddress(v210_opts_t *opts)
 	return ctx->v210_addr + (ctx->currentFrame * ctx->frameSizeBytesVideo);
 }
 
+static void sidecar_name(char *dst, size_t len, const char *video_fn, const char *ext)
+{
+	const char *dot = strrchr(video_fn, '.');
+	int n = (dot && strcmp(dot, ".v210") == 0) ? (int)(dot - video_fn) : (int)strlen(video_fn);
+
+	snprintf(dst, len, "%.*s%s", n, video_fn, ext);
+}
+
+static uint8_t *map_file(const char *fn, size_t *size, int populate)
+{
+	int fd = open(fn, O_RDONLY | O_LARGEFILE);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	*size = st.st_size;
+	return (uint8_t *)p;
+}
+
+static uint16_t rd16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int parse_wav(v210_opts_t *opts, const char *fn)
+{
+	v210_ctx_t *ctx = &opts->ctx;
+	const uint8_t *p = ctx->audio_map;
+	const uint8_t *end = p + ctx->audio_map_size;
+	const uint8_t *data = NULL;
+	size_t data_len = 0;
+	int format = 0, channels = 0, bits = 0;
+	uint32_t rate = 0;
+
+	if (ctx->audio_map_size < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4)) {
+		fprintf(stderr, MODULE_PREFIX "'%s' is not a WAV file.\n", fn);
+		return -1;
+	}
+
+	for (p += 12; p + 8 <= end; ) {
+		uint32_t len = rd32(p + 4);
+		const uint8_t *body = p + 8;
+
+		if (!memcmp(p, "fmt ", 4) && len >= 16 && body + 16 <= end) {
+			format = rd16(body);
+			if (format == 0xfffe && len >= 26)
+				format = rd16(body + 24); /* WAVE_FORMAT_EXTENSIBLE, sub format */
+			channels = rd16(body + 2);
+			rate = rd32(body + 4);
+			bits = rd16(body + 14);
+		} else if (!memcmp(p, "data", 4)) {
+			/* Tolerate a truncated or still growing file */
+			data = body;
+			data_len = body + len <= end ? len : end - body;
+			break;
+		}
+
+		p = body + len + (len & 1);
+	}
+
+	if (!data || format != 1 || channels < 1 || channels > opts->num_channels || rate != 48000 ||
+		(bits != 16 && bits != 24 && bits != 32)) {
+		fprintf(stderr, MODULE_PREFIX "'%s': need 48KHz 16/24/32 bit PCM, up to %d channels.\n",
+			fn, opts->num_channels);
+		return -1;
+	}
+
+	int bps = bits / 8;
+	ctx->audioFrames = data_len / (channels * bps);
+
+	if (channels == opts->num_channels && bits == 32) {
+		ctx->audio_s32 = (const int32_t *)data;
+		return 0;
+	}
+
+	/* Expand to the decklink layout once, so playout is the same as for .s32 */
+	ctx->audio_converted = (int32_t *)calloc(ctx->audioFrames * opts->num_channels, sizeof(int32_t));
+	if (!ctx->audio_converted) {
+		fprintf(stderr, MODULE_PREFIX "Unable to alloc audio buffer.\n");
+		return -1;
+	}
+
+	for (uint64_t i = 0; i < ctx->audioFrames; i++) {
+		int32_t *dst = ctx->audio_converted + (i * opts->num_channels);
+		for (int c = 0; c < channels; c++, data += bps) {
+			uint32_t v = 0;
+			for (int b = 0; b < bps; b++)
+				v |= (uint32_t)data[b] << (32 - bits + (b * 8));
+			dst[c] = (int32_t)v;
+		}
+	}
+	ctx->audio_s32 = ctx->audio_converted;
+
+	munmap(ctx->audio_map, ctx->audio_map_size);
+	ctx->audio_map = NULL;
+
+	return 0;
+}
+
+static int open_audio_sidecar(v210_opts_t *opts)
+{
+	v210_ctx_t *ctx = &opts->ctx;
+	char fn[sizeof(ctx->video_fn) + 8];
+
+	sidecar_name(fn, sizeof(fn), ctx->video_fn, ".s32");
+	ctx->audio_map = map_file(fn, &ctx->audio_map_size, !opts->probe);
+	if (ctx->audio_map) {
+		ctx->audio_s32 = (const int32_t *)ctx->audio_map;
+		ctx->audioFrames = ctx->audio_map_size / (opts->num_channels * sizeof(int32_t));
+	} else {
+		sidecar_name(fn, sizeof(fn), ctx->video_fn, ".wav");
+		ctx->audio_map = map_file(fn, &ctx->audio_map_size, !opts->probe);
+		if (!ctx->audio_map) {
+			printf(MODULE_PREFIX "No audio sidecar, playing silence.\n");
+			return 0;
+		}
+		if (parse_wav(opts, fn) < 0)
+			return -1;
+	}
+
+	printf(MODULE_PREFIX "Audio sidecar '%s', %" PRIu64 " sample frames.\n", fn, ctx->audioFrames);
+
+	return 0;
+}
+
+/* As decklink, only Multiple Operation Messages are translated to SCTE-35. */
+static int cb_SCTE_104(void *callback_context, struct klvanc_context_s *vh, struct klvanc_packet_scte_104_s *pkt)
+{
+	v210_ctx_t *ctx = (v210_ctx_t *)callback_context;
+
+	return sdi_scte104_to_scte35(ctx->h, ctx->device, pkt, ctx->vanc_pts);
+}
+
+static int open_vanc_sidecar(v210_opts_t *opts)
+{
+	v210_ctx_t *ctx = &opts->ctx;
+	char fn[sizeof(ctx->video_fn) + 8];
+
+	sidecar_name(fn, sizeof(fn), ctx->video_fn, ".vanc");
+	ctx->vanc_addr = map_file(fn, &ctx->vanc_file_size, !opts->probe);
+	if (!ctx->vanc_addr)
+		return 0;
+
+	ctx->vanc_index = (size_t *)malloc(ctx->totalInputFrames * sizeof(size_t));
+	ctx->anc_line = (uint16_t *)av_malloc(FFALIGN(opts->width * 2 * sizeof(uint16_t), 16));
+	if (!ctx->vanc_index || !ctx->anc_line) {
+		fprintf(stderr, MODULE_PREFIX "Unable to alloc VANC index.\n");
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < ctx->totalInputFrames; i++)
+		ctx->vanc_index[i] = SIZE_MAX;
+
+	size_t pos = 0;
+	int records = 0;
+	while (pos + sizeof(struct v210_vanc_record_s) <= ctx->vanc_file_size) {
+		const struct v210_vanc_record_s *r = (const struct v210_vanc_record_s *)(ctx->vanc_addr + pos);
+		if (r->magic != V210_VANC_RECORD_MAGIC || pos + sizeof(*r) + r->length > ctx->vanc_file_size) {
+			fprintf(stderr, MODULE_PREFIX "'%s' corrupt at offset %zu, ignoring the remainder.\n", fn, pos);
+			break;
+		}
+
+		if (r->frame_nr < ctx->totalInputFrames && ctx->vanc_index[r->frame_nr] == SIZE_MAX)
+			ctx->vanc_index[r->frame_nr] = pos;
+
+		pos += sizeof(*r) + r->length;
+		records++;
+	}
+	ctx->vanc_file_size = pos;
+
+	/* Same line formats decklink hands the parser */
+	ctx->pack_anc_line = IS_SD(opts->video_format) ? obe_v210_line_to_uyvy_c : obe_v210_line_to_nv20_c;
+
+	if (klvanc_context_create(&ctx->vanchdl) < 0) {
+		fprintf(stderr, MODULE_PREFIX "Error initializing VANC library context\n");
+		ctx->vanchdl = NULL;
+	} else {
+		memset(&ctx->callbacks, 0, sizeof(ctx->callbacks));
+		if (opts->enable_scte35)
+			ctx->callbacks.scte_104 = cb_SCTE_104;
+		ctx->vanchdl->verbose = 0;
+		ctx->vanchdl->callbacks = &ctx->callbacks;
+		ctx->vanchdl->callback_context = ctx;
+	}
+
+	printf(MODULE_PREFIX "VANC sidecar '%s', %d lines.\n", fn, records);
+
+	return 0;
+}
+
+/* Replay the VANC lines recorded for frame_nr, through both libklvanc and the OBE parser. */
+static void process_vanc(v210_opts_t *opts, obe_raw_frame_t *raw_frame, unsigned int frame_nr)
+{
+	v210_ctx_t *ctx = &opts->ctx;
+
+	if (!ctx->vanc_index || ctx->vanc_index[frame_nr] == SIZE_MAX)
+		return;
+
+	size_t pos = ctx->vanc_index[frame_nr];
+	while (pos < ctx->vanc_file_size) {
+		const struct v210_vanc_record_s *r = (const struct v210_vanc_record_s *)(ctx->vanc_addr + pos);
+		if (r->frame_nr != frame_nr)
+			break;
+		pos += sizeof(*r) + r->length;
+
+		if (r->length < ctx->strideBytesVideo)
+			continue;
+
+		uint32_t *line = (uint32_t *)(r + 1);
+
+		if (ctx->vanchdl) {
+			uint16_t decoded_words[16384];
+			memset(&decoded_words[0], 0, sizeof(decoded_words));
+			if (klvanc_v210_line_to_nv20_c(line, decoded_words, sizeof(decoded_words), (opts->width / 6) * 6) == 0)
+				klvanc_packet_parse(ctx->vanchdl, r->line_nr, decoded_words, sizeof(decoded_words) / (sizeof(unsigned short)));
+		}
+
+		ctx->pack_anc_line(line, ctx->anc_line, opts->width);
+		parse_vanc_line(ctx->h, &ctx->non_display_parser, raw_frame, ctx->anc_line, opts->width, r->line_nr);
+	}
+}
+
+/* Sample frames of audio belonging to video frame frame_nr. 1001 rates alternate
+ * (1601/1602 etc), derive it from the frame number so audio stays locked to video
+ * across file loops.
+ */
+static int64_t audio_frame_start(v210_opts_t *opts, int64_t frame_nr)
+{
+	return av_rescale(frame_nr, 48000 * opts->timebase_num, opts->timebase_den);
+}
+
+static const int32_t *get_audio(v210_opts_t *opts, unsigned int frame_nr, int *num_samples, obe_buf_t **packet_buf)
+{
+	v210_ctx_t *ctx = &opts->ctx;
+	int stride = opts->num_channels * sizeof(int32_t);
+	int64_t start = audio_frame_start(opts, frame_nr);
+
+	*num_samples = audio_frame_start(opts, frame_nr + 1) - start;
+	*packet_buf = NULL;
+
+	if (start + *num_samples <= (int64_t)ctx->audioFrames)
+		return ctx->audio_s32 + (start * opts->num_channels);
+
+	/* Past the end of the sidecar, or none at all, pad with silence */
+	obe_buf_t *buf = obe_buf_pool_get(ctx->apool, *num_samples * stride);
+	if (!buf)
+		return NULL;
+
+	int avail = start < (int64_t)ctx->audioFrames ? ctx->audioFrames - start : 0;
+	if (avail)
+		memcpy(buf->data, ctx->audio_s32 + (start * opts->num_channels), avail * stride);
+	memset(buf->data + (avail * stride), 0, (*num_samples - avail) * stride);
+
+	*packet_buf = buf;
+	return (const int32_t *)buf->data;
+}
+
+static void detect_bitstream_audio(v210_opts_t *opts, const int32_t *src, int num_samples)
+{
+	v210_ctx_t *ctx = &opts->ctx;
+	int depth = 32;
+	int span = 2;
+
+	for (int i = 0; i < MAX_AUDIO_PAIRS; i++) {
+		struct audio_pair_s *pair = &ctx->audio_pairs[i];
+		if (!pair->smpte337_detector)
+			continue;
+
+		/* Figure out the offset in the line, where this channel pair begins. */
+		int offset = i * ((depth / 8) * span);
+		smpte337_detector_write(pair->smpte337_detector, (uint8_t *)src + offset, num_samples,
+			depth, opts->num_channels, opts->num_channels * (depth / 8), span, NULL);
+	}
+}
+
+/* Ship the audio belonging to frame_nr, PCM and SMPTE-337 bitstream pairs as decklink's processAudio() does. */
+static void process_audio(v210_opts_t *opts, unsigned int frame_nr, int64_t videoPTS)
+{
+	v210_ctx_t *ctx = &opts->ctx;
+	obe_buf_t *packet_buf = NULL;
+	int hasSentAudioBuffer = 0;
+	int num_samples;
+	int stride = opts->num_channels * sizeof(int32_t);
+	int64_t vframe_duration = av_rescale(OBE_CLOCK, opts->timebase_num, opts->timebase_den);
+
+	const int32_t *src = get_audio(opts, frame_nr, &num_samples, &packet_buf);
+	if (!src) {
+		syslog(LOG_ERR, "Malloc failed\n");
+		return;
+	}
+
+	int64_t packet_time = av_rescale(ctx->a_counter, OBE_CLOCK, 48000);
+	ctx->a_counter += num_samples;
+
+	if (opts->enable_bitstream_audio)
+		detect_bitstream_audio(opts, src, num_samples);
+
+	for (int i = 0; i < MAX_AUDIO_PAIRS; i++) {
+		struct audio_pair_s *pair = &ctx->audio_pairs[i];
+		obe_raw_frame_t *raw_frame;
+
+		if (!pair->smpte337_detected_ac3 && hasSentAudioBuffer == 0) {
+			/* PCM audio, forward to compressors */
+			raw_frame = new_raw_frame();
+			if (!raw_frame) {
+				syslog(LOG_ERR, "Malloc failed\n");
+				break;
+			}
+			raw_frame->audio_frame.num_samples = num_samples;
+			raw_frame->audio_frame.num_channels = opts->num_channels;
+			raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_S32P;
+			raw_frame->release_data = obe_release_bufref_data;
+			raw_frame->release_frame = obe_release_frame;
+
+			if (sdi_deinterleave_audio(raw_frame, src, ctx->apool, ctx->deinterleave_pair,
+				ctx->deinterleave_align, UINT32_MAX) < 0) {
+				syslog(LOG_ERR, MODULE_PREFIX "Sample format conversion failed\n");
+				raw_frame->release_frame(raw_frame);
+				break;
+			}
+
+			raw_frame->pts = packet_time;
+			avfm_init(&raw_frame->avfm, AVFM_AUDIO_PCM);
+			avfm_set_hw_status_mask(&raw_frame->avfm, AVFM_HW_STATUS__BLACKMAGIC_DUPLEX_FULL);
+			avfm_set_pts_video(&raw_frame->avfm, videoPTS);
+			avfm_set_pts_audio(&raw_frame->avfm, packet_time);
+			avfm_set_hw_received_time(&raw_frame->avfm);
+			avfm_set_video_interval_clk(&raw_frame->avfm, vframe_duration);
+
+			raw_frame->input_stream_id = pair->input_stream_id;
+			if (add_to_filter_queue(ctx->h, raw_frame) < 0) {
+				raw_frame->release_data(raw_frame);
+				raw_frame->release_frame(raw_frame);
+			}
+			hasSentAudioBuffer++;
+		}
+
+		if (pair->smpte337_detected_ac3) {
+			/* One copy of the packet, shared by every bitstream pair */
+			if (!packet_buf) {
+				packet_buf = obe_buf_pool_get(ctx->apool, num_samples * stride);
+				if (!packet_buf) {
+					syslog(LOG_ERR, "Malloc failed\n");
+					break;
+				}
+				memcpy(packet_buf->data, src, num_samples * stride);
+			}
+
+			raw_frame = new_raw_frame();
+			if (!raw_frame) {
+				syslog(LOG_ERR, "Malloc failed\n");
+				break;
+			}
+			raw_frame->audio_frame.num_samples = num_samples;
+			raw_frame->audio_frame.num_channels = opts->num_channels;
+			raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_NONE; /* No specific format. The audio filter will play passthrough. */
+			raw_frame->audio_frame.linesize = stride;
+			raw_frame->audio_frame.stride = stride;
+			raw_frame->audio_frame.offset = i * 8;
+			raw_frame->buf_ref = obe_buf_ref(packet_buf);
+			raw_frame->audio_frame.audio_data[0] = packet_buf->data;
+
+			raw_frame->pts = packet_time;
+			avfm_init(&raw_frame->avfm, AVFM_AUDIO_A52);
+			avfm_set_hw_status_mask(&raw_frame->avfm, AVFM_HW_STATUS__BLACKMAGIC_DUPLEX_FULL);
+			avfm_set_pts_video(&raw_frame->avfm, videoPTS);
+			avfm_set_pts_audio(&raw_frame->avfm, packet_time);
+			avfm_set_hw_received_time(&raw_frame->avfm);
+			avfm_set_video_interval_clk(&raw_frame->avfm, vframe_duration);
+
+			raw_frame->release_data = obe_release_bufref_data;
+			raw_frame->release_frame = obe_release_frame;
+			raw_frame->input_stream_id = pair->input_stream_id;
+			if (add_to_filter_queue(ctx->h, raw_frame) < 0) {
+				raw_frame->release_data(raw_frame);
+				raw_frame->release_frame(raw_frame);
+			}
+		}
+	}
+
+	obe_buf_unref(packet_buf);
+}
+
+/* Run the first frames' sidecar payloads through the detectors and parsers, to discover services. */
+static void probe_sidecars(v210_opts_t *opts)
+{
+	v210_ctx_t *ctx = &opts->ctx;
+	unsigned int frames = ctx->totalInputFrames < 50 ? ctx->totalInputFrames : 50;
+
+	for (unsigned int i = 0; i < frames; i++) {
+		process_vanc(opts, NULL, i);
+
+		if (opts->enable_bitstream_audio && ctx->audioFrames) {
+			int num_samples;
+			obe_buf_t *packet_buf;
+			const int32_t *src = get_audio(opts, i, &num_samples, &packet_buf);
+			if (src)
+				detect_bitstream_audio(opts, src, num_samples);
+			obe_buf_unref(packet_buf);
+		}
+	}
+}
+
+/* Sleep until frame nr is due. Deadlines are computed from the start time
+ * rather than accumulated, so scheduling jitter never turns into drift.
+ */
+static void wait_for_frame(v210_opts_t *opts, uint64_t nr)
+{
+	v210_ctx_t *ctx = &opts->ctx;
+
+	uint64_t ns = av_rescale(nr, opts->timebase_num * 1000000000LL, opts->timebase_den);
+
+	struct timespec deadline = ctx->start_time;
+	deadline.tv_sec += ns / 1000000000ULL;
+	deadline.tv_nsec += ns % 1000000000ULL;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+		;
+}
+
 static void *v210_videoThreadFunc(void *p)
 {
 	v210_opts_t *opts = (v210_opts_t *)p;
 	v210_ctx_t *ctx = &opts->ctx;
 
-	printf(MODULE_PREFIX "Video thread starts\n");
+	printf(MODULE_PREFIX "Video thread starts, %s\n", opts->free_run ? "free-running" : "paced");
 
 	ctx->vthreadRunning = 1;
 	ctx->vthreadComplete = 0;
 	ctx->vthreadTerminate = 0;
 
+	clock_gettime(CLOCK_MONOTONIC, &ctx->start_time);
+
 	while (!ctx->vthreadTerminate && opts->probe == 0) {
 
+		if (!opts->free_run)
+			wait_for_frame(opts, ctx->v_counter);
+
 		/* Ship the payload into the OBE pipeline. */
 		obe_raw_frame_t *raw_frame = new_raw_frame();
 		if (!raw_frame) {
@@ -165,44 +679,62 @@ static void *v210_videoThreadFunc(void *p)
 			break;
 		}
 
-		AVFrame *frame = av_frame_alloc();
-		ctx->codec->width = opts->width;
-		ctx->codec->height = opts->height;
-
-		usleep(166 * 100);
-
-		AVPacket pkt;
-		av_init_packet(&pkt);
-
-		pkt.data = getNextFrameAddress(opts);
-		pkt.size = ctx->frameSizeBytesVideo;
+		raw_frame->release_data = obe_release_bufref_data;
+		raw_frame->release_frame = obe_release_frame;
 
-		int ret = avcodec_send_packet(ctx->codec, &pkt);
-		while (ret >= 0) {
-			ret = avcodec_receive_frame(ctx->codec, frame);
-			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-				return NULL;
-			else if (ret < 0) {
-			}
+		obe_image_t *img = &raw_frame->alloc_img;
+		if (obe_image_alloc_pooled(raw_frame, ctx->vpool, img->plane, img->stride, opts->width, opts->height + 1,
+		                           AV_PIX_FMT_YUV422P10, 32) < 0) {
+			fprintf(stderr, MODULE_PREFIX "Could not allocate video frame buffer\n");
+			raw_frame->release_frame(raw_frame);
 			break;
 		}
 
-		raw_frame->release_data = obe_release_video_data;
-		raw_frame->release_frame = obe_release_frame;
+		/* v210 to planar 4:2:2 10bit, straight out of the mapping. */
+		const uint8_t *src = getNextFrameAddress(opts);
+		unsigned int frame_nr = ctx->currentFrame;
+		uint16_t *y = (uint16_t *)img->plane[0];
+		uint16_t *u = (uint16_t *)img->plane[1];
+		uint16_t *v = (uint16_t *)img->plane[2];
+		for (int i = 0; i < opts->height; i++) {
+			ctx->unpack_line((const uint32_t *)src, y, u, v, opts->width);
+			src += ctx->strideBytesVideo;
+			y += img->stride[0] / 2;
+			u += img->stride[1] / 2;
+			v += img->stride[2] / 2;
+		}
 
-		memcpy(raw_frame->alloc_img.stride, frame->linesize, sizeof(raw_frame->alloc_img.stride));
-		memcpy(raw_frame->alloc_img.plane, frame->data, sizeof(raw_frame->alloc_img.plane));
-		av_frame_free(&frame);
-		raw_frame->alloc_img.csp = ctx->codec->pix_fmt;
-                const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(raw_frame->alloc_img.csp);
-		raw_frame->alloc_img.planes = d->nb_components;
-		raw_frame->alloc_img.width = opts->width;
-		raw_frame->alloc_img.height = opts->height;
-		raw_frame->alloc_img.format = opts->video_format;
+		img->csp = AV_PIX_FMT_YUV422P10;
+		img->planes = av_pix_fmt_count_planes(img->csp);
+		img->width = opts->width;
+		img->height = opts->height;
+		img->format = opts->video_format;
 		raw_frame->timebase_num = opts->timebase_num;
 		raw_frame->timebase_den = opts->timebase_den;
 		memcpy(&raw_frame->img, &raw_frame->alloc_img, sizeof(raw_frame->alloc_img));
 
+		if (IS_SD(opts->video_format)) {
+			int j;
+			for (j = 0; first_active_line[j].format != -1; j++) {
+				if (opts->video_format == first_active_line[j].format)
+					break;
+			}
+			raw_frame->img.first_line = first_active_line[j].line;
+
+			/* Like decklink, present the 480 coded lines out of the 486 captured. */
+			if (opts->video_format == INPUT_VIDEO_FORMAT_NTSC) {
+				raw_frame->img.height = 480;
+				while (raw_frame->img.first_line != NTSC_FIRST_CODED_LINE) {
+					for (int i = 0; i < raw_frame->img.planes; i++)
+						raw_frame->img.plane[i] += raw_frame->img.stride[i];
+
+					raw_frame->img.first_line = sdi_next_line(INPUT_VIDEO_FORMAT_NTSC, raw_frame->img.first_line);
+				}
+			}
+		}
+
+		raw_frame->sar_width = raw_frame->sar_height = 1;
+
 		int64_t pts = av_rescale_q(ctx->v_counter++, ctx->v_timebase, (AVRational){1, OBE_CLOCK} );
 		obe_clock_tick(ctx->h, pts);
 		raw_frame->pts = pts;
@@ -216,18 +748,23 @@ static void *v210_videoThreadFunc(void *p)
 		avfm_set_pts_audio(&raw_frame->avfm, pts);
 
 		avfm_set_hw_received_time(&raw_frame->avfm);
-		double dur = 27000000 / (opts->timebase_den / opts->timebase_num);
+		double dur = av_rescale(OBE_CLOCK, opts->timebase_num, opts->timebase_den);
 		avfm_set_video_interval_clk(&raw_frame->avfm, dur);
 		//raw_frame->avfm.hw_audio_correction_clk = clock_offset;
 			//avfm_dump(&raw_frame->avfm);
 
+		/* Sidecars, in lockstep with the video frame */
+		ctx->vanc_pts = pts;
+		process_vanc(opts, raw_frame, frame_nr);
+
+		obe_cadence_video(&ctx->h->input_cadence, pts, dur, &raw_frame->avfm);
+
 		if (add_to_filter_queue(ctx->h, raw_frame) < 0 ) {
+			raw_frame->release_data(raw_frame);
+			raw_frame->release_frame(raw_frame);
 		}
 
-		if (frame)
-			av_frame_free(&frame);
-
-		av_packet_unref(&pkt);
+		process_audio(opts, frame_nr, pts);
 	}
 	printf(MODULE_PREFIX "Video thread complete\n");
 
@@ -248,13 +785,46 @@ static void close_device(v210_opts_t *opts)
 			usleep(50 * 1000);
 	}
 
-	if (ctx->codec) {
-		avcodec_close(ctx->codec);
-		av_free(ctx->codec);
+	for (int i = 0; i < MAX_AUDIO_PAIRS; i++) {
+		struct audio_pair_s *pair = &ctx->audio_pairs[i];
+		if (pair->smpte337_detector) {
+			smpte337_detector_free(pair->smpte337_detector);
+			pair->smpte337_detector = NULL;
+		}
 	}
 
-	munmap(ctx->v210_addr, ctx->v210_file_size);
-	close(ctx->v210_fd);
+	if (ctx->vanchdl) {
+		klvanc_context_destroy(ctx->vanchdl);
+		ctx->vanchdl = NULL;
+	}
+	free(ctx->vanc_index);
+	ctx->vanc_index = NULL;
+	av_freep(&ctx->anc_line);
+	if (ctx->vanc_addr) {
+		munmap(ctx->vanc_addr, ctx->vanc_file_size);
+		ctx->vanc_addr = NULL;
+	}
+
+	if (ctx->audio_map) {
+		munmap(ctx->audio_map, ctx->audio_map_size);
+		ctx->audio_map = NULL;
+	}
+	free(ctx->audio_converted);
+	ctx->audio_converted = NULL;
+	ctx->audio_s32 = NULL;
+
+	/* Frames still in the pipeline keep their pool buffers until released */
+	obe_buf_pool_free(ctx->vpool);
+	ctx->vpool = NULL;
+	obe_buf_pool_free(ctx->apool);
+	ctx->apool = NULL;
+
+	if (ctx->v210_addr) {
+		munmap(ctx->v210_addr, ctx->v210_file_size);
+		ctx->v210_addr = NULL;
+	}
+	if (ctx->v210_fd >= 0)
+		close(ctx->v210_fd);
 	ctx->v210_fd = -1;
 
 	printf(MODULE_PREFIX "Closed card idx #%d\n", opts->card_idx);
@@ -266,21 +836,33 @@ static int open_device(v210_opts_t *opts)
 
 	v210_ctx_t *ctx = &opts->ctx;
 
-	char fn[64];
-	sprintf(fn, "../../raw-input%d.v210", opts->card_idx);
-	printf(MODULE_PREFIX "Searching for V210 filename '%s'\n", fn);
+	const struct obe_to_v210_video *fmt = lookupFormat(opts->video_format);
+	if (!fmt) {
+		/* Historical default */
+		fmt = lookupFormat(INPUT_VIDEO_FORMAT_720P_5994);
+	}
 
-	ctx->v210_fd = open(fn, O_LARGEFILE, 0600); //6 = read+write for me!
-	if (ctx->v210_fd < 0) {
-		fprintf(stderr, MODULE_PREFIX "No input filename '%s' detected.\n", fn);
-		sprintf(fn, "raw-input%d.v210", opts->card_idx);
+	char fn[256];
+	if (opts->location) {
+		snprintf(fn, sizeof(fn), "%s", opts->location);
+		printf(MODULE_PREFIX "Opening V210 filename '%s'\n", fn);
+		ctx->v210_fd = open(fn, O_RDONLY | O_LARGEFILE);
+	} else {
+		sprintf(fn, "../../raw-input%d.v210", opts->card_idx);
 		printf(MODULE_PREFIX "Searching for V210 filename '%s'\n", fn);
-		ctx->v210_fd = open(fn, O_LARGEFILE, 0600); //6 = read+write for me!
+		ctx->v210_fd = open(fn, O_RDONLY | O_LARGEFILE);
 		if (ctx->v210_fd < 0) {
 			fprintf(stderr, MODULE_PREFIX "No input filename '%s' detected.\n", fn);
-			return -1;
+			sprintf(fn, "raw-input%d.v210", opts->card_idx);
+			printf(MODULE_PREFIX "Searching for V210 filename '%s'\n", fn);
+			ctx->v210_fd = open(fn, O_RDONLY | O_LARGEFILE);
 		}
 	}
+	if (ctx->v210_fd < 0) {
+		fprintf(stderr, MODULE_PREFIX "No input filename '%s' detected.\n", fn);
+		return -1;
+	}
+	snprintf(ctx->video_fn, sizeof(ctx->video_fn), "%s", fn);
 
 	struct stat buf;
 	if (fstat(ctx->v210_fd, &buf) < 0) {
@@ -292,59 +874,84 @@ static int open_device(v210_opts_t *opts)
 
 	ctx->v210_file_size = buf.st_size;
 
-	/* Determine the overall size of the video frame. */
-	ctx->frameSizeBytesVideo = 3456 * 720;
+	opts->width = fmt->width;
+	opts->height = fmt->height;
+	opts->interlaced = !fmt->progressive;
+	opts->tff = 1;
+	opts->timebase_num = fmt->timebase_num;
+	opts->timebase_den = fmt->timebase_den;
+	opts->video_format = fmt->obe_name;
+
+	/* Determine the overall size of the video frame, v210 lines are padded to 48 pixels. */
+	ctx->strideBytesVideo = ((opts->width + 47) / 48) * 128;
+	ctx->frameSizeBytesVideo = ctx->strideBytesVideo * opts->height;
 	ctx->totalInputFrames = ctx->v210_file_size / ctx->frameSizeBytesVideo;
+	if (ctx->totalInputFrames == 0) {
+		fprintf(stderr, MODULE_PREFIX "File '%s' is smaller than one %s frame.\n", fn, fmt->name);
+		close(ctx->v210_fd);
+		ctx->v210_fd = -1;
+		return -1;
+	}
 
-	ctx->v210_addr = (uint8_t *)mmap(NULL, ctx->v210_file_size, PROT_READ, MAP_SHARED, ctx->v210_fd, 0);
-	printf("Mapped %" PRIi64 " bytes at %p, %lu frames.\n",
-		ctx->v210_file_size, ctx->v210_addr,
-		ctx->v210_file_size / ctx->frameSizeBytesVideo);
+	/* Prefault the whole file so the read side never takes a page fault mid stream,
+	 * the probe only needs the geometry.
+	 */
+	int flags = MAP_SHARED;
+	if (!opts->probe)
+		flags |= MAP_POPULATE;
 
-	if (ctx->v210_addr == (void*)-1) {
+	ctx->v210_addr = (uint8_t *)mmap(NULL, ctx->v210_file_size, PROT_READ, flags, ctx->v210_fd, 0);
+	if (ctx->v210_addr == MAP_FAILED) {
 		fprintf(stderr, MODULE_PREFIX "Unable to MMAP file.\n");
 		perror("mmap");
+		ctx->v210_addr = NULL;
 		close(ctx->v210_fd);
 		ctx->v210_fd = -1;
 		return -1;
 	}
 
-	/* We need to understand how much VANC we're going to be receiving. */
-	opts->width = 1280;
-	opts->height = 720;
-	opts->interlaced = 0;
-	opts->timebase_den = 60000;
-	opts->timebase_num = 1001;
-	opts->video_format = lookupOBEName(opts->width, opts->height, opts->timebase_den, opts->timebase_num);
+	/* Best effort, only honoured where the filesystem supports large folios for page cache. */
+	madvise(ctx->v210_addr, ctx->v210_file_size, MADV_HUGEPAGE);
+	madvise(ctx->v210_addr, ctx->v210_file_size, MADV_WILLNEED);
+
+	printf(MODULE_PREFIX "Mapped %" PRIi64 " bytes at %p, %u frames.\n",
+		(int64_t)ctx->v210_file_size, ctx->v210_addr, ctx->totalInputFrames);
 
 	ctx->v_timebase.den = opts->timebase_den;
 	ctx->v_timebase.num = opts->timebase_num;
 
-	fprintf(stderr, MODULE_PREFIX "Detected resolution %dx%d @ %d/%d\n",
+	fprintf(stderr, MODULE_PREFIX "Format %s, %dx%d @ %d/%d\n", fmt->name,
 		opts->width, opts->height,
 		opts->timebase_den, opts->timebase_num);
 
-	ctx->dec = avcodec_find_decoder(AV_CODEC_ID_V210);
-	if (!ctx->dec) {
-		fprintf(stderr, MODULE_PREFIX "Could not find v210 decoder\n");
-	}
+	/* Setup unpack functions, every row starts on a 128 byte boundary */
+	obe_v210_planar_unpack_select(&ctx->unpack_line, NULL);
 
-	ctx->codec = avcodec_alloc_context3(ctx->dec);
-	if (!ctx->codec) {
-		fprintf(stderr, MODULE_PREFIX "Could not allocate a codec context\n");
+	ctx->vpool = obe_buf_pool_alloc("v210 video");
+	ctx->apool = obe_buf_pool_alloc("v210 audio");
+	if (!ctx->vpool || !ctx->apool) {
+		fprintf(stderr, MODULE_PREFIX "Could not allocate buffer pools\n");
+		return -1;
 	}
 
-#if 0
-	ctx->codec->get_buffer = obe_get_buffer;
-	ctx->codec->release_buffer = obe_release_buffer;
-	ctx->codec->reget_buffer = obe_reget_buffer;
-	ctx->codec->flags |= CODEC_FLAG_EMU_EDGE;
-#endif
+	obe_s32_deinterleave_pair_select(&ctx->deinterleave_pair, &ctx->deinterleave_align);
 
-	if (avcodec_open2(ctx->codec, ctx->dec, NULL) < 0) {
-		fprintf(stderr, MODULE_PREFIX "Could not open libavcodec\n");
+	for (int i = 0; i < MAX_AUDIO_PAIRS; i++) {
+		struct audio_pair_s *pair = &ctx->audio_pairs[i];
+
+		pair->nr = i;
+		pair->smpte337_detected_ac3 = 0;
+		pair->input_stream_id = i + 1; /* Video is zero, audio onwards. */
+		if (ctx->device && ctx->device->num_input_streams > i + 1)
+			pair->input_stream_id = ctx->device->input_streams[i + 1]->input_stream_id;
+
+		if (opts->enable_bitstream_audio)
+			pair->smpte337_detector = smpte337_detector_alloc(sdi_smpte337_detector_callback, pair);
 	}
 
+	if (open_audio_sidecar(opts) < 0 || open_vanc_sidecar(opts) < 0)
+		return -1;
+
 	return 0; /* Success */
 }
 
@@ -368,7 +975,8 @@ static void *v210_probe_stream(void *ptr)
 	obe_input_t *user_opts = &probe_ctx->user_opts;
 	obe_device_t *device;
 	obe_int_input_stream_t *streams[MAX_STREAMS];
-	int num_streams = 2;
+	int num_streams = 0;
+	obe_sdi_non_display_data_t *non_display_parser;
 
 	printf(MODULE_PREFIX "%s()\n", __func__);
 
@@ -384,10 +992,15 @@ static void *v210_probe_stream(void *ptr)
 	opts->num_channels = 16;
 	opts->card_idx = user_opts->card_idx;
 	opts->video_format = user_opts->video_format;
+	opts->location = user_opts->location;
+	opts->enable_bitstream_audio = user_opts->enable_bitstream_audio;
+	opts->enable_scte35 = user_opts->enable_scte35;
 	opts->probe = 1;
 
 	ctx = &opts->ctx;
 	ctx->h = h;
+	non_display_parser = &ctx->non_display_parser;
+	non_display_parser->probe = 1;
 
 	/* Open device */
 	if (open_device(opts) < 0) {
@@ -395,7 +1008,7 @@ static void *v210_probe_stream(void *ptr)
 		goto finish;
 	}
 
-	sleep(1);
+	probe_sidecars(opts);
 
 	close_device(opts);
 
@@ -407,44 +1020,61 @@ static void *v210_probe_stream(void *ptr)
 		goto finish;
 	}
 
-	/* TODO: probe for SMPTE 337M */
-	/* TODO: factor some of the code below out */
-
-	for( int i = 0; i < 2; i++ ) {
+#define ALLOC_STREAM() \
+	streams[num_streams] = (obe_int_input_stream_t*)calloc(1, sizeof(*streams[num_streams])); \
+	if (!streams[num_streams]) goto finish; \
+	pthread_mutex_lock(&h->device_list_mutex); \
+	streams[num_streams]->input_stream_id = h->cur_input_stream_id++; \
+	pthread_mutex_unlock(&h->device_list_mutex);
+
+	ALLOC_STREAM();
+	streams[num_streams]->stream_type = STREAM_TYPE_VIDEO;
+	streams[num_streams]->stream_format = VIDEO_UNCOMPRESSED;
+	streams[num_streams]->width  = opts->width;
+	streams[num_streams]->height = opts->height;
+	streams[num_streams]->timebase_num = opts->timebase_num;
+	streams[num_streams]->timebase_den = opts->timebase_den;
+	streams[num_streams]->csp    = AV_PIX_FMT_YUV422P10;
+	streams[num_streams]->interlaced = opts->interlaced;
+	streams[num_streams]->tff = 1; /* NTSC is bff in baseband but coded as tff */
+	streams[num_streams]->sar_num = streams[num_streams]->sar_den = 1; /* The user can choose this when encoding */
+	if (add_non_display_services(non_display_parser, streams[num_streams], USER_DATA_LOCATION_FRAME) < 0)
+		goto finish;
+	num_streams++;
+
+	/* Audio pairs, in the same order as decklink so the pair ids line up */
+	for (int i = 0; i < MAX_AUDIO_PAIRS; i++) {
+		struct audio_pair_s *pair = &ctx->audio_pairs[i];
+
+		ALLOC_STREAM();
+		streams[num_streams]->sdi_audio_pair = i + 1;
+		streams[num_streams]->stream_type = STREAM_TYPE_AUDIO;
+		streams[num_streams]->sample_rate = 48000;
+		if (!pair->smpte337_detected_ac3) {
+			streams[num_streams]->stream_format = AUDIO_PCM;
+			streams[num_streams]->num_channels  = 2;
+			streams[num_streams]->sample_format = AV_SAMPLE_FMT_S32P;
+		} else {
+			streams[num_streams]->stream_format = AUDIO_AC_3_BITSTREAM;
+			streams[num_streams]->bitrate = 384;
+			streams[num_streams]->pid = 0x124; /* TODO: hardcoded PID not currently used. */
+		}
+		num_streams++;
+	}
 
-		streams[i] = (obe_int_input_stream_t*)calloc( 1, sizeof(*streams[i]) );
-		if (!streams[i])
+	if (opts->enable_scte35) {
+		ALLOC_STREAM();
+		streams[num_streams]->stream_type = STREAM_TYPE_MISC;
+		streams[num_streams]->stream_format = DVB_TABLE_SECTION;
+		streams[num_streams]->pid = 0x123; /* TODO: hardcoded PID not currently used. */
+		if (add_non_display_services(non_display_parser, streams[num_streams], USER_DATA_LOCATION_DVB_STREAM) < 0)
 			goto finish;
-
-		/* TODO: make it take a continuous set of stream-ids */
-		pthread_mutex_lock( &h->device_list_mutex );
-		streams[i]->input_stream_id = h->cur_input_stream_id++;
-		pthread_mutex_unlock( &h->device_list_mutex );
-
-		if (i == 0) {
-			streams[i]->stream_type = STREAM_TYPE_VIDEO;
-			streams[i]->stream_format = VIDEO_UNCOMPRESSED;
-			streams[i]->width  = opts->width;
-			streams[i]->height = opts->height;
-			streams[i]->timebase_num = opts->timebase_num;
-			streams[i]->timebase_den = opts->timebase_den;
-			streams[i]->csp    = AV_PIX_FMT_YUV422P10;
-			streams[i]->interlaced = opts->interlaced;
-			streams[i]->tff = 1; /* NTSC is bff in baseband but coded as tff */
-			streams[i]->sar_num = streams[i]->sar_den = 1; /* The user can choose this when encoding */
-		}
-		else if( i == 1 ) {
-			/* TODO: various v4l2 assumptions about audio being 48KHz need resolved.
-         		 * Some sources could be 44.1 and this module will fall down badly.
-			 */
-			streams[i]->stream_type = STREAM_TYPE_AUDIO;
-			streams[i]->stream_format = AUDIO_PCM;
-			streams[i]->num_channels  = 2;
-			streams[i]->sample_format = AV_SAMPLE_FMT_S16;
-			streams[i]->sample_rate = 48000;
-		}
+		num_streams++;
 	}
 
+	if (non_display_parser->num_frame_data)
+		free(non_display_parser->frame_data);
+
 	device = new_device();
 	if (!device)
 		goto finish;
@@ -486,11 +1116,16 @@ static void *v210_open_input(void *ptr)
 	opts->num_channels = 16;
 	opts->card_idx = user_opts->card_idx;
 	opts->video_format = user_opts->video_format;
+	opts->location = user_opts->location;
+	opts->free_run = user_opts->enable_free_run;
+	opts->enable_bitstream_audio = user_opts->enable_bitstream_audio;
+	opts->enable_scte35 = user_opts->enable_scte35;
 
 	ctx = &opts->ctx;
 
 	ctx->device = device;
 	ctx->h = h;
+	ctx->non_display_parser.device = device;
 	ctx->v_counter = 0;
 
 	if (open_device(opts) < 0)
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include "common/simd.h"
+#include "v210_unpack.h"
+#include "x86/sdi.h"
+
+void obe_v210_planar_unpack_c( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width )
+{
+    uint32_t val;
+
+    for( int i = 0; i < width - 5; i += 6 )
+    {
+        READ_PIXELS( u, y, v );
+        READ_PIXELS( y, u, y );
+        READ_PIXELS( v, y, u );
+        READ_PIXELS( y, v, y );
+    }
+}
+
+static const obe_simd_version_t v210_aligned_versions[] =
+{
+    { "c",      (obe_simd_fn_t)obe_v210_planar_unpack_c },
+    { "ssse3",  (obe_simd_fn_t)obe_v210_planar_unpack_aligned_ssse3 },
+    { "avx",    (obe_simd_fn_t)obe_v210_planar_unpack_aligned_avx },
+    { "avx2",   (obe_simd_fn_t)obe_v210_planar_unpack_avx2 },
+    { "avx512", (obe_simd_fn_t)obe_v210_planar_unpack_avx512 },
+};
+
+static const obe_simd_version_t v210_unaligned_versions[] =
+{
+    { "c",      (obe_simd_fn_t)obe_v210_planar_unpack_c },
+    { "ssse3",  (obe_simd_fn_t)obe_v210_planar_unpack_unaligned_ssse3 },
+    { "avx",    (obe_simd_fn_t)obe_v210_planar_unpack_unaligned_avx },
+    { "avx2",   (obe_simd_fn_t)obe_v210_planar_unpack_avx2 },
+    { "avx512", (obe_simd_fn_t)obe_v210_planar_unpack_avx512 },
+};
+
+/* Up to a 1080 line. The versions other than C finish a partial last group and
+ * may write a group past the row, so only the whole groups are compared */
+#define V210_TEST_WIDTH  1920
+#define V210_TEST_POISON 0xa5
+
+/* A 1080 line, whole groups of six and whole vectors for every version, then a
+ * 720 line which ends in a partial group and in a partial vector */
+static const int v210_test_widths[] = { V210_TEST_WIDTH, 1280 };
+
+typedef struct
+{
+    uint32_t src[V210_TEST_WIDTH / 6 * 4 + 4];
+    int offset; /* Into src, in words */
+    uint16_t y[V210_TEST_WIDTH + 8];
+    uint16_t u[V210_TEST_WIDTH / 2 + 8];
+    uint16_t v[V210_TEST_WIDTH / 2 + 8];
+    const int *widths;
+    int num_widths;
+    int out_size;
+} v210_test_t;
+
+static void test_v210_unpack( obe_simd_fn_t fn, void *ctx, uint8_t *out )
+{
+    v210_test_t *t = ctx;
+
+    for( int w = 0; w < t->num_widths; w++ )
+    {
+        int groups = t->widths[w] / 6;
+
+        if( out )
+        {
+            memset( t->y, V210_TEST_POISON, sizeof(t->y) );
+            memset( t->u, V210_TEST_POISON, sizeof(t->u) );
+            memset( t->v, V210_TEST_POISON, sizeof(t->v) );
+        }
+
+        ((obe_v210_unpack_t)fn)( t->src + t->offset, t->y, t->u, t->v, t->widths[w] );
+
+        if( out )
+        {
+            memcpy( out, t->y, groups * 12 );
+            memcpy( out + groups * 12, t->u, groups * 6 );
+            memcpy( out + groups * 18, t->v, groups * 6 );
+            out += groups * 24;
+        }
+    }
+}
+
+/* Pseudo random v210. The aligned asm needs src on a 16 byte boundary */
+static v210_test_t *v210_test_alloc( const int *widths, int num_widths )
+{
+    if( !widths )
+    {
+        widths = v210_test_widths;
+        num_widths = FF_ARRAY_ELEMS(v210_test_widths);
+    }
+
+    v210_test_t *t = av_malloc( sizeof(*t) );
+    if( !t )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        return NULL;
+    }
+
+    t->widths = widths;
+    t->num_widths = num_widths;
+    t->out_size = 0;
+    for( int w = 0; w < num_widths; w++ )
+    {
+        if( widths[w] < 6 || widths[w] > V210_TEST_WIDTH )
+        {
+            fprintf( stderr, "v210 width %d is not 6 to %d\n", widths[w], V210_TEST_WIDTH );
+            av_free( t );
+            return NULL;
+        }
+        t->out_size += widths[w] / 6 * 24;
+    }
+
+    uint32_t seed = 1;
+    for( int i = 0; i < FF_ARRAY_ELEMS(t->src); i++ )
+    {
+        seed = seed * 1664525 + 1013904223;
+        t->src[i] = seed >> 2;
+    }
+
+    return t;
+}
+
+void obe_v210_planar_unpack_select( obe_v210_unpack_t *aligned, obe_v210_unpack_t *unaligned )
+{
+    *aligned = obe_v210_planar_unpack_c;
+    if( unaligned )
+        *unaligned = obe_v210_planar_unpack_c;
+
+    v210_test_t *t = v210_test_alloc( NULL, 0 );
+    if( !t )
+        return;
+
+    t->offset = 0;
+    *aligned = (obe_v210_unpack_t)obe_simd_select( "v210_planar_unpack_aligned", v210_aligned_versions,
+        FF_ARRAY_ELEMS(v210_aligned_versions), test_v210_unpack, t, t->out_size );
+    t->offset = 1;
+    if( unaligned )
+        *unaligned = (obe_v210_unpack_t)obe_simd_select( "v210_planar_unpack_unaligned", v210_unaligned_versions,
+            FF_ARRAY_ELEMS(v210_unaligned_versions), test_v210_unpack, t, t->out_size );
+
+    av_free( t );
+}
+
+int obe_v210_planar_unpack_check( const int *widths, int num_widths, int timed )
+{
+    v210_test_t *t = v210_test_alloc( widths, num_widths );
+    if( !t )
+        return -1;
+
+    t->offset = 0;
+    int failed = obe_simd_check( "v210_planar_unpack_aligned", v210_aligned_versions,
+                                 FF_ARRAY_ELEMS(v210_aligned_versions), test_v210_unpack, t, t->out_size, timed );
+    t->offset = 1;
+    failed += obe_simd_check( "v210_planar_unpack_unaligned", v210_unaligned_versions,
+                              FF_ARRAY_ELEMS(v210_unaligned_versions), test_v210_unpack, t, t->out_size, timed );
+
+    av_free( t );
+
+    return failed;
+}
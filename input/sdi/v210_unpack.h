@@ -0,0 +1,32 @@
+#ifndef OBE_SDI_V210_UNPACK_H
+#define OBE_SDI_V210_UNPACK_H
+
+#include <stdint.h>
+#include <libavutil/bswap.h>
+
+/* v210 to planar 10-bit 4:2:2, with its C, asm and intrinsics versions. Free of
+ * the rest of the SDI code, so tools/simdcheck links it too. */
+
+#define READ_PIXELS(a, b, c)         \
+    do {                             \
+        val  = av_le2ne32( *src++ ); \
+        *a++ =  val & 0x3ff;         \
+        *b++ = (val >> 10) & 0x3ff;  \
+        *c++ = (val >> 20) & 0x3ff;  \
+    } while (0)
+
+typedef void (*obe_v210_unpack_t)( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+
+/* Whole groups of six pixels only */
+void obe_v210_planar_unpack_c( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+
+/* The fastest v210 to planar unpackers which match obe_v210_planar_unpack_c here,
+ * for rows starting on a 16 byte boundary and, unless it is NULL, for rows anywhere */
+void obe_v210_planar_unpack_select( obe_v210_unpack_t *aligned, obe_v210_unpack_t *unaligned );
+
+/* Check every version the CPU runs against C at each of the widths, 6 to 1920
+ * pixels, and time them when timed is set. widths NULL for the ones
+ * obe_v210_planar_unpack_select() checks. Returns how many versions differ. */
+int obe_v210_planar_unpack_check( const int *widths, int num_widths, int timed );
+
+#endif
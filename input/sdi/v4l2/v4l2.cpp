@@ -36,6 +36,7 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <linux/videodev2.h>
+#include <linux/dma-buf.h>
 
 extern "C"
 {
@@ -49,6 +50,7 @@ extern "C"
 #include <libavutil/opt.h>
 #include <libavutil/mathematics.h>
 #include <libavutil/bswap.h>
+#include <libavutil/imgutils.h>
 #include <libswresample/swresample.h>
 #include <libavutil/opt.h>
 #include <libyuv/convert.h>
@@ -85,15 +87,21 @@ const static struct obe_to_v4l2_video video_format_tab[] =
     { -1, 0, 0, 0, -1, -1 },
 };
 
+struct v4l2_ctx_s;
+
 struct capture_buffer_s
 {
 	struct v4l2_buffer vidbuf;
 	void *data;
 	int length;
 	int free;
+
+	struct v4l2_ctx_s *ctx;
+	int dmabuf_fd;      /* INPUT_V4L2_MEMORY_DMABUF: exported handle, else -1 */
+	obe_buf_t *userbuf; /* INPUT_V4L2_MEMORY_USERPTR: pool buffer currently owned by the driver */
 };
 
-typedef struct
+typedef struct v4l2_ctx_s
 {
 	/* V4L2 */
 	int fd;
@@ -108,6 +116,16 @@ typedef struct
 	struct capture_buffer_s buffers[MAX_BUFFERS];
 	int numFrames;
 
+	/* Capture format as negotiated with the driver */
+	uint32_t pixelformat;
+	int bytesperline;
+	int sizeimage;
+
+	int memory;                 /* INPUT_V4L2_MEMORY_* */
+	int streaming;
+	volatile int buffers_inflight; /* Driver buffers referenced by raw frames */
+	obe_buf_pool_t *vpool;
+
 	int64_t last_frame_time;
 
 	obe_device_t *device;
@@ -127,6 +145,7 @@ typedef struct
 
     int video_format;
     int num_channels;
+    int memory;
 
     /* True if we're problem, else false during normal streaming. */
     int probe;
@@ -136,6 +155,7 @@ typedef struct
 
     int width;
     int height;
+    enum AVPixelFormat csp;
     int timebase_num;
     int timebase_den;
 
@@ -163,18 +183,90 @@ static int wait_for_frame_v4l2(int fd)
 	return ret;
 }
 
-static int enqueue_buffer(v4l2_opts_t *v4l2_opts, int bufferNr)
+static int enqueue_buffer(v4l2_ctx_t *v4l2_ctx, int bufferNr)
 {
-	v4l2_ctx_t *v4l2_ctx = &v4l2_opts->v4l2_ctx;
+	struct capture_buffer_s *cb = &v4l2_ctx->buffers[bufferNr];
+
+	if (cb->vidbuf.memory == V4L2_MEMORY_USERPTR) {
+		cb->vidbuf.m.userptr = (unsigned long)cb->userbuf->data;
+		cb->vidbuf.length = cb->length;
+	}
 
-	v4l2_ctx->buffers[bufferNr].free = 1;
-	int ret = ioctl(v4l2_ctx->fd, VIDIOC_QBUF, &v4l2_ctx->buffers[bufferNr].vidbuf);
+	cb->free = 1;
+	int ret = ioctl(v4l2_ctx->fd, VIDIOC_QBUF, &cb->vidbuf);
 	if (ret < 0)
 		syslog(LOG_ERR, "[v4l2]: Could not enq frame %d, ret = %d\n", bufferNr, ret);
 
 	return ret;
 }
 
+static void dmabuf_sync(struct capture_buffer_s *cb, uint64_t flags)
+{
+	if (cb->dmabuf_fd < 0)
+		return;
+
+	struct dma_buf_sync sync;
+	sync.flags = flags | DMA_BUF_SYNC_RW;
+	ioctl(cb->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+/* INPUT_V4L2_MEMORY_DMABUF: the frame references the driver buffer directly,
+ * hand it back to the driver once the filter/encoder is done with it.
+ */
+static void v4l2_release_video_data(void *ptr)
+{
+	obe_raw_frame_t *raw_frame = (obe_raw_frame_t *)ptr;
+	struct capture_buffer_s *cb = (struct capture_buffer_s *)raw_frame->opaque;
+	if (!cb)
+		return;
+
+	raw_frame->opaque = NULL;
+
+	v4l2_ctx_t *v4l2_ctx = cb->ctx;
+	dmabuf_sync(cb, DMA_BUF_SYNC_END);
+	if (v4l2_ctx->streaming)
+		enqueue_buffer(v4l2_ctx, cb->vidbuf.index);
+
+	__sync_sub_and_fetch(&v4l2_ctx->buffers_inflight, 1);
+}
+
+/* Describe a capture buffer in its native layout, no copy. */
+static void fill_image(v4l2_opts_t *v4l2_opts, obe_image_t *img, uint8_t *base)
+{
+	v4l2_ctx_t *v4l2_ctx = &v4l2_opts->v4l2_ctx;
+
+	img->csp = v4l2_opts->csp;
+	img->planes = 2;
+	img->plane[0] = base;
+	img->plane[1] = base + (v4l2_ctx->bytesperline * v4l2_opts->height);
+	img->plane[2] = NULL;
+	img->plane[3] = NULL;
+	img->stride[0] = v4l2_ctx->bytesperline;
+	img->stride[1] = v4l2_ctx->bytesperline;
+	img->stride[2] = 0;
+	img->stride[3] = 0;
+}
+
+static void release_buffers(v4l2_ctx_t *v4l2_ctx)
+{
+	for (int i = 0; i < v4l2_ctx->numFrames; i++) {
+		struct capture_buffer_s *cb = &v4l2_ctx->buffers[i];
+
+		if (cb->userbuf) {
+			obe_buf_unref(cb->userbuf);
+			cb->userbuf = NULL;
+		} else if (cb->data) {
+			munmap(cb->data, cb->length);
+		}
+		cb->data = NULL;
+
+		if (cb->dmabuf_fd >= 0) {
+			close(cb->dmabuf_fd);
+			cb->dmabuf_fd = -1;
+		}
+	}
+}
+
 static void *audioThreadFunc(void *p)
 {
 	v4l2_opts_t *v4l2_opts = (v4l2_opts_t *)p;
@@ -302,10 +394,11 @@ static void *videoThreadFunc(void *p)
 	if (ioctl(v4l2_ctx->fd, VIDIOC_STREAMON, &bufferType) < 0 ) {
 		syslog(LOG_ERR, "[v4l2]: Could not transition to STREAMON\n" );
 	}
+	v4l2_ctx->streaming = 1;
 
 	/* Place all buffers on the h/w */
 	for (int i = 0; i < v4l2_ctx->numFrames; i++) {
-		enqueue_buffer(v4l2_opts, i);
+		enqueue_buffer(v4l2_ctx, i);
 	}
 
 	v4l2_ctx->vthreadRunning = 1;
@@ -320,14 +413,18 @@ static void *videoThreadFunc(void *p)
 
 		/* Dequeue a video frame */
 		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
 		buf.type = bufferType;
+		buf.memory = v4l2_ctx->buffers[0].vidbuf.memory;
 		if (ioctl(v4l2_ctx->fd, VIDIOC_DQBUF, &buf) < 0) {
 			syslog(LOG_ERR, "[v4l2]: Could not dq frame\n" );
 			continue;
 		}
 //printf("[%08lld] dq idx %d\n", v4l2_ctx->v_counter, buf.index);
 
-		v4l2_ctx->buffers[ buf.index ].free = 0;
+		struct capture_buffer_s *cb = &v4l2_ctx->buffers[ buf.index ];
+		cb->free = 0;
+		dmabuf_sync(cb, DMA_BUF_SYNC_START);
 
 #if DO_60
 #else
@@ -336,31 +433,23 @@ static void *videoThreadFunc(void *p)
 		 */
 		if (frame_counter++ & 1) {
 			/* Drop the frame */
-			enqueue_buffer(v4l2_opts, buf.index);
+			enqueue_buffer(v4l2_ctx, buf.index);
 			continue;
 		}
 #endif
 		raw_frame = new_raw_frame();
 		if (!raw_frame) {
 			syslog(LOG_ERR, "[v4l2]: Could not allocate raw video frame\n" );
+			enqueue_buffer(v4l2_ctx, buf.index);
 			break;
 		}
 
-//printf("data %p len = %d\n", frame_bytes, frame_len);
-
-		/* TODO: YUYV only. Drivers will non YUYV colorspaces won't work reliably. */
-		raw_frame->alloc_img.csp = AV_PIX_FMT_YUV420P;
+		raw_frame->alloc_img.csp = v4l2_opts->csp;
 		raw_frame->alloc_img.format = v4l2_opts->video_format;
 		raw_frame->alloc_img.width = v4l2_opts->width;
 		raw_frame->alloc_img.height = v4l2_opts->height;
 		raw_frame->alloc_img.first_line = 1;
-                const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(raw_frame->alloc_img.csp);
-		raw_frame->alloc_img.planes = d->nb_components;
-
-		raw_frame->alloc_img.stride[0] = v4l2_opts->width;
-		raw_frame->alloc_img.stride[1] = v4l2_opts->width / 2;
-		raw_frame->alloc_img.stride[2] = v4l2_opts->width / 2;
-		raw_frame->alloc_img.stride[3] = 0;
+		raw_frame->alloc_img.planes = av_pix_fmt_count_planes(raw_frame->alloc_img.csp);
 
 		int64_t pts = av_rescale_q(v4l2_ctx->v_counter++, v4l2_ctx->v_timebase, (AVRational){1, OBE_CLOCK} );
 		obe_clock_tick(v4l2_ctx->h, pts);
@@ -369,36 +458,92 @@ static void *videoThreadFunc(void *p)
 //printf("pts = %lld\n", raw_frame->pts);
 		raw_frame->timebase_num = v4l2_opts->timebase_num;
 		raw_frame->timebase_den = v4l2_opts->timebase_den;
+		raw_frame->release_data = obe_release_bufref_data;
+		raw_frame->release_frame = obe_release_frame;
 
-		raw_frame->alloc_img.plane[0] = (uint8_t *)calloc(1, v4l2_opts->width * v4l2_opts->height * 2);
-		raw_frame->alloc_img.plane[1] = raw_frame->alloc_img.plane[0] + (v4l2_opts->width * v4l2_opts->height);
-		raw_frame->alloc_img.plane[2] = raw_frame->alloc_img.plane[1] + ((v4l2_opts->width * v4l2_opts->height) / 4);
-		raw_frame->alloc_img.plane[3] = 0;
+		uint8_t *src = v4l2_ctx->memory == INPUT_V4L2_MEMORY_USERPTR ? cb->userbuf->data : (uint8_t *)cb->data;
+		int requeue = 1;
+
+		if (v4l2_ctx->pixelformat == V4L2_PIX_FMT_YUYV) {
+			/* Packed 4:2:2 has to be converted anyway, convert YUY2 to I420 into a
+			 * pooled frame and give the capture buffer straight back to the driver.
+			 */
+			if (obe_image_alloc_pooled(raw_frame, v4l2_ctx->vpool, raw_frame->alloc_img.plane, raw_frame->alloc_img.stride,
+			                           v4l2_opts->width, v4l2_opts->height, AV_PIX_FMT_YUV420P, 16) < 0)
+				goto drop;
+
+			libyuv::YUY2ToI420(src, v4l2_ctx->bytesperline,
+				raw_frame->alloc_img.plane[0], raw_frame->alloc_img.stride[0],
+				raw_frame->alloc_img.plane[1], raw_frame->alloc_img.stride[1],
+				raw_frame->alloc_img.plane[2], raw_frame->alloc_img.stride[2],
+				v4l2_opts->width, v4l2_opts->height);
+		} else if (v4l2_ctx->memory == INPUT_V4L2_MEMORY_USERPTR) {
+			/* The driver captured into a pool buffer, hand it to the frame and
+			 * back the slot with a fresh one so the ring never waits on the encoder.
+			 */
+			obe_buf_t *next = obe_buf_pool_get(v4l2_ctx->vpool, cb->length);
+			if (!next)
+				goto drop;
+
+			raw_frame->buf_ref = cb->userbuf;
+			cb->userbuf = next;
+			fill_image(v4l2_opts, &raw_frame->alloc_img, raw_frame->buf_ref->data);
+		} else if (v4l2_ctx->memory == INPUT_V4L2_MEMORY_DMABUF) {
+			/* Reference the exported driver buffer, it is queued again on release. */
+			__sync_add_and_fetch(&v4l2_ctx->buffers_inflight, 1);
+			raw_frame->opaque = cb;
+			raw_frame->release_data = v4l2_release_video_data;
+			fill_image(v4l2_opts, &raw_frame->alloc_img, src);
+			requeue = 0;
+		} else {
+			obe_image_t img;
+			fill_image(v4l2_opts, &img, src);
+
+			if (obe_image_alloc_pooled(raw_frame, v4l2_ctx->vpool, raw_frame->alloc_img.plane, raw_frame->alloc_img.stride,
+			                           v4l2_opts->width, v4l2_opts->height, v4l2_opts->csp, 16) < 0)
+				goto drop;
+
+			av_image_copy(raw_frame->alloc_img.plane, raw_frame->alloc_img.stride,
+				(const uint8_t **)img.plane, img.stride,
+				v4l2_opts->csp, v4l2_opts->width, v4l2_opts->height);
+		}
 		memcpy(&raw_frame->img, &raw_frame->alloc_img, sizeof(raw_frame->alloc_img));
 
-		raw_frame->release_data = obe_release_video_data;
-		raw_frame->release_frame = obe_release_frame;
+		if (requeue) {
+			dmabuf_sync(cb, DMA_BUF_SYNC_END);
+			enqueue_buffer(v4l2_ctx, buf.index);
+		}
 
-		/* Convert YUY2 to I420. */
-		libyuv::YUY2ToI420((unsigned char *)v4l2_ctx->buffers[ buf.index ].data,
-			v4l2_opts->width * 2,
-			raw_frame->alloc_img.plane[0], v4l2_opts->width,
-			raw_frame->alloc_img.plane[1], v4l2_opts->width / 2,
-			raw_frame->alloc_img.plane[2], v4l2_opts->width / 2,
-			v4l2_opts->width, v4l2_opts->height);
+		obe_cadence_video(&v4l2_ctx->h->input_cadence, raw_frame->pts,
+			av_rescale_q(1, v4l2_ctx->v_timebase, (AVRational){1, OBE_CLOCK}), NULL);
 
 		if (add_to_filter_queue(v4l2_ctx->h, raw_frame) < 0 ) {
+			raw_frame->release_data(raw_frame);
+			raw_frame->release_frame(raw_frame);
 		}
+		continue;
 
-		enqueue_buffer(v4l2_opts, buf.index);
+drop:
+		syslog(LOG_ERR, "[v4l2]: Could not allocate video frame buffer, dropping frame\n" );
+		raw_frame->release_data(raw_frame);
+		raw_frame->release_frame(raw_frame);
+		dmabuf_sync(cb, DMA_BUF_SYNC_END);
+		enqueue_buffer(v4l2_ctx, buf.index);
 	}
 
+	v4l2_ctx->streaming = 0;
 	if (ioctl(v4l2_ctx->fd, VIDIOC_STREAMOFF, &bufferType) < 0 ) {
 		syslog(LOG_ERR, "[v4l2]: Could not transition to STREAMOFF\n" );
 	}
 
-	for (int i = 0; i < v4l2_ctx->numFrames; i++)
-		munmap(v4l2_ctx->buffers[i].data, v4l2_ctx->buffers[i].length);
+	/* Frames still referencing driver buffers must be returned before the mappings go away. */
+	for (int i = 0; v4l2_ctx->buffers_inflight && i < 40; i++)
+		usleep(50 * 1000);
+
+	if (v4l2_ctx->buffers_inflight)
+		syslog(LOG_WARNING, "[v4l2]: %d capture buffers still referenced, leaving them mapped\n", v4l2_ctx->buffers_inflight);
+	else
+		release_buffers(v4l2_ctx);
 
 	v4l2_ctx->vthreadComplete = 1;
 	pthread_exit(0);
@@ -421,6 +566,10 @@ static void close_device(v4l2_opts_t *v4l2_opts)
 			usleep(50 * 1000);
 	}
 
+	/* Pool buffers still held by frames are reclaimed when they are released */
+	obe_buf_pool_free(v4l2_ctx->vpool);
+	v4l2_ctx->vpool = NULL;
+
 	/* close(fd) */
 }
 
@@ -491,6 +640,9 @@ static int open_device(v4l2_opts_t *v4l2_opts)
 	if (fmt.fmt.pix.width && fmt.fmt.pix.height) {
 		v4l2_opts->width = fmt.fmt.pix.width;
 		v4l2_opts->height = fmt.fmt.pix.height;
+		v4l2_ctx->pixelformat = fmt.fmt.pix.pixelformat;
+		v4l2_ctx->bytesperline = fmt.fmt.pix.bytesperline;
+		v4l2_ctx->sizeimage = fmt.fmt.pix.sizeimage;
 		if (fmt.fmt.pix.field == V4L2_FIELD_NONE)
 			v4l2_opts->interlaced = 0;
 		else
@@ -510,11 +662,47 @@ static int open_device(v4l2_opts_t *v4l2_opts)
     }
 
 
-    /* Now setup the videobuf buffers kernel to userspace memory mappings */
+    /* YUYV is converted to I420, the semi-planar formats pass through untouched. */
+    switch (v4l2_ctx->pixelformat) {
+    case V4L2_PIX_FMT_YUYV:
+        v4l2_opts->csp = AV_PIX_FMT_YUV420P;
+        if (!v4l2_ctx->bytesperline)
+            v4l2_ctx->bytesperline = v4l2_opts->width * 2;
+        if (!v4l2_ctx->sizeimage)
+            v4l2_ctx->sizeimage = v4l2_ctx->bytesperline * v4l2_opts->height;
+        break;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV16:
+        v4l2_opts->csp = v4l2_ctx->pixelformat == V4L2_PIX_FMT_NV12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_NV16;
+        if (!v4l2_ctx->bytesperline)
+            v4l2_ctx->bytesperline = v4l2_opts->width;
+        if (!v4l2_ctx->sizeimage)
+            v4l2_ctx->sizeimage = v4l2_ctx->bytesperline * v4l2_opts->height *
+                                  (v4l2_ctx->pixelformat == V4L2_PIX_FMT_NV12 ? 3 : 4) / 2;
+        break;
+    default:
+        fprintf(stderr, "[v4l2] Unsupported pixel format %.4s\n", (char *)&v4l2_ctx->pixelformat);
+        ret = -1;
+        goto finish;
+    }
+
+    v4l2_ctx->memory = v4l2_opts->memory;
+    v4l2_ctx->vpool = obe_buf_pool_alloc("v4l2 video");
+    if (!v4l2_ctx->vpool) {
+        fprintf(stderr, "[v4l2] Could not allocate video buffer pool\n" );
+        ret = -1;
+        goto finish;
+    }
+
+    /* Now setup the videobuf buffers kernel to userspace memory mappings.
+     * INPUT_V4L2_MEMORY_USERPTR: the driver captures into buffers from our pool.
+     * INPUT_V4L2_MEMORY_DMABUF: MMAP buffers exported as dmabufs and referenced by the raw frames.
+     */
     struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
     req.count = 8;
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
+    req.memory = v4l2_ctx->memory == INPUT_V4L2_MEMORY_USERPTR ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
 
     if (ioctl(v4l2_ctx->fd, VIDIOC_REQBUFS, &req) < 0) {
         fprintf(stderr, "[v4l2] Driver error during _REQBUFS\n" );
@@ -524,27 +712,68 @@ static int open_device(v4l2_opts_t *v4l2_opts)
 
     /* Preserve how many buffers the driver wants to use */
     v4l2_ctx->numFrames = req.count;
+    if (v4l2_ctx->numFrames > MAX_BUFFERS) {
+        fprintf(stderr, "[v4l2] Driver wants %d buffers, max is %d\n", v4l2_ctx->numFrames, MAX_BUFFERS);
+        ret = -1;
+        goto finish;
+    }
 
     /* Query each buffer and map it to the video device */
     for (int i = 0; i < v4l2_ctx->numFrames; i++) {
-        struct v4l2_buffer *vidbuf = &v4l2_ctx->buffers[i].vidbuf;
+        struct capture_buffer_s *cb = &v4l2_ctx->buffers[i];
+        struct v4l2_buffer *vidbuf = &cb->vidbuf;
+
+        cb->ctx = v4l2_ctx;
+        cb->dmabuf_fd = -1;
 
         vidbuf->index = i;
         vidbuf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        vidbuf->memory = V4L2_MEMORY_MMAP;
+        vidbuf->memory = req.memory;
+
+        if (req.memory == V4L2_MEMORY_USERPTR) {
+            cb->length = v4l2_ctx->sizeimage;
+            cb->userbuf = obe_buf_pool_get(v4l2_ctx->vpool, cb->length);
+            if (!cb->userbuf) {
+                fprintf(stderr, "[v4l2]: Can't allocate buffer %d.\n", i);
+                ret = -1;
+                goto finish;
+            }
+            continue;
+        }
+
         if (ioctl(v4l2_ctx->fd, VIDIOC_QUERYBUF, vidbuf) < 0 ) {
             fprintf(stderr, "[v4l2]: Can't get information about buffer %d: %s.\n", i, strerror(errno));
             ret = -1;
             goto finish;
         }
 
-        v4l2_ctx->buffers[i].data = mmap(0, vidbuf->length, PROT_READ | PROT_WRITE, MAP_SHARED, v4l2_ctx->fd, vidbuf->m.offset);
-        if (v4l2_ctx->buffers[i].data == MAP_FAILED) {
+        int map_fd = v4l2_ctx->fd;
+        off_t map_offset = vidbuf->m.offset;
+        if (v4l2_ctx->memory == INPUT_V4L2_MEMORY_DMABUF) {
+            struct v4l2_exportbuffer expbuf;
+            memset(&expbuf, 0, sizeof(expbuf));
+            expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            expbuf.index = i;
+            /* Read-write: the video filter blanks, dithers and burns in
+             * the picture in place */
+            expbuf.flags = O_RDWR | O_CLOEXEC;
+            if (ioctl(v4l2_ctx->fd, VIDIOC_EXPBUF, &expbuf) < 0) {
+                fprintf(stderr, "[v4l2]: Can't export buffer %d: %s.\n", i, strerror(errno));
+                ret = -1;
+                goto finish;
+            }
+            cb->dmabuf_fd = map_fd = expbuf.fd;
+            map_offset = 0;
+        }
+
+        cb->data = mmap(0, vidbuf->length, PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, map_offset);
+        if (cb->data == MAP_FAILED) {
             fprintf(stderr, "[v4l2]: Can't map buffer %d: %s.\n", i, strerror(errno));
+            cb->data = NULL;
             ret = -1;
             goto finish;
         }
-        v4l2_ctx->buffers[i].length = vidbuf->length;
+        cb->length = vidbuf->length;
     }
 
     syslog( LOG_INFO, "Opened V4L2 PCI card /dev/video%d", v4l2_opts->card_idx);
@@ -577,7 +806,10 @@ static void close_thread(void *handle)
 
 	v4l2_opts_t *v4l2_opts = (v4l2_opts_t*)handle;
 	close_device(v4l2_opts);
-	free(v4l2_opts);
+
+	/* Released frames still call back into the context */
+	if (v4l2_opts->v4l2_ctx.buffers_inflight == 0)
+		free(v4l2_opts);
 }
 
 static void *probe_stream(void *ptr)
@@ -645,7 +877,7 @@ static void *probe_stream(void *ptr)
             streams[i]->height = v4l2_opts->height;
             streams[i]->timebase_num = v4l2_opts->timebase_num;
             streams[i]->timebase_den = v4l2_opts->timebase_den;
-            streams[i]->csp    = AV_PIX_FMT_YUV420P;
+            streams[i]->csp    = v4l2_opts->csp;
             streams[i]->interlaced = v4l2_opts->interlaced;
             streams[i]->tff = 1; /* NTSC is bff in baseband but coded as tff */
             streams[i]->sar_num = streams[i]->sar_den = 1; /* The user can choose this when encoding */
@@ -705,6 +937,7 @@ static void *open_input( void *ptr )
     v4l2_opts->num_channels = 16;
     v4l2_opts->card_idx = user_opts->card_idx;
     v4l2_opts->video_format = user_opts->video_format;
+    v4l2_opts->memory = user_opts->v4l2_memory;
 
     v4l2_ctx = &v4l2_opts->v4l2_ctx;
 
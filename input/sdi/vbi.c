@@ -159,7 +159,7 @@ int decode_vbi( obe_t *h, obe_sdi_non_display_data_t *non_display_data, uint8_t
     unsigned int decoded_lines; /* unsigned for libzvbi */
     vbi_sliced *sliced;
     obe_int_frame_data_t *tmp, *frame_data;
-    obe_user_data_t *tmp2, *user_data;
+    obe_user_data_t *user_data;
     int j, vbi_type, skip;
 
     sliced = non_display_data->vbi_slices;
@@ -268,23 +268,8 @@ int decode_vbi( obe_t *h, obe_sdi_non_display_data_t *non_display_data, uint8_t
                 skip |= !check_user_selected_non_display_data( h, CAPTIONS_CEA_608, USER_DATA_LOCATION_FRAME );
 
                 /* Attach the caption data to the frame's user data */
-                if( !skip )
+                if( !skip && (user_data = obe_user_data_add( raw_frame, USER_DATA_CEA_608, VBI_RAW, num_lines * 2 )) )
                 {
-                    tmp2 = realloc( raw_frame->user_data, (raw_frame->num_user_data+1) * sizeof(*raw_frame->user_data) );
-                    if( !tmp2 )
-                        goto fail;
-
-                    raw_frame->user_data = tmp2;
-                    user_data = &raw_frame->user_data[raw_frame->num_user_data++];
-
-                    user_data->len  = num_lines * 2;
-                    user_data->data = malloc( user_data->len );
-                    if( !user_data->data )
-                        goto fail;
-
-                    user_data->type = USER_DATA_CEA_608;
-                    user_data->source = VBI_RAW;
-
                     /* Field 1 and Field 2 */
                     memcpy( &user_data->data[0], sliced[i].data, 2 );
                     if( num_lines > 1 )
@@ -302,21 +287,9 @@ int decode_vbi( obe_t *h, obe_sdi_non_display_data_t *non_display_data, uint8_t
                      check_user_selected_non_display_data( h, MISC_WSS, USER_DATA_LOCATION_FRAME ) )
                 {
                     /* Attach the WSS data to the frame's user data to be converted later to AFD */
-                    tmp2 = realloc( raw_frame->user_data, (raw_frame->num_user_data+1) * sizeof(*raw_frame->user_data) );
-                    if( !tmp2 )
-                        goto fail;
-
-                    raw_frame->user_data = tmp2;
-                    user_data = &raw_frame->user_data[raw_frame->num_user_data++];
-
-                    user_data->len = 1;
-                    user_data->data = malloc( user_data->len );
-                    if( !user_data->data )
-                        goto fail;
-
-                    user_data->data[0] = sliced[i].data[0] & 0x7;
-                    user_data->type = USER_DATA_WSS;
-                    user_data->source = VBI_RAW;
+                    user_data = obe_user_data_add( raw_frame, USER_DATA_WSS, VBI_RAW, 1 );
+                    if( user_data )
+                        user_data->data[0] = sliced[i].data[0] & 0x7;
                 }
 
                 if( skip )
@@ -357,7 +330,7 @@ int decode_video_index_information( obe_t *h, obe_sdi_non_display_data_t *non_di
     /* Video index information is only in the chroma samples */
     uint8_t data[90] = {0};
     obe_int_frame_data_t *tmp, *frame_data;
-    obe_user_data_t *tmp2, *user_data;
+    obe_user_data_t *user_data;
     uint8_t afd_code, scan_system, is_wide;
 
     for( int i = 0; i < 90; i++ )
@@ -405,23 +378,14 @@ int decode_video_index_information( obe_t *h, obe_sdi_non_display_data_t *non_di
             if( check_active_non_display_data( raw_frame, USER_DATA_AFD ) )
                 return 0;
 
-            tmp2 = realloc( raw_frame->user_data, (raw_frame->num_user_data+1) * sizeof(*raw_frame->user_data) );
-            if( !tmp2 )
-                goto fail;
-
-            raw_frame->user_data = tmp2;
-            user_data = &raw_frame->user_data[raw_frame->num_user_data++];
-            user_data->data = malloc( 1 );
-            if( !user_data->data )
-                goto fail;
+            user_data = obe_user_data_add( raw_frame, USER_DATA_AFD, VBI_VIDEO_INDEX, 1 );
+            if( !user_data )
+                return -1;
 
             afd_code = data[0] & 0x78;
             scan_system = data[0] & 0x7;
             is_wide = scan_system == 0x5 || scan_system == 0x6;
 
-            user_data->len  = 1;
-            user_data->type = USER_DATA_AFD;
-            user_data->source = VBI_VIDEO_INDEX;
             /* Create a packet like AFD from VANC */
             user_data->data[0] = afd_code | (is_wide << 2);
         }
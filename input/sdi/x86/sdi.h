@@ -35,4 +35,11 @@ void obe_v210_planar_unpack_unaligned_avx( const uint32_t *src, uint16_t *y, uin
 void obe_v210_planar_unpack_aligned_ssse3( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
 void obe_v210_planar_unpack_aligned_avx( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
 
+/* Any alignment */
+void obe_v210_planar_unpack_avx2( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+void obe_v210_planar_unpack_avx512( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+
+void obe_s32_deinterleave_pair_sse2( const int32_t *src, int32_t *l, int32_t *r, intptr_t stride, int len );
+void obe_s32_deinterleave_pair_avx2( const int32_t *src, int32_t *l, int32_t *r, intptr_t stride, int len );
+
 #endif
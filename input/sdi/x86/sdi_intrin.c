@@ -0,0 +1,106 @@
+#include <stdint.h>
+#include <immintrin.h>
+
+/* AVX2 and AVX-512 v210 unpackers, intrinsics as yasm can't emit AVX-512.
+ * The same steps as v210_planar_unpack in x86_sdi.asm, a group of six pixels
+ * per 128-bit lane. Both take rows on any alignment. */
+
+#define AVX2   __attribute__((target("avx2")))
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+
+#define V210_LUMA_SHUF   8, 9, 0, 1, 2, 3, 12, 13, 4, 5, 6, 7, -1, -1, -1, -1
+#define V210_CHROMA_SHUF 0, 1, 8, 9, 6, 7, -1, -1, 2, 3, 4, 5, 12, 13, -1, -1
+
+/* Six pixels at a time: y0 y1 y2 y3 y4 y5 __ __ in luma, u0 u1 u2 __ v0 v1 v2 __ in chroma */
+#define V210_UNPACK( bits, suffix, src ) \
+{ \
+    __m##bits##i m0 = src; \
+    __m##bits##i m1 = _mm##suffix##_srli_epi16( _mm##suffix##_mullo_epi16( m0, mult ), 6 ); \
+    m0 = _mm##suffix##_and_si##bits( _mm##suffix##_srli_epi32( m0, 10 ), mask ); \
+    luma = _mm##suffix##_shuffle_epi8( _mm##suffix##_castps_si##bits( \
+           _mm##suffix##_shuffle_ps( _mm##suffix##_castsi##bits##_ps( m1 ), _mm##suffix##_castsi##bits##_ps( m0 ), 0x8d ) ), luma_shuf ); \
+    chroma = _mm##suffix##_shuffle_epi8( _mm##suffix##_castps_si##bits( \
+           _mm##suffix##_shuffle_ps( _mm##suffix##_castsi##bits##_ps( m1 ), _mm##suffix##_castsi##bits##_ps( m0 ), 0xd8 ) ), chroma_shuf ); \
+}
+
+/* Like the asm, whole groups of six, the last one writing up to two luma
+ * and one chroma sample past the row */
+AVX2 void obe_v210_planar_unpack_avx2( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width )
+{
+    for( int i = 0; i < width; )
+    {
+        if( width - i > 6 )
+        {
+            const __m256i mult = _mm256_set1_epi32( 4 << 16 | 64 );
+            const __m256i mask = _mm256_set1_epi32( 0x3ff );
+            const __m256i luma_shuf = _mm256_setr_epi8( V210_LUMA_SHUF, V210_LUMA_SHUF );
+            const __m256i chroma_shuf = _mm256_setr_epi8( V210_CHROMA_SHUF, V210_CHROMA_SHUF );
+            __m256i luma, chroma;
+
+            V210_UNPACK( 256, 256, _mm256_loadu_si256( (const __m256i *)src ) )
+
+            /* The second lane over the unused end of the first */
+            _mm_storeu_si128( (__m128i *)&y[i], _mm256_castsi256_si128( luma ) );
+            _mm_storeu_si128( (__m128i *)&y[i+6], _mm256_extracti128_si256( luma, 1 ) );
+            __m128i c0 = _mm256_castsi256_si128( chroma );
+            __m128i c1 = _mm256_extracti128_si256( chroma, 1 );
+            _mm_storel_epi64( (__m128i *)&u[i/2], c0 );
+            _mm_storel_epi64( (__m128i *)&u[i/2+3], c1 );
+            _mm_storeh_pd( (double *)&v[i/2], _mm_castsi128_pd( c0 ) );
+            _mm_storeh_pd( (double *)&v[i/2+3], _mm_castsi128_pd( c1 ) );
+
+            src += 8;
+            i += 12;
+        }
+        else
+        {
+            const __m128i mult = _mm_set1_epi32( 4 << 16 | 64 );
+            const __m128i mask = _mm_set1_epi32( 0x3ff );
+            const __m128i luma_shuf = _mm_setr_epi8( V210_LUMA_SHUF );
+            const __m128i chroma_shuf = _mm_setr_epi8( V210_CHROMA_SHUF );
+            __m128i luma, chroma;
+
+            V210_UNPACK( 128, , _mm_loadu_si128( (const __m128i *)src ) )
+
+            _mm_storeu_si128( (__m128i *)&y[i], luma );
+            _mm_storel_epi64( (__m128i *)&u[i/2], chroma );
+            _mm_storeh_pd( (double *)&v[i/2], _mm_castsi128_pd( chroma ) );
+
+            src += 4;
+            i += 6;
+        }
+    }
+}
+
+/* Words of the four lanes which hold luma, u and v, for vpermw */
+static const uint16_t v210_perm[3][32] =
+{
+    { 0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, 16, 17, 18, 19, 20, 21, 24, 25, 26, 27, 28, 29 },
+    { 0, 1, 2, 8, 9, 10, 16, 17, 18, 24, 25, 26 },
+    { 4, 5, 6, 12, 13, 14, 20, 21, 22, 28, 29, 30 },
+};
+
+/* Four groups per register, packed together with vpermw. The last groups are
+ * loaded and stored masked, so nothing past them is read or written */
+AVX512 void obe_v210_planar_unpack_avx512( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width )
+{
+    const __m512i mult = _mm512_set1_epi32( 4 << 16 | 64 );
+    const __m512i mask = _mm512_set1_epi32( 0x3ff );
+    const __m512i luma_shuf = _mm512_broadcast_i32x4( _mm_setr_epi8( V210_LUMA_SHUF ) );
+    const __m512i chroma_shuf = _mm512_broadcast_i32x4( _mm_setr_epi8( V210_CHROMA_SHUF ) );
+    const __m512i luma_perm = _mm512_loadu_si512( v210_perm[0] );
+    const __m512i u_perm = _mm512_loadu_si512( v210_perm[1] );
+    const __m512i v_perm = _mm512_loadu_si512( v210_perm[2] );
+
+    for( int i = 0; i < width; i += 24, src += 16 )
+    {
+        int groups = width - i >= 24 ? 4 : ( width - i + 5 ) / 6;
+        __m512i luma, chroma;
+
+        V210_UNPACK( 512, 512, _mm512_maskz_loadu_epi32( ( 1 << 4*groups ) - 1, src ) )
+
+        _mm512_mask_storeu_epi16( &y[i], ( 1u << 6*groups ) - 1, _mm512_permutexvar_epi16( luma_perm, luma ) );
+        _mm512_mask_storeu_epi16( &u[i/2], ( 1u << 3*groups ) - 1, _mm512_permutexvar_epi16( u_perm, chroma ) );
+        _mm512_mask_storeu_epi16( &v[i/2], ( 1u << 3*groups ) - 1, _mm512_permutexvar_epi16( v_perm, chroma ) );
+    }
+}
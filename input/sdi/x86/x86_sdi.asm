@@ -86,3 +86,64 @@ INIT_XMM ssse3
 v210_planar_unpack aligned
 INIT_XMM avx
 v210_planar_unpack aligned
+
+; s32_deinterleave_pair(const int32_t *src, int32_t *l, int32_t *r, intptr_t stride, int len)
+; Extract a single stereo pair from interleaved S32 audio into two planes.
+; stride is the size of an interleaved sample frame in bytes, len must be a multiple of 4 (sse2) or 8 (avx2).
+
+INIT_XMM sse2
+cglobal s32_deinterleave_pair, 5, 6, 3
+    movsxdifnidn r4, r4d
+    lea    r5, [r3*3]
+    shl    r4, 2
+    add    r1, r4
+    add    r2, r4
+    neg    r4
+.loop
+    movq   m0, [r0]
+    movhps m0, [r0+r3]      ; l0 r0 l1 r1
+    movq   m1, [r0+r3*2]
+    movhps m1, [r0+r5]      ; l2 r2 l3 r3
+    lea    r0, [r0+r3*4]
+
+    shufps m2, m0, m1, 0x88 ; l0 l1 l2 l3
+    shufps m0, m1, 0xdd     ; r0 r1 r2 r3
+    movu   [r1+r4], m2
+    movu   [r2+r4], m0
+
+    add r4, mmsize
+    jl  .loop
+
+    REP_RET
+
+INIT_YMM avx2
+cglobal s32_deinterleave_pair, 5, 6, 4
+    movsxdifnidn r4, r4d
+    lea    r5, [r3*3]
+    shl    r4, 2
+    add    r1, r4
+    add    r2, r4
+    neg    r4
+.loop
+    vmovq   xmm0, [r0]
+    vmovhps xmm0, xmm0, [r0+r3]      ; l0 r0 l1 r1
+    vmovq   xmm1, [r0+r3*2]
+    vmovhps xmm1, xmm1, [r0+r5]      ; l2 r2 l3 r3
+    lea     r0, [r0+r3*4]
+    vmovq   xmm2, [r0]
+    vmovhps xmm2, xmm2, [r0+r3]      ; l4 r4 l5 r5
+    vmovq   xmm3, [r0+r3*2]
+    vmovhps xmm3, xmm3, [r0+r5]      ; l6 r6 l7 r7
+    lea     r0, [r0+r3*4]
+    vinserti128 ymm0, ymm0, xmm2, 1
+    vinserti128 ymm1, ymm1, xmm3, 1
+
+    vshufps ymm2, ymm0, ymm1, 0x88   ; l0 .. l7
+    vshufps ymm0, ymm0, ymm1, 0xdd   ; r0 .. r7
+    vmovdqu [r1+r4], ymm2
+    vmovdqu [r2+r4], ymm0
+
+    add r4, mmsize
+    jl  .loop
+
+    RET
@@ -582,9 +582,13 @@ void *open_muxer( void *ptr )
         {
             encoder_wait( h, output_stream->output_stream_id );
 
-            width = output_stream->avc_param.i_width;
-            height = output_stream->avc_param.i_height;
-            video_pid = stream->pid;
+            /* Extra renditions follow the main picture, which carries the PCR */
+            if( !video_pid )
+            {
+                width = output_stream->avc_param.i_width;
+                height = output_stream->avc_param.i_height;
+                video_pid = stream->pid;
+            }
         }
         else if( stream_format == AUDIO_MP2 )
             stream->audio_frame_size = (double)MP2_NUM_SAMPLES * 90000LL * output_stream->ts_opts.frames_per_pes / input_stream->sample_rate;
@@ -43,6 +43,20 @@ struct websockets_ctx
 	const char *software_version;
 	const char *hardware_version;
 	const char *fingerprint;
+
+	/* Loudness, one entry per metered output stream */
+#define LTN_WS_MAX_LOUDNESS 16
+	struct {
+		int outputStreamId;
+		double momentary, shortTerm, integrated, truePeak;
+	} loudness[LTN_WS_MAX_LOUDNESS];
+	int loudnessCount;
+
+	/* Video analytics of the input picture */
+	int videoAnalytics;
+	double lumaMean, sad, blockiness, illegalPct;
+	int lumaMin, lumaMax;
+	int black, freeze, illegal;
 };
 
 /*
@@ -97,6 +111,12 @@ static int callback_http(struct lws *wsi, enum lws_callback_reasons reason, void
 	//return lws_callback_http_dummy(wsi, reason, user, in, len);
 }
 
+/* Silence measures as -inf, which json can't carry */
+static json_object *json_level(double v)
+{
+	return isfinite(v) ? json_object_new_double(round(v * 10) / 10) : NULL;
+}
+
 static int callback_sse(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
 {
 	struct websockets_ctx *ctx = lws_context_user(lws_get_context(wsi));
@@ -195,6 +215,32 @@ static int callback_sse(struct lws *wsi, enum lws_callback_reasons reason, void
 				json_object *jrespint = json_object_new_int(ctx->framerateX100);
 				json_object_object_add(jresp, "framerate", jrespint);
 			}
+			if (ctx->loudnessCount) {
+				json_object *jarr = json_object_new_array();
+				for (int i = 0; i < ctx->loudnessCount; i++) {
+					json_object *jl = json_object_new_object();
+					json_object_object_add(jl, "output_stream_id", json_object_new_int(ctx->loudness[i].outputStreamId));
+					json_object_object_add(jl, "momentary", json_level(ctx->loudness[i].momentary));
+					json_object_object_add(jl, "short_term", json_level(ctx->loudness[i].shortTerm));
+					json_object_object_add(jl, "integrated", json_level(ctx->loudness[i].integrated));
+					json_object_object_add(jl, "true_peak", json_level(ctx->loudness[i].truePeak));
+					json_object_array_add(jarr, jl);
+				}
+				json_object_object_add(jresp, "loudness", jarr);
+			}
+			if (ctx->videoAnalytics) {
+				json_object *jv = json_object_new_object();
+				json_object_object_add(jv, "luma_mean", json_object_new_double(ctx->lumaMean));
+				json_object_object_add(jv, "luma_min", json_object_new_int(ctx->lumaMin));
+				json_object_object_add(jv, "luma_max", json_object_new_int(ctx->lumaMax));
+				json_object_object_add(jv, "illegal_pct", json_object_new_double(ctx->illegalPct));
+				json_object_object_add(jv, "sad", json_object_new_double(ctx->sad));
+				json_object_object_add(jv, "blockiness", json_object_new_double(ctx->blockiness));
+				json_object_object_add(jv, "black", json_object_new_boolean(ctx->black));
+				json_object_object_add(jv, "freeze", json_object_new_boolean(ctx->freeze));
+				json_object_object_add(jv, "illegal", json_object_new_boolean(ctx->illegal));
+				json_object_object_add(jresp, "video_analytics", jv);
+			}
 			resp_str = strdup(json_object_to_json_string(jresp));
 		} else
 		if (pss->urltype == URL_TARGET_FINGERPRINT) {
@@ -418,6 +464,53 @@ int ltn_ws_set_property_signal(void *p, int width, int height, int progressive,
 	return 0;
 }
 
+int ltn_ws_set_property_loudness(void *p, int outputStreamId, double momentary, double shortTerm, double integrated, double truePeak)
+{
+	struct websockets_ctx *ctx = (struct websockets_ctx *)p;
+	if (!ctx)
+		return -1;
+
+	int i;
+	for (i = 0; i < ctx->loudnessCount; i++) {
+		if (ctx->loudness[i].outputStreamId == outputStreamId)
+			break;
+	}
+	if (i == LTN_WS_MAX_LOUDNESS)
+		return -1;
+	if (i == ctx->loudnessCount) {
+		ctx->loudness[i].outputStreamId = outputStreamId;
+		ctx->loudnessCount++;
+	}
+
+	ctx->loudness[i].momentary = momentary;
+	ctx->loudness[i].shortTerm = shortTerm;
+	ctx->loudness[i].integrated = integrated;
+	ctx->loudness[i].truePeak = truePeak;
+
+	return 0;
+}
+
+int ltn_ws_set_property_video_analytics(void *p, double lumaMean, int lumaMin, int lumaMax, double illegalPct,
+	double sad, double blockiness, int black, int freeze, int illegal)
+{
+	struct websockets_ctx *ctx = (struct websockets_ctx *)p;
+	if (!ctx)
+		return -1;
+
+	ctx->lumaMean = lumaMean;
+	ctx->lumaMin = lumaMin;
+	ctx->lumaMax = lumaMax;
+	ctx->illegalPct = illegalPct;
+	ctx->sad = sad;
+	ctx->blockiness = blockiness;
+	ctx->black = black;
+	ctx->freeze = freeze;
+	ctx->illegal = illegal;
+	ctx->videoAnalytics = 1;
+
+	return 0;
+}
+
 int ltn_ws_set_property_software_version(void *p, const char *string)
 {
 	struct websockets_ctx *ctx = (struct websockets_ctx *)p;
@@ -20,6 +20,9 @@ int  ltn_ws_set_property_software_version(void *ctx, const char *string);
 int  ltn_ws_set_property_hardware_version(void *ctx, const char *string);
 int  ltn_ws_set_property_signal(void *ctx, int width, int height, int progressive, int framerateX100);
 int  ltn_ws_set_thumbnail_jpg(void *ctx, const unsigned char *buf, int sizeBytes);
+int  ltn_ws_set_property_loudness(void *ctx, int outputStreamId, double momentary, double shortTerm, double integrated, double truePeak);
+int  ltn_ws_set_property_video_analytics(void *ctx, double lumaMean, int lumaMin, int lumaMax, double illegalPct,
+	double sad, double blockiness, int black, int freeze, int illegal);
 
 #ifdef __cplusplus
 };
@@ -26,10 +26,16 @@
 #include "input/input.h"
 #include "filters/video/video.h"
 #include "filters/audio/audio.h"
+#include "filters/audio/loudness.h"
+#include "filters/audio/health.h"
+#include "filters/video/analytics.h"
 #include "encoders/video/video.h"
 #include "encoders/audio/audio.h"
 #include "mux/mux.h"
 #include "output/output.h"
+#if HAVE_X265_H
+#include <x265.h>
+#endif
 
 /* Avoid a minor compiler warning and defining GNU_SOURCE */
 extern int pthread_setname_np(pthread_t thread, const char *name);
@@ -115,7 +121,7 @@ void destroy_device( obe_device_t *device )
 /* Raw frame */
 obe_raw_frame_t *new_raw_frame( void )
 {
-    obe_raw_frame_t *raw_frame = calloc( 1, sizeof(*raw_frame) );
+    obe_raw_frame_t *raw_frame = malloc( sizeof(*raw_frame) );
 
     if( !raw_frame )
     {
@@ -123,6 +129,9 @@ obe_raw_frame_t *new_raw_frame( void )
         return NULL;
     }
 
+    /* Nothing reads the user data arena beyond user_data_used */
+    memset( raw_frame, 0, offsetof( obe_raw_frame_t, user_data_arena ) );
+
     return raw_frame;
 }
 
@@ -257,13 +266,143 @@ void obe_release_audio_data( void *ptr )
      av_freep( &raw_frame->audio_frame.audio_data[0] );
 }
 
-void obe_release_frame( void *ptr )
+void obe_release_bufref_data( void *ptr )
 {
      obe_raw_frame_t *raw_frame = ptr;
-     for( int i = 0; i < raw_frame->num_user_data; i++ )
-         free( raw_frame->user_data[i].data );
-     free( raw_frame->user_data );
-     free( raw_frame );
+     obe_buf_unref( raw_frame->buf_ref );
+     raw_frame->buf_ref = NULL;
+}
+
+/* av_image_alloc() equivalent backed by a pooled buffer. The frame holds the reference,
+ * so release_data must be obe_release_bufref_data() */
+int obe_image_alloc_pooled( obe_raw_frame_t *raw_frame, obe_buf_pool_t *pool, uint8_t *plane[4], int stride[4],
+                            int width, int height, enum AVPixelFormat csp, int align )
+{
+    int ret = av_image_fill_linesizes( stride, csp, FFALIGN( width, align ) );
+    if( ret < 0 )
+        return ret;
+
+    for( int i = 0; i < 4; i++ )
+        stride[i] = FFALIGN( stride[i], align );
+
+    int size = av_image_fill_pointers( plane, csp, height, NULL, stride );
+    if( size < 0 )
+        return size;
+
+    raw_frame->buf_ref = obe_buf_pool_get( pool, size + 16 + align - 1 );
+    if( !raw_frame->buf_ref )
+        return AVERROR(ENOMEM);
+
+    return av_image_fill_pointers( plane, csp, height, raw_frame->buf_ref->data, stride );
+}
+
+/* av_samples_alloc() equivalent backed by a pooled buffer. The frame holds the reference,
+ * so release_data must be obe_release_bufref_data() */
+int obe_audio_alloc_pooled( obe_raw_frame_t *raw_frame, obe_buf_pool_t *pool, uint8_t **audio_data, int *linesize,
+                            int num_channels, int num_samples, enum AVSampleFormat sample_fmt )
+{
+    int size = av_samples_get_buffer_size( linesize, num_channels, num_samples, sample_fmt, 64 );
+    if( size < 0 )
+        return size;
+
+    raw_frame->buf_ref = obe_buf_pool_get( pool, size );
+    if( !raw_frame->buf_ref )
+        return AVERROR(ENOMEM);
+
+    return av_samples_fill_arrays( audio_data, linesize, raw_frame->buf_ref->data, num_channels, num_samples, sample_fmt, 64 );
+}
+
+/* PCM frames leaving the audio filter are views into the capture buffer and share it with
+ * every other encoder fed from the same SDI group. Anything that writes to the samples
+ * must call this first, the channels are copied out only if the buffer is still shared. */
+int obe_audio_make_writable( obe_raw_frame_t *raw_frame, obe_buf_pool_t *pool )
+{
+    obe_audio_frame_t *af = &raw_frame->audio_frame;
+    obe_buf_t *shared = raw_frame->buf_ref;
+    uint8_t *src[MAX_CHANNELS];
+    int src_linesize = af->linesize;
+
+    if( !shared || shared->refcount == 1 )
+        return 0;
+
+    memcpy( src, af->audio_data, sizeof(src) );
+    if( obe_audio_alloc_pooled( raw_frame, pool, af->audio_data, &af->linesize, af->num_channels,
+                                af->num_samples, af->sample_fmt ) < 0 )
+    {
+        raw_frame->buf_ref = shared;
+        memcpy( af->audio_data, src, sizeof(src) );
+        af->linesize = src_linesize;
+        return -1;
+    }
+
+    av_samples_copy( af->audio_data, src, 0, 0, af->num_samples, af->num_channels, af->sample_fmt );
+    obe_buf_unref( shared );
+
+    return 0;
+}
+
+void obe_release_frame( void *ptr )
+{
+     free( ptr );
+}
+
+/* User data. Entries and payloads are appended to the frame, nothing is allocated.
+ * Returns NULL when the frame is out of entries or arena */
+obe_user_data_t *obe_user_data_add( obe_raw_frame_t *raw_frame, int type, int source, int len )
+{
+    if( raw_frame->num_user_data == MAX_USER_DATA || len > USER_DATA_ARENA_SIZE - raw_frame->user_data_used )
+    {
+        syslog( LOG_WARNING, "User data of type %d dropped, frame is full\n", type );
+        return NULL;
+    }
+
+    obe_user_data_t *user_data = &raw_frame->user_data[raw_frame->num_user_data++];
+    memset( user_data, 0, sizeof(*user_data) );
+    user_data->type = type;
+    user_data->source = source;
+    user_data->len = len;
+    user_data->data = &raw_frame->user_data_arena[raw_frame->user_data_used];
+    raw_frame->user_data_used += len;
+
+    return user_data;
+}
+
+/* The free end of the arena, for building a payload in place before obe_user_data_commit() */
+uint8_t *obe_user_data_tail( obe_raw_frame_t *raw_frame, int *avail )
+{
+    *avail = USER_DATA_ARENA_SIZE - raw_frame->user_data_used;
+
+    return &raw_frame->user_data_arena[raw_frame->user_data_used];
+}
+
+/* The len bytes built at the tail become the payload of user_data. Its old payload stays
+ * in the arena, so the input may have left too little room for the rewrite. Writers
+ * check obe_user_data_tail() first and drop the entry when it won't fit */
+void obe_user_data_commit( obe_raw_frame_t *raw_frame, obe_user_data_t *user_data, int len )
+{
+    user_data->data = &raw_frame->user_data_arena[raw_frame->user_data_used];
+    user_data->len = len;
+    raw_frame->user_data_used += len;
+}
+
+void obe_user_data_remove( obe_raw_frame_t *raw_frame, int idx )
+{
+    memmove( &raw_frame->user_data[idx], &raw_frame->user_data[idx+1],
+             sizeof(*raw_frame->user_data) * (raw_frame->num_user_data-idx-1) );
+    raw_frame->num_user_data--;
+}
+
+/* dst is a copy of src, point its payloads at its own arena */
+void obe_user_data_rebase( obe_raw_frame_t *dst, const obe_raw_frame_t *src )
+{
+    for( int i = 0; i < dst->num_user_data; i++ )
+        dst->user_data[i].data = dst->user_data_arena + (dst->user_data[i].data - src->user_data_arena);
+}
+
+void obe_user_data_clear( obe_raw_frame_t *raw_frame )
+{
+    raw_frame->num_user_data = 0;
+    raw_frame->user_data_used = 0;
 }
 
 /* Muxed data */
@@ -341,6 +480,8 @@ static void destroy_filter( obe_filter_t *filter )
 
     obe_destroy_queue( &filter->queue );
 
+    obe_audio_health_free( filter->audio_health );
+    obe_vanalytics_free( filter->video_analytics );
     free( filter->stream_id_list );
     free( filter );
 }
@@ -381,6 +522,7 @@ static void destroy_encoder( obe_encoder_t *encoder )
     if( encoder->encoder_params )
         free( encoder->encoder_params );
 
+    obe_loudness_free( encoder->loudness );
     free( encoder );
 }
 
@@ -537,6 +679,7 @@ obe_t *obe_setup(const char *syslogSuffix)
     h->sw_patch = VERSION_PATCH;
 
     pthread_mutex_init( &h->device_list_mutex, NULL );
+    obe_cadence_init( &h->input_cadence );
 
 #if 0
     if( av_lockmgr_register( obe_lavc_lockmgr ) < 0 )
@@ -647,6 +790,22 @@ static int __pthread_join( pthread_t thread, void **retval )
     return -1;
 }
 
+/* Bits per sample the video encoder of an output stream takes, the video filter
+ * dithers down to it. x265 and x264 can be built for different depths, the x265
+ * one is asked of the library we're running with */
+static int video_encoder_depth( obe_output_stream_t *ostream )
+{
+#if HAVE_X265_H
+    if( ostream->stream_format == VIDEO_HEVC_X265 )
+    {
+        const x265_api *api = x265_api_get( 0 );
+        return api ? api->bit_depth : 8;
+    }
+#endif
+
+    return X264_BIT_DEPTH;
+}
+
 int obe_probe_device( obe_t *h, obe_input_t *input_device, obe_input_program_t *program )
 {
     pthread_t thread;
@@ -680,7 +839,8 @@ int obe_probe_device( obe_t *h, obe_input_t *input_device, obe_input_program_t *
         goto fail;
     }
 #if HAVE_DECKLINK
-    else if( input_device->input_type == INPUT_DEVICE_DECKLINK )
+    else if( input_device->input_type == INPUT_DEVICE_DECKLINK ||
+             input_device->input_type == INPUT_DEVICE_DECKLINK_REPLAY )
         input = decklink_input;
 #endif
 #if HAVE_BLUEDRIVER_P_H
@@ -1098,7 +1258,8 @@ int obe_start( obe_t *h )
         goto fail;
     }
 #if HAVE_DECKLINK
-    else if( h->devices[0]->device_type == INPUT_DEVICE_DECKLINK )
+    else if( h->devices[0]->device_type == INPUT_DEVICE_DECKLINK ||
+             h->devices[0]->device_type == INPUT_DEVICE_DECKLINK_REPLAY )
         input = decklink_input;
 #endif
 #if HAVE_BLUEDRIVER_P_H
@@ -1149,6 +1310,26 @@ int obe_start( obe_t *h )
         pthread_setname_np(h->outputs[i]->output_thread, "obe-output");
     }
 
+    /* The video filter deinterlaces or decimates for every video encoder of the input.
+     * Field rate doubles the frame rate, decimation divides it */
+    obe_output_stream_t *video_stream = obe_core_get_output_stream_by_index(h, 0);
+    input_stream = get_input_stream( h, video_stream->input_stream_id );
+    for( int i = 0; input_stream && i < h->num_output_streams; i++ )
+    {
+        obe_output_stream_t *os = obe_core_get_output_stream_by_index(h, i);
+        if( os->input_stream_id != video_stream->input_stream_id )
+            continue;
+
+        if( video_stream->deinterlace && input_stream->interlaced )
+        {
+            os->avc_param.b_interlaced = 0;
+            if( video_stream->deinterlace == VIDEO_DEINTERLACE_FIELD )
+                os->avc_param.i_fps_num *= 2;
+        }
+        else if( video_stream->decimate > 1 && !input_stream->interlaced )
+            os->avc_param.i_fps_den *= video_stream->decimate;
+    }
+
     /* Open Encoder Threads */
     for( int i = 0; i < h->num_output_streams; i++ )
     {
@@ -1431,6 +1612,15 @@ int obe_start( obe_t *h )
 
                 ostream->sdi_audio_pair = input_stream->sdi_audio_pair;
 
+                if( ostream->loudness != AUDIO_LOUDNESS_OFF )
+                {
+                    if( input_stream->sample_format == AV_SAMPLE_FMT_S32P )
+                        h->encoders[h->num_encoders]->loudness = obe_loudness_alloc( input_stream->sample_rate, ostream->channel_layout,
+                                                                                     ostream->loudness );
+                    if( !h->encoders[h->num_encoders]->loudness )
+                        fprintf( stderr, "Loudness metering unavailable for output stream %d\n", ostream->output_stream_id );
+                }
+
                 /* Choose the optimal number of audio frames per PES
                  * TODO: This should be set after the encoder has told us the frame size */
                 if( !ostream->ts_opts.frames_per_pes && h->obe_system == OBE_SYSTEM_TYPE_GENERIC &&
@@ -1553,10 +1743,15 @@ int obe_start( obe_t *h )
                 vid_filter_params->input_stream = input_stream;
                 obe_output_stream_t *ostream = obe_core_get_output_stream_by_index(h, i);
                 vid_filter_params->target_csp = ostream->avc_param.i_csp & X264_CSP_MASK;
+                vid_filter_params->target_depth = video_encoder_depth( ostream );
 #if 0
                 vid_filter_params->target_csp = X264_CSP_I422;
 #endif
 
+                if( ostream->analytics > 0 )
+                    h->filters[h->num_filters]->video_analytics = obe_vanalytics_alloc( ostream->analytics, input_stream->timebase_num,
+                                                                                         input_stream->timebase_den );
+
                 if( pthread_create( &h->filters[h->num_filters]->filter_thread, NULL, video_filter.start_filter, vid_filter_params ) < 0 )
                 {
                     fprintf( stderr, "Couldn't create video filter thread \n" );
@@ -1582,6 +1777,10 @@ PRINT_OBE_FILTER(h->filters[h->num_filters], "AUDIO FILTER");
                 aud_filter_params->h = h;
                 aud_filter_params->filter = h->filters[h->num_filters];
 
+                if( input_stream->sample_format == AV_SAMPLE_FMT_S32P )
+                    h->filters[h->num_filters]->audio_health = obe_audio_health_alloc( input_stream->input_stream_id,
+                                                                                       input_stream->sample_rate );
+
                 if( pthread_create( &h->filters[h->num_filters]->filter_thread, NULL, audio_filter.start_filter, aud_filter_params ) < 0 )
                 {
                     fprintf( stderr, "Couldn't create filter thread \n" );
@@ -1752,6 +1951,7 @@ void obe_close( obe_t *h )
 
     free(obe_core_get_output_stream_by_index(h, 0));
     /* TODO: free other things */
+    obe_cadence_destroy( &h->input_cadence );
 
     free( h );
     h = NULL;
@@ -1890,9 +2090,6 @@ void obe_image_copy(obe_image_t *dst, obe_image_t *src)
 void obe_raw_frame_free(obe_raw_frame_t *frame)
 {
 	free(frame->alloc_img.plane[0]);
-	for (int i = 0; i < frame->num_user_data; i++)
-		free(frame->user_data[i].data);
-	free(frame->user_data);
 	free(frame);
 }
 #endif
@@ -1902,24 +2099,17 @@ obe_raw_frame_t *obe_raw_frame_copy(obe_raw_frame_t *frame)
     obe_raw_frame_t *f = new_raw_frame();
 
     memcpy(f, frame, sizeof(*frame));
+    obe_user_data_rebase(f, frame);
 
     obe_image_copy(&f->alloc_img, &frame->alloc_img);
+    if (f->buf_ref) {
+        /* The image was deep copied, it no longer belongs to the pool. */
+        f->buf_ref = NULL;
+        f->release_data = obe_release_video_data;
+    }
 
     memcpy(&f->img, &f->alloc_img, sizeof(frame->alloc_img));
 
-    if (f->num_user_data) {
-        f->user_data = (obe_user_data_t *)malloc(sizeof(obe_user_data_t) * f->num_user_data);
-        memcpy(f->user_data, frame->user_data, sizeof(obe_user_data_t) * f->num_user_data);
-
-        for (int i = 0; i < f->num_user_data; i++) {
-            f->user_data[i].data = (uint8_t *)malloc(frame->user_data[i].len);
-            memcpy(f->user_data[i].data, frame->user_data[i].data, f->user_data[i].len);
-        }
-
-    } else {
-        f->user_data = NULL;
-    }
-
 //    obe_raw_frame_printf(f);
 
     return f;
@@ -102,6 +102,7 @@ enum input_type_e
     INPUT_DEVICE_V4L2,
     INPUT_DEVICE_BLUEFISH,
     INPUT_DEVICE_V210,
+    INPUT_DEVICE_DECKLINK_REPLAY, /* A decklink capture file, location= */
     INPUT_DEVICE_NDI,
 //    INPUT_DEVICE_ASI,
 };
@@ -125,8 +126,51 @@ typedef struct
     int enable_los_exit_ms;
     int enable_frame_injection;
     int enable_allow_1080p60;
+    int enable_free_run; /* File inputs: deliver frames as fast as possible, no pacing */
+    int v4l2_memory;
+    char *record_location; /* Decklink: record the raw callback payloads to this capture file */
+    int los_slate;         /* Decklink frame injection: what to show during signal loss */
+    int enable_los_osd;    /* Burn "NO SIGNAL" and the time into the slate */
 } obe_input_t;
 
+enum input_v4l2_memory_e
+{
+    INPUT_V4L2_MEMORY_MMAP = 0, /* Copy/convert out of the driver buffers */
+    INPUT_V4L2_MEMORY_USERPTR,  /* Driver captures into the shared frame pool */
+    INPUT_V4L2_MEMORY_DMABUF,   /* Driver buffers are exported and referenced by the frame */
+};
+
+enum input_los_slate_e
+{
+    INPUT_LOS_SLATE_LAST_FRAME = 0, /* Repeat the last good frame */
+    INPUT_LOS_SLATE_BLACK,
+    INPUT_LOS_SLATE_BARS,
+};
+
+/* Video filter horizontal scaler, for the 4:3, 3:2 and 2:1 ratios with a dedicated scaler */
+enum video_scaler_e
+{
+    VIDEO_SCALER_NORMAL = 0, /* 8 tap Lanczos2 */
+    VIDEO_SCALER_FAST,       /* 4 tap triangle */
+    VIDEO_SCALER_SWSCALE,    /* Always use swscale Lanczos */
+};
+
+/* Video filter deinterlacing of interlaced inputs. The encoders are then set up progressive */
+enum video_deinterlace_e
+{
+    VIDEO_DEINTERLACE_OFF = 0,
+    VIDEO_DEINTERLACE_FRAME, /* One frame per input frame, at the time of its first field */
+    VIDEO_DEINTERLACE_FIELD, /* One frame per field, 50p from 50i */
+};
+
+/* Audio filter loudness metering of an encoded PCM stream, see filters/audio/loudness.h */
+enum audio_loudness_e
+{
+    AUDIO_LOUDNESS_OFF = 0,
+    AUDIO_LOUDNESS_EBU_R128, /* Reported in LUFS against -23 */
+    AUDIO_LOUDNESS_ATSC_A85, /* Reported in LKFS against -24 */
+};
+
 /**** Stream Formats ****/
 enum stream_type_e
 {
@@ -378,6 +422,13 @@ typedef struct
 
     /* Video */
     int is_wide;
+    int scaler;
+    int deinterlace;
+    int decimate; /* Keep one progressive frame in this many, 0 or 1 keeps them all */
+    int analytics; /* Analyse one input picture in this many, 0 disables, see filters/video/analytics.h */
+    int thumbnail_interval; /* ms between JPEG thumbnails of the input, 0 disables */
+    int thumbnail_width;
+    int osd; /* Items burnt into the output picture, see filters/video/burnin.h, 0 disables */
     obe_frame_anc_opts_t video_anc;
 
     /* AVC */
@@ -389,6 +440,7 @@ typedef struct
     uint64_t channel_layout;
     int mono_channel;
     int audio_offset_ms;
+    int loudness;
 
     /* Metadata */
     obe_audio_metadata_t audio_metadata;
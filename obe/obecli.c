@@ -41,6 +41,11 @@
 #include "obecli.h"
 #include "common/common.h"
 #include "ltn_ws.h"
+#include "filters/video/video.h"
+#include "filters/video/scale.h"
+#include "filters/audio/loudness.h"
+#include "filters/video/analytics.h"
+#include "filters/audio/health.h"
 
 #define FAIL_IF_ERROR( cond, ... ) FAIL_IF_ERR( cond, "obecli", __VA_ARGS__ )
 #define RETURN_IF_ERROR( cond, ... ) RETURN_IF_ERR( cond, "options", NULL, __VA_ARGS__ )
@@ -83,14 +88,18 @@ static const char * const input_types[]              = { "url", "decklink", "lin
 								"bluefish",
 //#endif
 								"v210",
+								"decklink-replay",
 #if HAVE_PROCESSING_NDI_LIB_H
 								"ndi",
 #endif
 								0 };
-static const char * const input_video_formats[]      = { "pal", "ntsc", "720p50", "720p59.94", "720p60", "1080i50", "1080i59.94", "1080i60",
+/* Indexed by input_video_format_e */
+static const char * const input_video_formats[]      = { "auto", "pal", "ntsc", "720p50", "720p59.94", "720p60", "1080i50", "1080i59.94", "1080i60",
                                                          "1080p23.98", "1080p24", "1080p25", "1080p29.97", "1080p30", "1080p50", "1080p59.94",
-                                                         "1080p60", 0 };
+                                                         "1080p60", "2160p50", 0 };
 static const char * const input_video_connections[]  = { "sdi", "hdmi", "optical-sdi", "component", "composite", "s-video", 0 };
+static const char * const input_v4l2_memory_modes[]  = { "mmap", "userptr", "dmabuf", 0 };
+static const char * const input_los_slates[]         = { "last-frame", "black", "bars", 0 };
 static const char * const input_audio_connections[]  = { "embedded", "aes-ebu", "analogue", 0 };
 static const char * const ttx_locations[]            = { "dvb-ttx", "dvb-vbi", "both", 0 };
 static const char * const stream_actions[]           = { "passthrough", "encode", 0 };
@@ -104,16 +113,25 @@ static const char * const mp2_modes[]                = { "auto", "stereo", "join
 static const char * const channel_maps[]             = { "", "mono", "stereo", "5.0", "5.1", 0 };
 static const char * const mono_channels[]            = { "left", "right", 0 };
 static const char * const output_modules[]           = { "udp", "rtp", "linsys-asi", "filets", 0 };
-static const char * const addable_streams[]          = { "audio", "ttx" };
+static const char * const addable_streams[]          = { "audio", "ttx", "video" };
 static const char * const preset_names[]        = { "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow", "placebo", NULL };
 static const char * const tuning_names[]        = { "animation", "zerolatency", "fastdecode", "grain", "ssim", "psnr", NULL };
 static const char * entropy_modes[] = { "cabac", "cavlc", NULL };
+static const char * const video_scalers[] = { "normal", "fast", "swscale", NULL };
+static const char * const video_deinterlacers[] = { "off", "frame", "field", NULL };
+static const char * const audio_loudness_meters[] = { "off", "r128", "a85", NULL };
+static const char * const video_osd_items[] = { "timecode", "pts", "encoder", "clock", NULL }; /* Bits of obe_burnin_item_e */
 
 static const char * system_opts[] = { "system-type", "max-probe-time", NULL };
 static const char * input_opts[]  = { "location", "card-idx", "video-format", "video-connection", "audio-connection",
                                       "smpte2038", "scte35", "vanc-cache", "bitstream-audio", "patch1", "los-exit-ms",
                                       "frame-injection", /* 11 */
                                       "allow-1080p60", /* 12 */
+                                      "v4l2-memory", /* 13 */
+                                      "free-run", /* 14 */
+                                      "record", /* 15 */
+                                      "los-slate", /* 16 */
+                                      "los-osd", /* 17 */
                                       NULL };
 static const char * add_opts[] =    { "type" };
 /* TODO: split the stream options into general options, video options, ts options */
@@ -141,6 +159,15 @@ static const char * stream_opts[] = { "action", "format",
                                       "audio-offset", /* 43 */
                                       "video-codec", /* 44 */
                                       "tuning-name", /* 45 */
+                                      "scaler", /* 46 */
+                                      "height", /* 47 */
+                                      "deinterlace", /* 48 */
+                                      "decimate", /* 49 */
+                                      "loudness", /* 50 */
+                                      "analytics", /* 51 */
+                                      "thumbnail", /* 52 */
+                                      "thumbnail-width", /* 53 */
+                                      "osd", /* 54 */
                                       NULL };
 
 static const char * muxer_opts[]  = { "ts-type", "cbr", "ts-muxrate", "passthrough", "ts-id", "program-num", "pmt-pid", "pcr-pid",
@@ -398,6 +425,43 @@ static int parse_enum_value( const char *arg, const char * const *names, int *ds
     return -1;
 }
 
+/* "a+b+c" of names, each sets bit 1 << index. "all" and "off" too */
+static int parse_flags_value( const char *arg, const char * const *names, int *dst )
+{
+    char tmp[128];
+    char *saveptr;
+    int flags = 0;
+
+    if( !strcasecmp( arg, "off" ) )
+    {
+        *dst = 0;
+        return 0;
+    }
+
+    snprintf( tmp, sizeof(tmp), "%s", arg );
+    for( char *tok = strtok_r( tmp, "+", &saveptr ); tok; tok = strtok_r( NULL, "+", &saveptr ) )
+    {
+        int i;
+
+        if( !strcasecmp( tok, "all" ) )
+        {
+            for( i = 0; names[i]; i++ )
+                flags |= 1 << i;
+            continue;
+        }
+
+        if( parse_enum_value( tok, names, &i ) < 0 )
+            return -1;
+        flags |= 1 << i;
+    }
+
+    if( !flags )
+        return -1;
+
+    *dst = flags;
+    return 0;
+}
+
 static char *get_format_name(int stream_format, const obecli_format_name_t *names, int long_name)
 {
     int i = 0;
@@ -476,6 +540,13 @@ static int add_stream( char *command, obecli_command_t *child )
         cli.output_streams[output_stream_id].input_stream_id = -1;
         cli.output_streams[output_stream_id].stream_format = stream_format;
     }
+    else if( !strcasecmp( type, addable_streams[2] ) ) /* Video rendition */
+    {
+        /* Start from the main video settings, on a PID of its own. Set the size with 'set stream opts' */
+        memcpy( &cli.output_streams[output_stream_id], &cli.output_streams[0], sizeof(*cli.output_streams) );
+        cli.output_streams[output_stream_id].ts_opts.pid = 0;
+        cli.output_streams[output_stream_id].ts_opts.teletext_opts = NULL;
+    }
     cli.output_streams[output_stream_id].output_stream_id = output_stream_id;
 
     printf( "NOTE: output-stream-ids have CHANGED! \n" );
@@ -591,6 +662,11 @@ static int set_input( char *command, obecli_command_t *child )
         char *los_exit_ms = obe_get_option( input_opts[10], opts );
         char *frame_injection = obe_get_option(input_opts[11], opts);
         char *allow_1080p60 = obe_get_option(input_opts[12], opts);
+        char *v4l2_memory = obe_get_option(input_opts[13], opts);
+        char *free_run = obe_get_option(input_opts[14], opts);
+        char *record = obe_get_option(input_opts[15], opts);
+        char *los_slate = obe_get_option(input_opts[16], opts);
+        char *los_osd = obe_get_option(input_opts[17], opts);
 
         FAIL_IF_ERROR( video_format && ( check_enum_value( video_format, input_video_formats ) < 0 ),
                        "Invalid video format\n" );
@@ -601,6 +677,12 @@ static int set_input( char *command, obecli_command_t *child )
         FAIL_IF_ERROR( audio_connection && ( check_enum_value( audio_connection, input_audio_connections ) < 0 ),
                        "Invalid audio connection\n" );
 
+        FAIL_IF_ERROR( v4l2_memory && ( check_enum_value( v4l2_memory, input_v4l2_memory_modes ) < 0 ),
+                       "Invalid v4l2 memory mode\n" );
+
+        FAIL_IF_ERROR( los_slate && ( check_enum_value( los_slate, input_los_slates ) < 0 ),
+                       "Invalid loss of signal slate\n" );
+
         if( location )
         {
              if( cli.input.location )
@@ -611,8 +693,20 @@ static int set_input( char *command, obecli_command_t *child )
              strcpy( cli.input.location, location );
         }
 
+        if( record )
+        {
+             if( cli.input.record_location )
+                 free( cli.input.record_location );
+
+             cli.input.record_location = malloc( strlen( record ) + 1 );
+             FAIL_IF_ERROR( !cli.input.record_location, "malloc failed\n" );
+             strcpy( cli.input.record_location, record );
+        }
+
         cli.input.enable_allow_1080p60 = obe_otoi(allow_1080p60, cli.input.enable_allow_1080p60);
+        cli.input.enable_free_run = obe_otoi(free_run, cli.input.enable_free_run);
         cli.input.enable_frame_injection = obe_otoi(frame_injection, cli.input.enable_frame_injection);
+        cli.input.enable_los_osd = obe_otoi(los_osd, cli.input.enable_los_osd);
         cli.input.enable_patch1 = obe_otoi( patch1, cli.input.enable_patch1 );
         cli.input.enable_bitstream_audio = obe_otoi( bitstream_audio, cli.input.enable_bitstream_audio );
         cli.input.enable_smpte2038 = obe_otoi( smpte2038, cli.input.enable_smpte2038 );
@@ -626,6 +720,10 @@ static int set_input( char *command, obecli_command_t *child )
             parse_enum_value( video_connection, input_video_connections, &cli.input.video_connection );
         if( audio_connection )
             parse_enum_value( audio_connection, input_audio_connections, &cli.input.audio_connection );
+        if( v4l2_memory )
+            parse_enum_value( v4l2_memory, input_v4l2_memory_modes, &cli.input.v4l2_memory );
+        if( los_slate )
+            parse_enum_value( los_slate, input_los_slates, &cli.input.los_slate );
 
         obe_free_string_array( opts );
     }
@@ -720,6 +818,15 @@ static int set_stream( char *command, obecli_command_t *child )
             const char *audio_offset = obe_get_option( stream_opts[43], opts );
             const char *video_codec = obe_get_option( stream_opts[44], opts );
             const char *tuning_name  = obe_get_option( stream_opts[45], opts );
+            const char *scaler       = obe_get_option( stream_opts[46], opts );
+            const char *height       = obe_get_option( stream_opts[47], opts );
+            const char *deinterlace  = obe_get_option( stream_opts[48], opts );
+            const char *decimate     = obe_get_option( stream_opts[49], opts );
+            const char *loudness     = obe_get_option( stream_opts[50], opts );
+            const char *analytics    = obe_get_option( stream_opts[51], opts );
+            const char *thumbnail    = obe_get_option( stream_opts[52], opts );
+            const char *thumbnail_width = obe_get_option( stream_opts[53], opts );
+            const char *osd          = obe_get_option( stream_opts[54], opts );
 
             int video_codec_id = 0; /* AVC */
             if (video_codec) {
@@ -771,6 +878,54 @@ static int set_stream( char *command, obecli_command_t *child )
                               "Invalid tuning-name\n" );
                 FAIL_IF_ERROR(entropy_mode && (check_enum_value(entropy_mode, entropy_modes) < 0),
                               "Invalid entropy coding mode\n" );
+                FAIL_IF_ERROR(scaler && (check_enum_value(scaler, video_scalers) < 0),
+                              "Invalid scaler\n" );
+
+                if (scaler)
+                    parse_enum_value(scaler, video_scalers, &cli.output_streams[output_stream_id].scaler);
+
+                FAIL_IF_ERROR(deinterlace && (check_enum_value(deinterlace, video_deinterlacers) < 0),
+                              "Invalid deinterlace mode\n" );
+                FAIL_IF_ERROR(deinterlace && output_stream_id != 0,
+                              "Renditions are deinterlaced along with the main video stream\n" );
+
+                if (deinterlace)
+                    parse_enum_value(deinterlace, video_deinterlacers, &cli.output_streams[output_stream_id].deinterlace);
+
+                if (decimate) {
+                    int n = obe_otoi(decimate, 1);
+                    FAIL_IF_ERROR(n < 1 || n > 4, "Invalid decimation, keep one frame in 1 to 4\n" );
+                    FAIL_IF_ERROR(output_stream_id != 0, "Renditions are decimated along with the main video stream\n" );
+                    cli.output_streams[output_stream_id].decimate = n;
+                }
+
+                if (analytics) {
+                    int n = obe_otoi(analytics, -1);
+                    FAIL_IF_ERROR(n < 0 || n > 60, "Invalid analytics interval, analyse one picture in 1 to 60, 0 disables\n" );
+                    FAIL_IF_ERROR(output_stream_id != 0, "Analytics run on the input picture, set them on the main video stream\n" );
+                    cli.output_streams[output_stream_id].analytics = n;
+                }
+
+                if (thumbnail) {
+                    int ms = obe_otoi(thumbnail, -1);
+                    FAIL_IF_ERROR(ms != 0 && (ms < 40 || ms > 60000), "Invalid thumbnail interval, 40 to 60000ms, 0 disables\n" );
+                    FAIL_IF_ERROR(output_stream_id != 0, "Thumbnails are of the input, set them on the main video stream\n" );
+                    cli.output_streams[output_stream_id].thumbnail_interval = ms;
+                    if (!cli.output_streams[output_stream_id].thumbnail_width)
+                        cli.output_streams[output_stream_id].thumbnail_width = 320;
+                }
+
+                if (thumbnail_width) {
+                    int w = obe_otoi(thumbnail_width, -1);
+                    FAIL_IF_ERROR(w < 16 || w > 1920, "Invalid thumbnail width, 16 to 1920\n" );
+                    cli.output_streams[output_stream_id].thumbnail_width = w;
+                }
+
+                if (osd) {
+                    FAIL_IF_ERROR(parse_flags_value(osd, video_osd_items, &cli.output_streams[output_stream_id].osd) < 0,
+                                  "Invalid osd, one or more of timecode, pts, encoder and clock joined with '+', all or off\n" );
+                    FAIL_IF_ERROR(output_stream_id != 0, "The OSD is burnt into the main picture, set it on the main video stream\n" );
+                }
 
 extern char g_video_encoder_preset_name[64];
 
@@ -822,15 +977,33 @@ extern char g_video_encoder_tuning_name[64];
                     }
                 }
 
-                if( width )
+                if( output_stream_id == 0 )
                 {
+                    FAIL_IF_ERROR( height, "Only additional video renditions can be scaled vertically\n" );
+
+                    if( width )
+                    {
+                        int i_width = obe_otoi( width, avc_param->i_width );
+                        while( allowed_resolutions[i][0] && ( allowed_resolutions[i][1] != avc_param->i_height ||
+                               allowed_resolutions[i][0] != i_width ) )
+                           i++;
+
+                        FAIL_IF_ERROR( !allowed_resolutions[i][0], "Invalid resolution. \n" );
+                        avc_param->i_width = i_width;
+                    }
+                }
+                else
+                {
+                    /* Additional renditions are scaled down from the main picture, to any even size.
+                     * Interlaced pictures are scaled a field at a time, so each field must stay even too */
                     int i_width = obe_otoi( width, avc_param->i_width );
-                    while( allowed_resolutions[i][0] && ( allowed_resolutions[i][1] != avc_param->i_height ||
-                           allowed_resolutions[i][0] != i_width ) )
-                       i++;
+                    int i_height = obe_otoi( height, avc_param->i_height );
 
-                    FAIL_IF_ERROR( !allowed_resolutions[i][0], "Invalid resolution. \n" );
+                    FAIL_IF_ERROR( i_width < 64 || i_height < 64 || i_width > input_stream->width || i_height > input_stream->height ||
+                                   ( i_width & 1 ) || ( i_height & ( input_stream->interlaced ? 3 : 1 ) ),
+                                   "Invalid rendition resolution. \n" );
                     avc_param->i_width = i_width;
+                    avc_param->i_height = i_height;
                 }
 
                 /* Set it to encode by default */
@@ -967,6 +1140,9 @@ extern char g_video_encoder_tuning_name[64];
                 FAIL_IF_ERROR( mono_channel && check_enum_value( mono_channel, mono_channels ) < 0,
                               "Invalid Mono channel selection\n" );
 
+                FAIL_IF_ERROR( loudness && check_enum_value( loudness, audio_loudness_meters ) < 0,
+                              "Invalid loudness meter\n" );
+
                 if( action )
                     parse_enum_value( action, stream_actions, &cli.output_streams[output_stream_id].stream_action );
                 if( format )
@@ -977,6 +1153,8 @@ extern char g_video_encoder_tuning_name[64];
                     parse_enum_value( channel_map, channel_maps, &channel_map_idx );
                 if( mono_channel )
                     parse_enum_value( mono_channel, mono_channels, &cli.output_streams[output_stream_id].mono_channel );
+                if( loudness )
+                    parse_enum_value( loudness, audio_loudness_meters, &cli.output_streams[output_stream_id].loudness );
 
                 channel_layout = channel_layouts[channel_map_idx];
 
@@ -1700,6 +1878,30 @@ extern void hevc_show_stats();
     return 0;
 }
 
+static int show_filter( char *command, obecli_command_t *child )
+{
+    if( !cli.h )
+        return -1;
+
+    for( int i = 0; i < cli.h->num_filters; i++ )
+    {
+        obe_filter_t *f = cli.h->filters[i];
+        obe_int_input_stream_t *input_stream = get_input_stream( cli.h, f->stream_id_list[0] );
+
+        if( input_stream && input_stream->stream_type == STREAM_TYPE_VIDEO )
+            video_filter_show( f );
+    }
+
+    return 0;
+}
+
+static int show_scalers( char *command, obecli_command_t *child )
+{
+    obe_hscale_bench();
+
+    return 0;
+}
+
 static int show_encoders( char *command, obecli_command_t *child )
 {
     printf( "\nSupported Encoders: \n" );
@@ -1765,6 +1967,28 @@ static int show_input( char *command, obecli_command_t *child )
     if( !strcasecmp( command, "streams" ) )
         return show_input_streams( NULL, NULL );
 
+    if( !strcasecmp( command, "cadence" ) )
+    {
+        if( !cli.h )
+            return -1;
+        obe_cadence_print( &cli.h->input_cadence );
+        return 0;
+    }
+
+    if( !strcasecmp( command, "health" ) )
+    {
+        if( !cli.h || !g_running )
+            return -1;
+        for( int i = 0; i < cli.h->num_filters; i++ )
+        {
+            if( cli.h->filters[i]->video_analytics )
+                obe_vanalytics_print( cli.h->filters[i]->video_analytics );
+            if( cli.h->filters[i]->audio_health )
+                obe_audio_health_print( cli.h->filters[i]->audio_health );
+        }
+        return 0;
+    }
+
     return -1;
 }
 
@@ -1954,6 +2178,13 @@ static int show_output_streams( char *command, obecli_command_t *child )
         {
             format_name = get_format_name( cli.output_streams[i].stream_format, format_names, 0 );
             printf( "Audio: %s - SDI audio pair: %d \n", format_name, cli.output_streams[i].sdi_audio_pair );
+
+            obe_encoder_t *encoder = g_running ? get_encoder( cli.h, output_stream->output_stream_id ) : NULL;
+            if( encoder && encoder->loudness )
+            {
+                printf( "    " );
+                obe_loudness_print( encoder->loudness );
+            }
         }
         else if(input_stream->stream_type == STREAM_TYPE_MISC && input_stream->stream_format == DVB_TABLE_SECTION)
         {
@@ -2103,6 +2334,12 @@ static int stop_encode( char *command, obecli_command_t *child )
         cli.input.location = NULL;
     }
 
+    if( cli.input.record_location )
+    {
+        free( cli.input.record_location );
+        cli.input.record_location = NULL;
+    }
+
     if( cli.mux_opts.service_name )
     {
         free( cli.mux_opts.service_name );
@@ -2480,7 +2717,7 @@ static void *runtime_statistics_thread(void *p)
 
 	ctx->running = 1;
 	char ts[64];
-	char line[256] = { 0 };
+	char line[1536] = { 0 };
 	while (!ctx->terminate) {
 		sleep(1);
 		obe_getTimestamp(ts, NULL);
@@ -2510,6 +2747,27 @@ static void *runtime_statistics_thread(void *p)
 		/* Mux */
 		sprintf(APPEND(line), ",mux_dtstotal=%" PRIi64, g_mux_dtstotal);
 
+		/* Input cadence */
+		obe_cadence_stats(&h->input_cadence, line, sizeof(line));
+
+		/* Video analytics of the input picture */
+		for (int i = 0; i < h->num_filters; i++) {
+			if (h->filters[i]->video_analytics)
+				obe_vanalytics_stats(h->filters[i]->video_analytics, line, sizeof(line));
+		}
+
+		/* Audio health alarms, bitmasks of the input channels */
+		for (int i = 0; i < h->num_filters; i++) {
+			if (h->filters[i]->audio_health)
+				obe_audio_health_stats(h->filters[i]->audio_health, line, sizeof(line));
+		}
+
+		/* Loudness of the metered audio streams */
+		for (int i = 0; i < h->num_encoders; i++) {
+			if (h->encoders[i]->loudness)
+				obe_loudness_stats(h->encoders[i]->loudness, h->encoders[i]->output_stream_id, line, sizeof(line));
+		}
+
 		/* Thermals */
 		if (ctx->thermal_bm == 0) {
 			char tmp[256];
@@ -2549,7 +2807,7 @@ static void *runtime_statistics_thread(void *p)
 			}
 		}
 
-		char msg[256];
+		char msg[1664];
 		sprintf(msg, "ts=%s%s\n", ts, line);
 
 		if (g_core_runtime_statistics_to_file > 1)
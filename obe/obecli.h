@@ -59,6 +59,8 @@ static int set_variable( char *command, obecli_command_t *child );
 static int show_bitdepth( char *command, obecli_command_t *child );
 static int show_decoders( char *command, obecli_command_t *child );
 static int show_encoders( char *command, obecli_command_t *child );
+static int show_filter( char *command, obecli_command_t *child );
+static int show_scalers( char *command, obecli_command_t *child );
 static int show_help( char *command, obecli_command_t *child );
 static int show_input( char *command, obecli_command_t *child );
 static int show_inputs( char *command, obecli_command_t *child );
@@ -135,12 +137,14 @@ static obecli_command_t show_commands[] =
     { "decoders", "",  "Show supported decoders",    show_decoders, NULL },
     { "encoders", "",  "Show supported encoders",    show_encoders, NULL },
     //{ "filters",  "",  "Show supported filters",   show_filters, NULL },
-    { "input",    "streams",  "Show input streams",  show_input,   NULL },
+    { "filter",   "",  "Show video filter plan",     show_filter,   NULL },
+    { "input",    "streams|cadence|health", "Show input streams, frame cadence or video and audio health", show_input, NULL },
     { "inputs",   "",  "Show supported inputs",      show_inputs,   NULL },
     { "muxers",   "",  "Show supported muxers",      show_muxers,   NULL },
     { "output",   "streams",  "Show output streams", show_output,   NULL },
     { "outputs",  "",  "Show supported outputs",     show_outputs,  NULL },
     { "queues",   "",  "Show queue metrics",         show_queues,   NULL },
+    { "scalers",  "",  "Benchmark video downscalers against swscale", show_scalers, NULL },
     { 0 }
 };
 
@@ -186,6 +190,9 @@ static const obecli_input_name_t input_names[] =
     { INPUT_DEVICE_BLUEFISH, "BlueFish", "BlueFish Epoch Raw Frame Device", "internal" },
 #endif
     { INPUT_DEVICE_V210    , "V210", "V210 Raw Frame Device", "internal" },
+#if HAVE_DECKLINK
+    { INPUT_DEVICE_DECKLINK_REPLAY, "Decklink Replay", "Decklink capture file replay", "internal" },
+#endif
 #if HAVE_PROCESSING_NDI_LIB_H
     { INPUT_DEVICE_NDI,      "NDI",  "NDI Raw Frame Device", "internal" },
 #endif
@@ -1275,6 +1275,15 @@ int vc8x0_display_render_character(struct vc8x0_display_context *ctx, u8 letter)
 	return 0;
 }
 
+/* The 8x8 bitmap for a letter, MSB is the leftmost pixel. */
+const unsigned char *vc8x0_display_glyph(unsigned char letter)
+{
+	if (letter > 0x9f)
+		return NULL;
+
+	return charset[letter].data;
+}
+
 static int vc8x0_display_render_ascii(struct vc8x0_display_context *ctx, u8 letter, int x, int y)
 {
 	if (letter > 0x9f)
@@ -30,6 +30,7 @@ struct vc8x0_display_context
 int vc8x0_display_init(struct vc8x0_display_context *ctx);
 int vc8x0_display_render_reset(struct vc8x0_display_context *ctx, unsigned char *ptr, int width, long stride);
 int vc8x0_display_render_string(struct vc8x0_display_context *ctx, const char *s, int len, int x, int y);
+const unsigned char *vc8x0_display_glyph(unsigned char letter);
 
 #ifdef __cplusplus
 };
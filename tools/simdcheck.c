@@ -0,0 +1,52 @@
+/* Check the SIMD versions of the video filter rows and the v210 unpackers
+ * against C at every width up to a 1080 line, then time them at the widths
+ * obecli checks at startup. Every version the CPU runs is checked, OBE_SIMD
+ * doesn't apply. Exits non-zero if any differs.
+ *
+ *   obe/simdcheck
+ */
+
+#include <stdio.h>
+#include "common/simd.h"
+#include "filters/video/rows.h"
+#include "input/sdi/v210_unpack.h"
+
+/* Widths reported before moving on to the next routine */
+#define MAX_REPORTED 8
+
+int main( int argc, char **argv )
+{
+    int failed = 0, reported = 0;
+
+    printf( "Checking the video filter rows at 1 to 960 chroma samples\n" );
+    for( int width = 1; width <= 960 && reported < MAX_REPORTED; width++ )
+    {
+        /* One width at a time, so a difference can be put down to it */
+        if( obe_vfilter_rows_check( &width, 1, 0 ) )
+        {
+            printf( "  at %d chroma samples\n", width );
+            reported++;
+        }
+    }
+    failed += reported;
+
+    reported = 0;
+    printf( "Checking the v210 unpackers at 6 to 1920 pixels\n" );
+    for( int width = 6; width <= 1920 && reported < MAX_REPORTED; width++ )
+    {
+        if( obe_v210_planar_unpack_check( &width, 1, 0 ) )
+        {
+            printf( "  at %d pixels\n", width );
+            reported++;
+        }
+    }
+    failed += reported;
+
+    printf( "\nTimings against c\n" );
+    failed += obe_vfilter_rows_check( NULL, 0, 1 ) != 0;
+    failed += obe_v210_planar_unpack_check( NULL, 0, 1 ) != 0;
+
+    printf( "\n%s\n", failed ? "FAILED, versions which differ from c are never selected" : "All versions match c" );
+
+    return failed ? 1 : 0;
+}
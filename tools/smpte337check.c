@@ -0,0 +1,392 @@
+/* Feed the SMPTE 337 detector AC-3, E-AC-3 and Dolby E bursts in each of the
+ * 16, 20 and 24 bit data modes and check every burst is reported, with its
+ * data mode, data type, length, payload and PTS. Pa is placed on both channels
+ * of the pair and on every word of a vector, amongst PCM noise on a 16 channel
+ * card, and the audio is written as decklink does, in NTSC's 1601/1602 sample
+ * frames, in short random writes and with a write boundary after each Pa and
+ * again before its Pd. Then time the SSE2 sync search against the scalar one.
+ * Exits non-zero if a burst is missed or misreported.
+ *
+ *   obe/smpte337check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "common/common.h"
+#include "input/sdi/smpte337_detector.h"
+
+#define CHANNELS    16
+#define PAIR        4  /* First channel of the pair carrying the bursts */
+#define NUM_BURSTS  16
+#define MAX_WRITE   4096 /* Frames */
+#define MAX_REPORTED 8
+
+/* Payload lengths are typical, AC-3 at 448 kbit/s and E-AC-3 at 1 Mbit/s.
+ * Dolby E at 25 fps fills most of its frame, whatever the data mode */
+typedef struct
+{
+    int data_type;
+    int data_mode;
+    int period;     /* Frames from one Pa to the next */
+    int bytes;
+} burst_test_t;
+
+static const burst_test_t burst_tests[] =
+{
+    { SMPTE337_DATA_TYPE_AC_3,    SMPTE337_DATA_MODE_16_BIT, 1536,  1792 },
+    { SMPTE337_DATA_TYPE_AC_3,    SMPTE337_DATA_MODE_20_BIT, 1536,  1792 },
+    { SMPTE337_DATA_TYPE_AC_3,    SMPTE337_DATA_MODE_24_BIT, 1536,  1792 },
+    { SMPTE337_DATA_TYPE_E_AC_3,  SMPTE337_DATA_MODE_16_BIT, 6144,  7500 },
+    { SMPTE337_DATA_TYPE_E_AC_3,  SMPTE337_DATA_MODE_20_BIT, 6144,  7500 },
+    { SMPTE337_DATA_TYPE_E_AC_3,  SMPTE337_DATA_MODE_24_BIT, 6144,  7500 },
+    { SMPTE337_DATA_TYPE_DOLBY_E, SMPTE337_DATA_MODE_16_BIT, 1920,  6912 },
+    { SMPTE337_DATA_TYPE_DOLBY_E, SMPTE337_DATA_MODE_20_BIT, 1920,  8640 },
+    { SMPTE337_DATA_TYPE_DOLBY_E, SMPTE337_DATA_MODE_24_BIT, 1920, 10368 },
+};
+
+/* Words after the start of each period, so Pa is on both channels and in each
+ * lane of an SSE2 vector */
+static const int pa_offsets[] = { 0, 1, 2, 3, 5, 6, 7, 9 };
+
+enum split_e { SPLIT_NTSC, SPLIT_RANDOM, SPLIT_AT_PA };
+static const char *split_names[] = { "1601/1602 frame writes", "1 to 64 frame writes", "writes split at Pa and Pd" };
+
+static const int mode_bits[] = { 16, 20, 24 };
+
+typedef struct
+{
+    int pa;         /* Word of the pair */
+    uint8_t *payload;
+} burst_t;
+
+typedef struct
+{
+    const burst_test_t *test;
+    uint32_t *frames;   /* CHANNELS words a frame, MSB aligned */
+    uint16_t *frames16;
+    int num_frames;
+    burst_t bursts[NUM_BURSTS];
+
+    /* Set per run */
+    int next;           /* Burst expected next */
+    int errors;
+} stream_t;
+
+static uint32_t seed = 1;
+
+static uint32_t rand32( void )
+{
+    seed = seed * 1664525 + 1013904223;
+    return seed ^ ( seed >> 16 );
+}
+
+static int64_t now_us( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* 48 kHz samples in 27 MHz ticks, as the detector times the bursts */
+static int64_t sample_pts( int64_t samples )
+{
+    return av_rescale_q( samples, (AVRational){1, 48000}, (AVRational){1, OBE_CLOCK} );
+}
+
+static uint32_t *pair_word( stream_t *s, int word )
+{
+    return &s->frames[(word / 2) * CHANNELS + PAIR + (word & 1)];
+}
+
+/* PCM noise on every channel, then the bursts, packed MSB first into words of
+ * the data mode. 24 bit noise in 32 bit samples unless the samples are 16 bit */
+static int stream_alloc( stream_t *s, const burst_test_t *test )
+{
+    int bits = mode_bits[test->data_mode];
+
+    memset( s, 0, sizeof(*s) );
+    s->test = test;
+    s->num_frames = ( NUM_BURSTS + 1 ) * test->period;
+    s->frames = malloc( s->num_frames * CHANNELS * sizeof(*s->frames) );
+    s->frames16 = malloc( s->num_frames * CHANNELS * sizeof(*s->frames16) );
+    if( !s->frames || !s->frames16 )
+        return -1;
+
+    for( int i = 0; i < s->num_frames * CHANNELS; i++ )
+        s->frames[i] = rand32() & ( bits == 16 ? 0xffff0000 : 0xffffff00 );
+
+    for( int b = 0; b < NUM_BURSTS; b++ )
+    {
+        burst_t *burst = &s->bursts[b];
+        burst->pa = b * test->period * 2 + pa_offsets[b % FF_ARRAY_ELEMS(pa_offsets)];
+        burst->payload = malloc( test->bytes );
+        if( !burst->payload )
+            return -1;
+        for( int i = 0; i < test->bytes; i++ )
+            burst->payload[i] = rand32();
+
+        int w = burst->pa;
+        *pair_word( s, w++ ) = ( bits == 16 ? SMPTE337_SYNCWORD_1_16_BIT : bits == 20 ? SMPTE337_SYNCWORD_1_20_BIT : SMPTE337_SYNCWORD_1_24_BIT ) << ( 32 - bits );
+        *pair_word( s, w++ ) = ( bits == 16 ? SMPTE337_SYNCWORD_2_16_BIT : bits == 20 ? SMPTE337_SYNCWORD_2_20_BIT : SMPTE337_SYNCWORD_2_24_BIT ) << ( 32 - bits );
+        *pair_word( s, w++ ) = (uint32_t)( test->data_mode << 5 | test->data_type ) << ( 32 - bits );
+        *pair_word( s, w++ ) = (uint32_t)( test->bytes * 8 ) << ( 32 - bits );
+
+        uint64_t acc = 0;
+        int accbits = 0;
+        for( int i = 0; i < test->bytes; i++ )
+        {
+            acc = acc << 8 | burst->payload[i];
+            accbits += 8;
+            if( accbits >= bits )
+            {
+                accbits -= bits;
+                *pair_word( s, w++ ) = (uint32_t)( acc >> accbits ) << ( 32 - bits );
+            }
+        }
+        if( accbits )
+            *pair_word( s, w++ ) = (uint32_t)( acc << ( bits - accbits ) ) << ( 32 - bits );
+    }
+
+    for( int i = 0; i < s->num_frames * CHANNELS; i++ )
+        s->frames16[i] = s->frames[i] >> 16;
+
+    return 0;
+}
+
+static void stream_free( stream_t *s )
+{
+    for( int b = 0; b < NUM_BURSTS; b++ )
+        free( s->bursts[b].payload );
+    free( s->frames );
+    free( s->frames16 );
+}
+
+static void report( stream_t *s, const char *fmt, ... )
+{
+    va_list ap;
+
+    if( s->errors++ >= MAX_REPORTED )
+        return;
+
+    printf( "    burst %d: ", s->next );
+    va_start( ap, fmt );
+    vprintf( fmt, ap );
+    va_end( ap );
+    printf( "\n" );
+}
+
+static void detector_callback( void *user_context, struct smpte337_detector_s *ctx,
+    uint8_t datamode, uint8_t datatype, uint32_t payload_bitCount, uint8_t *payload, struct avfm_s *avfm )
+{
+    stream_t *s = user_context;
+    const burst_test_t *test = s->test;
+
+    if( s->next >= NUM_BURSTS )
+    {
+        report( s, "reported, but only %d were sent", NUM_BURSTS );
+        return;
+    }
+
+    burst_t *burst = &s->bursts[s->next];
+
+    if( datamode != test->data_mode )
+        report( s, "data mode %d, not %d", datamode, test->data_mode );
+    if( datatype != test->data_type )
+        report( s, "data type %d, not %d", datatype, test->data_type );
+    if( payload_bitCount != test->bytes * 8 )
+        report( s, "%d bits, not %d", payload_bitCount, test->bytes * 8 );
+    else
+    {
+        for( int i = 0; i < test->bytes; i++ )
+        {
+            if( payload[i] != burst->payload[i] )
+            {
+                report( s, "payload differs at byte %d of %d", i, test->bytes );
+                break;
+            }
+        }
+    }
+
+    /* Each write is stamped with the PTS of its first frame */
+    int64_t pts = sample_pts( burst->pa / 2 );
+    if( !avfm )
+        report( s, "no timing" );
+    else if( llabs( avfm->audio_pts_corrected - pts ) > 1 )
+        report( s, "PTS is %d ticks from sample %d", (int)( avfm->audio_pts_corrected - pts ), burst->pa / 2 );
+
+    s->next++;
+}
+
+static int next_write( stream_t *s, enum split_e split, int frame, int writes )
+{
+    int frames = MAX_WRITE;
+
+    if( split == SPLIT_NTSC )
+        frames = writes % 5 == 0 || writes % 5 == 2 ? 1601 : 1602;
+    else if( split == SPLIT_RANDOM )
+        frames = 1 + rand32() % 64;
+    else
+    {
+        /* End writes with the frame holding Pa, and before the one holding Pd */
+        for( int b = 0; b < NUM_BURSTS; b++ )
+        {
+            int pa = s->bursts[b].pa / 2 + 1, pd = ( s->bursts[b].pa + 3 ) / 2;
+            if( pa > frame && pa - frame < frames )
+                frames = pa - frame;
+            else if( pd > frame && pd - frame < frames )
+                frames = pd - frame;
+        }
+    }
+
+    return frames < s->num_frames - frame ? frames : s->num_frames - frame;
+}
+
+static int run_stream( stream_t *s, enum split_e split, int sample_depth )
+{
+    struct smpte337_detector_s *det = smpte337_detector_alloc( detector_callback, s );
+    if( !det )
+    {
+        fprintf( stderr, "Malloc failed\n" );
+        return 1;
+    }
+
+    s->next = 0;
+    s->errors = 0;
+
+    for( int frame = 0, writes = 0; frame < s->num_frames; writes++ )
+    {
+        int frames = next_write( s, split, frame, writes );
+        struct avfm_s avfm;
+
+        memset( &avfm, 0, sizeof(avfm) );
+        avfm.audio_pts = sample_pts( frame );
+
+        if( sample_depth == 32 )
+            smpte337_detector_write( det, (uint8_t *)&s->frames[frame * CHANNELS + PAIR], frames, 32,
+                                     CHANNELS, CHANNELS * sizeof(*s->frames), 2, &avfm );
+        else
+            smpte337_detector_write( det, (uint8_t *)&s->frames16[frame * CHANNELS + PAIR], frames, 16,
+                                     CHANNELS, CHANNELS * sizeof(*s->frames16), 2, &avfm );
+        frame += frames;
+    }
+
+    if( s->next < NUM_BURSTS )
+        report( s, "and %d more were never reported", NUM_BURSTS - s->next );
+
+    smpte337_detector_free( det );
+
+    return s->errors;
+}
+
+/* Both searches from every hit onwards, over the pair of the stream */
+static int compare_sync( stream_t *s )
+{
+    int count = s->num_frames * 2;
+    uint32_t *words = malloc( count * sizeof(*words) );
+    int errors = 0;
+
+    if( !words )
+        return 1;
+    for( int i = 0; i < count; i++ )
+        words[i] = *pair_word( s, i );
+
+    for( int pos = 0; pos < count; )
+    {
+        int mode = -1, mode_c = -1;
+        int idx = obe_337m_find_sync( words + pos, count - pos, &mode );
+        int idx_c = obe_337m_find_sync_c( words + pos, count - pos, &mode_c );
+
+        if( idx != idx_c || mode != mode_c )
+        {
+            printf( "    sync search from word %d found %d mode %d, the scalar one %d mode %d\n", pos, idx, mode, idx_c, mode_c );
+            errors++;
+            break;
+        }
+        if( idx < 0 )
+            break;
+        pos += idx + 1;
+    }
+
+    free( words );
+
+    return errors;
+}
+
+/* One second of noise on a pair, which has to be searched in full */
+static void time_sync( void )
+{
+    const int count = 48000 * 2, runs = 200;
+    uint32_t *words = malloc( count * sizeof(*words) );
+    int64_t t[2];
+    int mode;
+
+    if( !words )
+        return;
+    for( int i = 0; i < count; i++ )
+        words[i] = rand32() & 0xffffff00;
+
+    for( int v = 0; v < 2; v++ )
+    {
+        int64_t start = now_us();
+        for( int r = 0; r < runs; r++ )
+            if( ( v ? obe_337m_find_sync_c : obe_337m_find_sync )( words, count, &mode ) >= 0 )
+                printf( "  sync found in noise\n" );
+        t[v] = now_us() - start;
+    }
+
+#if defined(__SSE2__)
+    printf( "  sse2   %7.1f us a second of a pair, %.2fx scalar\n", (double)t[0] / runs, (double)t[1] / ( t[0] ? t[0] : 1 ) );
+#else
+    printf( "  no sse2 in this build\n" );
+#endif
+    printf( "  scalar %7.1f us a second of a pair\n", (double)t[1] / runs );
+
+    free( words );
+}
+
+int main( int argc, char **argv )
+{
+    int failed = 0;
+
+    printf( "Checking the detector with %d bursts a stream\n", NUM_BURSTS );
+    for( int i = 0; i < FF_ARRAY_ELEMS(burst_tests); i++ )
+    {
+        const burst_test_t *test = &burst_tests[i];
+        stream_t s;
+
+        if( stream_alloc( &s, test ) < 0 )
+        {
+            fprintf( stderr, "Malloc failed\n" );
+            stream_free( &s );
+            return 1;
+        }
+
+        for( int split = SPLIT_NTSC; split <= SPLIT_AT_PA; split++ )
+        {
+            /* 16 bit bursts arrive in 16 bit samples too */
+            int depths = test->data_mode == SMPTE337_DATA_MODE_16_BIT ? 2 : 1;
+            for( int d = 0; d < depths; d++ )
+            {
+                int depth = d ? 16 : 32;
+                int errors = run_stream( &s, split, depth );
+                printf( "  %-8s %d bit, %d bit samples, %-26s %s\n", obe_337m_data_type_name( test->data_type ),
+                        mode_bits[test->data_mode], depth, split_names[split], errors ? "FAILED" : "ok" );
+                failed += errors;
+            }
+        }
+
+        failed += compare_sync( &s );
+        stream_free( &s );
+    }
+
+    printf( "\nTiming the sync search\n" );
+    time_sync();
+
+    printf( "\n%s\n", failed ? "FAILED" : "All bursts reported correctly" );
+
+    return failed ? 1 : 0;
+}